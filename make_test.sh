@@ -239,7 +239,7 @@ if (($TMUX & 8)) ; then
 		COVERAGE_OUT=$OUT_DOC/coverage.txt
 		$MAKE -j $MJOBS CC=gcc PROFILING=1 2>/dev/null >/dev/null
 		for f in schar scommon sdata senc shash smap smset shmap \
-			 shset ssearch ssort sstring sstringo stree svector \
+			 schmap sfmap shset srmap ssearch ssort sstring sstringo stree sbtree svector \
 			 stest ; do
 			gcov $f.c >/dev/null 2>/dev/null
 		done
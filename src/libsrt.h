@@ -14,10 +14,13 @@ extern "C" {
  */
 
 #include "sbitset.h"
+#include "schmap.h"
 #include "shmap.h"
 #include "shset.h"
 #include "smap.h"
 #include "smset.h"
+#include "srmap.h"
+#include "sfmap.h"
 #include "sstring.h"
 #include "svector.h"
 
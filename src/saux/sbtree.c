@@ -0,0 +1,535 @@
+/*
+ * sbtree.c
+ *
+ * B+tree index.
+ *
+ * Observations:
+ * - Using indexes instead of pointers, with all nodes stored in a vector
+ *   (as stree.c), so the index can be copied as a single block.
+ * - The search inside a node checks all key slots without early exit
+ *   (unused slots hold INT64_MAX), so the loop has fixed length and can be
+ *   vectorized by the compiler.
+ * - Internal node keys are lower bounds of their children keys, not
+ *   necessarily keys still in the index, so deleting the first key of a
+ *   leaf requires no ancestor update.
+ *
+ * Copyright (c) 2015-2019 F. Aragon. All rights reserved.
+ * Released under the BSD 3-Clause License (see the doc/LICENSE)
+ */
+
+#include "sbtree.h"
+#include "scommon.h"
+
+/*
+ * Internal data structures
+ */
+
+struct SBTPath {
+	srt_tndx n; /* internal node */
+	size_t i;   /* child followed */
+};
+
+/*
+ * Internal functions
+ */
+
+S_INLINE struct SBTNode *aux_node(srt_btree *b, srt_tndx i)
+{
+	return (struct SBTNode *)sbt_elem_addr(b, i);
+}
+
+/* Number of keys lower than 'k' (i.e. leaf position for 'k') */
+S_INLINE size_t aux_rank(const struct SBTNode *n, int64_t k)
+{
+	size_t i, r = 0;
+	for (i = 0; i < SBT_FANOUT; i++)
+		r += (size_t)(n->k[i] < k);
+	return r;
+}
+
+/* Internal node child for 'k' */
+S_INLINE size_t aux_child(const struct SBTNode *n, int64_t k)
+{
+	size_t i, r = 0;
+	for (i = 1; i < SBT_FANOUT; i++)
+		r += (size_t)(n->k[i] <= k);
+	return r < n->cnt ? r : n->cnt - 1U;
+}
+
+/* Walk from the root to the leaf for 'k', tracking the internal nodes */
+static srt_tndx aux_walk(const srt_btree *b, int64_t k, struct SBTPath *p)
+{
+	uint32_t l;
+	srt_tndx x = b->root;
+	const struct SBTNode *n;
+	for (l = 0; l < b->levels; l++) {
+		n = sbt_node_r(b, x);
+		p[l].n = x;
+		p[l].i = aux_child(n, k);
+		x = n->c[p[l].i];
+	}
+	return x;
+}
+
+/* Node allocation (space must be reserved in advance) */
+static srt_tndx aux_node_new(srt_btree *b, srt_bool leaf)
+{
+	size_t i;
+	struct SBTNode *n;
+	srt_tndx x = b->free_list;
+	if (x != ST_NIL) {
+		b->free_list = aux_node(b, x)->next;
+	} else {
+		x = (srt_tndx)sbt_size(b);
+		sbt_set_size(b, x + 1);
+	}
+	n = aux_node(b, x);
+	n->cnt = 0;
+	n->leaf = leaf ? 1 : 0;
+	n->next = ST_NIL;
+	for (i = 0; i < SBT_FANOUT; i++) {
+		n->k[i] = SBT_KEY_PAD;
+		n->c[i] = ST_NIL;
+	}
+	return x;
+}
+
+static void aux_node_free(srt_btree *b, srt_tndx x)
+{
+	struct SBTNode *n = aux_node(b, x);
+	n->cnt = 0;
+	n->next = b->free_list;
+	b->free_list = x;
+}
+
+static void aux_ins(struct SBTNode *n, size_t i, int64_t k, srt_tndx v)
+{
+	size_t mv = n->cnt - i;
+	if (mv) {
+		memmove(n->k + i + 1, n->k + i, mv * sizeof(n->k[0]));
+		memmove(n->c + i + 1, n->c + i, mv * sizeof(n->c[0]));
+	}
+	n->k[i] = k;
+	n->c[i] = v;
+	n->cnt++;
+}
+
+static void aux_rm(struct SBTNode *n, size_t i)
+{
+	size_t mv = n->cnt - i - 1;
+	if (mv) {
+		memmove(n->k + i, n->k + i + 1, mv * sizeof(n->k[0]));
+		memmove(n->c + i, n->c + i + 1, mv * sizeof(n->c[0]));
+	}
+	n->cnt--;
+	n->k[n->cnt] = SBT_KEY_PAD;
+	n->c[n->cnt] = ST_NIL;
+}
+
+/* Append 'cnt' entries from 's', starting at entry 'i' */
+static void aux_append(struct SBTNode *n, const struct SBTNode *s, size_t i,
+		       size_t cnt)
+{
+	memcpy(n->k + n->cnt, s->k + i, cnt * sizeof(n->k[0]));
+	memcpy(n->c + n->cnt, s->c + i, cnt * sizeof(n->c[0]));
+	n->cnt = (uint16_t)(n->cnt + cnt);
+}
+
+static void aux_trunc(struct SBTNode *n, size_t cnt)
+{
+	size_t i;
+	for (i = cnt; i < n->cnt; i++) {
+		n->k[i] = SBT_KEY_PAD;
+		n->c[i] = ST_NIL;
+	}
+	n->cnt = (uint16_t)cnt;
+}
+
+/*
+ * Observation: *recursive* function, intended for debug-only purposes
+ * (index validation tests). Keys must be in the [lo, hi) range (no upper
+ * bound if 'has_hi' is false).
+ */
+static srt_bool sbt_assert_aux(const srt_btree *b, srt_tndx x, uint32_t level,
+			       int64_t lo, int64_t hi, srt_bool has_hi,
+			       size_t *cnt)
+{
+	size_t i, min_cnt;
+	const struct SBTNode *n;
+	RETURN_IF(x >= sbt_size(b), S_FALSE);
+	n = sbt_node_r(b, x);
+	min_cnt = x != b->root ? SBT_MIN_FILL : level < b->levels ? 2 : 0;
+	RETURN_IF(n->cnt < min_cnt || n->cnt > SBT_FANOUT, S_FALSE);
+	RETURN_IF(n->leaf != (level == b->levels ? 1 : 0), S_FALSE);
+	for (i = n->cnt; i < SBT_FANOUT; i++)
+		RETURN_IF(n->k[i] != SBT_KEY_PAD, S_FALSE);
+	for (i = n->leaf ? 0 : 1; i < n->cnt; i++) {
+		RETURN_IF(n->k[i] < lo || (has_hi && n->k[i] >= hi), S_FALSE);
+		RETURN_IF(i > 0 && (n->leaf || i > 1) && n->k[i] <= n->k[i - 1],
+			  S_FALSE);
+	}
+	if (n->leaf) {
+		*cnt += n->cnt;
+		return S_TRUE;
+	}
+	for (i = 0; i < n->cnt; i++)
+		if (!sbt_assert_aux(b, n->c[i], level + 1, i ? n->k[i] : lo,
+				    i + 1 < n->cnt ? n->k[i + 1] : hi,
+				    i + 1 < n->cnt ? S_TRUE : has_hi, cnt))
+			return S_FALSE;
+	return S_TRUE;
+}
+
+/*
+ * Allocation
+ */
+
+srt_btree *sbt_alloc(size_t init_nodes)
+{
+	srt_btree *b;
+	size_t alloc_size;
+	if (!init_nodes)
+		init_nodes = 1;
+	alloc_size = sd_alloc_size_raw(sizeof(srt_btree),
+				       sizeof(struct SBTNode), init_nodes,
+				       S_FALSE);
+	b = (srt_btree *)s_malloc(alloc_size);
+	RETURN_IF(!b, NULL);
+	sd_reset((srt_data *)b, sizeof(srt_btree), sizeof(struct SBTNode),
+		 init_nodes, S_FALSE, S_FALSE);
+	sbt_clear(b);
+	return b;
+}
+
+srt_btree *sbt_dup(const srt_btree *b)
+{
+	size_t ns;
+	srt_btree *b2;
+	RETURN_IF(!b, NULL);
+	ns = sbt_size(b);
+	b2 = sbt_alloc(ns);
+	RETURN_IF(!b2, NULL);
+	memcpy(sbt_get_buffer(b2), sbt_get_buffer_r(b),
+	       ns * sizeof(struct SBTNode));
+	sbt_set_size(b2, ns);
+	b2->root = b->root;
+	b2->head = b->head;
+	b2->free_list = b->free_list;
+	b2->levels = b->levels;
+	return b2;
+}
+
+void sbt_clear(srt_btree *b)
+{
+	if (!b)
+		return;
+	sbt_set_size(b, 0);
+	b->free_list = ST_NIL;
+	b->levels = 0;
+	b->root = b->head = aux_node_new(b, S_TRUE);
+}
+
+/*
+ * Bulk load: every level is split into the minimum number of nodes, with
+ * the entries spread evenly (so at least SBT_MIN_FILL entries per node,
+ * except for the root). Nodes are stored level after level, leaves first.
+ */
+srt_bool sbt_load_sorted(srt_btree **b, size_t n, srt_btree_key key_f,
+			 const void *context)
+{
+	uint32_t levels = 1;
+	size_t i, j, c, cnt, nn, tot, first;
+	srt_tndx x;
+	struct SBTNode *t;
+	RETURN_IF(!b || !*b || !key_f, S_FALSE);
+	nn = n ? (n + SBT_FANOUT - 1) / SBT_FANOUT : 1;
+	for (tot = c = nn; c > 1; tot += c, levels++)
+		c = (c + SBT_FANOUT - 1) / SBT_FANOUT;
+	RETURN_IF(levels > SBT_MAX_LEVELS || sbt_reserve(b, tot) < tot,
+		  S_FALSE);
+	sbt_set_size(*b, 0);
+	(*b)->free_list = ST_NIL;
+	for (i = j = 0; i < nn; i++) {
+		x = aux_node_new(*b, S_TRUE);
+		t = aux_node(*b, x);
+		cnt = n / nn + (i < n % nn ? 1 : 0);
+		for (; t->cnt < cnt; j++) {
+			t->k[t->cnt] = key_f(context, (srt_tndx)j);
+			t->c[t->cnt++] = (srt_tndx)j;
+		}
+		t->next = i + 1 < nn ? x + 1 : ST_NIL;
+	}
+	for (first = 0, c = nn; c > 1; c = nn) {
+		nn = (c + SBT_FANOUT - 1) / SBT_FANOUT;
+		for (i = 0, j = first, first = sbt_size(*b); i < nn; i++) {
+			t = aux_node(*b, aux_node_new(*b, S_FALSE));
+			cnt = c / nn + (i < c % nn ? 1 : 0);
+			for (; t->cnt < cnt; j++) {
+				t->k[t->cnt] =
+					sbt_node_r(*b, (srt_tndx)j)->k[0];
+				t->c[t->cnt++] = (srt_tndx)j;
+			}
+		}
+	}
+	(*b)->head = 0;
+	(*b)->root = (srt_tndx)first;
+	(*b)->levels = levels - 1;
+	return S_TRUE;
+}
+
+/*
+ * Operations
+ */
+
+srt_tndx sbt_at(const srt_btree *b, int64_t k)
+{
+	size_t i;
+	const struct SBTNode *n;
+	struct SBTPath p[SBT_MAX_LEVELS];
+	RETURN_IF(!b, ST_NIL);
+	n = sbt_node_r(b, aux_walk(b, k, p));
+	i = aux_rank(n, k);
+	return i < n->cnt && n->k[i] == k ? n->c[i] : ST_NIL;
+}
+
+srt_tndx *sbt_insert(srt_btree **b, int64_t k, srt_tndx v, srt_bool *is_new)
+{
+	size_t i, l;
+	srt_tndx x, r, *out = NULL;
+	struct SBTNode *n, *rn, *t;
+	struct SBTPath p[SBT_MAX_LEVELS];
+	RETURN_IF(!b || !*b, NULL);
+	x = aux_walk(*b, k, p);
+	n = aux_node(*b, x);
+	i = aux_rank(n, k);
+	if (i < n->cnt && n->k[i] == k) {
+		if (is_new)
+			*is_new = S_FALSE;
+		return n->c + i;
+	}
+	/* Worst case: one split per level, plus a new root */
+	RETURN_IF((*b)->levels + 1 >= SBT_MAX_LEVELS, NULL);
+	RETURN_IF(!sbt_grow(b, (*b)->levels + 2), NULL);
+	if (is_new)
+		*is_new = S_TRUE;
+	for (l = (*b)->levels;; l--) {
+		n = aux_node(*b, x);
+		if (n->cnt < SBT_FANOUT) {
+			aux_ins(n, i, k, v);
+			if (!out)
+				out = n->c + i;
+			break;
+		}
+		/* Full node: move the upper half to a new right sibling */
+		r = aux_node_new(*b, n->leaf);
+		rn = aux_node(*b, r);
+		aux_append(rn, n, SBT_MIN_FILL, n->cnt - SBT_MIN_FILL);
+		aux_trunc(n, SBT_MIN_FILL);
+		if (n->leaf) {
+			rn->next = n->next;
+			n->next = r;
+		}
+		if (i <= SBT_MIN_FILL) {
+			t = n;
+		} else {
+			t = rn;
+			i -= SBT_MIN_FILL;
+		}
+		aux_ins(t, i, k, v);
+		if (!out)
+			out = t->c + i;
+		/* Insert the new sibling into the parent */
+		k = rn->k[0];
+		v = r;
+		if (!l) {
+			r = aux_node_new(*b, S_FALSE);
+			t = aux_node(*b, r);
+			aux_ins(t, 0, n->k[0], x);
+			aux_ins(t, 1, k, v);
+			(*b)->root = r;
+			(*b)->levels++;
+			break;
+		}
+		x = p[l - 1].n;
+		i = p[l - 1].i + 1;
+	}
+	return out;
+}
+
+srt_bool sbt_set(srt_btree *b, int64_t k, srt_tndx v)
+{
+	size_t i;
+	struct SBTNode *n;
+	struct SBTPath p[SBT_MAX_LEVELS];
+	RETURN_IF(!b, S_FALSE);
+	n = aux_node(b, aux_walk(b, k, p));
+	i = aux_rank(n, k);
+	RETURN_IF(i >= n->cnt || n->k[i] != k, S_FALSE);
+	n->c[i] = v;
+	return S_TRUE;
+}
+
+srt_bool sbt_delete(srt_btree *b, int64_t k, srt_tndx *v)
+{
+	size_t i, j, l;
+	srt_tndx x;
+	struct SBTNode *n, *pn, *ln, *rn;
+	struct SBTPath p[SBT_MAX_LEVELS];
+	RETURN_IF(!b, S_FALSE);
+	n = aux_node(b, aux_walk(b, k, p));
+	i = aux_rank(n, k);
+	RETURN_IF(i >= n->cnt || n->k[i] != k, S_FALSE);
+	if (v)
+		*v = n->c[i];
+	aux_rm(n, i);
+	/*
+	 * Underfilled node: merge with a sibling (going up, as the parent
+	 * loses one entry), or take one entry from it
+	 */
+	for (l = b->levels; l > 0 && n->cnt < SBT_MIN_FILL; l--) {
+		pn = aux_node(b, p[l - 1].n);
+		j = p[l - 1].i ? p[l - 1].i : 1; /* right node of the pair */
+		ln = aux_node(b, pn->c[j - 1]);
+		rn = aux_node(b, pn->c[j]);
+		if (!rn->leaf) /* lower bound for the right node first child */
+			rn->k[0] = pn->k[j];
+		if (ln->cnt + rn->cnt <= SBT_FANOUT) {
+			aux_append(ln, rn, 0, rn->cnt);
+			if (ln->leaf)
+				ln->next = rn->next;
+			aux_node_free(b, pn->c[j]);
+			aux_rm(pn, j);
+			n = pn;
+			continue;
+		}
+		if (ln->cnt < rn->cnt) {
+			aux_append(ln, rn, 0, 1);
+			aux_rm(rn, 0);
+		} else {
+			aux_ins(rn, 0, ln->k[ln->cnt - 1], ln->c[ln->cnt - 1]);
+			aux_trunc(ln, ln->cnt - 1U);
+		}
+		pn->k[j] = rn->k[0];
+		break;
+	}
+	/* Root having a single child: one level less */
+	n = aux_node(b, b->root);
+	if (b->levels && n->cnt == 1) {
+		x = b->root;
+		b->root = n->c[0];
+		aux_node_free(b, x);
+		b->levels--;
+	}
+	return S_TRUE;
+}
+
+void sbt_seek(const srt_btree *b, int64_t k, struct SBTCursor *c)
+{
+	struct SBTPath p[SBT_MAX_LEVELS];
+	if (!c)
+		return;
+	if (!b) {
+		c->n = ST_NIL;
+		c->i = 0;
+		return;
+	}
+	c->n = aux_walk(b, k, p);
+	c->i = aux_rank(sbt_node_r(b, c->n), k);
+}
+
+void sbt_seek_le(const srt_btree *b, int64_t k, struct SBTCursor *c)
+{
+	size_t i, r = 0;
+	uint32_t l;
+	srt_tndx x;
+	const struct SBTNode *n;
+	struct SBTPath p[SBT_MAX_LEVELS];
+	if (!c)
+		return;
+	c->n = ST_NIL;
+	c->i = 0;
+	if (!b)
+		return;
+	x = aux_walk(b, k, p);
+	n = sbt_node_r(b, x);
+	for (i = 0; i < SBT_FANOUT; i++)
+		r += (size_t)(n->k[i] <= k);
+	if (r > n->cnt)
+		r = n->cnt; /* k == SBT_KEY_PAD */
+	if (r) {
+		c->n = x;
+		c->i = r - 1;
+		return;
+	}
+	/*
+	 * No key <= k in the leaf: last key of the closest subtree on the left
+	 */
+	for (l = b->levels; l > 0 && !p[l - 1].i; l--)
+		;
+	if (!l)
+		return;
+	x = sbt_node_r(b, p[l - 1].n)->c[p[l - 1].i - 1];
+	for (; l < b->levels; l++) {
+		n = sbt_node_r(b, x);
+		x = n->c[n->cnt - 1];
+	}
+	c->n = x;
+	c->i = sbt_node_r(b, x)->cnt - 1U;
+}
+
+/*
+ * Order statistics: nodes keep no subtree counts, so leaves are scanned
+ * (O(n / SBT_MIN_FILL) steps, using the leaf entry count)
+ */
+
+size_t sbt_rank(const srt_btree *b, int64_t k)
+{
+	size_t r = 0;
+	srt_tndx x, leaf;
+	const struct SBTNode *n;
+	struct SBTPath p[SBT_MAX_LEVELS];
+	RETURN_IF(!b, 0);
+	leaf = aux_walk(b, k, p);
+	for (x = b->head; x != leaf; x = n->next) {
+		n = sbt_node_r(b, x);
+		r += n->cnt;
+	}
+	return r + aux_rank(sbt_node_r(b, leaf), k);
+}
+
+srt_tndx sbt_select(const srt_btree *b, size_t i)
+{
+	srt_tndx x;
+	const struct SBTNode *n;
+	RETURN_IF(!b, ST_NIL);
+	for (x = b->head; x != ST_NIL; x = n->next) {
+		n = sbt_node_r(b, x);
+		if (i < n->cnt)
+			return n->c[i];
+		i -= n->cnt;
+	}
+	return ST_NIL;
+}
+
+/*
+ * Other
+ */
+
+srt_bool sbt_assert(const srt_btree *b)
+{
+	int64_t k, kprev = 0;
+	size_t cnt = 0, cnt_leaves = 0;
+	srt_tndx v;
+	struct SBTCursor c;
+	RETURN_IF(!b, S_FALSE);
+	RETURN_IF(!sbt_assert_aux(b, b->root, 0, INT64_MIN, 0, S_FALSE, &cnt),
+		  S_FALSE);
+	c.n = b->head;
+	c.i = 0;
+	while (sbt_next(b, &c, &k, &v)) {
+		RETURN_IF(cnt_leaves && k <= kprev, S_FALSE);
+		kprev = k;
+		cnt_leaves++;
+	}
+	return cnt == cnt_leaves ? S_TRUE : S_FALSE;
+}
@@ -0,0 +1,152 @@
+#ifndef SBTREE_H
+#define SBTREE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * sbtree.h
+ *
+ * #SHORTDOC B+tree index (integer keys)
+ *
+ * #DOC B+tree index functions, mapping 64-bit integer keys to 32-bit
+ * #DOC references (e.g. element indexes of a vector). As with the
+ * #DOC Red-Black tree, nodes are stored in a vector, using indexes instead
+ * #DOC of pointers. Each node spans a few cache lines, with the keys stored
+ * #DOC together, so the search inside a node is a fixed-length comparison
+ * #DOC loop that the compiler can vectorize. Leaves are linked, for range
+ * #DOC scans without going up the tree. Leaves store references, not
+ * #DOC values: the referenced data is one more memory access (see smap.h).
+ *
+ * Copyright (c) 2015-2019 F. Aragon. All rights reserved.
+ * Released under the BSD 3-Clause License (see the doc/LICENSE)
+ */
+
+#include "stree.h"
+
+/*
+ * Structures and types
+ */
+
+#define SBT_FANOUT 20 /* 8 + 20 * (8 + 4) = 248 bytes per node */
+#define SBT_MIN_FILL (SBT_FANOUT / 2)
+#define SBT_MAX_LEVELS 16
+#define SBT_KEY_PAD INT64_MAX /* unused key slots */
+
+struct SBTNode {
+	uint16_t cnt;	/* number of entries */
+	uint16_t leaf;	/* 1: leaf node, 0: internal node */
+	srt_tndx next;	/* leaf: next leaf; free node: next free node */
+	int64_t k[SBT_FANOUT];
+	/*
+	 * Internal nodes: child node; leaves: stored reference. Internal
+	 * node key 'i' is the lower bound of the child 'i' keys (key 0 is
+	 * not used for the search)
+	 */
+	srt_tndx c[SBT_FANOUT];
+};
+
+struct S_BTree {
+	struct SDataFull d;
+	srt_tndx root, head, free_list;
+	uint32_t levels; /* internal node levels (0: root is a leaf) */
+};
+
+typedef struct S_BTree srt_btree;
+
+/* Key for a stored reference (sbt_load_sorted()) */
+typedef int64_t (*srt_btree_key)(const void *context, srt_tndx v);
+
+struct SBTCursor {
+	srt_tndx n; /* leaf */
+	size_t i;   /* leaf entry */
+};
+
+/*
+ * Functions
+ */
+
+/* #NOTAPI: |Allocate B+tree index (heap)|space preallocated to store n nodes|allocated index|O(1)|1;2| */
+srt_btree *sbt_alloc(size_t init_nodes);
+
+SD_BUILDFUNCS_FULL(sbt, srt_btree, 0)
+
+/*
+#NOTAPI: |Free one or more B+tree indexes (heap)|index;more indexes (optional)|-|O(1)|1;2|
+void sbt_free(srt_btree **b, ...)
+*/
+#ifdef S_USE_VA_ARGS
+#define sbt_free(...) sbt_free_aux(__VA_ARGS__, S_INVALID_PTR_VARG_TAIL)
+#else
+#define sbt_free(b) sbt_free_aux(b, S_INVALID_PTR_VARG_TAIL)
+#endif
+
+/* #NOTAPI: |Duplicate B+tree index|index|output index|O(n)|1;2| */
+srt_btree *sbt_dup(const srt_btree *b);
+
+/* #NOTAPI: |Reset B+tree index (keeping allocated nodes)|index|-|O(1)|1;2| */
+void sbt_clear(srt_btree *b);
+
+/* #NOTAPI: |Replace the index contents with sorted keys, filling the nodes level by level (bulk load)|index; number of keys; key callback for the references 0 to n - 1 (keys ascending, not repeated); callback context|S_TRUE: OK; S_FALSE: not enough memory (index unchanged)|O(n)|1;2| */
+srt_bool sbt_load_sorted(srt_btree **b, size_t n, srt_btree_key key_f,
+			 const void *context);
+
+/* #NOTAPI: |Locate key|index; key|stored reference (ST_NIL: not found)|O(log n)|1;2| */
+srt_tndx sbt_at(const srt_btree *b, int64_t k);
+
+/* #NOTAPI: |Insert key, if not already in the index|index; key; reference to store (new keys); output: S_TRUE if inserted (optional)|reference slot for the key, valid until the next index modification (NULL: not enough memory)|O(log n)|1;2| */
+srt_tndx *sbt_insert(srt_btree **b, int64_t k, srt_tndx v, srt_bool *is_new);
+
+/* #NOTAPI: |Update the reference of an existing key|index; key; new reference|S_TRUE: updated; S_FALSE: not found|O(log n)|1;2| */
+srt_bool sbt_set(srt_btree *b, int64_t k, srt_tndx v);
+
+/* #NOTAPI: |Delete key|index; key; output: reference stored for the key (optional)|S_TRUE: found and deleted; S_FALSE: not found|O(log n)|1;2| */
+srt_bool sbt_delete(srt_btree *b, int64_t k, srt_tndx *v);
+
+/* #NOTAPI: |Position cursor at the first key greater or equal than the given one|index; key; cursor|-|O(log n)|1;2| */
+void sbt_seek(const srt_btree *b, int64_t k, struct SBTCursor *c);
+
+/* #NOTAPI: |Position cursor at the last key lower or equal than the given one|index; key; cursor (leaf ST_NIL: no key found)|-|O(log n)|1;2| */
+void sbt_seek_le(const srt_btree *b, int64_t k, struct SBTCursor *c);
+
+/* #NOTAPI: |Number of keys lower than the given one|index; key|number of keys|O(n)|1;2| */
+size_t sbt_rank(const srt_btree *b, int64_t k);
+
+/* #NOTAPI: |Reference stored for the i-th key in key order|index; position (0 to n - 1)|stored reference (ST_NIL: out of range)|O(n)|1;2| */
+srt_tndx sbt_select(const srt_btree *b, size_t i);
+
+/* #NOTAPI: |B+tree check (debug purposes)|index|S_TRUE: OK, S_FALSE: breaks B+tree rules|O(n)|1;2| */
+srt_bool sbt_assert(const srt_btree *b);
+
+/*
+ * Inlined functions
+ */
+
+S_INLINE const struct SBTNode *sbt_node_r(const srt_btree *b, srt_tndx i)
+{
+	return (const struct SBTNode *)sbt_elem_addr_r(b, i);
+}
+
+/* #NOTAPI: |Cursor sorted enumeration|index; cursor; output: key; output: reference|S_TRUE: key returned, S_FALSE: no more keys|O(1)|1;2| */
+S_INLINE srt_bool sbt_next(const srt_btree *b, struct SBTCursor *c,
+			   int64_t *k, srt_tndx *v)
+{
+	const struct SBTNode *n;
+	while (c->n != ST_NIL) {
+		n = sbt_node_r(b, c->n);
+		if (c->i < n->cnt) {
+			*k = n->k[c->i];
+			*v = n->c[c->i++];
+			return S_TRUE;
+		}
+		c->n = n->next;
+		c->i = 0;
+	}
+	return S_FALSE;
+}
+
+#ifdef __cplusplus
+} /* extern "C" { */
+#endif
+
+#endif /* #ifndef SBTREE_H */
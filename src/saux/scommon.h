@@ -125,8 +125,10 @@ extern "C" {
 #if defined(__GNUC__) && __GNUC__ >= 4 || defined(__clang__)                   \
 	|| defined(__INTEL_COMPILER)
 #define S_EXPECT(expr, val) __builtin_expect(expr, val)
+#define S_PREFETCH(addr) __builtin_prefetch(addr)
 #else
 #define S_EXPECT(expr, val) (expr)
+#define S_PREFETCH(addr)
 #endif
 
 #define S_LIKELY(expr) S_EXPECT((expr) != 0, 1)
@@ -177,6 +177,21 @@ void sm_log_obj(srt_string **log, const srt_map *m)
 	if (!log)
 		return;
 	ss_cpy_c(log, "");
+	if (m && m->bt) { /* B+tree index: key -> element, in key order */
+		struct SBTCursor c;
+		int64_t k;
+		srt_tndx x;
+		sbt_seek(m->bt, INT64_MIN, &c);
+		while (sbt_next(m->bt, &c, &k, &x))
+			ss_cat_printf(log, 128, "[" FMT_I " -> %u] ", k,
+				      (unsigned)x);
+		ss_cat_printf(log, 128,
+			      "\nlevels: %u, nodes: %u, elements: %u\n",
+			      (unsigned)m->bt->levels + 1,
+			      (unsigned)sbt_size(m->bt), (unsigned)sm_size(m));
+		fprintf(stdout, "%s", ss_to_c(*log));
+		return;
+	}
 	levels = st_traverse_levelorder((const srt_tree *)m,
 					(st_traverse)aux_sm_log_traverse, log);
 	if (levels == 0)
@@ -193,21 +208,30 @@ void shm_log_obj(srt_string **log, const srt_hmap *h)
 	unsigned i;
 	const struct SHMBucket *b;
 	const struct SHMapii *e;
+	const uint8_t *t;
+	srt_hmap_stats st;
 	if (!log)
 		return;
 	ss_cpy_c(log, "");
+	shm_stats(h, &st);
+	ss_cat_printf(log, 256,
+		      "load: %.3f, empty: %.3f, probe avg: %.3f, max: %u, "
+		      "rehashes: %u\n",
+		      st.load_factor, st.empty_ratio, st.avg_probe,
+		      (unsigned)st.max_probe, (unsigned)st.rehashes);
 	switch (h->d.sub_type) {
 	case SHM0_II32:
 	case SHM0_UU32:
 		b = shm_get_buckets_r(h);
+		t = shm_get_tags_r(h);
 		e = (const struct SHMapii *)shm_get_buffer_r(h);
 		ss_cat_printf(log, 128, "hbits: %u, size: %u, max_size: %u\n",
 			      h->hbits, shm_size(h), shm_max_size(h));
 		for (i = 0; i < h->hmask + 1; i++) {
 			ss_cat_printf(log, 128,
 				      "b[%u] h: %08x "
-				      "l: %u cnt: %u\n",
-				      i, b[i].hash, b[i].loc, b[i].cnt);
+				      "l: %u t: %02x\n",
+				      i, b[i].hash, b[i].loc, t[i]);
 		}
 		es = shm_size(h);
 		for (i = 0; i < es; i++)
@@ -215,7 +239,7 @@ void shm_log_obj(srt_string **log, const srt_hmap *h)
 				      e[i].x.k, e[i].v);
 		break;
 	default:
-		ss_cpy_c(log, "[not implemented]");
+		ss_cat_c(log, "[not implemented]");
 		break;
 	}
 }
@@ -8,6 +8,7 @@
  */
 
 #include "shash.h"
+#include <time.h>
 
 /*
  * Constants
@@ -17,6 +18,10 @@
 #define S_FNV_PRIME ((uint32_t)0x01000193)
 #define MH3_32_C1 0xcc9e2d51
 #define MH3_32_C2 0x1b873593
+#define WYH_P0 ((uint64_t)0xa0761d6478bd642fULL)
+#define WYH_P1 ((uint64_t)0xe7037ed1a0b428dbULL)
+#define WYH_P2 ((uint64_t)0x8ebc6af09c88c6dbULL)
+#define WYH_P3 ((uint64_t)0x589965cc75374cc3ULL)
 
 /*
  * CRC-32 implementations
@@ -255,6 +260,99 @@ uint32_t sh_mh3_32(uint32_t acc, const void *buf, size_t buf_size)
 	return h;
 }
 
+/*
+ * 64x64 -> 128 bit multiplication, returning low and high parts in 'a' and
+ * 'b' ("mum" mixing, as in wyhash)
+ */
+S_INLINE void wyh_mum(uint64_t *a, uint64_t *b)
+{
+#if defined(__GNUC__) && defined(__SIZEOF_INT128__)
+	__extension__ typedef unsigned __int128 u128_t;
+	u128_t r = (u128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a,
+		 lb = (uint32_t)*b, rh = ha * hb, rm0 = ha * lb, rm1 = hb * la,
+		 rl = la * lb, t = rl + (rm0 << 32), c = t < rl, lo;
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+S_INLINE uint64_t wyh_mix(uint64_t a, uint64_t b)
+{
+	wyh_mum(&a, &b);
+	return a ^ b;
+}
+
+S_INLINE uint64_t wyh_r3(const uint8_t *p, size_t k)
+{
+	return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t sh_wyh64(uint64_t seed, const void *buf, size_t buf_size)
+{
+	uint64_t a, b, s1, s2;
+	size_t i = buf_size;
+	const uint8_t *p = (const uint8_t *)buf;
+	seed ^= wyh_mix(seed ^ WYH_P0, WYH_P1);
+	if (buf_size <= 16) {
+		if (buf_size >= 4) {
+			a = ((uint64_t)S_LD_LE_U32(p) << 32)
+			    | S_LD_LE_U32(p + ((buf_size >> 3) << 2));
+			b = ((uint64_t)S_LD_LE_U32(p + buf_size - 4) << 32)
+			    | S_LD_LE_U32(p + buf_size - 4
+					  - ((buf_size >> 3) << 2));
+		} else {
+			a = buf_size ? wyh_r3(p, buf_size) : 0;
+			b = 0;
+		}
+	} else {
+		/* body: 48 bytes per loop, three independent lanes */
+		if (i > 48) {
+			s1 = s2 = seed;
+			do {
+				seed = wyh_mix(S_LD_LE_U64(p) ^ WYH_P1,
+					       S_LD_LE_U64(p + 8) ^ seed);
+				s1 = wyh_mix(S_LD_LE_U64(p + 16) ^ WYH_P2,
+					     S_LD_LE_U64(p + 24) ^ s1);
+				s2 = wyh_mix(S_LD_LE_U64(p + 32) ^ WYH_P3,
+					     S_LD_LE_U64(p + 40) ^ s2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= s1 ^ s2;
+		}
+		for (; i > 16; p += 16, i -= 16)
+			seed = wyh_mix(S_LD_LE_U64(p) ^ WYH_P1,
+				       S_LD_LE_U64(p + 8) ^ seed);
+		/* tail: last 16 bytes (overlapping already processed data) */
+		a = S_LD_LE_U64(p + i - 16);
+		b = S_LD_LE_U64(p + i - 8);
+	}
+	a ^= WYH_P1;
+	b ^= seed;
+	wyh_mum(&a, &b);
+	return wyh_mix(a ^ WYH_P0 ^ buf_size, b ^ WYH_P1);
+}
+
+uint64_t sh_seed_random(void)
+{
+	/*
+	 * Entropy sources available without OS-specific calls: current time,
+	 * processor time, and addresses (stack, and static data, if ASLR is
+	 * enabled)
+	 */
+	static const uint64_t p0 = WYH_P0;
+	uint64_t s = (uint64_t)time(NULL);
+	s = sh_mix64(s ^ ((uint64_t)clock() << 32));
+	s = sh_mix64(s ^ (uint64_t)(uintptr_t)&s);
+	return sh_mix64(s ^ (uint64_t)(uintptr_t)&p0);
+}
+
 #else
 
 /*
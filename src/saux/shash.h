@@ -34,6 +34,10 @@ extern "C" {
 #define S_FNV1_INIT ((uint32_t)0x811c9dc5)
 #define S_MH3_32_INIT 42
 
+/* 64-bit mixer constants (MurmurHash3 finalizer) */
+#define S_MX64_C1 ((uint64_t)0xff51afd7ed558ccdULL)
+#define S_MX64_C2 ((uint64_t)0xc4ceb9fe1a85ec53ULL)
+
 /* #notAPI: |CRC-32 (0xedb88320 polynomial)|CRC accumulator (for offset 0 must be 0);buffer;buffer size (in bytes)|32-bit hash|O(n)|1;2| */
 uint32_t sh_crc32(uint32_t crc, const void *buf, size_t buf_size);
 /* #notAPI: |Adler32 checksum|Adler32 accumulator (for offset 0 must be 1);buffer;buffer size (in bytes)|32-bit hash|O(n)|1;2| */
@@ -44,6 +48,10 @@ uint32_t sh_fnv1(uint32_t fnv, const void *buf, size_t buf_size);
 uint32_t sh_fnv1a(uint32_t fnv, const void *buf, size_t buf_size);
 /* #notAPI: |MurmurHash3-32 hash|MH3 accumulator (for offset 0 must be S_MM3_32_INIT);buffer;buffer size (in bytes)|32-bit hash|O(n)|1;2| */
 uint32_t sh_mh3_32(uint32_t acc, const void *buf, size_t buf_size);
+/* #notAPI: |wyhash-style 64-bit hash (16 bytes per step, 48 for long buffers)|seed;buffer;buffer size (in bytes)|64-bit hash|O(n)|1;2| */
+uint64_t sh_wyh64(uint64_t seed, const void *buf, size_t buf_size);
+/* #notAPI: |Random seed for hash functions (from time and address entropy, not suitable for cryptography)||64-bit seed|O(1)|1;2| */
+uint64_t sh_seed_random(void);
 
 S_INLINE uint32_t sh_hash32(uint32_t v)
 {
@@ -55,6 +63,30 @@ S_INLINE uint32_t sh_hash64(uint64_t v)
         return (uint32_t)(v * S_GR64);
 }
 
+S_INLINE uint64_t sh_mix64(uint64_t v)
+{
+	v ^= v >> 33;
+	v *= S_MX64_C1;
+	v ^= v >> 33;
+	v *= S_MX64_C2;
+	return v ^ (v >> 33);
+}
+
+/*
+ * Seeded hashing for 32 and 64-bit values: the seed is applied before a
+ * full avalanche mixer, so all key bits affect the hash
+ */
+
+S_INLINE uint32_t sh_hash32s(uint32_t v, uint64_t seed)
+{
+	return (uint32_t)(sh_mix64(v ^ seed) >> 32);
+}
+
+S_INLINE uint32_t sh_hash64s(uint64_t v, uint64_t seed)
+{
+	return (uint32_t)(sh_mix64(v ^ seed) >> 32);
+}
+
 #ifdef __cplusplus
 } /* extern "C" { */
 #endif
@@ -17,6 +17,12 @@ S_INLINE const uint8_t *sso_dd_get_s2_raw(const srt_stringo *s)
 	return &s->kv.d.s_raw[0] + ss_size(s1) + sizeof(struct SDataSmall) + 1;
 }
 
+S_INLINE void sso_pfx_set(uint8_t *kp, const srt_string *s)
+{
+	uint64_t p = sso_pfx(s);
+	memcpy(kp, &p, sizeof(p));
+}
+
 S_INLINE void sso1_set0(srt_stringo1 *so, const srt_string *s, srt_string *s0)
 {
 	size_t ss;
@@ -38,6 +44,7 @@ S_INLINE void sso1_set0(srt_stringo1 *so, const srt_string *s, srt_string *s0)
 			ss_cpy(&so->i.s, s);
 		} else
 			so->i.s = ss_dup(s);
+		sso_pfx_set(so->i.kp, s);
 	}
 	ss_free(&s0);
 }
@@ -79,21 +86,22 @@ S_INLINE void sso_set0(srt_stringo *so, const srt_string *s1,
 		} else
 			so->kv.di.si = ss_dup(s2);
 		so->t = OptStr_DI;
-	} else if (s2s <= OptStr_MaxSize_DI) {
+	} else if (s2s <= OptStr_MaxSize_ID) {
 		if (sa || sb) {
 			if (sa) {
-				so->kv.di.si = sa;
+				so->kv.id.si = sa;
 				sa = NULL;
 			} else {
-				so->kv.di.si = sb;
+				so->kv.id.si = sb;
 				sb = NULL;
 			}
-			ss_cpy(&so->kv.di.si, s1);
+			ss_cpy(&so->kv.id.si, s1);
 		} else
-			so->kv.di.si = ss_dup(s1);
-		so2 = (srt_string *)so->kv.di.s_raw;
-		ss_alloc_into_ext_buf(so2, OptStr_MaxSize_DI);
+			so->kv.id.si = ss_dup(s1);
+		so2 = (srt_string *)so->kv.id.s_raw;
+		ss_alloc_into_ext_buf(so2, OptStr_MaxSize_ID);
 		ss_cpy(&so2, s2);
+		sso_pfx_set(so->kv.id.kp, s1);
 		so->t = OptStr_ID;
 	} else {
 		if (sa) {
@@ -108,6 +116,7 @@ S_INLINE void sso_set0(srt_stringo *so, const srt_string *s1,
 			ss_cpy(&so->kv.ii.s2, s2);
 		} else
 			so->kv.ii.s2 = ss_dup(s2);
+		sso_pfx_set(so->kv.ii.kp, s1);
 		so->t = OptStr_II;
 	}
 	ss_free(&sa);
@@ -128,7 +137,7 @@ const srt_string *sso_get(const srt_stringo *s)
 	RETURN_IF((s->t & OptStr_2) == 0, sso1_get((const srt_stringo1 *)s));
 	RETURN_IF(s->t == OptStr_DD, (const srt_string *)s->kv.d.s_raw);
 	RETURN_IF(s->t == OptStr_DI, (const srt_string *)s->kv.di.s_raw);
-	RETURN_IF(s->t == OptStr_ID, (const srt_string *)s->kv.di.si);
+	RETURN_IF(s->t == OptStr_ID, (const srt_string *)s->kv.id.si);
 	RETURN_IF(s->t == OptStr_II, (const srt_string *)s->kv.ii.s1);
 	return ss_void;
 }
@@ -142,7 +151,7 @@ const srt_string *sso_dd_get_s2(const srt_stringo *s)
 const srt_string *sso_get_s2(const srt_stringo *s)
 {
 	RETURN_IF(!s || (s->t & OptStr_2) == 0, ss_void);
-	RETURN_IF(s->t == OptStr_ID, (const srt_string *)s->kv.di.s_raw);
+	RETURN_IF(s->t == OptStr_ID, (const srt_string *)s->kv.id.s_raw);
 	RETURN_IF(s->t == OptStr_DI, (const srt_string *)s->kv.di.si);
 	RETURN_IF(s->t == OptStr_II, s->kv.ii.s2);
 	return sso_dd_get_s2(s); /* OptStr_DD */
@@ -188,6 +197,7 @@ void sso1_setref(srt_stringo1 *so, const srt_string *s)
 	if (so) {
 		so->t = OptStr_I;
 		so->i.s = (srt_string *)s; /* CONSTNESS */
+		sso_pfx_set(so->i.kp, s);
 	}
 }
 
@@ -197,6 +207,7 @@ void sso_setref(srt_stringo *so, const srt_string *s1, const srt_string *s2)
 		so->t = OptStr_II;
 		so->kv.ii.s1 = (srt_string *)s1; /* CONSTNESS */
 		so->kv.ii.s2 = (srt_string *)s2; /* CONSTNESS */
+		sso_pfx_set(so->kv.ii.kp, s1);
 	}
 }
 
@@ -217,7 +228,7 @@ void sso_free(srt_stringo *so)
 	else if (so->kv.t == OptStr_II) {
 		ss_free(&so->kv.ii.s1);
 		ss_free(&so->kv.ii.s2);
-	} else if (so->kv.t == OptStr_DI)
+	} else if ((so->kv.t & OptStr_Ix) != 0) /* DI, ID */
 		ss_free(&so->kv.di.si);
 	so->k.t |= OptStr_Null;
 }
@@ -253,4 +264,38 @@ void sso_dupa1(srt_stringo1 *s)
 		s->i.s = ss_dup(s->i.s);
 }
 
+/*
+ * String references: locations of the out-of-line string pointers (e.g. for
+ * relocating the strings), returning the number of references (0 to 2)
+ */
+
+size_t sso_refs(srt_stringo *s, srt_string **r[2])
+{
+	switch (s->t) {
+	case OptStr_I:
+		r[0] = &s->k.i.s;
+		return 1;
+	case OptStr_DI:
+	case OptStr_ID:
+		r[0] = &s->kv.di.si;
+		return 1;
+	case OptStr_II:
+		r[0] = &s->kv.ii.s1;
+		r[1] = &s->kv.ii.s2;
+		return 2;
+	default:
+		/* cases not using dynamic memory */
+		break;
+	}
+	return 0;
+}
+
+size_t sso_refs1(srt_stringo1 *s, srt_string **r[2])
+{
+	if (s->t != OptStr_I)
+		return 0;
+	r[0] = &s->i.s;
+	return 1;
+}
+
 #endif /* #ifdef S_ENABLE_SM_STRING_OPTIMIZATION */
@@ -25,6 +25,15 @@ extern "C" {
 
 #ifdef S_ENABLE_SM_STRING_OPTIMIZATION
 
+/*
+ * Key prefix cache: out-of-line keys (OptStr_I, OptStr_ID, OptStr_II) keep
+ * their first bytes, zero-padded, as an integer whose order is the key byte
+ * order, so comparisons only dereference the key when the prefixes tie.
+ * Keys sharing their first OptStrPfxSize bytes (e.g. "https://" URLs)
+ * always tie, getting no benefit.
+ */
+#define OptStrPfxSize 8
+
 /*
  * Up to 18-byte string when using direct storage
  */
@@ -39,10 +48,13 @@ extern "C" {
 #define OptStrRawSize2 48
 #define OptStrAllocSize2_DD (OptStrRawSize2 - sizeof(uint8_t))
 #define OptStrAllocSize2_DI (OptStrAllocSize2_DD - sizeof(srt_string *))
+#define OptStrAllocSize2_ID (OptStrAllocSize2_DI - OptStrPfxSize)
 #define OptStr_MaxSize_DD	\
 	(OptStrAllocSize2_DD - 2 * (sizeof(struct SDataSmall) + 1))
 #define OptStr_MaxSize_DI	\
 	(OptStrAllocSize2_DI - sizeof(struct SDataSmall) - 1)
+#define OptStr_MaxSize_ID	\
+	(OptStrAllocSize2_ID - sizeof(struct SDataSmall) - 1)
 
 #define OptStr_2 0x08
 #define OptStr_Ix 0x10
@@ -62,6 +74,7 @@ struct OptStrRaw {
 struct OptStrI {
 	uint8_t t;
 	srt_string *s;
+	uint8_t kp[OptStrPfxSize];
 };
 
 struct OptStrRaw2 {
@@ -75,10 +88,18 @@ struct OptStrDI {
 	srt_string *si;
 };
 
+struct OptStrID { /* OptStrDI, with the key prefix before the key */
+	uint8_t t;
+	uint8_t s_raw[OptStrAllocSize2_ID];
+	uint8_t kp[OptStrPfxSize];
+	srt_string *si;
+};
+
 struct OptStrII {
 	uint8_t t;
 	srt_string *s1;
 	srt_string *s2;
+	uint8_t kp[OptStrPfxSize];
 };
 
 union OptStr1 {
@@ -91,6 +112,7 @@ union OptStr2 {
 	uint8_t t;
 	struct OptStrRaw2 d;
 	struct OptStrDI di;
+	struct OptStrID id;
 	struct OptStrII ii;
 };
 
@@ -139,6 +161,8 @@ void sso1_free(srt_stringo1 *so);
 void sso_free(srt_stringo *so);
 void sso_dupa(srt_stringo *s);
 void sso_dupa1(srt_stringo1 *s);
+size_t sso_refs(srt_stringo *s, srt_string **r[2]);
+size_t sso_refs1(srt_stringo1 *s, srt_string **r[2]);
 
 #else
 
@@ -227,8 +251,92 @@ S_INLINE void sso_dupa(srt_stringo *s)
 	s->kv.s2 = ss_dup(s->kv.s2);
 }
 
+S_INLINE size_t sso_refs(srt_stringo *s, srt_string **r[2])
+{
+	r[0] = &s->kv.s1;
+	r[1] = &s->kv.s2;
+	return 2;
+}
+
+S_INLINE size_t sso_refs1(srt_stringo1 *s, srt_string **r[2])
+{
+	r[0] = &s->s;
+	return 1;
+}
+
 #endif /* #ifdef S_ENABLE_SM_STRING_OPTIMIZATION */
 
+#ifdef S_ENABLE_SM_STRING_OPTIMIZATION
+
+/* Key prefix: first bytes, zero-padded, in big-endian order */
+S_INLINE uint64_t sso_pfx(const srt_string *s)
+{
+	uint64_t p = 0;
+	const uint8_t *b;
+	size_t i, n = ss_size(s);
+	RETURN_IF(!n, 0);
+	b = (const uint8_t *)ss_get_buffer_r(s);
+	for (i = 0; i < OptStrPfxSize; i++)
+		p = (p << 8) | (i < n ? b[i] : 0);
+	return p;
+}
+
+/* Key prefix cache location (NULL: in-place key, or no key) */
+S_INLINE const uint8_t *sso_pfx_ref(const srt_stringo *s)
+{
+	switch (s->t) {
+	case OptStr_I:
+		return s->k.i.kp;
+	case OptStr_ID:
+		return s->kv.id.kp;
+	case OptStr_II:
+		return s->kv.ii.kp;
+	default:
+		break;
+	}
+	return NULL;
+}
+
+S_INLINE uint64_t sso_pfx_get(const uint8_t *kp)
+{
+	uint64_t p;
+	memcpy(&p, kp, sizeof(p));
+	return p;
+}
+
+/* Key comparison (srt_stringo1 can be passed, too) */
+S_INLINE int sso_cmp(const srt_stringo *a, const srt_stringo *b)
+{
+	uint64_t pa, pb;
+	const uint8_t *ka = sso_pfx_ref(a), *kb = sso_pfx_ref(b);
+	if (ka && kb) {
+		pa = sso_pfx_get(ka);
+		pb = sso_pfx_get(kb);
+		if (pa != pb)
+			return pa < pb ? -1 : 1;
+	}
+	return ss_cmp(sso_get(a), sso_get(b));
+}
+
+S_INLINE srt_bool sso_eq(const srt_string *s, const srt_stringo *sso)
+{
+	const uint8_t *kp = sso_pfx_ref(sso);
+	RETURN_IF(kp && sso_pfx_get(kp) != sso_pfx(s), S_FALSE);
+	return !ss_cmp(s, sso_get(sso));
+}
+
+S_INLINE srt_bool sso1_eq(const srt_string *s, const srt_stringo1 *sso1)
+{
+	return sso_eq(s, (const srt_stringo *)sso1);
+}
+
+#else
+
+S_INLINE int sso_cmp(const srt_stringo *a, const srt_stringo *b)
+{
+	return ss_cmp(sso_get(a), sso_get(b));
+}
+
 S_INLINE srt_bool sso1_eq(const srt_string *s, const srt_stringo1 *sso1)
 {
 	return !ss_cmp(s, sso1_get(sso1));
@@ -239,6 +347,8 @@ S_INLINE srt_bool sso_eq(const srt_string *s, const srt_stringo *sso)
 	return !ss_cmp(s, sso_get(sso));
 }
 
+#endif
+
 #ifdef __cplusplus
 } /* extern "C" { */
 #endif
@@ -85,11 +85,57 @@ S_INLINE srt_tnode *locate_parent(srt_tree *t, const struct NodeContext *son,
 	return cn;
 }
 
+/*
+ * Ranked trees: subtree node count, stored after the node data
+ */
+
+S_INLINE srt_tndx *st_cnt_addr(srt_tree *t, srt_tndx x)
+{
+	return (srt_tndx *)((char *)get_node(t, x) + t->cnt_off);
+}
+
+S_INLINE srt_tndx st_cnt(const srt_tree *t, srt_tndx x)
+{
+	RETURN_IF(x == ST_NIL, 0);
+	return *(const srt_tndx *)((const char *)get_node_r(t, x)
+				   + t->cnt_off);
+}
+
+S_INLINE void st_cnt_fix(srt_tree *t, srt_tndx x)
+{
+	const srt_tnode *n;
+	if (x == ST_NIL)
+		return;
+	n = get_node_r(t, x);
+	*st_cnt_addr(t, x) = st_cnt(t, n->x.l) + st_cnt(t, n->r) + 1;
+}
+
+/*
+ * Recompute the subtree node count of the nodes in the search path of 'n'
+ * (equal keys go left, as in st_delete()), bottom-up. Used after inserting
+ * or removing a node, as rotations keep the count of the nodes involved.
+ */
+static void st_cnt_fix_path(srt_tree *t, const srt_tnode *n)
+{
+	size_t d = 0;
+	srt_tndx x, p[ST_CURSOR_MAX_DEPTH];
+	const srt_tnode *cn;
+	for (x = st_size(t) ? t->root : ST_NIL;
+	     x != ST_NIL && d < ST_CURSOR_MAX_DEPTH;) {
+		p[d++] = x;
+		cn = get_node_r(t, x);
+		x = get_lr(cn, t->cmp_f(cn, n) < 0 ? ST_Right : ST_Left);
+	}
+	while (d > 0)
+		st_cnt_fix(t, p[--d]);
+}
+
 S_INLINE void update_node_data(const srt_tree *t, srt_tnode *tgt,
 			       const srt_tnode *src)
 {
 	size_t node_header_size = sizeof(srt_tnode),
-	       copy_size = t->d.elem_size - node_header_size;
+	       copy_size = (t->cnt_off ? t->cnt_off : t->d.elem_size)
+			   - node_header_size;
 	char *tgtp = (char *)tgt + node_header_size;
 	const char *srcp = (const char *)src + node_header_size;
 	memcpy(tgtp, srcp, copy_size);
@@ -106,6 +152,8 @@ S_INLINE void new_node(const srt_tree *t, srt_tnode *tgt, const srt_tnode *src,
 	update_node_data(t, tgt, src);
 	tgt->x.l = tgt->r = ST_NIL;
 	tgt->x.is_red = ir;
+	if (t->cnt_off)
+		*(srt_tndx *)((char *)tgt + t->cnt_off) = 1;
 }
 
 S_INLINE srt_bool is_red(const srt_tree *t, srt_tndx node_id)
@@ -136,7 +184,11 @@ S_INLINE enum STNDir cd(enum STNDir d)
 	set_lr(xn, xd, get_lr(yn, d));                                         \
 	set_lr(yn, d, x);                                                      \
 	set_red(t, x, S_TRUE);                                                 \
-	set_red(t, y, S_FALSE);
+	set_red(t, y, S_FALSE);                                                \
+	if (t->cnt_off) {                                                      \
+		st_cnt_fix(t, x);                                              \
+		st_cnt_fix(t, y);                                              \
+	}
 
 S_INLINE srt_tndx rot1x(srt_tree *t, srt_tnode *xn, srt_tndx x, enum STNDir d,
 			enum STNDir xd)
@@ -203,6 +255,13 @@ static size_t st_assert_aux(const srt_tree *t, srt_tndx ndx)
 	    && n->r != ST_NIL && t->cmp_f(get_node_r(t, n->r), n) <= 0) {
 #ifdef DEBUG_stree
 		fprintf(stderr, "st_assert: tree structure violation\n");
+#endif
+		return 0;
+	}
+	if (t->cnt_off
+	    && st_cnt(t, ndx) != st_cnt(t, n->x.l) + st_cnt(t, n->r) + 1) {
+#ifdef DEBUG_stree
+		fprintf(stderr, "st_assert: subtree node count mismatch\n");
 #endif
 		return 0;
 	}
@@ -234,6 +293,9 @@ srt_tree *st_alloc_raw(srt_cmp cmp_f, srt_bool ext_buf, void *buffer,
 		 S_FALSE);
 	t->cmp_f = cmp_f;
 	t->root = 0;
+	t->bt = NULL;
+	t->cnt_off = 0;
+	t->log = NULL;
 	return t;
 }
 
@@ -248,6 +310,16 @@ srt_tree *st_alloc(srt_cmp cmp_f, size_t elem_size, size_t init_size)
 	return t;
 }
 
+srt_tree *st_alloc_ranked(srt_cmp cmp_f, size_t elem_size, size_t init_size)
+{
+	/* Node count after the node data, keeping 8-byte node alignment */
+	size_t es = (elem_size + sizeof(srt_tndx) + 7) & ~(size_t)7;
+	srt_tree *t = st_alloc(cmp_f, es, init_size);
+	if (t && t != st_void)
+		t->cnt_off = elem_size;
+	return t;
+}
+
 /*
  * Operations
  */
@@ -259,6 +331,8 @@ srt_tree *st_dup(const srt_tree *t)
 	t2 = st_alloc(t->cmp_f, t->d.elem_size, t->d.size);
 	RETURN_IF(!t2, NULL);
 	memcpy(t2, t, t->d.header_size + t->d.size * t->d.elem_size);
+	t2->bt = NULL; /* not owned by the tree */
+	t2->log = NULL;
 	return t2;
 }
 
@@ -267,7 +341,9 @@ srt_bool st_insert(srt_tree **tt, const srt_tnode *n)
 	return st_insert_rw(tt, n, NULL);
 }
 
-srt_bool st_insert_rw(srt_tree **tt, const srt_tnode *n, srt_tree_rewrite rw_f)
+/* 'out': inserted or rewritten node (optional) */
+static srt_bool st_insert_aux(srt_tree **tt, const srt_tnode *n,
+			      srt_tree_rewrite rw_f, srt_tnode **out)
 {
 	srt_tree *t;
 	srt_tnode auxn = EMPTY_STN;
@@ -293,6 +369,8 @@ srt_bool st_insert_rw(srt_tree **tt, const srt_tnode *n, srt_tree_rewrite rw_f)
 		new_node(t, node, n, S_FALSE);
 		if (rw_f)
 			rw_f(node, n, S_FALSE);
+		if (out)
+			*out = node;
 		t->root = 0;
 		st_set_size(t, 1);
 		return S_TRUE;
@@ -330,6 +408,8 @@ srt_bool st_insert_rw(srt_tree **tt, const srt_tnode *n, srt_tree_rewrite rw_f)
 			new_node(t, w[c].n, n, S_TRUE);
 			if (rw_f)
 				rw_f(w[c].n, n, S_FALSE);
+			if (out)
+				*out = w[c].n;
 			/* Update parent node: */
 			set_lr(w[cp].n, d, w[c].x);
 			if (get_lr(w[cp].n, cd(d)) != ST_NIL)
@@ -363,14 +443,19 @@ srt_bool st_insert_rw(srt_tree **tt, const srt_tnode *n, srt_tree_rewrite rw_f)
 				t->root = v;
 			}
 		}
-		if (done)
+		if (done) {
+			if (t->cnt_off)
+				st_cnt_fix_path(t, n);
 			break;
+		}
 		cmp = t->cmp_f(w[c].n, n);
 		if (!cmp) {
 			if (rw_f)
 				rw_f(w[c].n, n, S_TRUE);
 			else
 				update_node_data(t, w[c].n, n);
+			if (out)
+				*out = w[c].n;
 			break;
 		}
 		/* Step down: left or right */
@@ -384,6 +469,22 @@ srt_bool st_insert_rw(srt_tree **tt, const srt_tnode *n, srt_tree_rewrite rw_f)
 	return S_TRUE;
 }
 
+srt_bool st_insert_rw(srt_tree **tt, const srt_tnode *n, srt_tree_rewrite rw_f)
+{
+	return st_insert_aux(tt, n, rw_f, NULL);
+}
+
+srt_tnode *st_insert_rw_node(srt_tree **tt, const srt_tnode *n,
+			     srt_tree_rewrite rw_f, srt_bool *is_new)
+{
+	size_t ts = st_size(tt ? *tt : NULL);
+	srt_tnode *out = NULL;
+	RETURN_IF(!st_insert_aux(tt, n, rw_f, &out), NULL);
+	if (is_new)
+		*is_new = st_size(*tt) > ts ? S_TRUE : S_FALSE;
+	return out;
+}
+
 srt_bool st_delete(srt_tree *t, const srt_tnode *n, srt_tree_callback callback)
 {
 	size_t ts0;
@@ -508,6 +609,21 @@ srt_bool st_delete(srt_tree *t, const srt_tnode *n, srt_tree_callback callback)
 		d0 = d;
 	}
 	if (found.n) {
+		if (!w[cp].n) { /* Root node deletion (???) */
+			t->root =
+				w[c].n->x.l != ST_NIL ? w[c].n->x.l : w[c].n->r;
+		} else {
+			ds = w[c].n->x.l == ST_NIL ? ST_Right : ST_Left;
+			dt = w[cp].n->r == w[c].x ? ST_Right : ST_Left;
+			set_lr(w[cp].n, dt, get_lr(w[c].n, ds));
+		}
+		/*
+		 * Ranked tree: the found node still has the search key (the
+		 * delete callback is called after the path walk, as it could
+		 * release the key, e.g. out-of-line strings)
+		 */
+		if (t->cnt_off)
+			st_cnt_fix_path(t, n);
 		if (callback)
 			callback((void *)found.n);
 		/*
@@ -520,14 +636,6 @@ srt_bool st_delete(srt_tree *t, const srt_tnode *n, srt_tree_callback callback)
 			update_node_data(t, found.n, w[c].n);
 			found.x = w[c].x;
 		}
-		if (!w[cp].n) { /* Root node deletion (???) */
-			t->root =
-				w[c].n->x.l != ST_NIL ? w[c].n->x.l : w[c].n->r;
-		} else {
-			ds = w[c].n->x.l == ST_NIL ? ST_Right : ST_Left;
-			dt = w[cp].n->r == w[c].x ? ST_Right : ST_Left;
-			set_lr(w[cp].n, dt, get_lr(w[c].n, ds));
-		}
 		/*
 		 * If deleted node is not the last node in the linear space,
 		 * in order to avoid fragmentation the last one will be
@@ -575,6 +683,183 @@ const srt_tnode *st_locate(const srt_tree *t, const srt_tnode *n)
 	return cn;
 }
 
+/*
+ * Balanced tree from nodes already stored in key order: the middle node of
+ * every range is the subtree root, so all levels are complete except the
+ * last one, whose nodes are colored red (same black height for all paths).
+ * Recursion depth is O(log n).
+ */
+static srt_tndx st_build_aux(srt_tree *t, srt_tndx lo, srt_tndx hi,
+			     size_t depth, size_t red_depth)
+{
+	srt_tndx m;
+	srt_tnode *n;
+	RETURN_IF(lo >= hi, ST_NIL);
+	m = lo + (hi - lo) / 2;
+	n = get_node(t, m);
+	n->x.l = st_build_aux(t, lo, m, depth + 1, red_depth);
+	n->r = st_build_aux(t, m + 1, hi, depth + 1, red_depth);
+	n->x.is_red = depth == red_depth ? S_TRUE : S_FALSE;
+	if (t->cnt_off)
+		*st_cnt_addr(t, m) = hi - lo;
+	return m;
+}
+
+srt_bool st_build_sorted(srt_tree *t)
+{
+	size_t i, size, complete_levels;
+	RETURN_IF(!t, S_FALSE);
+	size = st_size(t);
+	for (i = 1; i < size; i++)
+		if (t->cmp_f(get_node_r(t, (srt_tndx)(i - 1)),
+			     get_node_r(t, (srt_tndx)i))
+		    >= 0)
+			return S_FALSE; /* not sorted or repeated keys */
+	for (complete_levels = 0; ((size_t)2 << complete_levels) <= size + 1;
+	     complete_levels++)
+		;
+	t->root = st_build_aux(t, 0, (srt_tndx)size, 0, complete_levels);
+	if (t->root == ST_NIL)
+		t->root = 0; /* empty tree */
+	return S_TRUE;
+}
+
+/*
+ * Cursor: the path from the root is kept, as nodes have no parent
+ * reference. Stepping is O(1) amortized (a full scan visits every tree
+ * edge twice).
+ */
+
+static srt_bool st_cursor_seek(const srt_tree *t, const srt_tnode *n,
+			       struct STCursor *c, srt_bool ge)
+{
+	int r;
+	size_t d = 0;
+	srt_tndx x;
+	const srt_tnode *cn;
+	RETURN_IF(!c, S_FALSE);
+	c->d = 0;
+	RETURN_IF(!t || !n || !st_size(t), S_FALSE);
+	for (x = t->root; x != ST_NIL && d < ST_CURSOR_MAX_DEPTH;) {
+		cn = get_node_r(t, x);
+		c->p[d++] = x;
+		r = t->cmp_f(cn, n);
+		if (!r) {
+			c->d = d;
+			break;
+		}
+		if (ge ? r > 0 : r < 0)
+			c->d = d; /* candidate, look for a closer one */
+		x = get_lr(cn, r < 0 ? ST_Right : ST_Left);
+	}
+	return c->d ? S_TRUE : S_FALSE;
+}
+
+static srt_bool st_cursor_step(const srt_tree *t, struct STCursor *c,
+			       enum STNDir d)
+{
+	srt_tndx x;
+	RETURN_IF(!t || !c || !c->d, S_FALSE);
+	x = get_lr(get_node_r(t, c->p[c->d - 1]), d);
+	if (x != ST_NIL) { /* subtree: go down, then to the opposite side */
+		for (; x != ST_NIL && c->d < ST_CURSOR_MAX_DEPTH;
+		     x = get_lr(get_node_r(t, x), cd(d)))
+			c->p[c->d++] = x;
+		return S_TRUE;
+	}
+	/* Go up until arriving from the opposite side */
+	for (x = c->p[--c->d]; c->d; x = c->p[--c->d])
+		if (get_lr(get_node_r(t, c->p[c->d - 1]), cd(d)) == x)
+			return S_TRUE;
+	return S_FALSE;
+}
+
+srt_bool st_cursor_seek_ge(const srt_tree *t, const srt_tnode *n,
+			   struct STCursor *c)
+{
+	return st_cursor_seek(t, n, c, S_TRUE);
+}
+
+srt_bool st_cursor_seek_le(const srt_tree *t, const srt_tnode *n,
+			   struct STCursor *c)
+{
+	return st_cursor_seek(t, n, c, S_FALSE);
+}
+
+srt_bool st_cursor_next(const srt_tree *t, struct STCursor *c)
+{
+	return st_cursor_step(t, c, ST_Right);
+}
+
+srt_bool st_cursor_prev(const srt_tree *t, struct STCursor *c)
+{
+	return st_cursor_step(t, c, ST_Left);
+}
+
+/*
+ * Order statistics: O(log n) for ranked trees, using the subtree node
+ * count; otherwise a linear scan.
+ */
+
+size_t st_rank(const srt_tree *t, const srt_tnode *n)
+{
+	int r;
+	size_t i, size, acc = 0;
+	srt_tndx x;
+	const srt_tnode *cn;
+	RETURN_IF(!t || !n, 0);
+	size = st_size(t);
+	if (!t->cnt_off) { /* unsorted scan, sequential memory access */
+		for (i = 0; i < size; i++)
+			acc += t->cmp_f(get_node_r(t, (srt_tndx)i), n) < 0 ? 1
+									    : 0;
+		return acc;
+	}
+	for (x = size ? t->root : ST_NIL; x != ST_NIL;) {
+		cn = get_node_r(t, x);
+		r = t->cmp_f(cn, n);
+		if (r < 0) {
+			acc += st_cnt(t, cn->x.l) + 1;
+			x = cn->r;
+		} else {
+			if (!r)
+				return acc + st_cnt(t, cn->x.l);
+			x = cn->x.l;
+		}
+	}
+	return acc;
+}
+
+srt_tndx st_select(const srt_tree *t, size_t i)
+{
+	size_t l;
+	srt_tndx x;
+	const srt_tnode *cn;
+	struct STCursor c;
+	RETURN_IF(!t || i >= st_size(t), ST_NIL);
+	if (!t->cnt_off) { /* in-order walk from the first node */
+		c.d = 0;
+		for (x = t->root; x != ST_NIL && c.d < ST_CURSOR_MAX_DEPTH;
+		     x = get_node_r(t, x)->x.l)
+			c.p[c.d++] = x;
+		for (; i > 0; i--)
+			st_cursor_next(t, &c);
+		return c.p[c.d - 1];
+	}
+	for (x = t->root;;) {
+		cn = get_node_r(t, x);
+		l = st_cnt(t, cn->x.l);
+		if (i == l)
+			return x;
+		if (i < l) {
+			x = cn->x.l;
+		} else {
+			i -= l + 1;
+			x = cn->r;
+		}
+	}
+}
+
 /*
  * Depth-first tree traversal
  */
@@ -758,7 +1043,9 @@ ssize_t st_traverse_levelorder(const srt_tree *t, st_traverse f, void *context)
 srt_bool st_assert(const srt_tree *t)
 {
 	RETURN_IF(!t, S_FALSE);
+	RETURN_IF(!t->d.size, S_TRUE);
 	RETURN_IF(t->d.size == 1 && is_red(t, t->root), S_FALSE);
+	RETURN_IF(t->cnt_off && st_cnt(t, t->root) != t->d.size, S_FALSE);
 	RETURN_IF(t->d.size == 1, S_TRUE);
 	return st_assert_aux(t, t->root) ? S_TRUE : S_FALSE;
 }
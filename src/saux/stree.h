@@ -41,10 +41,16 @@ struct S_Node {
 	srt_tndx r;
 };
 
+struct S_BTree;
+struct SMapLog;
+
 struct S_Tree {
 	struct SDataFull d;
 	srt_tndx root;
 	srt_cmp cmp_f;
+	struct S_BTree *bt; /* B+tree index (srt_map), replacing the RB tree */
+	size_t cnt_off;	    /* ranked tree: subtree node count offset, 0: off */
+	struct SMapLog *log; /* srt_map: changes since the last snapshot */
 };
 
 typedef struct S_Node srt_tnode;
@@ -58,6 +64,13 @@ struct STraverseParams {
 	ssize_t max_level;
 };
 
+#define ST_CURSOR_MAX_DEPTH 64 /* RB tree height <= 2 * log2(n + 1) */
+
+struct STCursor {
+	srt_tndx p[ST_CURSOR_MAX_DEPTH]; /* path from the root */
+	size_t d;			  /* path depth (0: no current node) */
+};
+
 typedef int (*st_traverse)(struct STraverseParams *p);
 typedef void (*srt_tree_rewrite)(srt_tnode *node, const srt_tnode *new_data,
 				 srt_bool existing);
@@ -88,6 +101,9 @@ srt_tree *st_alloc_raw(srt_cmp cmp_f, srt_bool ext_buf,
 /* #NOTAPI: |Allocate tree (heap)|compare function;element size;space preallocated to store n elements|allocated tree|O(1)|1;2| */
 srt_tree *st_alloc(srt_cmp cmp_f, size_t elem_size, size_t init_size);
 
+/* #NOTAPI: |Allocate ranked tree (heap): nodes also store their subtree node count, for O(log n) rank/select|compare function;element size;space preallocated to store n elements|allocated tree|O(1)|1;2| */
+srt_tree *st_alloc_ranked(srt_cmp cmp_f, size_t elem_size, size_t init_size);
+
 SD_BUILDFUNCS_FULL(st, srt_tree, 0)
 
 /*
@@ -132,12 +148,36 @@ srt_bool st_insert(srt_tree **t, const srt_tnode *n);
 /* #NOTAPI: |Insert element into tree, with rewrite function (in case of key already written)|tree; element to insert; rewrite function (if NULL it will behave like st_insert()|S_TRUE: OK, S_FALSE: error (not enough memory)|O(log n)|1;2| */
 srt_bool st_insert_rw(srt_tree **t, const srt_tnode *n, srt_tree_rewrite rw_f);
 
+/* #NOTAPI: |Insert element into tree, with rewrite function, returning the inserted or rewritten node (valid until the next tree modification)|tree; element to insert; rewrite function (if NULL it will behave like st_insert()); output: S_TRUE if inserted (optional)|node (NULL: error, not enough memory)|O(log n)|1;2| */
+srt_tnode *st_insert_rw_node(srt_tree **t, const srt_tnode *n, srt_tree_rewrite rw_f, srt_bool *is_new);
+
 /* #NOTAPI: |Delete tree element|tree; element to delete; node delete handling callback (optional if e.g. nodes use no extra dynamic memory references)|S_TRUE: found and deleted; S_FALSE: not found|O(log n)|1;2| */
 srt_bool st_delete(srt_tree *t, const srt_tnode *n, srt_tree_callback callback);
 
 /* #NOTAPI: |Locate node|tree; node|Reference to the located node; NULL if not found|O(log n)|1;2| */
 const srt_tnode *st_locate(const srt_tree *t, const srt_tnode *n);
 
+/* #NOTAPI: |Link the tree nodes, already stored in ascending key order (e.g. from a sorted dump), into a balanced tree|tree|S_TRUE: OK; S_FALSE: nodes not sorted or with repeated keys (tree left unlinked)|O(n)|1;2| */
+srt_bool st_build_sorted(srt_tree *t);
+
+/* #NOTAPI: |Position cursor at the first node greater or equal than the given one|tree; node; cursor|S_TRUE: cursor at a node; S_FALSE: no node found|O(log n)|1;2| */
+srt_bool st_cursor_seek_ge(const srt_tree *t, const srt_tnode *n, struct STCursor *c);
+
+/* #NOTAPI: |Position cursor at the last node lower or equal than the given one|tree; node; cursor|S_TRUE: cursor at a node; S_FALSE: no node found|O(log n)|1;2| */
+srt_bool st_cursor_seek_le(const srt_tree *t, const srt_tnode *n, struct STCursor *c);
+
+/* #NOTAPI: |Move cursor to the next node, in key order|tree; cursor|S_TRUE: cursor at a node; S_FALSE: no more nodes|O(1) amortized|1;2| */
+srt_bool st_cursor_next(const srt_tree *t, struct STCursor *c);
+
+/* #NOTAPI: |Move cursor to the previous node, in key order|tree; cursor|S_TRUE: cursor at a node; S_FALSE: no more nodes|O(1) amortized|1;2| */
+srt_bool st_cursor_prev(const srt_tree *t, struct STCursor *c);
+
+/* #NOTAPI: |Number of nodes lower than the given one|tree; node|Number of nodes|O(log n) for ranked trees, O(n) otherwise|1;2| */
+size_t st_rank(const srt_tree *t, const srt_tnode *n);
+
+/* #NOTAPI: |Locate the i-th node in key order|tree; position (0 to n - 1)|node index (ST_NIL: out of range)|O(log n) for ranked trees, O(n) otherwise|1;2| */
+srt_tndx st_select(const srt_tree *t, size_t i);
+
 /* #NOTAPI: |Full tree traversal: pre-order|tree; traverse callback; callback context|Number of levels stepped down|O(n)|1;2| */
 ssize_t st_traverse_preorder(const srt_tree *t, st_traverse f, void *context);
 
@@ -0,0 +1,447 @@
+/*
+ * schmap.c
+ *
+ * Sharded hash map handling
+ *
+ * Copyright (c) 2015-2019 F. Aragon. All rights reserved. Released under
+ * the BSD 3-Clause License (see the doc/LICENSE file included).
+ */
+
+#include "schmap.h"
+#include "saux/shash.h"
+
+/*
+ * Constants and macros
+ */
+#define SCHM_MAX_SHARD_BITS 12
+#define shm_void (srt_hmap *)sd_void /* shm_alloc*() error */
+
+/*
+ * Internal functions
+ */
+
+S_INLINE void schm_lock(const srt_chmap *cm, size_t i, srt_bool exclusive)
+{
+	if (cm->lockf)
+		cm->lockf(cm->lock_context, i, exclusive);
+}
+
+S_INLINE void schm_unlock(const srt_chmap *cm, size_t i, srt_bool exclusive)
+{
+	if (cm->unlockf)
+		cm->unlockf(cm->lock_context, i, exclusive);
+}
+
+/*
+ * Shard selection: the key hash is mixed again and the upper bits used,
+ * so the shard doesn't correlate with the bucket index (upper bits of the
+ * key hash; for 64-bit hashes, the lower 32 bits are mixed)
+ */
+S_INLINE size_t schm_shard(const srt_chmap *cm, shm_hash_t_ h)
+{
+	return cm->sbits ? sh_hash32((uint32_t)h) >> (32 - cm->sbits) : 0;
+}
+
+/*
+ * Key hashing, using the same hash function set as the shards (map fields
+ * are used instead of the shard ones, as shards can be reallocated)
+ */
+
+S_INLINE shm_hash_t_ schm_hash_u32(const srt_chmap *cm, uint32_t k)
+{
+	return shm_hashx_u32(cm->htype, cm->hseed, k);
+}
+
+S_INLINE shm_hash_t_ schm_hash_u64(const srt_chmap *cm, uint64_t k)
+{
+	return shm_hashx_u64(cm->htype, cm->hseed, k);
+}
+
+S_INLINE shm_hash_t_ schm_hash_i(const srt_chmap *cm, int64_t k)
+{
+	return cm->ksize == 4 ? schm_hash_u32(cm, (uint32_t)k)
+			      : schm_hash_u64(cm, (uint64_t)k);
+}
+
+S_INLINE shm_hash_t_ schm_hash_s(const srt_chmap *cm, const srt_string *k)
+{
+	return shm_hashx_s(cm->htype, cm->hseed, k);
+}
+
+/*
+ * Allocation
+ */
+
+srt_chmap *schm_alloc_hash(enum eSHM_Type t, size_t nshards, size_t init_size,
+			   enum eSHM_Hash h, uint64_t seed)
+{
+	size_t i, ns, shard_size;
+	unsigned sbits = 0;
+	srt_chmap *cm;
+	while (sbits < SCHM_MAX_SHARD_BITS && ((size_t)1 << sbits) < nshards)
+		sbits++;
+	ns = (size_t)1 << sbits;
+	cm = (srt_chmap *)s_malloc(sizeof(srt_chmap)
+				   + (ns - 1) * sizeof(srt_hmap *));
+	RETURN_IF(!cm, NULL);
+	cm->t = (int)t;
+	cm->sbits = sbits;
+	cm->nshards = ns;
+	cm->lockf = cm->unlockf = NULL;
+	cm->lock_context = NULL;
+	if (h == SHM_HASH_RANDOM) {
+		h = SHM_HASH_SEEDED;
+		seed = sh_seed_random();
+	}
+	cm->htype = (uint32_t)h;
+	cm->hseed = h == SHM_HASH_SEEDED ? seed : 0;
+	shard_size = init_size / ns + (init_size % ns ? 1 : 0);
+	for (i = 0; i < ns; i++) {
+		cm->s[i] = shm_alloc_hash(t, shard_size, h, seed);
+		if (!cm->s[i] || cm->s[i] == shm_void) {
+			cm->nshards = i;
+			schm_free(&cm);
+			return NULL;
+		}
+	}
+	cm->ksize = cm->s[0]->ksize;
+	return cm;
+}
+
+void schm_set_locking(srt_chmap *cm, srt_chmap_lock_f lockf,
+		      srt_chmap_lock_f unlockf, void *context)
+{
+	if (!cm)
+		return;
+	cm->lockf = lockf;
+	cm->unlockf = unlockf;
+	cm->lock_context = context;
+}
+
+size_t schm_size(const srt_chmap *cm)
+{
+	size_t i, sz = 0;
+	RETURN_IF(!cm, 0);
+	for (i = 0; i < cm->nshards; i++) {
+		schm_lock(cm, i, S_FALSE);
+		sz += shm_size(cm->s[i]);
+		schm_unlock(cm, i, S_FALSE);
+	}
+	return sz;
+}
+
+void schm_clear(srt_chmap *cm)
+{
+	size_t i;
+	if (!cm)
+		return;
+	for (i = 0; i < cm->nshards; i++) {
+		schm_lock(cm, i, S_TRUE);
+		shm_clear(cm->s[i]);
+		schm_unlock(cm, i, S_TRUE);
+	}
+}
+
+void schm_free_aux(srt_chmap **cm, ...)
+{
+	size_t i;
+	va_list ap;
+	srt_chmap **next = cm;
+	va_start(ap, cm);
+	while (!s_varg_tail_ptr_tag(next)) { /* last element tag */
+		if (next && *next) {
+			for (i = 0; i < (*next)->nshards; i++)
+				shm_free(&(*next)->s[i]);
+			s_free(*next);
+			*next = NULL;
+		}
+		next = (srt_chmap **)va_arg(ap, srt_chmap **);
+	}
+	va_end(ap);
+}
+
+/*
+ * Random access
+ */
+
+/*
+ * Lookup in the key shard, using the key hash already computed for
+ * selecting the shard (the shards use the same hash function set)
+ */
+#define SCHM_AT_X(cm, hash, key, NT, found_v, def)                             \
+	RETURN_IF(!cm, def);                                                   \
+	h = hash;                                                              \
+	i = schm_shard(cm, h);                                                 \
+	schm_lock(cm, i, S_FALSE);                                             \
+	e = (const NT *)shm_at(cm->s[i], h, key, NULL);                        \
+	r = e ? found_v : def;                                                 \
+	schm_unlock(cm, i, S_FALSE);                                           \
+	return r
+
+int32_t schm_at_ii32(const srt_chmap *cm, int32_t k)
+{
+	size_t i;
+	int32_t r;
+	shm_hash_t_ h;
+	const struct SHMapii *e;
+	SCHM_AT_X(cm, schm_hash_u32(cm, (uint32_t)k), &k, struct SHMapii, e->v,
+		  0);
+}
+
+uint32_t schm_at_uu32(const srt_chmap *cm, uint32_t k)
+{
+	size_t i;
+	uint32_t r;
+	shm_hash_t_ h;
+	const struct SHMapuu *e;
+	SCHM_AT_X(cm, schm_hash_u32(cm, k), &k, struct SHMapuu, e->v, 0);
+}
+
+int64_t schm_at_ii(const srt_chmap *cm, int64_t k)
+{
+	size_t i;
+	int64_t r;
+	shm_hash_t_ h;
+	const struct SHMapII *e;
+	SCHM_AT_X(cm, schm_hash_u64(cm, (uint64_t)k), &k, struct SHMapII, e->v,
+		  0);
+}
+
+srt_string *schm_at_is(const srt_chmap *cm, int64_t k, srt_string **v)
+{
+	size_t i;
+	srt_string *r;
+	shm_hash_t_ h;
+	const struct SHMapIS *e;
+	RETURN_IF(!v, NULL);
+	SCHM_AT_X(cm, schm_hash_u64(cm, (uint64_t)k), &k, struct SHMapIS,
+		  ss_cpy(v, sso1_get(&e->v)), ss_cpy(v, ss_void));
+}
+
+const void *schm_at_ip(const srt_chmap *cm, int64_t k)
+{
+	size_t i;
+	const void *r;
+	shm_hash_t_ h;
+	const struct SHMapIP *e;
+	SCHM_AT_X(cm, schm_hash_u64(cm, (uint64_t)k), &k, struct SHMapIP, e->v,
+		  NULL);
+}
+
+int64_t schm_at_si(const srt_chmap *cm, const srt_string *k)
+{
+	size_t i;
+	int64_t r;
+	shm_hash_t_ h;
+	const struct SHMapSI *e;
+	SCHM_AT_X(cm, schm_hash_s(cm, k), k, struct SHMapSI, e->v, 0);
+}
+
+srt_string *schm_at_ss(const srt_chmap *cm, const srt_string *k,
+		       srt_string **v)
+{
+	size_t i;
+	srt_string *r;
+	shm_hash_t_ h;
+	const struct SHMapSS *e;
+	RETURN_IF(!v, NULL);
+	SCHM_AT_X(cm, schm_hash_s(cm, k), k, struct SHMapSS,
+		  ss_cpy(v, sso_get_s2(&e->kv)), ss_cpy(v, ss_void));
+}
+
+const void *schm_at_sp(const srt_chmap *cm, const srt_string *k)
+{
+	size_t i;
+	const void *r;
+	shm_hash_t_ h;
+	const struct SHMapSP *e;
+	SCHM_AT_X(cm, schm_hash_s(cm, k), k, struct SHMapSP, e->v, NULL);
+}
+
+/*
+ * Existence check
+ */
+
+size_t schm_count_i(const srt_chmap *cm, int64_t k)
+{
+	size_t i, r;
+	shm_hash_t_ h;
+	const uint8_t *e;
+	uint32_t k32 = (uint32_t)k;
+	SCHM_AT_X(cm, schm_hash_i(cm, k),
+		  cm->ksize == 4 ? (const void *)&k32 : (const void *)&k,
+		  uint8_t, 1, 0);
+}
+
+size_t schm_count_s(const srt_chmap *cm, const srt_string *k)
+{
+	size_t i, r;
+	shm_hash_t_ h;
+	const uint8_t *e;
+	SCHM_AT_X(cm, schm_hash_s(cm, k), k, uint8_t, 1, 0);
+}
+
+/*
+ * Insert, increment, and delete
+ */
+
+#define SCHM_UPDATE_X(cm, h, update_call)                                      \
+	size_t i;                                                              \
+	srt_bool r;                                                            \
+	RETURN_IF(!cm, S_FALSE);                                               \
+	i = schm_shard(cm, h);                                                 \
+	schm_lock(cm, i, S_TRUE);                                              \
+	r = update_call;                                                       \
+	schm_unlock(cm, i, S_TRUE);                                            \
+	return r
+
+srt_bool schm_insert_ii32(srt_chmap *cm, int32_t k, int32_t v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_u32(cm, (uint32_t)k),
+		      shm_insert_ii32(&cm->s[i], k, v));
+}
+
+srt_bool schm_insert_uu32(srt_chmap *cm, uint32_t k, uint32_t v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_u32(cm, k),
+		      shm_insert_uu32(&cm->s[i], k, v));
+}
+
+srt_bool schm_insert_ii(srt_chmap *cm, int64_t k, int64_t v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_u64(cm, (uint64_t)k),
+		      shm_insert_ii(&cm->s[i], k, v));
+}
+
+srt_bool schm_insert_is(srt_chmap *cm, int64_t k, const srt_string *v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_u64(cm, (uint64_t)k),
+		      shm_insert_is(&cm->s[i], k, v));
+}
+
+srt_bool schm_insert_ip(srt_chmap *cm, int64_t k, const void *v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_u64(cm, (uint64_t)k),
+		      shm_insert_ip(&cm->s[i], k, v));
+}
+
+srt_bool schm_insert_si(srt_chmap *cm, const srt_string *k, int64_t v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_s(cm, k), shm_insert_si(&cm->s[i], k, v));
+}
+
+srt_bool schm_insert_ss(srt_chmap *cm, const srt_string *k,
+			const srt_string *v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_s(cm, k), shm_insert_ss(&cm->s[i], k, v));
+}
+
+srt_bool schm_insert_sp(srt_chmap *cm, const srt_string *k, const void *v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_s(cm, k), shm_insert_sp(&cm->s[i], k, v));
+}
+
+srt_bool schm_inc_ii32(srt_chmap *cm, int32_t k, int32_t v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_u32(cm, (uint32_t)k),
+		      shm_inc_ii32(&cm->s[i], k, v));
+}
+
+srt_bool schm_inc_uu32(srt_chmap *cm, uint32_t k, uint32_t v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_u32(cm, k), shm_inc_uu32(&cm->s[i], k, v));
+}
+
+srt_bool schm_inc_ii(srt_chmap *cm, int64_t k, int64_t v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_u64(cm, (uint64_t)k),
+		      shm_inc_ii(&cm->s[i], k, v));
+}
+
+srt_bool schm_inc_si(srt_chmap *cm, const srt_string *k, int64_t v)
+{
+	SCHM_UPDATE_X(cm, schm_hash_s(cm, k), shm_inc_si(&cm->s[i], k, v));
+}
+
+srt_bool schm_delete_i(srt_chmap *cm, int64_t k)
+{
+	SCHM_UPDATE_X(cm, schm_hash_i(cm, k), shm_delete_i(cm->s[i], k));
+}
+
+srt_bool schm_delete_s(srt_chmap *cm, const srt_string *k)
+{
+	SCHM_UPDATE_X(cm, schm_hash_s(cm, k), shm_delete_s(cm->s[i], k));
+}
+
+/*
+ * Enumeration: shards are walked in order, mapping the global [begin, end)
+ * range into each shard local range. Stops if the callback does.
+ */
+
+#define SCHM_ITP_X(cm, begin, end, f, context, shm_itp_f)                      \
+	size_t i, ss, lb, le, r, off = 0, cnt = 0;                             \
+	RETURN_IF(!cm || begin >= end, 0);                                     \
+	for (i = 0; i < cm->nshards; i++) {                                    \
+		schm_lock(cm, i, S_FALSE);                                     \
+		ss = shm_size(cm->s[i]);                                       \
+		if (begin < off + ss) {                                        \
+			lb = begin > off ? begin - off : 0;                    \
+			le = end - off < ss ? end - off : ss;                  \
+			r = shm_itp_f(cm->s[i], lb, le, f, context);           \
+			schm_unlock(cm, i, S_FALSE);                           \
+			cnt += r;                                              \
+			if (r < le - lb || end - off <= ss)                    \
+				break;                                         \
+		} else                                                         \
+			schm_unlock(cm, i, S_FALSE);                           \
+		off += ss;                                                     \
+	}                                                                      \
+	return cnt
+
+size_t schm_itp_ii32(const srt_chmap *cm, size_t begin, size_t end,
+		     srt_hmap_it_ii32 f, void *context)
+{
+	SCHM_ITP_X(cm, begin, end, f, context, shm_itp_ii32);
+}
+
+size_t schm_itp_uu32(const srt_chmap *cm, size_t begin, size_t end,
+		     srt_hmap_it_uu32 f, void *context)
+{
+	SCHM_ITP_X(cm, begin, end, f, context, shm_itp_uu32);
+}
+
+size_t schm_itp_ii(const srt_chmap *cm, size_t begin, size_t end,
+		   srt_hmap_it_ii f, void *context)
+{
+	SCHM_ITP_X(cm, begin, end, f, context, shm_itp_ii);
+}
+
+size_t schm_itp_is(const srt_chmap *cm, size_t begin, size_t end,
+		   srt_hmap_it_is f, void *context)
+{
+	SCHM_ITP_X(cm, begin, end, f, context, shm_itp_is);
+}
+
+size_t schm_itp_ip(const srt_chmap *cm, size_t begin, size_t end,
+		   srt_hmap_it_ip f, void *context)
+{
+	SCHM_ITP_X(cm, begin, end, f, context, shm_itp_ip);
+}
+
+size_t schm_itp_si(const srt_chmap *cm, size_t begin, size_t end,
+		   srt_hmap_it_si f, void *context)
+{
+	SCHM_ITP_X(cm, begin, end, f, context, shm_itp_si);
+}
+
+size_t schm_itp_ss(const srt_chmap *cm, size_t begin, size_t end,
+		   srt_hmap_it_ss f, void *context)
+{
+	SCHM_ITP_X(cm, begin, end, f, context, shm_itp_ss);
+}
+
+size_t schm_itp_sp(const srt_chmap *cm, size_t begin, size_t end,
+		   srt_hmap_it_sp f, void *context)
+{
+	SCHM_ITP_X(cm, begin, end, f, context, shm_itp_sp);
+}
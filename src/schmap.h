@@ -0,0 +1,229 @@
+#ifndef SCHMAP_H
+#define SCHMAP_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * schmap.h
+ *
+ * #SHORTDOC sharded hash map handling (key-value storage, for concurrent use)
+ *
+ * #DOC Sharded hash map functions handle key-value storage partitioned
+ * #DOC into N independent hash maps (srt_hmap), being the shard chosen from
+ * #DOC the key hash. Each shard can be protected by its own lock, so
+ * #DOC operations on keys going to different shards don't block each other.
+ * #DOC
+ * #DOC
+ * #DOC Locking is provided by the user, through two callbacks (lock and
+ * #DOC unlock), receiving the shard number and if the access is exclusive
+ * #DOC (write) or shared (read). E.g. using one pthread_rwlock_t per shard,
+ * #DOC exclusive access would call pthread_rwlock_wrlock(), and shared
+ * #DOC access pthread_rwlock_rdlock(). Without callbacks, no locking is
+ * #DOC done (single thread usage).
+ * #DOC
+ * #DOC
+ * #DOC Supported key/value modes: same as srt_hmap (enum eSHM_Type).
+ * #DOC
+ * #DOC
+ * #DOC Callback types for the lock/unlock functions:
+ * #DOC
+ * #DOC
+ * #DOC	typedef void (*srt_chmap_lock_f)(void *context, size_t shard, srt_bool exclusive);
+ * #DOC
+ * #DOC
+ * #DOC Callback types for the schm_itp_*() functions: same as shm_itp_*().
+ *
+ * Copyright (c) 2015-2019 F. Aragon. All rights reserved. Released under
+ * the BSD 3-Clause License (see the doc/LICENSE file included).
+ */
+
+#include "shmap.h"
+
+/*
+ * Structures and types
+ */
+
+typedef void (*srt_chmap_lock_f)(void *context, size_t shard,
+				 srt_bool exclusive);
+
+struct S_CHMap {
+	int t;
+	unsigned sbits; /* shard bits */
+	uint32_t ksize; /* key size, in bytes (0: string) */
+	uint32_t htype; /* hash function set (enum eSHM_Hash) */
+	uint64_t hseed; /* hash seed (same for all shards) */
+	size_t nshards;
+	srt_chmap_lock_f lockf;
+	srt_chmap_lock_f unlockf;
+	void *lock_context;
+	srt_hmap *s[1]; /* shards (nshards elements) */
+};
+
+typedef struct S_CHMap srt_chmap;
+
+/*
+ * Allocation
+ */
+
+/* #API: |Allocate sharded hash map (heap), with hash function selection (see shm_set_hash(); the seed is shared by all shards)|hash map type; number of shards (rounded up to a power of 2, 4096 max); initial reserve (total); hash function set; seed|sharded hash map|O(n)|1;2| */
+srt_chmap *schm_alloc_hash(enum eSHM_Type t, size_t nshards, size_t init_size, enum eSHM_Hash h, uint64_t seed);
+
+/* #API: |Allocate sharded hash map (heap)|hash map type; number of shards (rounded up to a power of 2, 4096 max); initial reserve (total)|sharded hash map|O(n)|1;2| */
+S_INLINE srt_chmap *schm_alloc(enum eSHM_Type t, size_t nshards,
+			       size_t init_size)
+{
+	return schm_alloc_hash(t, nshards, init_size, SHM_HASH_DEFAULT, 0);
+}
+
+/* #API: |Set shard locking callbacks (call it before sharing the map between threads)|sharded hash map; lock callback; unlock callback; callback context|-|O(1)|1;2| */
+void schm_set_locking(srt_chmap *cm, srt_chmap_lock_f lockf, srt_chmap_lock_f unlockf, void *context);
+
+/* #API: |Number of shards|sharded hash map|number of shards|O(1)|1;2| */
+S_INLINE size_t schm_nshards(const srt_chmap *cm)
+{
+	return cm ? cm->nshards : 0;
+}
+
+/* #API: |Get sharded hash map size|sharded hash map|Number of elements|O(number of shards)|1;2| */
+size_t schm_size(const srt_chmap *cm);
+
+/* #API: |Clear/reset map (keeping map type)|sharded hash map||O(number of shards) for simple maps, O(n) for maps having nodes with strings|1;2| */
+void schm_clear(srt_chmap *cm);
+
+/*
+#API: |Free one or more sharded hash maps|sharded hash map; more sharded hash maps (optional)|-|O(number of shards) for simple maps, O(n) for maps having nodes with strings|1;2|
+void schm_free(srt_chmap **cm, ...)
+*/
+#ifdef S_USE_VA_ARGS
+#define schm_free(...) schm_free_aux(__VA_ARGS__, S_INVALID_PTR_VARG_TAIL)
+#else
+#define schm_free(cm) schm_free_aux(cm, S_INVALID_PTR_VARG_TAIL)
+#endif
+void schm_free_aux(srt_chmap **cm, ...);
+
+/*
+ * Random access
+ */
+
+/* #API: |Access to int32:int32 map|sharded hash map; int32 key|int32|O(n), O(1) average amortized|1;2| */
+int32_t schm_at_ii32(const srt_chmap *cm, int32_t k);
+
+/* #API: |Access to uint32:uint32 map|sharded hash map; uint32 key|uint32|O(n), O(1) average amortized|1;2| */
+uint32_t schm_at_uu32(const srt_chmap *cm, uint32_t k);
+
+/* #API: |Access to int64_t:int64_t map|sharded hash map; integer key|integer|O(n), O(1) average amortized|1;2| */
+int64_t schm_at_ii(const srt_chmap *cm, int64_t k);
+
+/* #API: |Access to integer-string map (the value is copied, as the stored one could be changed by other thread after the call)|sharded hash map; integer key; output string (empty if not found)|output string|O(n), O(1) average amortized|1;2| */
+srt_string *schm_at_is(const srt_chmap *cm, int64_t k, srt_string **v);
+
+/* #API: |Access to integer-pointer map|sharded hash map; integer key|pointer|O(n), O(1) average amortized|1;2| */
+const void *schm_at_ip(const srt_chmap *cm, int64_t k);
+
+/* #API: |Access to string-integer map|sharded hash map; string key|integer|O(n), O(1) average amortized|1;2| */
+int64_t schm_at_si(const srt_chmap *cm, const srt_string *k);
+
+/* #API: |Access to string-string map (the value is copied, as the stored one could be changed by other thread after the call)|sharded hash map; string key; output string (empty if not found)|output string|O(n), O(1) average amortized|1;2| */
+srt_string *schm_at_ss(const srt_chmap *cm, const srt_string *k, srt_string **v);
+
+/* #API: |Access to string-pointer map|sharded hash map; string key|pointer|O(n), O(1) average amortized|1;2| */
+const void *schm_at_sp(const srt_chmap *cm, const srt_string *k);
+
+/*
+ * Existence check
+ */
+
+/* #API: |Map element count/check|sharded hash map; integer key|S_TRUE: element found; S_FALSE: not in the map|O(n), O(1) average amortized|1;2| */
+size_t schm_count_i(const srt_chmap *cm, int64_t k);
+
+/* #API: |Map element count/check|sharded hash map; string key|S_TRUE: element found; S_FALSE: not in the map|O(n), O(1) average amortized|1;2| */
+size_t schm_count_s(const srt_chmap *cm, const srt_string *k);
+
+/*
+ * Insert
+ */
+
+/* #API: |Insert into int32-int32 map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_insert_ii32(srt_chmap *cm, int32_t k, int32_t v);
+
+/* #API: |Insert into uint32-uint32 map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_insert_uu32(srt_chmap *cm, uint32_t k, uint32_t v);
+
+/* #API: |Insert into int-int map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_insert_ii(srt_chmap *cm, int64_t k, int64_t v);
+
+/* #API: |Insert into int-string map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_insert_is(srt_chmap *cm, int64_t k, const srt_string *v);
+
+/* #API: |Insert into int-pointer map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_insert_ip(srt_chmap *cm, int64_t k, const void *v);
+
+/* #API: |Insert into string-int map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_insert_si(srt_chmap *cm, const srt_string *k, int64_t v);
+
+/* #API: |Insert into string-string map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_insert_ss(srt_chmap *cm, const srt_string *k, const srt_string *v);
+
+/* #API: |Insert into string-pointer map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_insert_sp(srt_chmap *cm, const srt_string *k, const void *v);
+
+/*
+ * Increment
+ */
+
+/* #API: |Increment value into int32-int32 map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_inc_ii32(srt_chmap *cm, int32_t k, int32_t v);
+
+/* #API: |Increment into uint32-uint32 map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_inc_uu32(srt_chmap *cm, uint32_t k, uint32_t v);
+
+/* #API: |Increment into int-int map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_inc_ii(srt_chmap *cm, int64_t k, int64_t v);
+
+/* #API: |Increment into string-int map|sharded hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool schm_inc_si(srt_chmap *cm, const srt_string *k, int64_t v);
+
+/*
+ * Delete
+ */
+
+/* #API: |Delete map element|sharded hash map; integer key|S_TRUE: found and deleted; S_FALSE: not found|O(n), O(1) average amortized|1;2| */
+srt_bool schm_delete_i(srt_chmap *cm, int64_t k);
+
+/* #API: |Delete map element|sharded hash map; string key|S_TRUE: found and deleted; S_FALSE: not found|O(n), O(1) average amortized|1;2| */
+srt_bool schm_delete_s(srt_chmap *cm, const srt_string *k);
+
+/*
+ * Enumeration, with callback helper (shards are enumerated in order, as
+ * a single index space; each shard is locked while being enumerated)
+ */
+
+/* #API: |Enumerate map elements in portions|sharded hash map; index start; index end; callback function; callback function context|Elements processed|O(n)|1;2| */
+size_t schm_itp_ii32(const srt_chmap *cm, size_t begin, size_t end, srt_hmap_it_ii32 f, void *context);
+
+/* #API: |Enumerate map elements in portions|sharded hash map; index start; index end; callback function; callback function context|Elements processed|O(n)|1;2| */
+size_t schm_itp_uu32(const srt_chmap *cm, size_t begin, size_t end, srt_hmap_it_uu32 f, void *context);
+
+/* #API: |Enumerate map elements in portions|sharded hash map; index start; index end; callback function; callback function context|Elements processed|O(n)|1;2| */
+size_t schm_itp_ii(const srt_chmap *cm, size_t begin, size_t end, srt_hmap_it_ii f, void *context);
+
+/* #API: |Enumerate map elements in portions|sharded hash map; index start; index end; callback function; callback function context|Elements processed|O(n)|1;2| */
+size_t schm_itp_is(const srt_chmap *cm, size_t begin, size_t end, srt_hmap_it_is f, void *context);
+
+/* #API: |Enumerate map elements in portions|sharded hash map; index start; index end; callback function; callback function context|Elements processed|O(n)|1;2| */
+size_t schm_itp_ip(const srt_chmap *cm, size_t begin, size_t end, srt_hmap_it_ip f, void *context);
+
+/* #API: |Enumerate map elements in portions|sharded hash map; index start; index end; callback function; callback function context|Elements processed|O(n)|1;2| */
+size_t schm_itp_si(const srt_chmap *cm, size_t begin, size_t end, srt_hmap_it_si f, void *context);
+
+/* #API: |Enumerate map elements in portions|sharded hash map; index start; index end; callback function; callback function context|Elements processed|O(n)|1;2| */
+size_t schm_itp_ss(const srt_chmap *cm, size_t begin, size_t end, srt_hmap_it_ss f, void *context);
+
+/* #API: |Enumerate map elements in portions|sharded hash map; index start; index end; callback function; callback function context|Elements processed|O(n)|1;2| */
+size_t schm_itp_sp(const srt_chmap *cm, size_t begin, size_t end, srt_hmap_it_sp f, void *context);
+
+#ifdef __cplusplus
+} /* extern "C" { */
+#endif
+#endif /* #ifndef SCHMAP_H */
@@ -0,0 +1,273 @@
+/*
+ * sfmap.c
+ *
+ * Frozen (read-only) map handling (Eytzinger layout).
+ *
+ * Observations:
+ * - Memory block: header (64 bytes), keys (n + 1 elements, starting at
+ *   the next cache line), values (n + 1 elements, 8-byte aligned). Both
+ *   arrays use positions 1 to n, position 0 being the "not found" result
+ *   (its value is 0, so a failed lookup needs no special case).
+ * - The search keeps the last position where the walk went left (i.e.
+ *   the lower bound), using a conditional move instead of a branch, and
+ *   checks for the key once, at the end.
+ * - Positions 2^j * i to 2^j * (i + 1) - 1 (the descendants j levels below
+ *   position i) are contiguous: with the key array starting at a cache
+ *   line, the descendants 3 levels below (64-bit keys) or 4 levels below
+ *   (32-bit keys) share one cache line, prefetched on every step.
+ * - Heap-allocated maps are aligned to the cache line, so the allocation
+ *   starts up to 63 bytes before the header ('heap_off').
+ *
+ * Copyright (c) 2015-2019 F. Aragon. All rights reserved.
+ * Released under the BSD 3-Clause License (see the doc/LICENSE)
+ */
+
+#include "sfmap.h"
+#include "saux/scommon.h"
+
+#define SFM_CACHE_LINE 64
+
+/*
+ * Internal functions
+ */
+
+/* Key and value sizes for the supported map types */
+static srt_bool sfm_elem_sizes(int t, size_t *ks, size_t *vs)
+{
+	switch (t) {
+	case SM0_II32:
+	case SM0_UU32:
+		*ks = *vs = sizeof(int32_t);
+		return S_TRUE;
+	case SM0_II:
+		*ks = *vs = sizeof(int64_t);
+		return S_TRUE;
+	case SM0_I32:
+	case SM0_U32:
+		*ks = sizeof(int32_t);
+		*vs = 0;
+		return S_TRUE;
+	case SM0_I:
+		*ks = sizeof(int64_t);
+		*vs = 0;
+		return S_TRUE;
+	default:
+		break;
+	}
+	return S_FALSE;
+}
+
+/* Value array offset and memory block size */
+static void sfm_layout(size_t n, size_t ks, size_t vs, size_t *voff,
+		       size_t *size)
+{
+	*voff = SFM_HDR_SIZE + (((n + 1) * ks + 7) & ~(size_t)7);
+	*size = *voff + (n + 1) * vs;
+}
+
+S_INLINE srt_bool sfm_chk_t(const srt_fmap *f, int t)
+{
+	return f && f->sub_type == t ? S_TRUE : S_FALSE;
+}
+
+S_INLINE void *sfm_keys(srt_fmap *f)
+{
+	return (char *)f + SFM_HDR_SIZE;
+}
+
+S_INLINE const void *sfm_keys_r(const srt_fmap *f)
+{
+	return (const char *)f + SFM_HDR_SIZE;
+}
+
+S_INLINE void *sfm_values(srt_fmap *f)
+{
+	return (char *)f + f->voff;
+}
+
+S_INLINE const void *sfm_values_r(const srt_fmap *f)
+{
+	return (const char *)f + f->voff;
+}
+
+/*
+ * Search: position of the key (0: not found). 'PF': keys per cache line
+ */
+
+#define SFM_BUILD_FIND(FN, T, PF)                                              \
+	static size_t FN(const srt_fmap *f, T k)                               \
+	{                                                                      \
+		const T *K = (const T *)sfm_keys_r(f);                         \
+		size_t i = 1, r = 0, n = (size_t)f->n;                         \
+		while (i <= n) {                                               \
+			S_PREFETCH(K + i * PF);                                \
+			r = K[i] >= k ? i : r;                                 \
+			i = 2 * i + (K[i] < k);                                \
+		}                                                              \
+		return r && K[r] == k ? r : 0;                                 \
+	}
+
+SFM_BUILD_FIND(sfm_find_i32, int32_t, 16)
+SFM_BUILD_FIND(sfm_find_u32, uint32_t, 16)
+SFM_BUILD_FIND(sfm_find_i64, int64_t, 8)
+
+/* Element from the source map, stored at the Eytzinger position 'i' */
+static void sfm_put(srt_fmap *f, size_t i, const srt_map *m, srt_tndx id)
+{
+	void *k = sfm_keys(f), *v = sfm_values(f);
+	switch (f->sub_type) {
+	case SM0_II32:
+		((int32_t *)v)[i] = sm_it_ii32_v(m, id);
+		/* fallthrough */
+	case SM0_I32:
+		((int32_t *)k)[i] = sm_it_i32_k(m, id);
+		break;
+	case SM0_UU32:
+		((uint32_t *)v)[i] = sm_it_uu32_v(m, id);
+		/* fallthrough */
+	case SM0_U32:
+		((uint32_t *)k)[i] = sm_it_u32_k(m, id);
+		break;
+	case SM0_II:
+		((int64_t *)v)[i] = sm_it_ii_v(m, id);
+		/* fallthrough */
+	case SM0_I:
+		((int64_t *)k)[i] = sm_it_i_k(m, id);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Allocation
+ */
+
+srt_fmap *sm_freeze(const srt_map *m)
+{
+	char *raw;
+	srt_fmap *f;
+	srt_map_cursor c;
+	size_t n, ks, vs, voff, size, i, off;
+	RETURN_IF(!m || !sfm_elem_sizes(m->d.sub_type, &ks, &vs), NULL);
+	n = sm_size(m);
+	sfm_layout(n, ks, vs, &voff, &size);
+	raw = (char *)s_malloc(size + SFM_CACHE_LINE - 1);
+	RETURN_IF(!raw, NULL);
+	off = (SFM_CACHE_LINE - ((uintptr_t)raw & (SFM_CACHE_LINE - 1)))
+	      & (SFM_CACHE_LINE - 1);
+	f = (srt_fmap *)(raw + off);
+	memset(f, 0, size);
+	f->magic = SFM_MAGIC;
+	f->version = SFM_VERSION;
+	f->sub_type = m->d.sub_type;
+	f->ksize = (uint8_t)ks;
+	f->vsize = (uint8_t)vs;
+	f->n = n;
+	f->size = size;
+	f->voff = voff;
+	f->heap_off = (uint32_t)off;
+	if (!n)
+		return f;
+	/*
+	 * Sorted elements are stored following the Eytzinger positions
+	 * in-order: the leftmost position first, then the successor of each
+	 * position (leftmost of the right subtree, or the first ancestor
+	 * reached from a left child)
+	 */
+	for (i = 1; 2 * i <= n; i *= 2)
+		;
+	if (sm_cur_seek_ge_i(m, INT64_MIN, &c)) {
+		do {
+			sfm_put(f, i, m, sm_cur_id(m, &c));
+			if (2 * i + 1 <= n) {
+				for (i = 2 * i + 1; 2 * i <= n; i *= 2)
+					;
+			} else {
+				while (i & 1)
+					i >>= 1;
+				i >>= 1;
+			}
+		} while (sm_cur_next(m, &c));
+	}
+	return f;
+}
+
+void sfm_free_aux(srt_fmap **f, ...)
+{
+	va_list ap;
+	srt_fmap **next;
+	va_start(ap, f);
+	next = f;
+	while (!s_varg_tail_ptr_tag(next)) { /* last element tag */
+		if (next && *next) {
+			s_free((char *)*next - (*next)->heap_off);
+			*next = NULL;
+		}
+		next = (srt_fmap **)va_arg(ap, srt_fmap **);
+	}
+	va_end(ap);
+}
+
+/*
+ * Serialization
+ */
+
+const srt_fmap *sfm_ref(const void *buf, size_t buf_size)
+{
+	size_t ks, vs, voff, size;
+	const srt_fmap *f = (const srt_fmap *)buf;
+	RETURN_IF(!buf || ((uintptr_t)buf & 7) || buf_size < SFM_HDR_SIZE,
+		  NULL);
+	RETURN_IF(f->magic != SFM_MAGIC || f->version != SFM_VERSION
+			  || !sfm_elem_sizes(f->sub_type, &ks, &vs)
+			  || f->ksize != ks || f->vsize != vs
+			  || f->n > buf_size / ks,
+		  NULL);
+	sfm_layout((size_t)f->n, ks, vs, &voff, &size);
+	RETURN_IF(f->voff != voff || f->size != size || size > buf_size, NULL);
+	return f;
+}
+
+/*
+ * Random access
+ */
+
+int32_t sfm_at_ii32(const srt_fmap *f, int32_t k)
+{
+	RETURN_IF(!sfm_chk_t(f, SM0_II32), 0);
+	return ((const int32_t *)sfm_values_r(f))[sfm_find_i32(f, k)];
+}
+
+uint32_t sfm_at_uu32(const srt_fmap *f, uint32_t k)
+{
+	RETURN_IF(!sfm_chk_t(f, SM0_UU32), 0);
+	return ((const uint32_t *)sfm_values_r(f))[sfm_find_u32(f, k)];
+}
+
+int64_t sfm_at_ii(const srt_fmap *f, int64_t k)
+{
+	RETURN_IF(!sfm_chk_t(f, SM0_II), 0);
+	return ((const int64_t *)sfm_values_r(f))[sfm_find_i64(f, k)];
+}
+
+/*
+ * Existence check
+ */
+
+srt_bool sfm_count_u(const srt_fmap *f, uint32_t k)
+{
+	RETURN_IF(!sfm_chk_t(f, SM0_UU32) && !sfm_chk_t(f, SM0_U32), S_FALSE);
+	return sfm_find_u32(f, k) ? S_TRUE : S_FALSE;
+}
+
+srt_bool sfm_count_i(const srt_fmap *f, int64_t k)
+{
+	RETURN_IF(!f, S_FALSE);
+	if (f->sub_type == SM0_II || f->sub_type == SM0_I)
+		return sfm_find_i64(f, k) ? S_TRUE : S_FALSE;
+	RETURN_IF((f->sub_type != SM0_II32 && f->sub_type != SM0_I32)
+			  || k < INT32_MIN || k > INT32_MAX,
+		  S_FALSE);
+	return sfm_find_i32(f, (int32_t)k) ? S_TRUE : S_FALSE;
+}
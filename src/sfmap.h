@@ -0,0 +1,145 @@
+#ifndef SFMAP_H
+#define SFMAP_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * sfmap.h
+ *
+ * #SHORTDOC frozen (read-only) map handling (integer keys)
+ *
+ * #DOC Frozen map functions handle read-only copies of integer-key maps
+ * #DOC and sets (sm_freeze()), for data built once and then only read.
+ * #DOC Keys are stored in a sorted array, in Eytzinger order (the layout
+ * #DOC of a complete binary tree in breadth-first order: the children of
+ * #DOC position i are 2i and 2i + 1), with the values in a parallel array.
+ * #DOC There are no child references, and the search is a fixed loop
+ * #DOC without data-dependent branches: the descendants of the next levels
+ * #DOC are contiguous in memory, so they are prefetched a few levels ahead,
+ * #DOC hiding most of the memory latency of a tree walk.
+ * #DOC
+ * #DOC Memory per element is the key and value size only, without the tree
+ * #DOC node header: SM_II uses 16 bytes vs 24 in the map (two thirds),
+ * #DOC SM_II32/SM_UU32 and SMS_I 8 bytes vs 16 (half), and SMS_I32/SMS_U32
+ * #DOC 4 bytes vs 12 (one third), plus a 64-byte header. Ranked maps and
+ * #DOC unused map capacity increase the difference.
+ * #DOC
+ * #DOC A frozen map is a single memory block, with no pointers, so it can
+ * #DOC be written as-is to a file (sfm_get_buffer_r(), sfm_get_buffer_size())
+ * #DOC and used later from memory, e.g. from a memory-mapped file, without
+ * #DOC copying or parsing (sfm_ref()). The format is not portable across
+ * #DOC hosts with different endianness (such buffers are rejected).
+ * #DOC
+ * #DOC
+ * #DOC Supported map modes: SM_II32, SM_UU32, SM_II, SMS_I32, SMS_U32,
+ * #DOC SMS_I (string, pointer and string-value maps are not supported, as
+ * #DOC their elements live outside the map memory block).
+ *
+ * Copyright (c) 2015-2019 F. Aragon. All rights reserved.
+ * Released under the BSD 3-Clause License (see the doc/LICENSE)
+ */
+
+#include "smap.h"
+#include "smset.h"
+
+/*
+ * Structures and types
+ */
+
+#define SFM_MAGIC 0x4d465253 /* "SRFM" (little endian) */
+#define SFM_VERSION 1
+#define SFM_HDR_SIZE 64 /* keys start at the next cache line */
+
+struct S_FMap {		  /* fixed layout (64 bytes, serialized as-is) */
+	uint32_t magic;	  /* SFM_MAGIC */
+	uint8_t version;  /* SFM_VERSION */
+	uint8_t sub_type; /* map type (enum eSM_Type0) */
+	uint8_t ksize;	  /* key size (bytes) */
+	uint8_t vsize;	  /* value size (bytes, 0 for sets) */
+	uint64_t n;	  /* number of elements */
+	uint64_t size;	  /* memory block size (bytes) */
+	uint64_t voff;	  /* value array offset (bytes) */
+	uint32_t heap_off; /* heap allocation: bytes before the header */
+	uint8_t reserved[SFM_HDR_SIZE - 36];
+};
+
+typedef struct S_FMap srt_fmap;
+
+/*
+ * Allocation
+ */
+
+/* #API: |Frozen copy of a map (heap)|map (supported types: SM_II32, SM_UU32, SM_II, SMS_I32, SMS_U32, SMS_I)|frozen map (NULL: not supported map type or not enough memory)|O(n)|1;2| */
+srt_fmap *sm_freeze(const srt_map *m);
+
+/* #API: |Frozen copy of a set (heap)|set (supported types: SMS_I32, SMS_U32, SMS_I)|frozen set (NULL: not supported set type or not enough memory)|O(n)|1;2| */
+S_INLINE srt_fmap *sms_freeze(const srt_set *s)
+{
+	return sm_freeze(s);
+}
+
+/*
+#API: |Free one or more frozen maps (heap; not for sfm_ref() buffers)|frozen map; more frozen maps (optional)|-|O(1)|1;2|
+void sfm_free(srt_fmap **f, ...)
+*/
+#ifdef S_USE_VA_ARGS
+#define sfm_free(...) sfm_free_aux(__VA_ARGS__, S_INVALID_PTR_VARG_TAIL)
+#else
+#define sfm_free(f) sfm_free_aux(f, S_INVALID_PTR_VARG_TAIL)
+#endif
+void sfm_free_aux(srt_fmap **f, ...);
+
+/* #API: |Get frozen map size|frozen map|Number of elements|O(1)|1;2| */
+S_INLINE size_t sfm_size(const srt_fmap *f)
+{
+	return f ? (size_t)f->n : 0;
+}
+
+/*
+ * Serialization
+ */
+
+/* #API: |Frozen map memory block (e.g. for writing it to a file)|frozen map|memory block (NULL: no map)|O(1)|1;2| */
+S_INLINE const void *sfm_get_buffer_r(const srt_fmap *f)
+{
+	return f;
+}
+
+/* #API: |Frozen map memory block size|frozen map|size in bytes|O(1)|1;2| */
+S_INLINE size_t sfm_get_buffer_size(const srt_fmap *f)
+{
+	return f ? (size_t)f->size : 0;
+}
+
+/* #API: |Use a frozen map memory block in place (e.g. a memory-mapped file), after checking it|memory block (8-byte aligned; 64-byte alignment for best performance); memory block size|frozen map, valid while the memory block is (NULL: not a valid frozen map)|O(1)|1;2| */
+const srt_fmap *sfm_ref(const void *buf, size_t buf_size);
+
+/*
+ * Random access
+ */
+
+/* #API: |Access to int32-int32 frozen map|frozen map; key|value (0 if not found)|O(log n)|1;2| */
+int32_t sfm_at_ii32(const srt_fmap *f, int32_t k);
+
+/* #API: |Access to uint32-uint32 frozen map|frozen map; key|value (0 if not found)|O(log n)|1;2| */
+uint32_t sfm_at_uu32(const srt_fmap *f, uint32_t k);
+
+/* #API: |Access to int64-int64 frozen map|frozen map; key|value (0 if not found)|O(log n)|1;2| */
+int64_t sfm_at_ii(const srt_fmap *f, int64_t k);
+
+/*
+ * Existence check
+ */
+
+/* #API: |Frozen map/set element count/check (SM_UU32, SMS_U32)|frozen map; key|S_TRUE: element found; S_FALSE: not found|O(log n)|1;2| */
+srt_bool sfm_count_u(const srt_fmap *f, uint32_t k);
+
+/* #API: |Frozen map/set element count/check (SM_II32, SM_II, SMS_I32, SMS_I)|frozen map; key|S_TRUE: element found; S_FALSE: not found|O(log n)|1;2| */
+srt_bool sfm_count_i(const srt_fmap *f, int64_t k);
+
+#ifdef __cplusplus
+} /* extern "C" { */
+#endif
+
+#endif /* #ifndef SFMAP_H */
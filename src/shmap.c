@@ -11,43 +11,219 @@
 #include "saux/shash.h"
 #include "saux/sstringo.h"
 
+#ifdef S_SHM_STATS
+#include <time.h>
+#endif
+
+#if !defined(_WIN32) && !defined(S_MINIMAL)
+#define SHM_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /*
  * Constants and macros
  */
-#define SHM_MAX_ELEMS 0xffffffff
+#define SHM_MAX_ELEMS ((shm_eloc_t_)-1)
 #define SHM_LOC_EMPTY 0			    /* do not change this */
-#define SHM_REHASH_DEFAULT_THRESHOLD_PCT 90 /* rehash at 90% of buckets */
+#define SHM_TAG_EMPTY 0			    /* do not change this */
+#define SHM_TAG_DEL 1			    /* tombstone (old table) */
 #define shm_void (srt_hmap *)sd_void
+#define shm_ro(hm) ((hm)->d.f.flag1) /* loaded with shm_map_file() */
+
+/*
+ * Bucket tag group scan: 16 tags per step using SSE2, or 8 tags per step
+ * using portable SWAR code. Masks have one bit (SSE2) or one byte (SWAR)
+ * per tag, so the tag offset is the lowest set bit >> SHM_TG_SHIFT.
+ */
+
+#if defined(__SSE2__) && !defined(S_DISABLE_SHM_SIMD)
+#include <emmintrin.h>
+
+#define SHM_TG_SIZE 16
+#define SHM_TG_SHIFT 0
+typedef uint32_t shm_tgm_t;
+
+S_INLINE shm_tgm_t tg_match(const uint8_t *t, uint8_t tag)
+{
+	__m128i g = _mm_loadu_si128((const __m128i *)t);
+	return (shm_tgm_t)_mm_movemask_epi8(
+		_mm_cmpeq_epi8(g, _mm_set1_epi8((char)tag)));
+}
+
+S_INLINE shm_tgm_t tg_empty(const uint8_t *t)
+{
+	return tg_match(t, SHM_TAG_EMPTY);
+}
+
+S_INLINE shm_tgm_t tg_free(const uint8_t *t)
+{
+	__m128i g = _mm_loadu_si128((const __m128i *)t);
+	return (shm_tgm_t)_mm_movemask_epi8(g) ^ 0xffff;
+}
+#else
+#define SHM_TG_SIZE 8
+#define SHM_TG_SHIFT 3
+#define SHM_TG_L7 ((uint64_t)0x7f7f7f7f7f7f7f7fULL)
+#define SHM_TG_H1 ((uint64_t)0x8080808080808080ULL)
+#define SHM_TG_B1 ((uint64_t)0x0101010101010101ULL)
+typedef uint64_t shm_tgm_t;
+
+S_INLINE shm_tgm_t tg_zero(uint64_t v)
+{
+	return ~(((v & SHM_TG_L7) + SHM_TG_L7) | v | SHM_TG_L7);
+}
+
+S_INLINE shm_tgm_t tg_match(const uint8_t *t, uint8_t tag)
+{
+	return tg_zero(S_LD_LE_U64(t) ^ (SHM_TG_B1 * tag));
+}
+
+S_INLINE shm_tgm_t tg_empty(const uint8_t *t)
+{
+	return tg_zero(S_LD_LE_U64(t));
+}
+
+S_INLINE shm_tgm_t tg_free(const uint8_t *t)
+{
+	return ~S_LD_LE_U64(t) & SHM_TG_H1;
+}
+#endif
+
+S_INLINE size_t tg_first(shm_tgm_t m)
+{
+#if (defined(__GNUC__) && __GNUC__ >= 4 || defined(__clang__))               \
+	&& ULONG_MAX > 0xffffffffUL
+	return (size_t)__builtin_ctzl((unsigned long)m) >> SHM_TG_SHIFT;
+#else
+	return slog2_64(m & (~m + 1)) >> SHM_TG_SHIFT;
+#endif
+}
 
 /*
  * Internal functions
  */
 
-S_INLINE size_t h2bid(uint32_t h32, size_t hbits)
+S_INLINE size_t h2bid(shm_hash_t_ h, size_t hbits)
+{
+	return (size_t)(h >> (SHM_HASH_BITS - hbits));
+}
+
+S_INLINE uint8_t h2tag(shm_hash_t_ h)
+{
+	return (uint8_t)(0x80 | ((h ^ (h >> 16)) & 0x7f));
+}
+
+/*
+ * Hash table view: the current one, or the previous one while doing
+ * incremental rehash (same layout, half the buckets)
+ */
+struct SHMTable {
+	struct SHMBucket *b;
+	uint8_t *t;
+	size_t hbits, hmask;
+};
+
+S_INLINE void shm_tbl(struct SHMTable *x, const srt_hmap *hm, srt_bool prev)
+{
+	if (prev) {
+		x->hbits = hm->hbits - 1;
+		x->hmask = hm->hmask >> 1;
+		x->b = (struct SHMBucket *)hm->rh_old;
+	} else {
+		x->hbits = hm->hbits;
+		x->hmask = hm->hmask;
+		x->b = (struct SHMBucket *)shm_get_buckets_r(hm);
+	}
+	x->t = (uint8_t *)(x->b + x->hmask + 1);
+}
+
+static void set_tag(const struct SHMTable *x, size_t l, uint8_t tag)
 {
-	return h32 >> (32 - hbits);
+	size_t n = x->hmask + 1;
+	x->t[l] = tag;
+	/* Tail replica, so tag group loads never wrap */
+	for (l += n; l < n + SHM_TAG_PAD; l += n)
+		x->t[l] = tag;
 }
 
-static srt_bool eq_64(const void *key, const void *node)
+static srt_bool eq_64(const srt_hmap *hm, const void *key, const void *node)
 {
+	(void)hm;
 	return memcmp(key, node, sizeof(int64_t)) ? S_FALSE : S_TRUE;
 }
 
-static srt_bool eq_32(const void *key, const void *node)
+static srt_bool eq_32(const srt_hmap *hm, const void *key, const void *node)
 {
+	(void)hm;
 	return memcmp(key, node, sizeof(int32_t)) ? S_FALSE : S_TRUE;
 }
 
-static srt_bool eq_sso(const void *key, const void *node)
+static srt_bool eq_sso(const srt_hmap *hm, const void *key, const void *node)
 {
+	(void)hm;
 	return sso_eq((const srt_string *)key, (const srt_stringo *)node);
 }
 
-static srt_bool eq_sso1(const void *key, const void *node)
+static srt_bool eq_sso1(const srt_hmap *hm, const void *key, const void *node)
 {
+	(void)hm;
 	return sso1_eq((const srt_string *)key, (const srt_stringo1 *)node);
 }
 
+/*
+ * Generic mode key equality: fixed-size kernels (8, 16, 24, and 32 bytes),
+ * any size, and user callback
+ */
+
+S_INLINE uint64_t eqg_w(const void *key, const void *node, size_t off)
+{
+	return S_LD_U64((const uint8_t *)key + off)
+	       ^ S_LD_U64((const uint8_t *)node + off);
+}
+
+static srt_bool eq_g8(const srt_hmap *hm, const void *key, const void *node)
+{
+	(void)hm;
+	return eqg_w(key, node, 0) ? S_FALSE : S_TRUE;
+}
+
+static srt_bool eq_g16(const srt_hmap *hm, const void *key, const void *node)
+{
+	(void)hm;
+	return (eqg_w(key, node, 0) | eqg_w(key, node, 8)) ? S_FALSE : S_TRUE;
+}
+
+static srt_bool eq_g24(const srt_hmap *hm, const void *key, const void *node)
+{
+	(void)hm;
+	return (eqg_w(key, node, 0) | eqg_w(key, node, 8)
+		| eqg_w(key, node, 16))
+		       ? S_FALSE
+		       : S_TRUE;
+}
+
+static srt_bool eq_g32(const srt_hmap *hm, const void *key, const void *node)
+{
+	(void)hm;
+	return (eqg_w(key, node, 0) | eqg_w(key, node, 8)
+		| eqg_w(key, node, 16) | eqg_w(key, node, 24))
+		       ? S_FALSE
+		       : S_TRUE;
+}
+
+static srt_bool eq_gn(const srt_hmap *hm, const void *key, const void *node)
+{
+	return memcmp(key, node, hm->ksize) ? S_FALSE : S_TRUE;
+}
+
+static srt_bool eq_gu(const srt_hmap *hm, const void *key, const void *node)
+{
+	return hm->geqf(key, node, hm->ksize);
+}
+
 static void shmcb_set_ii32(void *loc, const void *key, const void *value)
 {
 	struct SHMapii *e = (struct SHMapii *)loc;
@@ -179,24 +355,69 @@ static void del_nop(void *node)
 	(void)node;
 }
 
-static uint32_t hash_32(const void *node)
+static shm_hash_t_ hash_32(const srt_hmap *hm, const void *node)
+{
+	return shm_hash_u32(hm, S_LD_U32(node));
+}
+
+static shm_hash_t_ hash_64(const srt_hmap *hm, const void *node)
+{
+	return shm_hash_u64(hm, S_LD_U64(node));
+}
+
+static shm_hash_t_ hash_sx(const srt_hmap *hm, const void *node)
+{
+	return shm_hash_s(hm, sso1_get((const srt_stringo1 *)node));
+}
+
+static shm_hash_t_ hash_ss(const srt_hmap *hm, const void *node)
+{
+	return shm_hash_s(hm, sso_get((const srt_stringo *)node));
+}
+
+/*
+ * Generic mode key hash: 64-bit words are folded, and the result is hashed
+ * as a 64-bit integer key (so the map hash function set applies)
+ */
+
+S_INLINE uint64_t hg_fold(uint64_t acc, const void *node, size_t off)
+{
+	acc = (acc ^ S_LD_U64((const uint8_t *)node + off)) * S_MX64_C1;
+	return acc ^ (acc >> 29);
+}
+
+static shm_hash_t_ hash_g8(const srt_hmap *hm, const void *node)
+{
+	return shm_hash_u64(hm, S_LD_U64(node));
+}
+
+static shm_hash_t_ hash_g16(const srt_hmap *hm, const void *node)
+{
+	return shm_hash_u64(hm, hg_fold(hg_fold(0, node, 0), node, 8));
+}
+
+static shm_hash_t_ hash_g24(const srt_hmap *hm, const void *node)
 {
-	return sh_hash32(S_LD_U32(node));
+	return shm_hash_u64(
+		hm, hg_fold(hg_fold(hg_fold(0, node, 0), node, 8), node, 16));
 }
 
-static uint32_t hash_64(const void *node)
+static shm_hash_t_ hash_g32(const srt_hmap *hm, const void *node)
 {
-	return sh_hash64(S_LD_U64(node));
+	return shm_hash_u64(
+		hm, hg_fold(hg_fold(hg_fold(hg_fold(0, node, 0), node, 8),
+				    node, 16),
+			    node, 24));
 }
 
-static uint32_t hash_sx(const void *node)
+static shm_hash_t_ hash_gn(const srt_hmap *hm, const void *node)
 {
-	return SHM_SHASH(sso1_get((const srt_stringo1 *)node));
+	return shm_hashx_buf(hm->hseed, node, hm->ksize);
 }
 
-static uint32_t hash_ss(const void *node)
+static shm_hash_t_ hash_gu(const srt_hmap *hm, const void *node)
 {
-	return SHM_SHASH(sso_get((const srt_stringo *)node));
+	return hm->ghashf(node, hm->ksize);
 }
 
 static const void *n2key_direct(const void *node)
@@ -214,54 +435,155 @@ static const void *n2key_ss(const void *node)
 	return sso_get((const srt_stringo *)node);
 }
 
-static void aux_reg_hash(srt_hmap *hm, const void *key, uint32_t h32,
-			 uint32_t loc)
-{
-	uint8_t *eloc;
-	size_t bid, l, hmask;
-	struct SHMBucket *b = shm_get_buckets(hm);
-	bid = h2bid(h32, hm->hbits);
-	hmask = hm->hmask;
-	for (l = bid; b[l].loc; l = (l + 1) & hmask)
-		if (b[l].hash == h32) {
-			eloc = shm_get_buffer(hm)
-			       + (b[l].loc - 1) * hm->d.elem_size;
-			if (hm->eqf(key, eloc))
-				goto skip_bucket_inc; /* found, overwrite */
+/* 'key' must not be already in the hash table */
+static void aux_reg_hash(srt_hmap *hm, shm_hash_t_ h, size_t loc)
+{
+	shm_tgm_t m;
+	size_t bid, l;
+	struct SHMTable x;
+	shm_tbl(&x, hm, S_FALSE);
+	bid = h2bid(h, x.hbits);
+	for (l = bid; !(m = tg_free(x.t + l)); l = (l + SHM_TG_SIZE) & x.hmask)
+		;
+	l = (l + tg_first(m)) & x.hmask;
+	x.b[l].loc = (shm_eloc_t_)(loc + 1);
+	x.b[l].hash = h;
+	set_tag(&x, l, h2tag(h));
+}
+
+/*
+ * Register table buckets, starting from bucket 'from', using the stored
+ * hashes (element keys are not read)
+ */
+static void aux_reg_table(srt_hmap *hm, const struct SHMTable *x, size_t from)
+{
+	size_t i;
+	for (i = from; i <= x->hmask; i++)
+		if (x->t[i] & 0x80)
+			aux_reg_hash(hm, x->b[i].hash, x->b[i].loc - 1);
+}
+
+/* Incremental rehash: move up to 'n' buckets from the previous table */
+static void aux_migrate(srt_hmap *hm, size_t n)
+{
+	size_t i = hm->rh_next;
+	struct SHMTable x;
+	shm_tbl(&x, hm, S_TRUE);
+	for (; n > 0 && i <= x.hmask; n--, i++)
+		if (x.t[i] & 0x80)
+			aux_reg_hash(hm, x.b[i].hash, x.b[i].loc - 1);
+	hm->rh_next = i;
+	if (i > x.hmask) {
+		s_free(hm->rh_old);
+		hm->rh_old = NULL;
+	}
+}
+
+/*
+ * Incremental rehash: buckets to migrate per update, being at least the
+ * configured step, and enough for completing the migration before the
+ * table has to grow again (so the growth never has to finish a pending
+ * migration). Right after growing, there are 100 / rh_threshold_pct
+ * previous table buckets per insert left, so the step stays small.
+ */
+static size_t aux_migrate_step(const srt_hmap *hm)
+{
+	size_t sz = shm_size(hm),
+	       todo = ((size_t)hm->hmask >> 1) + 1 - hm->rh_next,
+	       left = hm->rh_threshold > sz ? hm->rh_threshold - sz : 1,
+	       n = (todo + left - 1) / left;
+	return n > hm->rh_step ? n : hm->rh_step;
+}
+
+/* Release the table allocated out of the map memory block, if any */
+static void aux_tbl_free(srt_hmap *hm)
+{
+	if (hm->rh_old) {
+		s_free(hm->rh_old);
+		hm->rh_old = NULL;
+	}
+	if (hm->rh_tbl) {
+		s_free(hm->rh_tbl);
+		hm->rh_tbl = NULL;
+	}
+}
+
+/*
+ * Previous table copy, for rebuilding the table from the bucket hashes
+ * after growing, adjusting element locations for the data rotation done
+ * when growing (first 'rot' elements moved to the tail)
+ */
+static void *aux_save_table(const srt_hmap *hm, size_t rot)
+{
+	size_t i, loc, nb = (size_t)hm->hmask + 1, n = shm_size(hm),
+		       tbs = nb * sizeof(struct SHMBucket);
+	struct SHMBucket *b;
+	const uint8_t *t = shm_get_tags_r(hm);
+	void *o = s_malloc(tbs + nb + SHM_TAG_PAD);
+	RETURN_IF(!o, NULL);
+	memcpy(o, shm_get_buckets_r(hm), tbs);
+	memcpy((uint8_t *)o + tbs, t, nb + SHM_TAG_PAD);
+	if (rot > 0)
+		for (b = (struct SHMBucket *)o, i = 0; i < nb; i++) {
+			if (!(t[i] & 0x80))
+				continue;
+			loc = b[i].loc - 1;
+			loc = loc >= rot ? loc - rot : loc + n - rot;
+			b[i].loc = (shm_eloc_t_)(loc + 1);
 		}
-	b[bid].cnt++;
-skip_bucket_inc:
-	b[l].loc = loc + 1;
-	b[l].hash = h32;
+	return o;
+}
+
+/* Table mask and growth threshold, for the current table bits */
+static void aux_set_hbits(srt_hmap *hm, size_t hbits)
+{
+	size_t nbuckets = (size_t)1 << hbits;
+	hm->hbits = (uint32_t)hbits;
+	hm->hmask = hbits == SHM_HASH_BITS ? (shm_hash_t_)-1
+					   : (shm_hash_t_)(nbuckets - 1);
+	hm->rh_threshold = s_size_t_pct(nbuckets, hm->rh_threshold_pct);
+}
+
+static void aux_reset(srt_hmap *hm)
+{
+	size_t nbuckets = (size_t)1 << hm->hbits;
+	aux_set_hbits(hm, hm->hbits);
+	memset(shm_get_buckets(hm), 0, sizeof(struct SHMBucket) * nbuckets);
+	memset(shm_get_tags(hm), SHM_TAG_EMPTY, nbuckets + SHM_TAG_PAD);
 }
 
 static void aux_rehash(srt_hmap *hm)
 {
-	shm_eloc_t_ i;
+	size_t i;
 	const srt_string *s;
 	uint8_t *data = shm_get_buffer(hm);
-	struct SHMBucket *b = shm_get_buckets(hm);
-	size_t nbuckets, elem_size = hm->d.elem_size, nelems = shm_size(hm);
-	nbuckets = 1 << hm->hbits;
-	hm->hmask = hm->hbits == 32 ? (uint32_t)-1 : (uint32_t)(nbuckets - 1);
-	hm->rh_threshold = s_size_t_pct(nbuckets, hm->rh_threshold_pct);
+	size_t elem_size = hm->d.elem_size, nelems = shm_size(hm);
+	if (hm->rh_old) {
+		s_free(hm->rh_old);
+		hm->rh_old = NULL;
+	}
 	/*
-	 * Reset the hash table buckets, and rehash all elements
+	 * Reset the hash table buckets and tags, and rehash all elements
 	 */
-	memset(b, 0, sizeof(struct SHMBucket) * nbuckets);
+	aux_reset(hm);
+	if (hm->d.sub_type == SHM0_GEN) {
+		for (i = 0; i < nelems; i++, data += elem_size)
+			aux_reg_hash(hm, hm->hashf(hm, data), i);
+		return;
+	}
 	switch (hm->ksize) {
 	case 4:
 		for (i = 0; i < nelems; i++, data += elem_size)
-			aux_reg_hash(hm, data, sh_hash32(S_LD_U32(data)), i);
+			aux_reg_hash(hm, shm_hash_u32(hm, S_LD_U32(data)), i);
 		break;
 	case 8:
 		for (i = 0; i < nelems; i++, data += elem_size)
-			aux_reg_hash(hm, data, sh_hash64(S_LD_U64(data)), i);
+			aux_reg_hash(hm, shm_hash_u64(hm, S_LD_U64(data)), i);
 		break;
 	case 0:
 		for (i = 0; i < nelems; i++, data += elem_size) {
 			s = sso_get((const srt_stringo *)data);
-			aux_reg_hash(hm, s, SHM_SHASH(s), i);
+			aux_reg_hash(hm, shm_hash_s(hm, s), i);
 		}
 		break;
 	default:
@@ -270,33 +592,81 @@ static void aux_rehash(srt_hmap *hm)
 	}
 }
 
-static srt_bool aux_insert_check(srt_hmap **hm)
+/*
+ * Rebuild the table from the source map bucket hashes (same elements, in
+ * the same order, e.g. after a copy), so keys are not read
+ */
+static void aux_rehash_from(srt_hmap *hm, const srt_hmap *src)
 {
-	srt_hmap *h2;
-	size_t h2bits, hs1, hs2, hsd, sxz, sxzm, sz;
-	RETURN_IF(!shm_grow(hm, 1), S_FALSE);
-	sz = shm_size(*hm);
-	/* Check if rehash is not required */
-	if (sz < (*hm)->rh_threshold)
-		return S_TRUE;
-	if ((*hm)->hbits == 32) {
-		(*hm)->rh_threshold = SHM_MAX_ELEMS;
-		RETURN_IF(sz == (*hm)->rh_threshold, S_FALSE);
-		return S_TRUE;
+	struct SHMTable x;
+	if (hm->rh_old) {
+		s_free(hm->rh_old);
+		hm->rh_old = NULL;
 	}
-	/* Rehash required: realloc for twice the bucket size */
-	if ((*hm)->d.f.ext_buffer) {
-		S_ERROR("out of memory on fixed-size allocated space");
-		shm_set_alloc_errors(*hm);
-		return S_FALSE;
+	aux_reset(hm);
+	shm_tbl(&x, src, S_FALSE);
+	aux_reg_table(hm, &x, 0);
+	if (src->rh_old) {
+		/* Buckets not migrated yet */
+		shm_tbl(&x, src, S_TRUE);
+		aux_reg_table(hm, &x, src->rh_next);
+	}
+}
+
+/*
+ * Grow the table kept out of the map memory block (incremental rehash
+ * mode): the new table is allocated zeroed (empty buckets and tags), so
+ * the elements are not moved and the table is not initialized here. When
+ * doubling the size, the previous table is migrated in steps by the
+ * following updates; otherwise it is registered at once.
+ */
+static srt_bool aux_grow_tbl(srt_hmap *hm, size_t h2bits)
+{
+	struct SHMTable x;
+	void *t;
+	/* Previous migration, if not completed yet (e.g. shm_reserve()) */
+	if (hm->rh_old)
+		aux_migrate(hm, S_NPOS);
+	t = s_calloc(1, sh_tbl_size((size_t)1 << h2bits));
+	RETURN_IF(!t, S_FALSE); /* Not enough memory */
+	shm_tbl(&x, hm, S_FALSE);
+	hm->rh_tbl = t;
+	aux_set_hbits(hm, h2bits);
+	if (hm->rh_step && h2bits == x.hbits + 1) {
+		hm->rh_old = x.b;
+		hm->rh_next = 0;
+	} else {
+		aux_reg_table(hm, &x, 0);
+		s_free(x.b);
 	}
+	return S_TRUE;
+}
+
+/*
+ * Grow the table stored after the map header, moving the elements for
+ * making room for the bigger header. If 'use_hashes' is set, the new table
+ * is built from the previous table bucket hashes.
+ */
+static srt_bool aux_grow_blk(srt_hmap **hm, size_t h2bits,
+			     srt_bool use_hashes)
+{
+	srt_hmap *h2;
+	void *old = NULL;
+	struct SHMTable x;
+	size_t hs1, hs2, hsd, sxz, sxzm, h1bits = (*hm)->hbits;
 	sxz = shm_size(*hm) * (*hm)->d.elem_size;
 	sxzm = shm_max_size(*hm) * (*hm)->d.elem_size;
 	hs1 = (*hm)->d.header_size;
-	h2bits = (*hm)->hbits + 1;
-	hs2 = sh_hdr_size((*hm)->d.sub_type, 1 << h2bits);
+	hs2 = sh_hdr_size_es((*hm)->d.elem_size, (size_t)1 << h2bits);
+	hsd = hs2 - hs1;
+	if (use_hashes) /* If not enough memory, fall back to full rehash */
+		old = aux_save_table(*hm,
+				     sxz > hsd ? hsd / (*hm)->d.elem_size : 0);
 	h2 = (srt_hmap *)s_realloc(*hm, hs2 + sxzm);
-	RETURN_IF(!h2, S_FALSE); /* Not enough memory */
+	if (!h2) { /* Not enough memory */
+		s_free(old);
+		return S_FALSE;
+	}
 	*hm = h2;
 #if 1
 	/*
@@ -313,7 +683,6 @@ static srt_bool aux_insert_check(srt_hmap **hm)
 	 *                                        <-- ds1'-->
 	 */
 	/* move ds1 from the head, to the tail */
-	hsd = hs2 - hs1;
 	if (sxz <= hsd)
 		memmove((uint8_t *)h2 + hs2, (uint8_t *)h2 + hs1, sxz);
 	else
@@ -325,152 +694,474 @@ static srt_bool aux_insert_check(srt_hmap **hm)
 	/* Reconfigure the data structure */
 	h2->d.header_size = hs2;
 	h2->hbits = (uint32_t)h2bits;
-	/* Rehash elements */
-	aux_rehash(h2);
+	if (old) {
+		/* Register the previous table buckets */
+		aux_reset(h2);
+		x.hbits = h1bits;
+		x.hmask = ((size_t)1 << h1bits) - 1;
+		x.b = (struct SHMBucket *)old;
+		x.t = (uint8_t *)(x.b + x.hmask + 1);
+		aux_reg_table(h2, &x, 0);
+		s_free(old);
+	} else {
+		/* Rehash elements */
+		aux_rehash(h2);
+	}
 	return S_TRUE;
 }
 
-S_INLINE srt_bool shm_chk_t(const srt_hmap *h, int t)
+/* Grow the hash table to 'h2bits' bits (more than the current ones) */
+static srt_bool aux_grow_table(srt_hmap **hm, size_t h2bits,
+			       srt_bool use_hashes)
 {
-	return h && h->d.sub_type == t ? S_TRUE : S_FALSE;
+	srt_bool r;
+#ifdef S_SHM_STATS
+	clock_t c0 = clock();
+#endif
+	if ((*hm)->d.f.ext_buffer) {
+		S_ERROR("out of memory on fixed-size allocated space");
+		shm_set_alloc_errors(*hm);
+		return S_FALSE;
+	}
+	r = (*hm)->rh_tbl ? aux_grow_tbl(*hm, h2bits)
+			  : aux_grow_blk(hm, h2bits, use_hashes);
+	RETURN_IF(!r, S_FALSE);
+	(*hm)->st_rehashes++;
+#ifdef S_SHM_STATS
+	(*hm)->st_rehash_clk += (uint64_t)(clock() - c0);
+#endif
+	return S_TRUE;
 }
 
-typedef uint32_t (*hash_f)(const void *data);
-
-/* 'hm' already checked externally */
-const void *shm_at(const srt_hmap *hm, uint32_t h, const void *key,
-		   uint32_t *tl)
-{
-	const uint8_t *data, *eloc;
-	size_t bid = h2bid(h, hm->hbits), eoff, es, hbits, hcnt, hmask, hmax, l;
-	const struct SHMBucket *b = shm_get_buckets_r(hm);
-	RETURN_IF(!b[bid].cnt, NULL); /* Hash not in the HT */
-	hmax = b[bid].cnt;
-	data = shm_get_buffer_r(hm);
-	es = hm->d.elem_size;
-	hmask = hm->hmask;
-	hbits = hm->hbits;
-	for (hcnt = 0, l = bid; hcnt < hmax; l = (l + 1) & hmask) {
-		if (b[l].loc == SHM_LOC_EMPTY || h2bid(b[l].hash, hbits) != bid)
-			continue;
-		/* Possible match */
-		hcnt++;
-		if (b[l].hash == h) {
-			eoff = b[l].loc - 1;
-			eloc = data + eoff * es;
-			if (hm->eqf(key, eloc)) {
-				if (tl)
-					*tl = (uint32_t)l;
-				return eloc;
-			}
-		}
+static srt_bool aux_insert_check(srt_hmap **hm)
+{
+	size_t sz;
+	RETURN_IF(!shm_grow(hm, 1), S_FALSE);
+	if ((*hm)->rh_old)
+		aux_migrate(*hm, aux_migrate_step(*hm));
+	sz = shm_size(*hm);
+	/* Check if rehash is not required */
+	if (sz < (*hm)->rh_threshold)
+		return S_TRUE;
+	if ((*hm)->hbits == SHM_MAX_HBITS) {
+		(*hm)->rh_threshold = SHM_MAX_ELEMS;
+		RETURN_IF(sz == (*hm)->rh_threshold, S_FALSE);
+		return S_TRUE;
 	}
-	return NULL;
+	/*
+	 * Rehash required: twice the bucket size. String keys: the new table
+	 * is built from the previous table bucket hashes, instead of reading
+	 * all keys.
+	 */
+	return aux_grow_table(hm, (*hm)->hbits + 1, !(*hm)->ksize);
 }
 
-static srt_bool del(srt_hmap *hm, uint32_t h, const void *key)
+/*
+ * Reserve space for 'n' elements, growing the hash table at once (instead
+ * of one doubling at a time), reusing the bucket hashes
+ */
+static srt_bool aux_presize(srt_hmap **hm, size_t n)
+{
+	size_t h2bits = (*hm)->hbits;
+	RETURN_IF(shm_reserve(hm, n) < n, S_FALSE);
+	while (h2bits < SHM_MAX_HBITS
+	       && s_size_t_pct((size_t)1 << h2bits, (*hm)->rh_threshold_pct)
+			  <= n)
+		h2bits++;
+	if (h2bits == (*hm)->hbits)
+		return S_TRUE;
+	return aux_grow_table(hm, h2bits, S_TRUE);
+}
+
+S_INLINE srt_bool shm_chk_t(const srt_hmap *h, int t)
 {
-	struct SHMBucket *b;
-	const uint8_t *tloc;
-	uint32_t ht, l0, tl = 0;
-	size_t bid, e_off, es, hcnt, hmax, l, ss, hbits, hmask;
-	uint8_t *data, *dloc, *hole, *tail;
-	RETURN_IF(!hm, S_FALSE);
-	hbits = hm->hbits;
-	bid = h2bid(h, hbits);
-	b = shm_get_buckets(hm);
-	RETURN_IF(!b[bid].cnt, S_FALSE); /* Hash not in the HT */
-	hmax = b[bid].cnt;
-	data = shm_get_buffer(hm);
+	return h && h->d.sub_type == t ? S_TRUE : S_FALSE;
+}
+
+S_INLINE size_t aux_find(const srt_hmap *hm, const struct SHMTable *x,
+			shm_hash_t_ h, const void *key)
+{
+	shm_tgm_t m;
+	const uint8_t *data;
+	uint8_t tag = h2tag(h);
+	size_t es, i, l, s;
+	data = shm_get_buffer_r(hm);
 	es = hm->d.elem_size;
-	hmask = hm->hmask;
-	for (hcnt = 0, l = bid; hcnt < hmax; l = (l + 1) & hmask) {
-		if (b[l].loc == SHM_LOC_EMPTY || h2bid(b[l].hash, hbits) != bid)
-			continue;
-		/* Possible match */
-		hcnt++;
-		if (b[l].hash == h) {
-			e_off = b[l].loc - 1;
-			dloc = data + e_off * es;
-			if (hm->eqf(key, dloc)) {
-				l0 = b[l].loc;
-				b[bid].cnt--;
-				b[l].loc = 0;
-				hm->delf(dloc);
-				/* Fill the hole with the latest elem */
-				ss = shm_size(hm);
-				if (ss > 1 && ss != l0) {
-					hole = data + e_off * es;
-					tail = data + (ss - 1) * es;
-					ht = hm->hashf(tail);
-					tloc = (const uint8_t *)shm_at(
-						hm, ht, hm->n2kf(tail), &tl);
-					(void)tloc;
-#if 0
-					/*
-					 * This should never happen. Otherwise
-					 * it would mean memory corruption.
-					 */
-					if (tloc != tail || b[tl].loc == l0)
-						abort();
+	l = h2bid(h, x->hbits);
+	for (i = 0; i <= x->hmask; i += SHM_TG_SIZE) {
+#ifdef S_SHM_STATS
+		((srt_hmap *)hm)->st_probes++; /* CONSTNESS */
 #endif
-					memcpy(hole, tail, es);
-					b[tl].loc = l0;
-				}
-				shm_set_size(hm, ss - 1);
-				return S_TRUE;
-			}
+		for (m = tg_match(x->t + l, tag); m; m &= m - 1) {
+			s = (l + tg_first(m)) & x->hmask;
+			/* Possible match */
+			if (x->b[s].hash == h
+			    && hm->eqf(hm, key, data + (x->b[s].loc - 1) * es))
+				return s;
 		}
+		/* An empty bucket terminates the probe sequence */
+		if (tg_empty(x->t + l))
+			break;
+		l = (l + SHM_TG_SIZE) & x->hmask;
 	}
-	return S_FALSE;
+	return S_NPOS;
 }
 
-S_INLINE void shm_tsetup(srt_hmap *h, int t)
+/* Current table lookup, and previous one, if migrating */
+S_INLINE size_t aux_lookup(const srt_hmap *hm, shm_hash_t_ h, const void *key,
+			   struct SHMTable *x)
 {
-	switch (t) {
-	case SHM0_I32:
-	case SHM0_U32:
-	case SHM0_II32:
-	case SHM0_UU32:
-		h->ksize = 4;
-		h->eqf = eq_32;
-		h->delf = del_nop;
-		h->hashf = hash_32;
-		h->n2kf = n2key_direct;
-		break;
-	case SHM0_I:
-	case SHM0_II:
-	case SHM0_IS:
-	case SHM0_IP:
-		h->ksize = 8;
-		h->eqf = eq_64;
-		h->delf = t == SHM0_IS ? del_is : del_nop;
-		h->hashf = hash_64;
-		h->n2kf = n2key_direct;
-		break;
-	case SHM0_SI:
-	case SHM0_SP:
-	case SHM0_S:
-		h->ksize = 0;
-		h->eqf = eq_sso1;
-		h->delf = del_sx;
-		h->hashf = hash_sx;
-		h->n2kf = n2key_sx;
-		break;
-	case SHM0_SS:
-		h->ksize = 0;
-		h->eqf = eq_sso;
-		h->delf = del_ss;
-		h->hashf = hash_ss;
-		h->n2kf = n2key_ss;
-		break;
-	default:
-		break;
+	size_t l;
+	shm_tbl(x, hm, S_FALSE);
+	l = aux_find(hm, x, h, key);
+	if (l == S_NPOS && hm->rh_old) {
+		shm_tbl(x, hm, S_TRUE);
+		l = aux_find(hm, x, h, key);
 	}
+	return l;
 }
 
 /*
- * Public functions
+ * Cache mode: eviction data (CLOCK: reference byte per element; LRU: list
+ * links per element)
+ */
+
+S_INLINE uint8_t *aux_cref(srt_hmap *hm)
+{
+	return (uint8_t *)hm + hm->c_off + sh_cache_state_size();
+}
+
+S_INLINE struct SHMCacheLink *aux_clnk(srt_hmap *hm)
+{
+	return (struct SHMCacheLink *)aux_cref(hm);
+}
+
+static void aux_cache_reset(srt_hmap *hm)
+{
+	struct SHMCache *c = shm_get_cache(hm);
+	c->hand = c->mru = 0;
+}
+
+/* LRU: link element 'i' neighbors to it (e.g. after moving it) */
+static void aux_lru_relink(srt_hmap *hm, size_t i)
+{
+	struct SHMCacheLink *k = aux_clnk(hm);
+	struct SHMCache *c = shm_get_cache(hm);
+	if (k[i].prev)
+		k[k[i].prev - 1].next = (shm_eloc_t_)(i + 1);
+	else
+		c->hand = i + 1;
+	if (k[i].next)
+		k[k[i].next - 1].prev = (shm_eloc_t_)(i + 1);
+	else
+		c->mru = i + 1;
+}
+
+static void aux_lru_unlink(srt_hmap *hm, size_t i)
+{
+	struct SHMCacheLink *k = aux_clnk(hm);
+	struct SHMCache *c = shm_get_cache(hm);
+	if (k[i].prev)
+		k[k[i].prev - 1].next = k[i].next;
+	else
+		c->hand = k[i].next;
+	if (k[i].next)
+		k[k[i].next - 1].prev = k[i].prev;
+	else
+		c->mru = k[i].prev;
+}
+
+/* LRU: element 'i' becomes the most recently used one */
+static void aux_lru_push(srt_hmap *hm, size_t i)
+{
+	struct SHMCacheLink *k = aux_clnk(hm);
+	struct SHMCache *c = shm_get_cache(hm);
+	k[i].prev = (shm_eloc_t_)c->mru;
+	k[i].next = 0;
+	if (c->mru)
+		k[c->mru - 1].next = (shm_eloc_t_)(i + 1);
+	else
+		c->hand = i + 1;
+	c->mru = i + 1;
+}
+
+/* Element 'i' used (found or updated) */
+S_INLINE void aux_cache_touch(srt_hmap *hm, size_t i)
+{
+	const struct SHMCache *c = shm_get_cache_r(hm);
+	if (c->policy == SHM_EVICT_LRU) {
+		if (c->mru != i + 1) {
+			aux_lru_unlink(hm, i);
+			aux_lru_push(hm, i);
+		}
+	} else {
+		aux_cref(hm)[i] = 1;
+	}
+}
+
+/* New element 'i' */
+S_INLINE void aux_cache_add(srt_hmap *hm, size_t i)
+{
+	if (shm_get_cache_r(hm)->policy == SHM_EVICT_LRU)
+		aux_lru_push(hm, i);
+	else
+		aux_cref(hm)[i] = 0;
+}
+
+/* Element 'i' deleted, being the last one ('tail') moved to its place */
+static void aux_cache_del(srt_hmap *hm, size_t i, size_t tail)
+{
+	if (shm_get_cache_r(hm)->policy == SHM_EVICT_LRU) {
+		aux_lru_unlink(hm, i);
+		if (i != tail) {
+			aux_clnk(hm)[i] = aux_clnk(hm)[tail];
+			aux_lru_relink(hm, i);
+		}
+	} else if (i != tail) {
+		aux_cref(hm)[i] = aux_cref(hm)[tail];
+	}
+}
+
+/* 'hm' already checked externally; no cache mode accounting */
+static uint8_t *aux_at(const srt_hmap *hm, shm_hash_t_ h, const void *key)
+{
+	struct SHMTable x;
+	size_t l = aux_lookup(hm, h, key, &x);
+	RETURN_IF(l == S_NPOS, NULL);
+	return (uint8_t *)shm_get_buffer_r(hm) /* CONSTNESS */
+	       + (x.b[l].loc - 1) * hm->d.elem_size;
+}
+
+/* 'hm' already checked externally */
+const void *shm_at(const srt_hmap *hm, shm_hash_t_ h, const void *key,
+		   size_t *tl)
+{
+	struct SHMTable x;
+	srt_hmap *hmc;
+	size_t l = aux_lookup(hm, h, key, &x);
+	if (hm->c_off) {
+		/* Cache mode: lookups update the eviction data and stats */
+		hmc = (srt_hmap *)hm; /* CONSTNESS */
+		if (l == S_NPOS) {
+			shm_get_cache(hmc)->misses++;
+		} else {
+			shm_get_cache(hmc)->hits++;
+			aux_cache_touch(hmc, x.b[l].loc - 1);
+		}
+	}
+	RETURN_IF(l == S_NPOS, NULL);
+	if (tl)
+		*tl = l;
+	return shm_get_buffer_r(hm) + (x.b[l].loc - 1) * hm->d.elem_size;
+}
+
+/*
+ * Batch lookup, in three passes, so cache misses overlap: prefetch tag
+ * groups and home buckets; prefetch the first fingerprint match element;
+ * resolve
+ */
+static void aux_at_batch(const srt_hmap *hm, size_t n, const shm_hash_t_ *h,
+			 const void **k, const uint8_t **e)
+{
+	shm_tgm_t m;
+	size_t j, l, es = hm->d.elem_size;
+	struct SHMTable x;
+	const uint8_t *data = shm_get_buffer_r(hm);
+	shm_tbl(&x, hm, S_FALSE);
+	for (j = 0; j < n; j++) {
+		l = h2bid(h[j], x.hbits);
+		S_PREFETCH(x.t + l);
+		S_PREFETCH(x.b + l);
+	}
+	for (j = 0; j < n; j++) {
+		l = h2bid(h[j], x.hbits);
+		m = tg_match(x.t + l, h2tag(h[j]));
+		if (m) {
+			l = (l + tg_first(m)) & x.hmask;
+			if (x.b[l].hash == h[j])
+				S_PREFETCH(data + (x.b[l].loc - 1) * es);
+		}
+	}
+	for (j = 0; j < n; j++) {
+		l = aux_lookup(hm, h[j], k[j], &x);
+		e[j] = l == S_NPOS ? NULL : data + (x.b[l].loc - 1) * es;
+	}
+}
+
+/*
+ * Backward-shift deletion: the following buckets of the probe sequence are
+ * moved back to the freed one, if reachable from their home bucket, until
+ * an empty bucket is found. This way no tombstones are left, and probe
+ * distances are the same as if the deleted element had never been inserted
+ */
+static void aux_shift_back(const struct SHMTable *x, size_t l)
+{
+	size_t j = l, home;
+	for (;;) {
+		j = (j + 1) & x->hmask;
+		if (x->t[j] == SHM_TAG_EMPTY)
+			break;
+		home = h2bid(x->b[j].hash, x->hbits);
+		if (((j - home) & x->hmask) < ((j - l) & x->hmask))
+			continue; /* freed bucket is before the home bucket */
+		x->b[l].loc = x->b[j].loc;
+		x->b[l].hash = x->b[j].hash;
+		set_tag(x, l, x->t[j]);
+		l = j;
+	}
+	x->b[l].loc = SHM_LOC_EMPTY;
+	set_tag(x, l, SHM_TAG_EMPTY);
+}
+
+static srt_bool del(srt_hmap *hm, shm_hash_t_ h, const void *key)
+{
+	struct SHMTable x;
+	shm_eloc_t_ l0;
+	size_t es, l, ss;
+	uint8_t *data, *hole, *tail;
+	RETURN_IF(!hm || shm_ro(hm), S_FALSE);
+	if (hm->rh_old)
+		aux_migrate(hm, aux_migrate_step(hm));
+	l = aux_lookup(hm, h, key, &x);
+	RETURN_IF(l == S_NPOS, S_FALSE);
+	data = shm_get_buffer(hm);
+	es = hm->d.elem_size;
+	l0 = x.b[l].loc;
+	hole = data + (l0 - 1) * es;
+	if (x.b == shm_get_buckets(hm)) {
+		aux_shift_back(&x, l);
+	} else {
+		/*
+		 * Previous table (incremental rehash): tombstone, as shifting
+		 * could move buckets behind the migration point
+		 */
+		x.b[l].loc = SHM_LOC_EMPTY;
+		set_tag(&x, l, SHM_TAG_DEL);
+	}
+	hm->delf(hole);
+	/* Fill the hole with the latest elem */
+	ss = shm_size(hm);
+	if (hm->c_off)
+		aux_cache_del(hm, l0 - 1, ss - 1);
+	if (ss > 1 && ss != l0) {
+		tail = data + (ss - 1) * es;
+		l = aux_lookup(hm, hm->hashf(hm, tail), hm->n2kf(tail), &x);
+		if (l != S_NPOS)
+			x.b[l].loc = l0;
+		memcpy(hole, tail, es);
+	}
+	shm_set_size(hm, ss - 1);
+	return S_TRUE;
+}
+
+/* Cache mode: evict one element */
+static void aux_cache_evict(srt_hmap *hm)
+{
+	size_t i, n = shm_size(hm);
+	struct SHMCache *c = shm_get_cache(hm);
+	uint8_t *r, *e;
+	if (!n)
+		return;
+	if (c->policy == SHM_EVICT_LRU) {
+		i = c->hand - 1;
+	} else {
+		/* Second chance: clear marks until an unmarked element */
+		r = aux_cref(hm);
+		for (i = c->hand;; i++) {
+			if (i >= n)
+				i = 0;
+			if (!r[i])
+				break;
+			r[i] = 0;
+		}
+		c->hand = i;
+	}
+	e = shm_get_buffer(hm) + i * hm->d.elem_size;
+	if (del(hm, hm->hashf(hm, e), hm->n2kf(e)))
+		c->evictions++;
+}
+
+S_INLINE void shm_tsetup(srt_hmap *h, int t)
+{
+	shm_hash_f hf;
+	shm_eq_f ef;
+	switch (t) {
+	case SHM0_I32:
+	case SHM0_U32:
+	case SHM0_II32:
+	case SHM0_UU32:
+		h->ksize = 4;
+		h->eqf = eq_32;
+		h->delf = del_nop;
+		h->hashf = hash_32;
+		h->n2kf = n2key_direct;
+		break;
+	case SHM0_I:
+	case SHM0_II:
+	case SHM0_IS:
+	case SHM0_IP:
+		h->ksize = 8;
+		h->eqf = eq_64;
+		h->delf = t == SHM0_IS ? del_is : del_nop;
+		h->hashf = hash_64;
+		h->n2kf = n2key_direct;
+		break;
+	case SHM0_SI:
+	case SHM0_SP:
+	case SHM0_S:
+		h->ksize = 0;
+		h->eqf = eq_sso1;
+		h->delf = del_sx;
+		h->hashf = hash_sx;
+		h->n2kf = n2key_sx;
+		break;
+	case SHM0_SS:
+		h->ksize = 0;
+		h->eqf = eq_sso;
+		h->delf = del_ss;
+		h->hashf = hash_ss;
+		h->n2kf = n2key_ss;
+		break;
+	case SHM0_GEN:
+		h->delf = del_nop;
+		h->n2kf = n2key_direct;
+		/* User callbacks, if any, take precedence */
+		hf = h->ghashf ? hash_gu : NULL;
+		ef = h->geqf ? eq_gu : NULL;
+		switch (h->ksize) {
+		case 8:
+			h->hashf = hash_g8;
+			h->eqf = eq_g8;
+			break;
+		case 16:
+			h->hashf = hash_g16;
+			h->eqf = eq_g16;
+			break;
+		case 24:
+			h->hashf = hash_g24;
+			h->eqf = eq_g24;
+			break;
+		case 32:
+			h->hashf = hash_g32;
+			h->eqf = eq_g32;
+			break;
+		default:
+			h->hashf = hash_gn;
+			h->eqf = eq_gn;
+			break;
+		}
+		if (hf)
+			h->hashf = hf;
+		if (ef)
+			h->eqf = ef;
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Public functions
  */
 
 srt_hmap *shm_alloc_raw(int t, srt_bool ext_buf, void *buffer, size_t hdr_size,
@@ -482,9 +1173,21 @@ srt_hmap *shm_alloc_raw(int t, srt_bool ext_buf, void *buffer, size_t hdr_size,
 	sd_reset((srt_data *)h, hdr_size, elem_size, max_size, ext_buf,
 		 S_FALSE);
 	h->d.sub_type = (uint8_t)t;
+	h->ksize = h->vsize = 0;
+	h->ghashf = NULL;
+	h->geqf = NULL;
 	shm_tsetup(h, t);
 	h->rh_threshold_pct = SHM_REHASH_DEFAULT_THRESHOLD_PCT;
 	h->hbits = (uint32_t)hbits;
+	h->rh_step = h->rh_next = 0;
+	h->rh_old = h->rh_tbl = NULL;
+	h->htype = SHM_HASH_DEFAULT;
+	h->hseed = 0;
+	h->c_off = 0;
+	h->st_rehashes = 0;
+#ifdef S_SHM_STATS
+	h->st_probes = h->st_rehash_clk = 0;
+#endif
 	aux_rehash(h);
 	return h;
 }
@@ -492,7 +1195,7 @@ srt_hmap *shm_alloc_raw(int t, srt_bool ext_buf, void *buffer, size_t hdr_size,
 srt_hmap *shm_alloc_aux(int t, size_t init_size)
 {
 	size_t elem_size = shm_elem_size(t), hbits = shm_s2hb(init_size),
-	       hs = sh_hdr_size(t, 1 << hbits),
+	       hs = sh_hdr_size(t, (size_t)1 << hbits),
 	       as = sd_alloc_size_raw(hs, elem_size, init_size, S_FALSE);
 	void *buf = s_malloc(as);
 	srt_hmap *h =
@@ -502,11 +1205,125 @@ srt_hmap *shm_alloc_aux(int t, size_t init_size)
 	return h;
 }
 
+srt_hmap *shm_alloc_gen(size_t key_size, size_t value_size, srt_hmap_hash_f hf,
+			srt_hmap_eq_f eqf, size_t init_size)
+{
+	size_t elem_size = shm_gen_elem_size(key_size, value_size),
+	       hbits = shm_s2hb(init_size),
+	       hs = sh_hdr_size_es(elem_size, (size_t)1 << hbits),
+	       as = sd_alloc_size_raw(hs, elem_size, init_size, S_FALSE);
+	void *buf;
+	srt_hmap *h;
+	RETURN_IF(!key_size || key_size > 0xffff || value_size > 0xffff,
+		  shm_void);
+	buf = s_malloc(as);
+	h = shm_alloc_raw(SHM0_GEN, S_FALSE, buf, hs, elem_size, init_size,
+			  hbits);
+	if (!h || h == shm_void) {
+		s_free(buf);
+		return h;
+	}
+	h->ksize = (uint32_t)key_size;
+	h->vsize = (uint32_t)value_size;
+	h->ghashf = hf;
+	h->geqf = eqf;
+	shm_tsetup(h, SHM0_GEN);
+	return h;
+}
+
+srt_hmap *shm_alloc_cache_raw(int t, srt_bool ext_buf, void *buffer,
+			      size_t capacity, enum eSHM_Evict p)
+{
+	srt_hmap *h;
+	struct SHMCache *c;
+	size_t co, es = shm_elem_size(t), hs;
+	RETURN_IF(!capacity || capacity >= SHM_MAX_ELEMS
+			  || (p != SHM_EVICT_CLOCK && p != SHM_EVICT_LRU),
+		  shm_void);
+	hs = sh_hdr_size_cache(es, capacity, p, &co);
+	h = shm_alloc_raw(t, ext_buf, buffer, hs, es, capacity,
+			  shm_cache_hbits(capacity));
+	if (!h || h == shm_void)
+		return h;
+	h->c_off = co;
+	c = shm_get_cache(h);
+	c->cap = capacity;
+	c->hand = c->mru = 0;
+	c->hits = c->misses = c->evictions = 0;
+	c->policy = (uint32_t)p;
+	return h;
+}
+
+srt_hmap *shm_alloc_cache(enum eSHM_Type t, size_t capacity,
+			  enum eSHM_Evict p)
+{
+	void *buf = s_malloc(shm_cache_alloc_size((int)t, capacity, p));
+	srt_hmap *h = shm_alloc_cache_raw((int)t, S_FALSE, buf, capacity, p);
+	if (!h || h == shm_void)
+		s_free(buf);
+	return h;
+}
+
+/*
+ * Incremental rehash mode: move the table out of the map memory block, so
+ * growing it does not move the elements (cache and fixed-size allocated
+ * maps do not grow the table)
+ */
+static srt_bool aux_tbl_out(srt_hmap *hm)
+{
+	void *t;
+	size_t es = hm->d.elem_size, hs1 = hm->d.header_size, hs2,
+	       ts = sh_tbl_size((size_t)hm->hmask + 1);
+	if (hm->rh_tbl || hm->c_off || hm->d.f.ext_buffer)
+		return S_TRUE;
+	t = s_malloc(ts);
+	RETURN_IF(!t, S_FALSE);
+	memcpy(t, shm_get_tbl_r(hm), ts);
+	hm->rh_tbl = t;
+	/* Elements after the header (keeping the allocated space) */
+	hs2 = sh_hdr_size_es(es, 0);
+	memmove((uint8_t *)hm + hs2, (uint8_t *)hm + hs1, shm_size(hm) * es);
+	hm->d.max_size += (hs1 - hs2) / es;
+	hm->d.header_size = hs2;
+	return S_TRUE;
+}
+
+void shm_set_rehash_step(srt_hmap *hm, size_t step)
+{
+	if (!hm || hm == shm_void || shm_ro(hm) || (step && !aux_tbl_out(hm)))
+		return;
+	hm->rh_step = step;
+	if (!step && hm->rh_old)
+		aux_migrate(hm, S_NPOS);
+}
+
+void shm_set_hash(srt_hmap *hm, enum eSHM_Hash h, uint64_t seed)
+{
+	if (!hm || hm == shm_void || shm_ro(hm))
+		return;
+	if (h == SHM_HASH_RANDOM) {
+		h = SHM_HASH_SEEDED;
+		seed = sh_seed_random();
+	}
+	hm->htype = (uint32_t)h;
+	hm->hseed = h == SHM_HASH_SEEDED ? seed : 0;
+	if (shm_size(hm) > 0) {
+#ifdef S_SHM_STATS
+		clock_t c0 = clock();
+#endif
+		aux_rehash(hm);
+		hm->st_rehashes++;
+#ifdef S_SHM_STATS
+		hm->st_rehash_clk += (uint64_t)(clock() - c0);
+#endif
+	}
+}
+
 void shm_clear(srt_hmap *hm)
 {
 	size_t es;
 	uint8_t *p, *pt;
-	if (!hm)
+	if (!hm || hm == shm_void || shm_ro(hm))
 		return;
 	p = shm_get_buffer(hm);
 	es = hm->d.elem_size;
@@ -522,6 +1339,9 @@ void shm_clear(srt_hmap *hm)
 		break;
 	}
 	shm_set_size(hm, 0);
+	if (hm->c_off)
+		aux_cache_reset(hm);
+	aux_rehash(hm);
 }
 
 void shm_free_aux(srt_hmap **hm, ...)
@@ -531,6 +1351,8 @@ void shm_free_aux(srt_hmap **hm, ...)
 	va_start(ap, hm);
 	while (!s_varg_tail_ptr_tag(next)) { /* last element tag */
 		shm_clear(*next); /* release associated dyn. memory */
+		if (*next && *next != shm_void)
+			aux_tbl_free(*next);
 		sd_free((srt_data **)next);
 		next = (srt_hmap **)va_arg(ap, srt_hmap **);
 	}
@@ -551,16 +1373,16 @@ S_INLINE size_t shm_current_alloc_size(const srt_hmap *h)
 static srt_bool shm_cpy_reconfig(srt_hmap **hm, const srt_hmap *src)
 {
 	srt_hmap *hra;
-	uint8_t t = src->d.sub_type;
 	uint64_t hs64 = snextpow2(shm_size(src));
 	size_t tgt0_cas = shm_current_alloc_size(*hm),
 	       src0_cas = shm_current_alloc_size(src), np2 = (size_t)hs64,
-	       hbits = slog2(np2), hdr_size = sh_hdr_size(t, np2),
-	       es = src->d.elem_size, elems = shm_size(src),
+	       es = src->d.elem_size, hbits = slog2(np2),
+	       hdr_size = sh_hdr_size_es(es, np2), elems = shm_size(src),
 	       data_size = es * elems, min_alloc_size = hdr_size + data_size;
 	RETURN_IF((uint64_t)np2 != hs64, S_FALSE);
-	/* Target cleanup, before the copy */
+	/* Target cleanup, before the copy (table after the header) */
 	shm_clear(*hm);
+	aux_tbl_free(*hm);
 	/* Make room for the copy */
 	if ((*hm)->d.f.ext_buffer) {
 		/* Using stack-allocated: check for enough space */
@@ -585,8 +1407,12 @@ static srt_bool shm_cpy_reconfig(srt_hmap **hm, const srt_hmap *src)
 	(*hm)->hbits = (uint32_t)hbits;
 	(*hm)->eqf = src->eqf;
 	(*hm)->delf = src->delf;
+	(*hm)->hashf = src->hashf;
 	(*hm)->n2kf = src->n2kf;
 	(*hm)->ksize = src->ksize;
+	(*hm)->vsize = src->vsize;
+	(*hm)->ghashf = src->ghashf;
+	(*hm)->geqf = src->geqf;
 	return S_TRUE;
 }
 
@@ -603,19 +1429,31 @@ srt_hmap *shm_cpy(srt_hmap **hm, const srt_hmap *src)
 	struct SHMapSS *h_ss;
 	RETURN_IF(!hm || !src, NULL); /* BEHAVIOR */
 	RETURN_IF(*hm == src, *hm);
+	RETURN_IF(*hm && shm_ro(*hm), NULL);
 	t = src->d.sub_type;
 	hs = shm_size(src);
 	es = src->d.elem_size;
 	ss = shm_size(src);
 	RETURN_IF(hs > SHM_MAX_ELEMS, NULL); /* BEHAVIOR */
+	RETURN_IF(*hm && (*hm)->c_off, NULL); /* BEHAVIOR: cache target */
 	if (*hm) {
 		/* De-allocate target nodes, if necessary */
 		RETURN_IF(!shm_cpy_reconfig(hm, src), NULL);
 	} else {
-		*hm = shm_alloc_aux(t, ss);
+		if (t == SHM0_GEN)
+			*hm = shm_alloc_gen(src->ksize, src->vsize, src->ghashf,
+					    src->geqf, ss);
+		else if (src->c_off)
+			*hm = shm_alloc_cache(
+				(enum eSHM_Type)t, shm_get_cache_r(src)->cap,
+				(enum eSHM_Evict)shm_get_cache_r(src)->policy);
+		else
+			*hm = shm_alloc_aux(t, ss);
 		RETURN_IF(!*hm, NULL); /* BEHAVIOR: allocation error */
 	}
 	RETURN_IF(shm_max_size(*hm) < ss, *hm); /* BEHAVIOR: not enough space */
+	(*hm)->htype = src->htype;
+	(*hm)->hseed = src->hseed;
 	/* Copy data */
 	data_tgt = shm_get_buffer(*hm);
 	data_src = shm_get_buffer_r(src);
@@ -652,61 +1490,637 @@ srt_hmap *shm_cpy(srt_hmap **hm, const srt_hmap *src)
 	default:
 		break;
 	}
-	/* rehash */
-	if ((*hm)->d.header_size == src->d.header_size) {
-		/* Same header size: hash table buckets bulk copy */
-		hdr0_size = sh_hdr0_size();
-		memcpy((uint8_t *)*hm + hdr0_size,
-		       (const uint8_t *)src + hdr0_size,
-		       src->d.header_size - hdr0_size);
-	} else {
-		/* Different bucket size, rehash required */
-		aux_rehash(*hm);
+	/* rehash */
+	if ((*hm)->d.header_size == src->d.header_size
+	    && (*hm)->hbits == src->hbits && (*hm)->c_off == src->c_off
+	    && !src->rh_tbl) {
+		/*
+		 * Same header layout: hash table buckets bulk copy (and cache
+		 * state and eviction data, if the source is a cache)
+		 */
+		hdr0_size = sh_hdr0_size();
+		memcpy((uint8_t *)*hm + hdr0_size,
+		       (const uint8_t *)src + hdr0_size,
+		       src->d.header_size - hdr0_size);
+		(*hm)->hmask = src->hmask;
+		(*hm)->rh_threshold = src->rh_threshold;
+	} else {
+		/*
+		 * Different bucket size, or migrating: rebuild the table,
+		 * reusing the source bucket hashes
+		 */
+		aux_rehash_from(*hm, src);
+	}
+	shm_set_rehash_step(*hm, src->rh_step);
+	return *hm;
+}
+
+/*
+ * Serialization
+ *
+ * File image:
+ * | struct SHMFileHdr (padded) | map section | string section |
+ *
+ * The map section is the map memory (header, buckets, tags, and elements),
+ * with out-of-line string references stored as offsets from the map section
+ * start. The string section contains those strings, as fixed-size
+ * (external buffer) strings, aligned to 8 bytes.
+ */
+
+#define SHM_FILE_MAGIC "SRTHMAP"
+#define SHM_FILE_VERSION 1
+#define SHM_FILE_BOM 0x01020304
+#define SHM_FILE_HDR_SIZE 64 /* map section alignment */
+#define SHM_FILE_STR_ALIGN 8
+
+struct SHMFileHdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t bom;	   /* byte order check */
+	uint32_t cfg;	   /* build check (see shm_file_cfg()) */
+	uint32_t crc;	   /* map and string sections CRC-32 */
+	uint64_t map_size; /* map section size, in bytes */
+	uint64_t str_size; /* string section size, in bytes */
+};
+
+union SHMapStrElem {
+	struct SHMapS s;
+	struct SHMapIS is;
+	struct SHMapSI si;
+	struct SHMapSS ss;
+	struct SHMapSP sp;
+};
+
+S_INLINE uint32_t shm_file_cfg()
+{
+	return (uint32_t)sizeof(void *) | (uint32_t)sizeof(srt_hmap) << 8
+#ifdef S_ENABLE_SM_STRING_OPTIMIZATION
+	       | (uint32_t)1 << 24
+#endif
+#ifdef S_SHM_WIDE
+	       | (uint32_t)1 << 25
+#endif
+		;
+}
+
+S_INLINE size_t shm_file_str_size(const srt_string *s)
+{
+	/* extra byte for the string terminator */
+	size_t as = sd_alloc_size_raw(sizeof(srt_string), 1, ss_size(s),
+				      S_TRUE) + 1,
+	       r = as % SHM_FILE_STR_ALIGN;
+	return r ? as - r + SHM_FILE_STR_ALIGN : as;
+}
+
+/* Out-of-line string reference locations of an element (0 to 2) */
+static size_t aux_str_refs(int t, void *e, srt_string **r[2])
+{
+	switch (t) {
+	case SHM0_IS:
+		return sso_refs1(&((struct SHMapIS *)e)->v, r);
+	case SHM0_SI:
+	case SHM0_SP:
+	case SHM0_S:
+		return sso_refs1(&((struct SHMapS *)e)->k, r);
+	case SHM0_SS:
+		return sso_refs(&((struct SHMapSS *)e)->kv, r);
+	default:
+		break;
+	}
+	return 0;
+}
+
+S_INLINE srt_bool shm_has_str(int t)
+{
+	return t == SHM0_IS || t == SHM0_SI || t == SHM0_SP || t == SHM0_SS
+			       || t == SHM0_S
+		       ? S_TRUE
+		       : S_FALSE;
+}
+
+struct SHMWriter {
+	FILE *f;
+	uint32_t crc;
+	srt_bool ok;
+};
+
+static void aux_write(struct SHMWriter *w, const void *buf, size_t size)
+{
+	if (w->ok && size > 0) {
+		w->ok = fwrite(buf, 1, size, w->f) == size ? S_TRUE : S_FALSE;
+		w->crc = sh_crc32(w->crc, buf, size);
+	}
+}
+
+static void aux_write_zeros(struct SHMWriter *w, size_t size)
+{
+	static const uint8_t z[64] = {0};
+	size_t n;
+	for (; size > 0; size -= n) {
+		n = size < sizeof(z) ? size : sizeof(z);
+		aux_write(w, z, n);
+	}
+}
+
+/* Elements, with string references as string section offsets */
+static size_t aux_save_elems(struct SHMWriter *w, const srt_hmap *hm,
+			     size_t map_size, size_t *max_str)
+{
+	int t = hm->d.sub_type;
+	srt_string **r[2];
+	union SHMapStrElem e;
+	size_t i, j, nr, ss, soff = 0, es = hm->d.elem_size, n = shm_size(hm);
+	const uint8_t *data = shm_get_buffer_r(hm);
+	*max_str = 0;
+	if (!shm_has_str(t)) {
+		aux_write(w, data, es * n);
+		return 0;
+	}
+	for (i = 0; i < n; i++, data += es) {
+		memcpy(&e, data, es);
+		nr = aux_str_refs(t, &e, r);
+		for (j = 0; j < nr; j++) {
+			if (!*r[j])
+				continue;
+			ss = shm_file_str_size(*r[j]);
+			*r[j] = (srt_string *)(map_size + soff);
+			soff += ss;
+			if (ss > *max_str)
+				*max_str = ss;
+		}
+		aux_write(w, &e, es);
+	}
+	return soff;
+}
+
+/* String section (same order used by aux_save_elems()) */
+static void aux_save_strings(struct SHMWriter *w, const srt_hmap *hm,
+			     size_t max_str)
+{
+	int t = hm->d.sub_type;
+	srt_string **r[2], *s;
+	union SHMapStrElem e;
+	size_t i, j, nr, ss, es = hm->d.elem_size, n = shm_size(hm);
+	const uint8_t *data = shm_get_buffer_r(hm);
+	void *buf;
+	if (!max_str) /* no strings */
+		return;
+	buf = s_malloc(max_str);
+	if (!buf) {
+		w->ok = S_FALSE;
+		return;
+	}
+	for (i = 0; i < n && w->ok; i++, data += es) {
+		memcpy(&e, data, es);
+		nr = aux_str_refs(t, &e, r);
+		for (j = 0; j < nr; j++) {
+			if (!*r[j])
+				continue;
+			ss = shm_file_str_size(*r[j]);
+			memset(buf, 0, ss);
+			s = ss_alloc_into_ext_buf(buf, ss_size(*r[j]));
+			ss_cpy(&s, *r[j]);
+			aux_write(w, buf, ss);
+		}
+	}
+	s_free(buf);
+}
+
+srt_bool shm_save(const srt_hmap *hm, const char *path)
+{
+	srt_hmap h, *tmp = NULL;
+	struct SHMFileHdr fh;
+	struct SHMWriter w;
+	uint8_t pad[SHM_FILE_HDR_SIZE];
+	char *tpath;
+	size_t hs, nb, map_size, max_str, pl;
+	RETURN_IF(!hm || hm == shm_void || !path, S_FALSE);
+	/* User callbacks and cache eviction data can not be stored */
+	RETURN_IF(hm->ghashf || hm->geqf || hm->c_off, S_FALSE);
+	if (hm->rh_old) {
+		/* Migrating: save a copy having a single table */
+		tmp = shm_dup(hm);
+		if (!tmp || tmp->rh_old) {
+			shm_free(&tmp);
+			return S_FALSE;
+		}
+		hm = tmp;
+	}
+	/* Hash table after the header (e.g. if kept out of the map memory) */
+	nb = (size_t)hm->hmask + 1;
+	hs = sh_hdr_size_es(hm->d.elem_size, nb);
+	map_size = hs + hm->d.elem_size * shm_size(hm);
+	/* Map header, as loaded */
+	h = *hm;
+	h.d.f.ext_buffer = 1;
+	h.d.f.alloc_errors = 0;
+	h.d.max_size = h.d.size;
+	h.d.header_size = hs;
+	h.rh_step = h.rh_next = 0;
+	h.rh_old = h.rh_tbl = NULL;
+	h.eqf = NULL;
+	h.delf = NULL;
+	h.hashf = NULL;
+	h.n2kf = NULL;
+	h.ghashf = NULL;
+	h.geqf = NULL;
+	memset(&fh, 0, sizeof(fh));
+	memset(pad, 0, sizeof(pad));
+	/*
+	 * Write to a temporary file, replacing the target at the end, so maps
+	 * already loaded from the previous file are not affected
+	 */
+	pl = strlen(path);
+	tpath = (char *)s_malloc(pl + 5);
+	if (!tpath) {
+		shm_free(&tmp);
+		return S_FALSE;
+	}
+	memcpy(tpath, path, pl);
+	memcpy(tpath + pl, ".tmp", 5);
+	w.f = fopen(tpath, S_FOPEN_BINARY_RW_TRUNC);
+	w.crc = 0;
+	w.ok = w.f ? S_TRUE : S_FALSE;
+	if (w.ok) {
+		/* Header placeholder, written after the checksum */
+		w.ok = fwrite(pad, 1, sizeof(pad), w.f) == sizeof(pad)
+			       ? S_TRUE
+			       : S_FALSE;
+		aux_write(&w, &h, sizeof(h));
+		aux_write_zeros(&w, sh_hdr0_size() - sizeof(h));
+		aux_write(&w, shm_get_tbl_r(hm), sh_tbl_size(nb));
+		aux_write_zeros(&w, hs - sh_hdr0_size() - sh_tbl_size(nb));
+		fh.str_size = aux_save_elems(&w, hm, map_size, &max_str);
+		aux_save_strings(&w, hm, max_str);
+	}
+	if (w.ok) {
+		memcpy(fh.magic, SHM_FILE_MAGIC, sizeof(fh.magic));
+		fh.version = SHM_FILE_VERSION;
+		fh.bom = SHM_FILE_BOM;
+		fh.cfg = shm_file_cfg();
+		fh.crc = w.crc;
+		fh.map_size = map_size;
+		memcpy(pad, &fh, sizeof(fh));
+		w.ok = !fseek(w.f, 0, SEEK_SET)
+				       && fwrite(pad, 1, sizeof(pad), w.f)
+						  == sizeof(pad)
+			       ? S_TRUE
+			       : S_FALSE;
+	}
+	if (w.f && fclose(w.f))
+		w.ok = S_FALSE;
+#ifndef SHM_MMAP
+	if (w.ok)
+		remove(path); /* rename() may not replace existing files */
+#endif
+	if (w.ok && rename(tpath, path))
+		w.ok = S_FALSE;
+	if (!w.ok && w.f)
+		remove(tpath);
+	s_free(tpath);
+	shm_free(&tmp);
+	return w.ok;
+}
+
+static void aux_file_release(void *base, size_t size)
+{
+#ifdef SHM_MMAP
+	munmap(base, size);
+#else
+	(void)size;
+	s_free(base);
+#endif
+}
+
+/*
+ * Memory mapping is private (copy on write), so only the pages written when
+ * loading (map header, and elements with string references) get copied
+ */
+static uint8_t *aux_file_load(const char *path, size_t *size)
+{
+	void *base;
+#ifdef SHM_MMAP
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	RETURN_IF(fd < 0, NULL);
+	if (fstat(fd, &st) || st.st_size < SHM_FILE_HDR_SIZE
+	    || (off_t)(size_t)st.st_size != st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	*size = (size_t)st.st_size;
+	base = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	return base == MAP_FAILED ? NULL : (uint8_t *)base;
+#else
+	long fs;
+	FILE *f = fopen(path, "rb");
+	RETURN_IF(!f, NULL);
+	base = NULL;
+	if (!fseek(f, 0, SEEK_END) && (fs = ftell(f)) >= SHM_FILE_HDR_SIZE
+	    && !fseek(f, 0, SEEK_SET)) {
+		*size = (size_t)fs;
+		base = s_malloc(*size);
+		if (base && fread(base, 1, *size, f) != *size) {
+			s_free(base);
+			base = NULL;
+		}
+	}
+	fclose(f);
+	return (uint8_t *)base;
+#endif
+}
+
+/* String references, from offsets to addresses (checking bounds) */
+static srt_bool aux_reloc_strings(srt_hmap *hm, size_t map_size,
+				  size_t str_size)
+{
+	int t = hm->d.sub_type;
+	srt_string **r[2];
+	uint8_t *data = shm_get_buffer(hm);
+	size_t i, j, nr, off, es = hm->d.elem_size, n = shm_size(hm),
+			      end = map_size + str_size,
+			      hmin = sizeof(struct SDataSmall);
+	for (i = 0; i < n; i++, data += es) {
+		nr = aux_str_refs(t, data, r);
+		for (j = 0; j < nr; j++) {
+			if (!*r[j])
+				continue;
+			off = (size_t)*r[j];
+			RETURN_IF(off < map_size || end - off < hmin, S_FALSE);
+			*r[j] = (srt_string *)((uint8_t *)hm + off);
+			RETURN_IF(sdx_alloc_size((srt_data *)*r[j])
+					  > end - off,
+				  S_FALSE);
+		}
+	}
+	return S_TRUE;
+}
+
+static srt_hmap *aux_map_image(uint8_t *base, size_t size, srt_bool check)
+{
+	int t;
+	srt_hmap *hm;
+	uint64_t nb;
+	size_t es;
+	struct SHMFileHdr fh;
+	memcpy(&fh, base, sizeof(fh));
+	RETURN_IF(memcmp(fh.magic, SHM_FILE_MAGIC, sizeof(fh.magic))
+			  || fh.version != SHM_FILE_VERSION
+			  || fh.bom != SHM_FILE_BOM
+			  || fh.cfg != shm_file_cfg(),
+		  NULL);
+	size -= SHM_FILE_HDR_SIZE;
+	RETURN_IF(fh.map_size < sizeof(srt_hmap) || fh.map_size > size
+			  || fh.str_size != size - fh.map_size,
+		  NULL);
+	RETURN_IF(check
+			  && sh_crc32(0, base + SHM_FILE_HDR_SIZE, size)
+				     != fh.crc,
+		  NULL);
+	hm = (srt_hmap *)(base + SHM_FILE_HDR_SIZE);
+	t = hm->d.sub_type;
+	nb = (uint64_t)hm->hmask + 1;
+	es = t == SHM0_GEN ? shm_gen_elem_size(hm->ksize, hm->vsize)
+			   : shm_elem_size(t);
+	RETURN_IF(!es || hm->d.elem_size != es
+			  || (t == SHM0_GEN && !hm->ksize)
+			  || hm->hbits < 1 || hm->hbits > SHM_MAX_HBITS
+			  || nb != (uint64_t)1 << hm->hbits
+			  || hm->d.header_size != sh_hdr_size_es(es, (size_t)nb)
+			  || hm->d.max_size != hm->d.size
+			  || hm->d.size > SHM_MAX_ELEMS
+			  || hm->d.header_size
+					     + hm->d.elem_size * hm->d.size
+				     != fh.map_size,
+		  NULL);
+	/*
+	 * Writer process state is not used (shm_save() clears it, but the
+	 * image could come from elsewhere): table after the header, with no
+	 * migration in progress, and no cache or user callbacks
+	 */
+	hm->rh_step = hm->rh_next = 0;
+	hm->rh_old = hm->rh_tbl = NULL;
+	hm->ghashf = NULL;
+	hm->geqf = NULL;
+	hm->c_off = 0;
+	/* Read-only: no growth, and no writes (see shm_ro()) */
+	hm->d.f.ext_buffer = 1;
+	hm->d.f.flag1 = 1;
+	shm_tsetup(hm, t);
+	RETURN_IF(fh.str_size > 0
+			  && !aux_reloc_strings(hm, (size_t)fh.map_size,
+						(size_t)fh.str_size),
+		  NULL);
+	return hm;
+}
+
+srt_hmap *shm_map_file(const char *path, srt_bool check)
+{
+	size_t size = 0;
+	srt_hmap *hm;
+	uint8_t *base;
+	RETURN_IF(!path, NULL);
+	base = aux_file_load(path, &size);
+	RETURN_IF(!base, NULL);
+	hm = aux_map_image(base, size, check);
+	if (!hm)
+		aux_file_release(base, size);
+	return hm;
+}
+
+void shm_unmap(srt_hmap **hm)
+{
+	struct SHMFileHdr fh;
+	uint8_t *base;
+	if (!hm || !*hm)
+		return;
+	base = (uint8_t *)*hm - SHM_FILE_HDR_SIZE;
+	memcpy(&fh, base, sizeof(fh));
+	aux_file_release(base, SHM_FILE_HDR_SIZE + (size_t)fh.map_size
+				       + (size_t)fh.str_size);
+	*hm = NULL;
+}
+
+/*
+ * Statistics
+ */
+
+/* Probe distances, for the used buckets starting from bucket 'from' */
+static void aux_probe_stats(const struct SHMTable *x, size_t from,
+			    srt_hmap_stats *st, size_t *nused, size_t *sum)
+{
+	size_t i, d;
+	for (i = from; i <= x->hmask; i++) {
+		if (!(x->t[i] & 0x80))
+			continue;
+		d = (i - h2bid(x->b[i].hash, x->hbits)) & x->hmask;
+		*sum += d;
+		(*nused)++;
+		if (d > st->max_probe)
+			st->max_probe = d;
+	}
+}
+
+/*
+ * Elements per home bucket histogram (current table). Buckets don't keep
+ * that count, so it is rebuilt here from the stored hashes.
+ */
+static void aux_cnt_hist(const struct SHMTable *x, srt_hmap_stats *st)
+{
+	size_t i, nb = (size_t)x->hmask + 1;
+	uint32_t *c = (uint32_t *)s_calloc(nb, sizeof(uint32_t));
+	if (!c)
+		return;
+	for (i = 0; i < nb; i++)
+		if (x->t[i] & 0x80)
+			c[h2bid(x->b[i].hash, x->hbits)]++;
+	for (i = 0; i < nb; i++)
+		st->cnt_hist[c[i] < SHM_STATS_CNT_BINS
+				     ? c[i]
+				     : SHM_STATS_CNT_BINS - 1]++;
+	s_free(c);
+}
+
+void shm_stats(const srt_hmap *hm, srt_hmap_stats *st)
+{
+	struct SHMTable x;
+	srt_string **r[2];
+	const uint8_t *e;
+	size_t i, j, nr, es, ss, nempty = 0, nused = 0, sum = 0;
+	if (!st)
+		return;
+	memset(st, 0, sizeof(*st));
+	if (!hm || hm == shm_void)
+		return;
+	shm_tbl(&x, hm, S_FALSE);
+	ss = shm_size(hm);
+	es = hm->d.elem_size;
+	st->size = ss;
+	st->buckets = (size_t)x.hmask + 1;
+	for (i = 0; i <= x.hmask; i++)
+		if (x.t[i] == SHM_TAG_EMPTY)
+			nempty++;
+	aux_cnt_hist(&x, st);
+	aux_probe_stats(&x, 0, st, &nused, &sum);
+	st->bucket_bytes = hm->rh_tbl ? sh_tbl_size(st->buckets)
+				      : hm->d.header_size - sh_hdr0_size();
+	if (hm->rh_old) {
+		/* Buckets not migrated yet */
+		shm_tbl(&x, hm, S_TRUE);
+		aux_probe_stats(&x, hm->rh_next, st, &nused, &sum);
+		st->bucket_bytes += sh_tbl_size((size_t)x.hmask + 1);
+	}
+	st->load_factor = (double)ss / (double)st->buckets;
+	st->empty_ratio = (double)nempty / (double)st->buckets;
+	st->avg_probe = nused ? (double)sum / (double)nused : 0;
+	st->rehashes = hm->st_rehashes;
+	st->elem_bytes = shm_max_size(hm) * es;
+	if (shm_has_str(hm->d.sub_type)) {
+		e = shm_get_buffer_r(hm);
+		for (i = 0; i < ss; i++, e += es) {
+			nr = aux_str_refs(hm->d.sub_type,
+					  (void *)e /* CONSTNESS */, r);
+			for (j = 0; j < nr; j++)
+				if (*r[j] && *r[j] != ss_void)
+					st->str_bytes += sd_alloc_size_raw(
+						sizeof(srt_string), 1,
+						ss_capacity(*r[j]), S_TRUE);
+		}
 	}
-	return *hm;
+#ifdef S_SHM_STATS
+	st->probe_steps = hm->st_probes;
+	st->rehash_ns = (uint64_t)((double)hm->st_rehash_clk * 1e9
+				   / (double)CLOCKS_PER_SEC);
+#endif
 }
 
 /*
  * Insert
  */
 
+S_INLINE const srt_hmap *aux_hm(srt_hmap **hm)
+{
+	return hm ? *hm : NULL;
+}
+
+/*
+ * Element for key 'k': existing one, or a new one, not initialized ('is_new'
+ * set). Cache mode: found elements are refreshed, and if full, one element
+ * is evicted before adding the new one (no memory growth).
+ */
+static uint8_t *aux_upsert(srt_hmap **hm, shm_hash_t_ h, const void *k,
+			   srt_bool *is_new)
+{
+	uint8_t *l;
+	size_t i, es = (*hm)->d.elem_size;
+	RETURN_IF(shm_ro(*hm), NULL);
+	if ((*hm)->c_off) {
+		l = aux_at(*hm, h, k);
+		if (l) {
+			i = (size_t)(l - shm_get_buffer(*hm)) / es;
+			aux_cache_touch(*hm, i);
+			*is_new = S_FALSE;
+			return l;
+		}
+		if (shm_size(*hm) >= shm_get_cache_r(*hm)->cap)
+			aux_cache_evict(*hm);
+		RETURN_IF(!aux_insert_check(hm), NULL);
+	} else {
+		RETURN_IF(!aux_insert_check(hm), NULL);
+		l = aux_at(*hm, h, k);
+		if (l) {
+			*is_new = S_FALSE;
+			return l;
+		}
+	}
+	i = shm_size(*hm);
+	aux_reg_hash(*hm, h, i);
+	shm_set_size(*hm, i + 1);
+	if ((*hm)->c_off)
+		aux_cache_add(*hm, i);
+	*is_new = S_TRUE;
+	return shm_get_buffer(*hm) + i * es;
+}
+
 typedef void (*shm_set1_f)(void *loc, const void *key);
 
-static srt_bool shm_insert1(srt_hmap **hm, int t, const void *k, uint32_t h32,
+static srt_bool shm_insert1(srt_hmap **hm, int t, const void *k, shm_hash_t_ h,
 			    shm_set1_f setf)
 {
 	void *l;
-	size_t i;
+	srt_bool is_new;
 	RETURN_IF(!hm || !*hm || !shm_chk_t(*hm, t), S_FALSE);
-	RETURN_IF(!aux_insert_check(hm), S_FALSE);
-	l = (void *)shm_at(*hm, h32, k, NULL);
-	if (!l) {
-		i = shm_size(*hm);
-		aux_reg_hash(*hm, k, h32, (shm_eloc_t_)i);
-		shm_set_size(*hm, i + 1);
-		l = shm_get_buffer(*hm) + i * (*hm)->d.elem_size;
-	}
-	setf(l, k);
+	l = aux_upsert(hm, h, k, &is_new);
+	RETURN_IF(!l, S_FALSE);
+	if (is_new) /* existing element: same key, nothing to update */
+		setf(l, k);
 	return S_TRUE;
 }
 
 typedef void (*shm_set_f)(void *loc, const void *key, const void *value);
 
-static srt_bool shm_insert(srt_hmap **hm, int t, const void *k, uint32_t h32,
+static srt_bool shm_insert(srt_hmap **hm, int t, const void *k, shm_hash_t_ h,
 			   const void *v, shm_set_f setf)
 {
 	void *l;
-	size_t i;
+	srt_bool is_new;
+	union SHMapStrElem tmp;
 	RETURN_IF(!hm || !*hm || !shm_chk_t(*hm, t), S_FALSE);
-	RETURN_IF(!aux_insert_check(hm), S_FALSE);
-	l = (void *)shm_at(*hm, h32, k, NULL);
-	if (!l) {
-		i = shm_size(*hm);
-		aux_reg_hash(*hm, k, h32, (shm_eloc_t_)i);
-		shm_set_size(*hm, i + 1);
-		l = shm_get_buffer(*hm) + i * (*hm)->d.elem_size;
-	}
-	setf(l, k, v);
+	l = aux_upsert(hm, h, k, &is_new);
+	RETURN_IF(!l, S_FALSE);
+	if (!is_new && (*hm)->delf != del_nop) {
+		/*
+		 * Element with strings: the previous ones are released after
+		 * setting the new ones, as the key or the value could be
+		 * stored in the element being overwritten
+		 */
+		setf(&tmp, k, v);
+		(*hm)->delf(l);
+		memcpy(l, &tmp, (*hm)->d.elem_size);
+	} else {
+		setf(l, k, v);
+	}
 	return S_TRUE;
 }
 
@@ -716,16 +2130,18 @@ static srt_bool shm_insert(srt_hmap **hm, int t, const void *k, uint32_t h32,
 
 typedef void (*shm_inc_f)(void *loc, const void *value);
 
-static srt_bool shm_inc(srt_hmap **hm, int t, const void *k, uint32_t h32,
+static srt_bool shm_inc(srt_hmap **hm, int t, const void *k, shm_hash_t_ h,
 			const void *v, shm_set_f setf, shm_inc_f incf)
 {
 	void *l;
+	srt_bool is_new;
 	RETURN_IF(!hm || !*hm || !shm_chk_t(*hm, t), S_FALSE);
-	RETURN_IF(!aux_insert_check(hm), S_FALSE);
-	l = (void *)shm_at(*hm, h32, k, NULL);
-	if (!l) /* not found: create new elem */
-		return shm_insert(hm, t, k, h32, v, setf);
-	incf(l, v);
+	l = aux_upsert(hm, h, k, &is_new);
+	RETURN_IF(!l, S_FALSE);
+	if (is_new) /* not found: new elem */
+		setf(l, k, v);
+	else
+		incf(l, v);
 	return S_TRUE;
 }
 
@@ -735,46 +2151,54 @@ static srt_bool shm_inc(srt_hmap **hm, int t, const void *k, uint32_t h32,
 
 srt_bool shm_insert_ii32(srt_hmap **hm, int32_t k, int32_t v)
 {
-	return shm_insert(hm, SHM0_II32, &k, sh_hash32((uint32_t)k), &v,
+	return shm_insert(hm, SHM0_II32, &k,
+			  shm_hash_u32(aux_hm(hm), (uint32_t)k), &v,
 			  shmcb_set_ii32);
 }
 
 srt_bool shm_insert_uu32(srt_hmap **hm, uint32_t k, uint32_t v)
 {
-	return shm_insert(hm, SHM0_UU32, &k, sh_hash32(k), &v, shmcb_set_uu32);
+	return shm_insert(hm, SHM0_UU32, &k, shm_hash_u32(aux_hm(hm), k), &v,
+			  shmcb_set_uu32);
 }
 
 srt_bool shm_insert_ii(srt_hmap **hm, int64_t k, int64_t v)
 {
-	return shm_insert(hm, SHM0_II, &k, sh_hash64((uint64_t)k), &v,
+	return shm_insert(hm, SHM0_II, &k,
+			  shm_hash_u64(aux_hm(hm), (uint64_t)k), &v,
 			  shmcb_set_ii64);
 }
 
 srt_bool shm_insert_is(srt_hmap **hm, int64_t k, const srt_string *v)
 {
-	return shm_insert(hm, SHM0_IS, &k, sh_hash64((uint64_t)k), v,
+	return shm_insert(hm, SHM0_IS, &k,
+			  shm_hash_u64(aux_hm(hm), (uint64_t)k), v,
 			  shmcb_set_is);
 }
 
 srt_bool shm_insert_ip(srt_hmap **hm, int64_t k, const void *v)
 {
-	return shm_insert(hm, SHM0_IP, &k, sh_hash64((uint64_t)k), v,
+	return shm_insert(hm, SHM0_IP, &k,
+			  shm_hash_u64(aux_hm(hm), (uint64_t)k), v,
 			  shmcb_set_ip);
 }
 
 srt_bool shm_insert_si(srt_hmap **hm, const srt_string *k, int64_t v)
 {
-	return shm_insert(hm, SHM0_SI, k, SHM_SHASH(k), &v, shmcb_set_si);
+	return shm_insert(hm, SHM0_SI, k, shm_hash_s(aux_hm(hm), k), &v,
+			  shmcb_set_si);
 }
 
 srt_bool shm_insert_ss(srt_hmap **hm, const srt_string *k, const srt_string *v)
 {
-	return shm_insert(hm, SHM0_SS, k, SHM_SHASH(k), v, shmcb_set_ss);
+	return shm_insert(hm, SHM0_SS, k, shm_hash_s(aux_hm(hm), k), v,
+			  shmcb_set_ss);
 }
 
 srt_bool shm_insert_sp(srt_hmap **hm, const srt_string *k, const void *v)
 {
-	return shm_insert(hm, SHM0_SP, k, SHM_SHASH(k), v, shmcb_set_sp);
+	return shm_insert(hm, SHM0_SP, k, shm_hash_s(aux_hm(hm), k), v,
+			  shmcb_set_sp);
 }
 
 /*
@@ -783,49 +2207,162 @@ srt_bool shm_insert_sp(srt_hmap **hm, const srt_string *k, const void *v)
 
 srt_bool shm_inc_ii32(srt_hmap **hm, int32_t k, int32_t v)
 {
-	return shm_inc(hm, SHM0_II32, &k, sh_hash32((uint32_t)k), &v,
+	return shm_inc(hm, SHM0_II32, &k,
+		       shm_hash_u32(aux_hm(hm), (uint32_t)k), &v,
 		       shmcb_set_ii32, shmcb_inc_ii32);
 }
 
 srt_bool shm_inc_uu32(srt_hmap **hm, uint32_t k, uint32_t v)
 {
-	return shm_inc(hm, SHM0_UU32, &k, sh_hash32(k), &v, shmcb_set_uu32,
-		       shmcb_inc_uu32);
+	return shm_inc(hm, SHM0_UU32, &k, shm_hash_u32(aux_hm(hm), k), &v,
+		       shmcb_set_uu32, shmcb_inc_uu32);
 }
 
 srt_bool shm_inc_ii(srt_hmap **hm, int64_t k, int64_t v)
 {
-	return shm_inc(hm, SHM0_II, &k, sh_hash64((uint64_t)k), &v,
-		       shmcb_set_ii64, shmcb_inc_ii64);
+	return shm_inc(hm, SHM0_II, &k, shm_hash_u64(aux_hm(hm), (uint64_t)k),
+		       &v, shmcb_set_ii64, shmcb_inc_ii64);
 }
 
 srt_bool shm_inc_si(srt_hmap **hm, const srt_string *k, int64_t v)
 {
-	return shm_inc(hm, SHM0_SI, k, SHM_SHASH(k), &v, shmcb_set_si,
-		       shmcb_inc_si);
+	return shm_inc(hm, SHM0_SI, k, shm_hash_s(aux_hm(hm), k), &v,
+		       shmcb_set_si, shmcb_inc_si);
 }
 
 srt_bool shm_insert_i32(srt_hmap **hm, int32_t k)
 {
-	return shm_insert1(hm, SHM0_I32, &k, sh_hash32((uint32_t)k),
+	return shm_insert1(hm, SHM0_I32, &k,
+			   shm_hash_u32(aux_hm(hm), (uint32_t)k),
 			   shmcb_set_i32);
 }
 
 srt_bool shm_insert_u32(srt_hmap **hm, uint32_t k)
 {
-	return shm_insert1(hm, SHM0_U32, &k, sh_hash32((uint32_t)k),
+	return shm_insert1(hm, SHM0_U32, &k, shm_hash_u32(aux_hm(hm), k),
 			   shmcb_set_u32);
 }
 
 srt_bool shm_insert_i(srt_hmap **hm, int64_t k)
 {
-	return shm_insert1(hm, SHM0_I, &k, sh_hash64((uint64_t)k),
+	return shm_insert1(hm, SHM0_I, &k,
+			   shm_hash_u64(aux_hm(hm), (uint64_t)k),
 			   shmcb_set_i64);
 }
 
 srt_bool shm_insert_s(srt_hmap **hm, const srt_string *k)
 {
-	return shm_insert1(hm, SHM0_S, k, SHM_SHASH(k), shmcb_set_s);
+	return shm_insert1(hm, SHM0_S, k, shm_hash_s(aux_hm(hm), k),
+			   shmcb_set_s);
+}
+
+/* Generic mode element for key 'k' (new elements: value set to zero) */
+static uint8_t *aux_emplace_gen(srt_hmap **hm, const void *k, srt_bool *is_new)
+{
+	uint8_t *l;
+	RETURN_IF(!hm || !*hm || !shm_chk_t(*hm, SHM0_GEN) || !k, NULL);
+	l = aux_upsert(hm, (*hm)->hashf(*hm, k), k, is_new);
+	if (l && *is_new) {
+		memset(l, 0, (*hm)->d.elem_size);
+		memcpy(l, k, (*hm)->ksize);
+	}
+	return l;
+}
+
+srt_bool shm_insert_gen(srt_hmap **hm, const void *k, const void *v)
+{
+	uint8_t *l;
+	srt_bool is_new;
+	l = aux_emplace_gen(hm, k, &is_new);
+	RETURN_IF(!l, S_FALSE);
+	if ((*hm)->vsize) {
+		l += shm_gen_voff((*hm)->ksize);
+		if (v)
+			memcpy(l, v, (*hm)->vsize);
+		else if (!is_new)
+			memset(l, 0, (*hm)->vsize);
+	}
+	return S_TRUE;
+}
+
+/*
+ * Find or insert
+ */
+
+/* Element for key 'k' (new elements: value set to zero/NULL) */
+static uint8_t *aux_emplace(srt_hmap **hm, int t, const void *k,
+			    shm_hash_t_ h, shm_set_f setf, srt_bool *is_new)
+{
+	uint8_t *l;
+	srt_bool n;
+	const int64_t zero = 0;
+	RETURN_IF(!hm || !*hm || !shm_chk_t(*hm, t), NULL);
+	l = aux_upsert(hm, h, k, &n);
+	RETURN_IF(!l, NULL);
+	if (n) /* pointer values are passed by value */
+		setf(l, k, t == SHM0_IP || t == SHM0_SP ? NULL : &zero);
+	if (is_new)
+		*is_new = n;
+	return l;
+}
+
+int32_t *shm_emplace_ii32(srt_hmap **hm, int32_t k, srt_bool *is_new)
+{
+	struct SHMapii *e = (struct SHMapii *)aux_emplace(
+		hm, SHM0_II32, &k, shm_hash_u32(aux_hm(hm), (uint32_t)k),
+		shmcb_set_ii32, is_new);
+	return e ? &e->v : NULL;
+}
+
+uint32_t *shm_emplace_uu32(srt_hmap **hm, uint32_t k, srt_bool *is_new)
+{
+	struct SHMapuu *e = (struct SHMapuu *)aux_emplace(
+		hm, SHM0_UU32, &k, shm_hash_u32(aux_hm(hm), k),
+		shmcb_set_uu32, is_new);
+	return e ? &e->v : NULL;
+}
+
+int64_t *shm_emplace_ii(srt_hmap **hm, int64_t k, srt_bool *is_new)
+{
+	struct SHMapII *e = (struct SHMapII *)aux_emplace(
+		hm, SHM0_II, &k, shm_hash_u64(aux_hm(hm), (uint64_t)k),
+		shmcb_set_ii64, is_new);
+	return e ? &e->v : NULL;
+}
+
+const void **shm_emplace_ip(srt_hmap **hm, int64_t k, srt_bool *is_new)
+{
+	struct SHMapIP *e = (struct SHMapIP *)aux_emplace(
+		hm, SHM0_IP, &k, shm_hash_u64(aux_hm(hm), (uint64_t)k),
+		shmcb_set_ip, is_new);
+	return e ? &e->v : NULL;
+}
+
+int64_t *shm_emplace_si(srt_hmap **hm, const srt_string *k, srt_bool *is_new)
+{
+	struct SHMapSI *e = (struct SHMapSI *)aux_emplace(
+		hm, SHM0_SI, k, shm_hash_s(aux_hm(hm), k), shmcb_set_si,
+		is_new);
+	return e ? &e->v : NULL;
+}
+
+const void **shm_emplace_sp(srt_hmap **hm, const srt_string *k,
+			    srt_bool *is_new)
+{
+	struct SHMapSP *e = (struct SHMapSP *)aux_emplace(
+		hm, SHM0_SP, k, shm_hash_s(aux_hm(hm), k), shmcb_set_sp,
+		is_new);
+	return e ? &e->v : NULL;
+}
+
+void *shm_emplace_gen(srt_hmap **hm, const void *k, srt_bool *is_new)
+{
+	srt_bool n;
+	uint8_t *l = aux_emplace_gen(hm, k, &n);
+	RETURN_IF(!l, NULL);
+	if (is_new)
+		*is_new = n;
+	return (*hm)->vsize ? l + shm_gen_voff((*hm)->ksize) : l;
 }
 
 /*
@@ -837,19 +2374,482 @@ srt_bool shm_delete_i(srt_hmap *hm, int64_t k)
 	uint32_t k32;
 	if (hm->ksize == 4) {
 		k32 = (uint32_t)k;
-		return del(hm, sh_hash32(k32), &k32);
+		return del(hm, shm_hash_u32(hm, k32), &k32);
 	}
-	return del(hm, sh_hash64((uint64_t)k), &k);
+	return del(hm, shm_hash_u64(hm, (uint64_t)k), &k);
 }
 
 srt_bool shm_delete_s(srt_hmap *hm, const srt_string *k)
 {
-	return del(hm, SHM_SHASH(k), k);
+	return del(hm, shm_hash_s(hm, k), k);
+}
+
+srt_bool shm_delete_gen(srt_hmap *hm, const void *k)
+{
+	RETURN_IF(!hm || hm->d.sub_type != SHM0_GEN || !k, S_FALSE);
+	return del(hm, hm->hashf(hm, k), k);
+}
+
+/*
+ * Merge and set operations: elements are visited through the bucket
+ * tables, so the stored hashes are reused when both maps use the same hash
+ * function set (otherwise, keys are hashed again)
+ */
+
+typedef srt_bool (*shm_each_f)(void *context, shm_hash_t_ h, const uint8_t *e);
+
+static srt_bool aux_each(const srt_hmap *hm, shm_each_f f, void *context)
+{
+	size_t i, es = hm->d.elem_size;
+	struct SHMTable x;
+	const uint8_t *data = shm_get_buffer_r(hm);
+	shm_tbl(&x, hm, S_FALSE);
+	for (i = 0; i <= x.hmask; i++)
+		if ((x.t[i] & 0x80)
+		    && !f(context, x.b[i].hash, data + (x.b[i].loc - 1) * es))
+			return S_FALSE;
+	if (hm->rh_old) {
+		/* Buckets not migrated yet */
+		shm_tbl(&x, hm, S_TRUE);
+		for (i = hm->rh_next; i <= x.hmask; i++)
+			if ((x.t[i] & 0x80)
+			    && !f(context, x.b[i].hash,
+				  data + (x.b[i].loc - 1) * es))
+				return S_FALSE;
+	}
+	return S_TRUE;
+}
+
+S_INLINE srt_bool aux_same_kind(const srt_hmap *a, const srt_hmap *b)
+{
+	return a->d.sub_type == b->d.sub_type
+			       && a->d.elem_size == b->d.elem_size
+			       && a->ksize == b->ksize && a->geqf == b->geqf
+		       ? S_TRUE
+		       : S_FALSE;
+}
+
+S_INLINE srt_bool aux_same_hash(const srt_hmap *a, const srt_hmap *b)
+{
+	srt_bool da = a->htype == SHM_HASH_DEFAULT ? S_TRUE : S_FALSE,
+		 db = b->htype == SHM_HASH_DEFAULT ? S_TRUE : S_FALSE;
+	return da == db && (da || a->hseed == b->hseed)
+			       && a->ghashf == b->ghashf
+		       ? S_TRUE
+		       : S_FALSE;
+}
+
+/* Element copy ('is_new': 'd' is not initialized) */
+static void aux_elem_set(int t, size_t es, uint8_t *d, const uint8_t *s,
+			 srt_bool is_new)
+{
+	const struct SHMapIS *s_is = (const struct SHMapIS *)s;
+	const struct SHMapSS *s_ss = (const struct SHMapSS *)s;
+	switch (t) {
+	case SHM0_S:
+		if (is_new)
+			sso1_set(&((struct SHMapS *)d)->k,
+				 sso1_get(&((const struct SHMapS *)s)->k));
+		break;
+	case SHM0_IS:
+		((struct SHMapIS *)d)->x = s_is->x;
+		if (is_new)
+			sso1_set(&((struct SHMapIS *)d)->v, sso1_get(&s_is->v));
+		else
+			sso1_update(&((struct SHMapIS *)d)->v,
+				    sso1_get(&s_is->v));
+		break;
+	case SHM0_SI:
+		if (is_new)
+			sso1_set(&((struct SHMapSI *)d)->x.k,
+				 sso1_get(&((const struct SHMapSI *)s)->x.k));
+		((struct SHMapSI *)d)->v = ((const struct SHMapSI *)s)->v;
+		break;
+	case SHM0_SP:
+		if (is_new)
+			sso1_set(&((struct SHMapSP *)d)->x.k,
+				 sso1_get(&((const struct SHMapSP *)s)->x.k));
+		((struct SHMapSP *)d)->v = ((const struct SHMapSP *)s)->v;
+		break;
+	case SHM0_SS:
+		if (is_new)
+			sso_set(&((struct SHMapSS *)d)->kv, sso_get(&s_ss->kv),
+				sso_get_s2(&s_ss->kv));
+		else
+			sso_update(&((struct SHMapSS *)d)->kv,
+				   sso_get(&s_ss->kv), sso_get_s2(&s_ss->kv));
+		break;
+	default:
+		memcpy(d, s, es);
+		break;
+	}
+}
+
+/* Value addition (SHM_MERGE_SUM) */
+S_INLINE srt_bool aux_can_sum(int t)
+{
+	return t == SHM0_II32 || t == SHM0_UU32 || t == SHM0_II || t == SHM0_SI
+		       ? S_TRUE
+		       : S_FALSE;
+}
+
+static void aux_elem_inc(int t, uint8_t *d, const uint8_t *s)
+{
+	switch (t) {
+	case SHM0_II32:
+		shmcb_inc_ii32(d, &((const struct SHMapii *)s)->v);
+		break;
+	case SHM0_UU32:
+		shmcb_inc_uu32(d, &((const struct SHMapuu *)s)->v);
+		break;
+	case SHM0_II:
+		shmcb_inc_ii64(d, &((const struct SHMapII *)s)->v);
+		break;
+	case SHM0_SI:
+		shmcb_inc_si(d, &((const struct SHMapSI *)s)->v);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Add element 'e' (not in the map) */
+static srt_bool aux_add(srt_hmap **hm, shm_hash_t_ h, const uint8_t *e)
+{
+	size_t i;
+	RETURN_IF(!aux_insert_check(hm), S_FALSE);
+	i = shm_size(*hm);
+	aux_reg_hash(*hm, h, i);
+	shm_set_size(*hm, i + 1);
+	aux_elem_set((*hm)->d.sub_type, (*hm)->d.elem_size,
+		     shm_get_buffer(*hm) + i * (*hm)->d.elem_size, e, S_TRUE);
+	return S_TRUE;
+}
+
+/* Empty map, having the same configuration */
+static srt_hmap *aux_alloc_like(const srt_hmap *hm, size_t n)
+{
+	srt_hmap *h = hm->d.sub_type == SHM0_GEN
+			      ? shm_alloc_gen(hm->ksize, hm->vsize, hm->ghashf,
+					      hm->geqf, n)
+			      : shm_alloc_aux(hm->d.sub_type, n);
+	RETURN_IF(!h || h == shm_void, NULL);
+	h->htype = hm->htype;
+	h->hseed = hm->hseed;
+	shm_set_rehash_step(h, hm->rh_step);
+	return h;
+}
+
+/* Replace map contents with the ones from 'tmp' (releasing it) */
+static srt_bool aux_replace(srt_hmap **hm, srt_hmap *tmp)
+{
+	srt_bool r = S_TRUE;
+	if ((*hm)->d.f.ext_buffer) {
+		r = shm_cpy(hm, tmp) && shm_size(*hm) == shm_size(tmp)
+			    ? S_TRUE
+			    : S_FALSE;
+		shm_free(&tmp);
+	} else {
+		shm_free(hm);
+		*hm = tmp;
+	}
+	return r;
+}
+
+struct SHMSetOp {
+	srt_hmap **hm; /* target */
+	const srt_hmap *y; /* the other operand */
+	srt_hmap *out; /* result (intersection, difference) */
+	enum eSHM_Merge m;
+	srt_bool same_hash;
+	srt_bool from_y; /* visiting 'y' elements */
+};
+
+/* Lookup of the visited element in the other operand */
+S_INLINE const uint8_t *aux_probe(const srt_hmap *o, srt_bool same_hash,
+				  shm_hash_t_ h, const uint8_t *e,
+				  shm_hash_t_ *ho)
+{
+	*ho = same_hash ? h : o->hashf(o, e);
+	return aux_at(o, *ho, o->n2kf(e));
+}
+
+static srt_bool aux_merge_elem(void *context, shm_hash_t_ h, const uint8_t *e)
+{
+	struct SHMSetOp *o = (struct SHMSetOp *)context;
+	shm_hash_t_ hd;
+	uint8_t *d = (uint8_t *)aux_probe(*o->hm, o->same_hash, h, e, &hd);
+	if (!d)
+		return aux_add(o->hm, hd, e);
+	if (o->m == SHM_MERGE_OVERWRITE)
+		aux_elem_set((*o->hm)->d.sub_type, (*o->hm)->d.elem_size, d, e,
+			     S_FALSE);
+	else if (o->m == SHM_MERGE_SUM)
+		aux_elem_inc((*o->hm)->d.sub_type, d, e);
+	return S_TRUE;
+}
+
+static srt_bool aux_intersect_elem(void *context, shm_hash_t_ h,
+				   const uint8_t *e)
+{
+	struct SHMSetOp *o = (struct SHMSetOp *)context;
+	shm_hash_t_ ho;
+	const uint8_t *f;
+	if (o->from_y) {
+		f = aux_probe(*o->hm, o->same_hash, h, e, &ho);
+		return f ? aux_add(&o->out, ho, f) : S_TRUE;
+	}
+	f = aux_probe(o->y, o->same_hash, h, e, &ho);
+	return f ? aux_add(&o->out, h, e) : S_TRUE;
 }
 
+static srt_bool aux_diff_elem(void *context, shm_hash_t_ h, const uint8_t *e)
+{
+	struct SHMSetOp *o = (struct SHMSetOp *)context;
+	shm_hash_t_ ho;
+	const uint8_t *f;
+	if (o->from_y) {
+		ho = o->same_hash ? h : (*o->hm)->hashf(*o->hm, e);
+		del(*o->hm, ho, (*o->hm)->n2kf(e));
+		return S_TRUE;
+	}
+	f = aux_probe(o->y, o->same_hash, h, e, &ho);
+	return f ? S_TRUE : aux_add(&o->out, h, e);
+}
+
+static void aux_setop_init(struct SHMSetOp *o, srt_hmap **hm,
+			   const srt_hmap *y, enum eSHM_Merge m)
+{
+	o->hm = hm;
+	o->y = y;
+	o->out = NULL;
+	o->m = m;
+	o->same_hash = aux_same_hash(*hm, y);
+	o->from_y = S_TRUE;
+}
+
+srt_bool shm_merge(srt_hmap **hm, const srt_hmap *src, enum eSHM_Merge m)
+{
+	srt_bool r;
+	srt_hmap *tmp;
+	struct SHMSetOp o;
+	RETURN_IF(!hm || !*hm || !src || (*hm)->c_off || shm_ro(*hm)
+			  || !aux_same_kind(*hm, src),
+		  S_FALSE);
+	RETURN_IF(m != SHM_MERGE_OVERWRITE && m != SHM_MERGE_KEEP
+			  && (m != SHM_MERGE_SUM
+			      || !aux_can_sum((*hm)->d.sub_type)),
+		  S_FALSE);
+	if (*hm == src) {
+		RETURN_IF(m != SHM_MERGE_SUM, S_TRUE);
+		tmp = shm_dup(src);
+		r = tmp && shm_merge(hm, tmp, m) ? S_TRUE : S_FALSE;
+		shm_free(&tmp);
+		return r;
+	}
+	aux_setop_init(&o, hm, src, m);
+	if (shm_size(*hm) < shm_size(src) && o.same_hash
+	    && !(*hm)->d.f.ext_buffer && !src->c_off) {
+		/*
+		 * Smaller target: start from a source copy (bulk copy, reusing
+		 * the source hash table), and merge the target into it
+		 */
+		tmp = shm_dup(src);
+		RETURN_IF(!tmp, S_FALSE);
+		shm_set_rehash_step(tmp, (*hm)->rh_step);
+		o.hm = &tmp;
+		o.m = m == SHM_MERGE_OVERWRITE
+			      ? SHM_MERGE_KEEP
+			      : m == SHM_MERGE_KEEP ? SHM_MERGE_OVERWRITE : m;
+		if (!aux_each(*hm, aux_merge_elem, &o)) {
+			shm_free(&tmp);
+			return S_FALSE;
+		}
+		return aux_replace(hm, tmp);
+	}
 	/*
-	 * Enumeration
+	 * Pre-size for the maximum result size, i.e. no common keys (no table
+	 * doubling steps while merging)
 	 */
+	if (!(*hm)->d.f.ext_buffer
+	    && !aux_presize(hm, shm_size(*hm) + shm_size(src)))
+		return S_FALSE;
+	return aux_each(src, aux_merge_elem, &o);
+}
+
+srt_bool shm_intersect(srt_hmap **hm, const srt_hmap *src)
+{
+	size_t n;
+	struct SHMSetOp o;
+	RETURN_IF(!hm || !*hm || !src || (*hm)->c_off || shm_ro(*hm)
+			  || !aux_same_kind(*hm, src),
+		  S_FALSE);
+	RETURN_IF(*hm == src, S_TRUE);
+	aux_setop_init(&o, hm, src, SHM_MERGE_KEEP);
+	/* Visit the smaller operand, looking up in the other */
+	o.from_y = shm_size(src) < shm_size(*hm) ? S_TRUE : S_FALSE;
+	n = o.from_y ? shm_size(src) : shm_size(*hm);
+	o.out = aux_alloc_like(*hm, n);
+	RETURN_IF(!o.out, S_FALSE);
+	if (!aux_each(o.from_y ? src : *hm, aux_intersect_elem, &o)) {
+		shm_free(&o.out);
+		return S_FALSE;
+	}
+	return aux_replace(hm, o.out);
+}
+
+srt_bool shm_diff(srt_hmap **hm, const srt_hmap *src)
+{
+	struct SHMSetOp o;
+	RETURN_IF(!hm || !*hm || !src || (*hm)->c_off || shm_ro(*hm)
+			  || !aux_same_kind(*hm, src),
+		  S_FALSE);
+	if (*hm == src) {
+		shm_clear(*hm);
+		return S_TRUE;
+	}
+	aux_setop_init(&o, hm, src, SHM_MERGE_KEEP);
+	/* Smaller source: delete its elements from the target */
+	if (shm_size(src) < shm_size(*hm))
+		return aux_each(src, aux_diff_elem, &o);
+	/* Otherwise, build the result from the target elements */
+	o.from_y = S_FALSE;
+	o.out = aux_alloc_like(*hm, shm_size(*hm));
+	RETURN_IF(!o.out, S_FALSE);
+	if (!aux_each(*hm, aux_diff_elem, &o)) {
+		shm_free(&o.out);
+		return S_FALSE;
+	}
+	return aux_replace(hm, o.out);
+}
+
+/*
+ * Batch access
+ */
+
+#define SHM_BATCH 16
+
+#define SHM_AT_BATCH_X(hm, n, hash_j, key_j, on_result)                       \
+	size_t i, j, nb, cnt = 0;                                              \
+	shm_hash_t_ h[SHM_BATCH];                                              \
+	const void *kp[SHM_BATCH];                                             \
+	const uint8_t *e[SHM_BATCH];                                           \
+	RETURN_IF(!hm || !k, 0);                                               \
+	for (i = 0; i < n; i += nb) {                                          \
+		nb = n - i < SHM_BATCH ? n - i : SHM_BATCH;                    \
+		for (j = 0; j < nb; j++) {                                     \
+			h[j] = hash_j;                                         \
+			kp[j] = key_j;                                         \
+		}                                                              \
+		aux_at_batch(hm, nb, h, kp, e);                                \
+		for (j = 0; j < nb; j++) {                                     \
+			if (e[j])                                              \
+				cnt++;                                         \
+			on_result;                                             \
+		}                                                              \
+	}                                                                      \
+	return cnt
+
+#define SHM_AT_BATCH_I32(hm, k, n, v, NT, def_v)                               \
+	SHM_AT_BATCH_X(hm, n, shm_hash_u32(hm, (uint32_t)k[i + j]),            \
+		       &k[i + j],                                              \
+		       if (v) v[i + j] = e[j] ? ((const NT *)e[j])->v : def_v)
+
+#define SHM_AT_BATCH_I64(hm, k, n, v, NT, n_v, def_v)                          \
+	SHM_AT_BATCH_X(hm, n, shm_hash_u64(hm, (uint64_t)k[i + j]),            \
+		       &k[i + j],                                              \
+		       if (v) v[i + j] = e[j] ? n_v((const NT *)e[j]) : def_v)
+
+#define SHM_AT_BATCH_S(hm, k, n, v, NT, n_v, def_v)                            \
+	SHM_AT_BATCH_X(hm, n, shm_hash_s(hm, k[i + j]), k[i + j],              \
+		       if (v) v[i + j] = e[j] ? n_v((const NT *)e[j]) : def_v)
+
+#define SHM_NV_V(n) (n)->v
+#define SHM_NV_SSO1(n) sso1_get(&(n)->v)
+#define SHM_NV_SSO2(n) sso_get_s2(&(n)->kv)
+#define SHM_FOUND_J if (found) found[i + j] = e[j] ? S_TRUE : S_FALSE
+
+size_t shm_at_batch_ii32(const srt_hmap *hm, const int32_t *k, size_t n,
+			 int32_t *v)
+{
+	SHM_AT_BATCH_I32(hm, k, n, v, struct SHMapii, 0);
+}
+
+size_t shm_at_batch_uu32(const srt_hmap *hm, const uint32_t *k, size_t n,
+			 uint32_t *v)
+{
+	SHM_AT_BATCH_I32(hm, k, n, v, struct SHMapuu, 0);
+}
+
+size_t shm_at_batch_ii(const srt_hmap *hm, const int64_t *k, size_t n,
+		       int64_t *v)
+{
+	SHM_AT_BATCH_I64(hm, k, n, v, struct SHMapII, SHM_NV_V, 0);
+}
+
+size_t shm_at_batch_is(const srt_hmap *hm, const int64_t *k, size_t n,
+		       const srt_string **v)
+{
+	SHM_AT_BATCH_I64(hm, k, n, v, struct SHMapIS, SHM_NV_SSO1, ss_void);
+}
+
+size_t shm_at_batch_ip(const srt_hmap *hm, const int64_t *k, size_t n,
+		       const void **v)
+{
+	SHM_AT_BATCH_I64(hm, k, n, v, struct SHMapIP, SHM_NV_V, NULL);
+}
+
+size_t shm_at_batch_si(const srt_hmap *hm, const srt_string **k, size_t n,
+		       int64_t *v)
+{
+	SHM_AT_BATCH_S(hm, k, n, v, struct SHMapSI, SHM_NV_V, 0);
+}
+
+size_t shm_at_batch_ss(const srt_hmap *hm, const srt_string **k, size_t n,
+		       const srt_string **v)
+{
+	SHM_AT_BATCH_S(hm, k, n, v, struct SHMapSS, SHM_NV_SSO2, ss_void);
+}
+
+size_t shm_at_batch_sp(const srt_hmap *hm, const srt_string **k, size_t n,
+		       const void **v)
+{
+	SHM_AT_BATCH_S(hm, k, n, v, struct SHMapSP, SHM_NV_V, NULL);
+}
+
+size_t shm_count_batch_u(const srt_hmap *hm, const uint32_t *k, size_t n,
+			 srt_bool *found)
+{
+	SHM_AT_BATCH_X(hm, n, shm_hash_u32(hm, k[i + j]), &k[i + j],
+		       SHM_FOUND_J);
+}
+
+size_t shm_count_batch_i(const srt_hmap *hm, const int64_t *k, size_t n,
+			 srt_bool *found)
+{
+	uint32_t k32[SHM_BATCH];
+	if (hm && hm->ksize == 4) {
+		SHM_AT_BATCH_X(hm, n,
+			       shm_hash_u32(hm, k32[j] = (uint32_t)k[i + j]),
+			       &k32[j], SHM_FOUND_J);
+	}
+	RETURN_IF(!hm || hm->ksize != 8, 0);
+	{
+		SHM_AT_BATCH_X(hm, n, shm_hash_u64(hm, (uint64_t)k[i + j]),
+			       &k[i + j], SHM_FOUND_J);
+	}
+}
+
+size_t shm_count_batch_s(const srt_hmap *hm, const srt_string **k, size_t n,
+			 srt_bool *found)
+{
+	SHM_AT_BATCH_X(hm, n, shm_hash_s(hm, k[i + j]), k[i + j],
+		       SHM_FOUND_J);
+}
+
+/*
+ * Enumeration
+ */
 
 #define SHM_ITP_X(t, hm, f, begin, end)                                        \
 	size_t cnt = 0, ms;                                                    \
@@ -894,10 +2894,10 @@ size_t shm_itp_uu32(const srt_hmap *m, size_t begin, size_t end,
 size_t shm_itp_ii(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_ii f,
 		  void *context)
 {
-	const struct SHMapii *e;
+	const struct SHMapII *e;
 	SHM_ITP_X(SHM_II, m, f, begin, end)
 	{
-		e = (const struct SHMapii *)db;
+		e = (const struct SHMapII *)db;
 		if (!f(e->x.k, e->v, context))
 			break;
 	}
@@ -968,3 +2968,163 @@ size_t shm_itp_sp(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_sp f,
 	}
 	return cnt;
 }
+
+/*
+ * Parallel enumeration: every job enumerates one portion of the range,
+ * using the typed shm_itp_*() function
+ */
+
+union SHMItCb {
+	srt_hmap_it_ii32 ii32;
+	srt_hmap_it_uu32 uu32;
+	srt_hmap_it_ii ii;
+	srt_hmap_it_is is;
+	srt_hmap_it_ip ip;
+	srt_hmap_it_si si;
+	srt_hmap_it_ss ss;
+	srt_hmap_it_sp sp;
+};
+
+struct SHMParJob {
+	const srt_hmap *hm;
+	const srt_hmap_par *p;
+	union SHMItCb f;
+	size_t begin, end, nw, chunk;
+	size_t *cnt; /* elements processed, per worker */
+};
+
+static void *aux_par_ctx(const srt_hmap_par *p, size_t w)
+{
+	return p->contexts ? (uint8_t *)p->contexts + w * p->context_size
+			   : NULL;
+}
+
+static void aux_itpp_job(void *job_context, size_t w)
+{
+	struct SHMParJob *j = (struct SHMParJob *)job_context;
+	size_t b, e, c = 0;
+	void *ctx;
+	if (w >= j->nw)
+		return;
+	b = j->begin + w * j->chunk;
+	e = b + j->chunk < j->end ? b + j->chunk : j->end;
+	ctx = aux_par_ctx(j->p, w);
+	if (b < e)
+		switch (j->hm->d.sub_type) {
+		case SHM_II32:
+			c = shm_itp_ii32(j->hm, b, e, j->f.ii32, ctx);
+			break;
+		case SHM_UU32:
+			c = shm_itp_uu32(j->hm, b, e, j->f.uu32, ctx);
+			break;
+		case SHM_II:
+			c = shm_itp_ii(j->hm, b, e, j->f.ii, ctx);
+			break;
+		case SHM_IS:
+			c = shm_itp_is(j->hm, b, e, j->f.is, ctx);
+			break;
+		case SHM_IP:
+			c = shm_itp_ip(j->hm, b, e, j->f.ip, ctx);
+			break;
+		case SHM_SI:
+			c = shm_itp_si(j->hm, b, e, j->f.si, ctx);
+			break;
+		case SHM_SS:
+			c = shm_itp_ss(j->hm, b, e, j->f.ss, ctx);
+			break;
+		case SHM_SP:
+			c = shm_itp_sp(j->hm, b, e, j->f.sp, ctx);
+			break;
+		default:
+			break;
+		}
+	j->cnt[w] = c;
+}
+
+static size_t aux_itpp(int t, const srt_hmap *hm, size_t begin, size_t end,
+		       union SHMItCb f, const srt_hmap_par *p)
+{
+	size_t i, ms, cnt = 0;
+	struct SHMParJob j;
+	RETURN_IF(!hm || t != hm->d.sub_type || !p, 0);
+	ms = shm_size(hm);
+	if (end > ms)
+		end = ms;
+	if (begin > end)
+		begin = end;
+	j.hm = hm;
+	j.p = p;
+	j.f = f;
+	j.begin = begin;
+	j.end = end;
+	j.nw = p->nworkers ? p->nworkers : 1;
+	j.chunk = (end - begin) / j.nw + ((end - begin) % j.nw ? 1 : 0);
+	j.cnt = (size_t *)s_malloc(j.nw * sizeof(size_t));
+	RETURN_IF(!j.cnt, 0);
+	memset(j.cnt, 0, j.nw * sizeof(size_t));
+	if (p->runf)
+		p->runf(p->run_context, j.nw, aux_itpp_job, &j);
+	else
+		for (i = 0; i < j.nw; i++)
+			aux_itpp_job(&j, i);
+	for (i = 0; i < j.nw; i++) {
+		cnt += j.cnt[i];
+		if (p->reducef)
+			p->reducef(p->reduce_context, aux_par_ctx(p, i), i);
+	}
+	s_free(j.cnt);
+	return cnt;
+}
+
+#define SHM_ITPP_X(t, fld)                                                     \
+	union SHMItCb cb;                                                      \
+	cb.fld = f;                                                            \
+	return aux_itpp(t, m, begin, end, cb, p)
+
+size_t shm_itpp_ii32(const srt_hmap *m, size_t begin, size_t end,
+		     srt_hmap_it_ii32 f, const srt_hmap_par *p)
+{
+	SHM_ITPP_X(SHM_II32, ii32);
+}
+
+size_t shm_itpp_uu32(const srt_hmap *m, size_t begin, size_t end,
+		     srt_hmap_it_uu32 f, const srt_hmap_par *p)
+{
+	SHM_ITPP_X(SHM_UU32, uu32);
+}
+
+size_t shm_itpp_ii(const srt_hmap *m, size_t begin, size_t end,
+		   srt_hmap_it_ii f, const srt_hmap_par *p)
+{
+	SHM_ITPP_X(SHM_II, ii);
+}
+
+size_t shm_itpp_is(const srt_hmap *m, size_t begin, size_t end,
+		   srt_hmap_it_is f, const srt_hmap_par *p)
+{
+	SHM_ITPP_X(SHM_IS, is);
+}
+
+size_t shm_itpp_ip(const srt_hmap *m, size_t begin, size_t end,
+		   srt_hmap_it_ip f, const srt_hmap_par *p)
+{
+	SHM_ITPP_X(SHM_IP, ip);
+}
+
+size_t shm_itpp_si(const srt_hmap *m, size_t begin, size_t end,
+		   srt_hmap_it_si f, const srt_hmap_par *p)
+{
+	SHM_ITPP_X(SHM_SI, si);
+}
+
+size_t shm_itpp_ss(const srt_hmap *m, size_t begin, size_t end,
+		   srt_hmap_it_ss f, const srt_hmap_par *p)
+{
+	SHM_ITPP_X(SHM_SS, ss);
+}
+
+size_t shm_itpp_sp(const srt_hmap *m, size_t begin, size_t end,
+		   srt_hmap_it_sp f, const srt_hmap_par *p)
+{
+	SHM_ITPP_X(SHM_SP, sp);
+}
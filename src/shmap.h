@@ -33,6 +33,46 @@ extern "C" {
  * #DOC
  * #DOC	SHM_SP: string key, pointer value
  * #DOC
+ * #DOC	Generic mode (shm_alloc_gen()): fixed-size keys and values (e.g.
+ * #DOC	structs), stored inline, compared and hashed byte-wise (unless
+ * #DOC	callbacks are given). Keys are compared byte by byte, so struct
+ * #DOC	padding must be zeroed (e.g. using memset()).
+ * #DOC
+ * #DOC
+ * #DOC Hash function selection (enum eSHM_Hash, see shm_set_hash()):
+ * #DOC
+ * #DOC
+ * #DOC	SHM_HASH_DEFAULT: multiplicative hash (integer keys), FNV-1A or
+ * #DOC	MurmurHash3 (string keys). Fast, not seeded.
+ * #DOC
+ * #DOC	SHM_HASH_SEEDED: seeded 64-bit mixer (integer keys), wyhash-style
+ * #DOC	seeded 64-bit hash (string keys). Robust for integer keys having
+ * #DOC	patterns (e.g. multiples of powers of two), and faster for long string
+ * #DOC	keys.
+ * #DOC
+ * #DOC	SHM_HASH_RANDOM: SHM_HASH_SEEDED with a random seed (hardening against
+ * #DOC	collision attacks from untrusted keys).
+ * #DOC
+ * #DOC
+ * #DOC Table addressing: by default, bucket hashes and element locations are
+ * #DOC 32-bit (up to 2^32 - 1 elements per map, 8 bytes per bucket, plus
+ * #DOC one tag byte). Building with S_SHM_WIDE defined switches to 64-bit
+ * #DOC hashes and locations (16 bytes per bucket, plus the tag byte), for
+ * #DOC maps beyond that limit. Both the library and the user code must be
+ * #DOC built with the same setting.
+ * #DOC
+ * #DOC
+ * #DOC Cache mode (shm_alloc_cache(), shm_alloca_cache()): bounded-capacity
+ * #DOC map, where inserting a new key when full evicts one element first
+ * #DOC (CLOCK: first element found without the reference mark, clearing the
+ * #DOC marks found on the way; LRU: least recently used element). Elements
+ * #DOC are marked/refreshed when found by a lookup or updated, new elements
+ * #DOC start unmarked under CLOCK. The eviction data is stored in the map
+ * #DOC memory block, indexed by element location, so a hit is a single hash
+ * #DOC table lookup, and the stack-allocated variant never allocates. Batch
+ * #DOC lookups and enumeration don't refresh elements. Caches can not be
+ * #DOC merge/intersect/diff targets, nor saved with shm_save().
+ * #DOC
  * #DOC
  * #DOC Callback types for the shm_itp_*() functions:
  * #DOC
@@ -52,6 +92,25 @@ extern "C" {
  * #DOC	typedef srt_bool (*srt_hmap_it_ss)(const srt_string *, const srt_string *, void *context);
  * #DOC
  * #DOC	typedef srt_bool (*srt_hmap_it_sp)(const srt_string *, const void *, void *context);
+ * #DOC
+ * #DOC
+ * #DOC Parallel enumeration (shm_itpp_*() functions): the [begin, end) range
+ * #DOC is split into one contiguous portion per worker, each enumerated
+ * #DOC with its own callback context. Threads are provided by the user,
+ * #DOC through a job runner callback (e.g. a thread pool), that must call
+ * #DOC the job function once for every job in [0, njobs), in any order and
+ * #DOC concurrently or not, returning once all are done. Without runner,
+ * #DOC jobs are run sequentially by the calling thread. Once all jobs are
+ * #DOC done, the optional reduce callback is called for every worker, in
+ * #DOC worker order (deterministic, independent of the execution order).
+ * #DOC The map must not be modified during the enumeration.
+ * #DOC
+ * #DOC
+ * #DOC	typedef void (*srt_hmap_job_f)(void *job_context, size_t job);
+ * #DOC
+ * #DOC	typedef void (*srt_hmap_run_f)(void *run_context, size_t njobs, srt_hmap_job_f job, void *job_context);
+ * #DOC
+ * #DOC	typedef void (*srt_hmap_reduce_f)(void *reduce_context, void *worker_context, size_t worker);
  *
  * Copyright (c) 2015-2019 F. Aragon. All rights reserved. Released under
  * the BSD 3-Clause License (see the doc/LICENSE file included).
@@ -76,7 +135,8 @@ enum eSHM_Type0 {
 	SHM0_I32,
 	SHM0_U32,
 	SHM0_I,
-	SHM0_S
+	SHM0_S,
+	SHM0_GEN
 };
 
 enum eSHM_Type {
@@ -90,6 +150,23 @@ enum eSHM_Type {
 	SHM_SP = SHM0_SP
 };
 
+enum eSHM_Merge {
+	SHM_MERGE_OVERWRITE, /* common keys: source value */
+	SHM_MERGE_KEEP,	     /* common keys: target value */
+	SHM_MERGE_SUM	     /* common keys: values added (II32, UU32, II, SI) */
+};
+
+enum eSHM_Evict {
+	SHM_EVICT_CLOCK, /* second chance (one reference byte per element) */
+	SHM_EVICT_LRU	 /* least recently used (element list links) */
+};
+
+enum eSHM_Hash {
+	SHM_HASH_DEFAULT,
+	SHM_HASH_SEEDED,
+	SHM_HASH_RANDOM
+};
+
 struct SHMapI {
 	int64_t k;
 };
@@ -136,7 +213,27 @@ struct SHMapSP {
 
 typedef struct S_HMap srt_hmap;
 
-typedef uint32_t shm_eloc_t_; /* element location offset */
+/*
+ * Bucket hash and element location offset: 32-bit (default) or 64-bit
+ * (S_SHM_WIDE, for maps with more than 2^32 - 1 elements)
+ */
+#ifdef S_SHM_WIDE
+typedef uint64_t shm_hash_t_;
+typedef uint64_t shm_eloc_t_;
+#define SHM_HASH_BITS 64
+#define SHM_MAX_HBITS 48
+#else
+typedef uint32_t shm_hash_t_;
+typedef uint32_t shm_eloc_t_;
+#define SHM_HASH_BITS 32
+#define SHM_MAX_HBITS 32
+#endif
+#define SHM_REHASH_DEFAULT_THRESHOLD_PCT 90 /* rehash at 90% of buckets */
+
+/* Generic mode (fixed-size keys and values) user callbacks */
+typedef shm_hash_t_ (*srt_hmap_hash_f)(const void *key, size_t key_size);
+typedef srt_bool (*srt_hmap_eq_f)(const void *a, const void *b,
+				  size_t key_size);
 
 struct SHMBucket {
 	/*
@@ -146,40 +243,122 @@ struct SHMBucket {
 	/*
 	 * Hash of the element (the bucket id would be the N highest bits)
 	 */
-	uint32_t hash;
-	/*
-	 * Bucket collision counter
-	 * 0: Zero elements associated to the bucket. This means that no
-	 *    element with the hash associated to the bucket has been inserted
-	 * >= 1: Number of elements associated to the bucket.
-	 */
-	uint32_t cnt;
+	shm_hash_t_ hash;
+};
+
+/*
+ * Cache mode LRU list links (element location + 1, 0: none), from the
+ * least recently used element to the most recently used one
+ */
+struct SHMCacheLink {
+	shm_eloc_t_ prev;
+	shm_eloc_t_ next;
+};
+
+/* Cache mode state (stored before the eviction data) */
+struct SHMCache {
+	size_t cap; /* capacity */
+	size_t hand; /* CLOCK: next element to check; LRU: oldest elem + 1 */
+	size_t mru; /* LRU: newest element + 1 */
+	uint64_t hits; /* lookups finding the key */
+	uint64_t misses; /* lookups not finding the key */
+	uint64_t evictions; /* elements evicted */
+	uint32_t policy; /* eviction policy (enum eSHM_Evict) */
 };
 
 /*
  * srt_hmap memory layout:
  *
- * | SDataFull | struct fields | struct SHMBucket [N] | elements [M] |
+ * | SDataFull | struct fields | struct SHMBucket [N] | tags [N + P] | elements [M] |
+ *
+ * Bucket tags: one byte per bucket, used for scanning many buckets at once
+ * (0: empty, 1: deleted -only in the previous table, while doing
+ * incremental rehash-, >= 0x80: in use, being the low 7 bits a hash
+ * fingerprint). Deletion shifts back the following buckets of the probe
+ * sequence, so the current table has no deleted buckets. The extra P bytes
+ * replicate the first ones, so tag groups can be loaded without wrapping
+ * around the end of the table.
+ *
+ * Incremental rehash mode (see shm_set_rehash_step()) keeps the buckets
+ * and tags in a separate allocation (rh_tbl), so the table can grow
+ * without moving the elements:
+ *
+ * | SDataFull | struct fields | pad | elements [M] |
+ *
+ * Generic mode (see shm_alloc_gen()) elements: | key | pad | value | pad |,
+ * being the value at the key size rounded up to 8 bytes, and the element
+ * size multiple of 8 bytes.
+ *
+ * Cache mode (see shm_alloc_cache()) adds the cache state and the eviction
+ * data, one entry per element, indexed by element location, between the
+ * tags and the elements:
+ *
+ * | ... | tags [N + P] | struct SHMCache | eviction data [M] | elements [M] |
  */
 
-typedef srt_bool (*shm_eq_f)(const void *key, const void *node);
+#define SHM_TAG_PAD 16
+
+struct S_HMap;
+
+typedef srt_bool (*shm_eq_f)(const struct S_HMap *hm, const void *key,
+			     const void *node);
 typedef void (*shm_del_f)(void *node);
-typedef uint32_t (*shm_hash_f)(const void *node);
+typedef shm_hash_t_ (*shm_hash_f)(const struct S_HMap *hm, const void *node);
 typedef const void *(*shm_n2key_f)(const void *node);
 
 struct S_HMap {
 	struct SDataFull d;
 	uint32_t hbits; /* hash table bits */
-	uint32_t hmask; /* hash table bitmask */
+	shm_hash_t_ hmask; /* hash table bitmask */
 	uint32_t ksize; /* key size, in bytes */
+	uint32_t vsize; /* value size, in bytes (generic mode) */
+	uint32_t htype; /* hash function set (enum eSHM_Hash) */
+	uint64_t hseed; /* hash seed (SHM_HASH_SEEDED) */
 	size_t rh_threshold; /* (1 << hbits) * rh_threshold_pct) / 100 */
 	size_t rh_threshold_pct;
+	size_t rh_step; /* incremental rehash: buckets migrated per update */
+	size_t rh_next; /* incremental rehash: next previous table bucket */
+	void *rh_old; /* incremental rehash: previous table buckets and tags */
+	void *rh_tbl; /* incremental rehash mode: table buckets and tags */
 	shm_eq_f eqf;
 	shm_del_f delf;
 	shm_hash_f hashf;
 	shm_n2key_f n2kf;
+	srt_hmap_hash_f ghashf; /* key hash (generic mode, optional) */
+	srt_hmap_eq_f geqf; /* key equality (generic mode, optional) */
+	size_t c_off; /* cache mode: struct SHMCache offset (0: not a cache) */
+	size_t st_rehashes; /* table rebuilds (growth, hash function change) */
+#ifdef S_SHM_STATS
+	uint64_t st_probes; /* tag groups scanned by lookups */
+	uint64_t st_rehash_clk; /* clock() ticks rebuilding */
+#endif
+};
+
+#define SHM_STATS_CNT_BINS 8
+
+/* Hash map statistics (see shm_stats()) */
+struct SHMStats {
+	size_t size; /* elements */
+	size_t buckets; /* current table buckets */
+	double load_factor; /* elements per bucket */
+	double empty_ratio; /* empty buckets ratio (current table) */
+	double avg_probe; /* average probe distance (from the home bucket) */
+	size_t max_probe; /* max probe distance */
+	/*
+	 * buckets per number of elements having it as home bucket (last
+	 * bin: cnt >= bins - 1)
+	 */
+	size_t cnt_hist[SHM_STATS_CNT_BINS];
+	size_t rehashes; /* table rebuilds (growth, hash function change) */
+	size_t bucket_bytes; /* buckets, tags (and cache eviction data) */
+	size_t elem_bytes; /* element storage (allocated) */
+	size_t str_bytes; /* out-of-line strings */
+	uint64_t probe_steps; /* tag groups scanned (S_SHM_STATS builds) */
+	uint64_t rehash_ns; /* table rebuild CPU time (S_SHM_STATS builds) */
 };
 
+typedef struct SHMStats srt_hmap_stats;
+
 /*
  * Configuration
  */
@@ -190,6 +369,79 @@ struct S_HMap {
 #define SHM_SHASH ss_fnv1a
 #endif
 
+/*
+ * Key hashing, for a given hash function set (enum eSHM_Hash) and seed
+ */
+
+#ifdef S_SHM_WIDE
+S_INLINE shm_hash_t_ shm_hashx_u32(uint32_t htype, uint64_t seed, uint32_t k)
+{
+	return htype != SHM_HASH_DEFAULT ? sh_mix64(k ^ seed) : k * S_GR64;
+}
+
+S_INLINE shm_hash_t_ shm_hashx_u64(uint32_t htype, uint64_t seed, uint64_t k)
+{
+	return htype != SHM_HASH_DEFAULT ? sh_mix64(k ^ seed) : k * S_GR64;
+}
+
+S_INLINE shm_hash_t_ shm_hashx_buf(uint64_t seed, const void *b, size_t n)
+{
+	return sh_wyh64(seed, b, n);
+}
+
+S_INLINE shm_hash_t_ shm_hashx_s(uint32_t htype, uint64_t seed,
+				 const srt_string *k)
+{
+	return shm_hashx_buf(htype != SHM_HASH_DEFAULT ? seed : 0,
+			     ss_get_buffer_r(k), ss_size(k));
+}
+#else
+S_INLINE shm_hash_t_ shm_hashx_u32(uint32_t htype, uint64_t seed, uint32_t k)
+{
+	return htype != SHM_HASH_DEFAULT ? sh_hash32s(k, seed) : sh_hash32(k);
+}
+
+S_INLINE shm_hash_t_ shm_hashx_u64(uint32_t htype, uint64_t seed, uint64_t k)
+{
+	return htype != SHM_HASH_DEFAULT ? sh_hash64s(k, seed) : sh_hash64(k);
+}
+
+S_INLINE shm_hash_t_ shm_hashx_buf(uint64_t seed, const void *b, size_t n)
+{
+	return (uint32_t)(sh_wyh64(seed, b, n) >> 32);
+}
+
+S_INLINE shm_hash_t_ shm_hashx_s(uint32_t htype, uint64_t seed,
+				 const srt_string *k)
+{
+	return htype != SHM_HASH_DEFAULT
+		       ? shm_hashx_buf(seed, ss_get_buffer_r(k), ss_size(k))
+		       : SHM_SHASH(k);
+}
+#endif
+
+/*
+ * Key hashing, using the map hash function set
+ */
+
+S_INLINE shm_hash_t_ shm_hash_u32(const srt_hmap *hm, uint32_t k)
+{
+	return hm ? shm_hashx_u32(hm->htype, hm->hseed, k)
+		  : shm_hashx_u32(SHM_HASH_DEFAULT, 0, k);
+}
+
+S_INLINE shm_hash_t_ shm_hash_u64(const srt_hmap *hm, uint64_t k)
+{
+	return hm ? shm_hashx_u64(hm->htype, hm->hseed, k)
+		  : shm_hashx_u64(SHM_HASH_DEFAULT, 0, k);
+}
+
+S_INLINE shm_hash_t_ shm_hash_s(const srt_hmap *hm, const srt_string *k)
+{
+	return hm ? shm_hashx_s(hm->htype, hm->hseed, k)
+		  : shm_hashx_s(SHM_HASH_DEFAULT, 0, k);
+}
+
 /*
  * Allocation
  */
@@ -233,23 +485,76 @@ S_INLINE size_t sh_hdr0_size()
 	return (sizeof(srt_hmap) / as) * as + (sizeof(srt_hmap) % as ? as : 0);
 }
 
-S_INLINE size_t sh_hdr_size(int t, size_t np2_elems)
+/* Hash table size: buckets and tags */
+S_INLINE size_t sh_tbl_size(size_t np2_elems)
+{
+	return np2_elems * (sizeof(struct SHMBucket) + 1) + SHM_TAG_PAD;
+}
+
+S_INLINE size_t sh_hdr_size_es(size_t es, size_t np2_elems)
 {
-	size_t h0s = sh_hdr0_size(),
-	       es = shm_elem_size(t),
-	       hs = h0s + np2_elems * sizeof(struct SHMBucket),
+	size_t h0s = sh_hdr0_size(), hs = h0s + sh_tbl_size(np2_elems),
 	       hsr = es ? hs % es : 0;
 	return hsr ? hs - hsr + es : hs;
 }
 
-#define BUILD_GET_BUCKETS(fn, TMOD)					\
+S_INLINE size_t sh_hdr_size(int t, size_t np2_elems)
+{
+	return sh_hdr_size_es(shm_elem_size(t), np2_elems);
+}
+
+/* Generic mode value offset and element size */
+S_INLINE size_t shm_gen_voff(size_t key_size)
+{
+	return (key_size + 7) & ~(size_t)7;
+}
+
+S_INLINE size_t shm_gen_elem_size(size_t key_size, size_t value_size)
+{
+	return shm_gen_voff(key_size) + shm_gen_voff(value_size);
+}
+
+/*
+ * Hash table location: after the map header, or out of the map memory block
+ * (incremental rehash mode, see shm_set_rehash_step())
+ */
+#define BUILD_GET_TBL(fn, TMOD)						\
+	S_INLINE TMOD uint8_t *fn(TMOD srt_hmap *hm) {			\
+		return hm->rh_tbl ? (TMOD uint8_t *)hm->rh_tbl :	\
+				    (TMOD uint8_t *)hm + sh_hdr0_size(); \
+	}
+
+#define BUILD_GET_BUCKETS(fn, tblfn, TMOD)				\
 	S_INLINE TMOD struct SHMBucket *fn(TMOD srt_hmap *hm) {		\
-		return (TMOD struct SHMBucket *)((TMOD uint8_t *)hm +	\
-						sh_hdr0_size());	\
+		return (TMOD struct SHMBucket *)tblfn(hm);		\
 	}
 
-BUILD_GET_BUCKETS(shm_get_buckets,)
-BUILD_GET_BUCKETS(shm_get_buckets_r, const)
+/* Non-const type modifier, for the const/non-const accessor pairs */
+#define SHM_RW
+
+BUILD_GET_TBL(shm_get_tbl, SHM_RW)
+BUILD_GET_TBL(shm_get_tbl_r, const)
+BUILD_GET_BUCKETS(shm_get_buckets, shm_get_tbl, SHM_RW)
+BUILD_GET_BUCKETS(shm_get_buckets_r, shm_get_tbl_r, const)
+
+#define BUILD_GET_TAGS(fn, tblfn, TMOD)					\
+	S_INLINE TMOD uint8_t *fn(TMOD srt_hmap *hm) {			\
+		return tblfn(hm) +					\
+		       ((size_t)hm->hmask + 1) * sizeof(struct SHMBucket); \
+	}
+
+BUILD_GET_TAGS(shm_get_tags, shm_get_tbl, SHM_RW)
+BUILD_GET_TAGS(shm_get_tags_r, shm_get_tbl_r, const)
+
+/* Cache mode state ('hm' must be a cache) */
+#define BUILD_GET_CACHE(fn, TMOD)					\
+	S_INLINE TMOD struct SHMCache *fn(TMOD srt_hmap *hm) {		\
+		return (TMOD struct SHMCache *)((TMOD uint8_t *)hm +	\
+						hm->c_off);		\
+	}
+
+BUILD_GET_CACHE(shm_get_cache, SHM_RW)
+BUILD_GET_CACHE(shm_get_cache_r, const)
 
 S_INLINE unsigned shm_s2hb(size_t max_size)
 {
@@ -257,6 +562,48 @@ S_INLINE unsigned shm_s2hb(size_t max_size)
 	return hbits ? hbits : 1;
 }
 
+/* Cache mode: hash table bits (no rehash below the capacity) */
+S_INLINE unsigned shm_cache_hbits(size_t capacity)
+{
+	unsigned hbits = shm_s2hb(capacity);
+	while (hbits < SHM_MAX_HBITS
+	       && s_size_t_pct((size_t)1 << hbits,
+			       SHM_REHASH_DEFAULT_THRESHOLD_PCT)
+			  <= capacity)
+		hbits++;
+	return hbits;
+}
+
+/* Cache mode: state size, rounded up for aligning the eviction data */
+S_INLINE size_t sh_cache_state_size()
+{
+	return (sizeof(struct SHMCache) + 7) & ~(size_t)7;
+}
+
+/* Cache mode: header size, including the cache state and eviction data */
+S_INLINE size_t sh_hdr_size_cache(size_t es, size_t capacity,
+				  enum eSHM_Evict p, size_t *cache_off)
+{
+	size_t co = sh_hdr_size_es(es, (size_t)1 << shm_cache_hbits(capacity)),
+	       hs, hsr;
+	co = (co + 7) & ~(size_t)7;
+	hs = co + sh_cache_state_size()
+	     + capacity
+		       * (p == SHM_EVICT_LRU ? sizeof(struct SHMCacheLink) : 1);
+	hsr = es ? hs % es : 0;
+	if (cache_off)
+		*cache_off = co;
+	return hsr ? hs - hsr + es : hs;
+}
+
+S_INLINE size_t shm_cache_alloc_size(int t, size_t capacity,
+				     enum eSHM_Evict p)
+{
+	return sd_alloc_size_raw(
+		sh_hdr_size_cache(shm_elem_size(t), capacity, p, NULL),
+		shm_elem_size(t), capacity, S_FALSE);
+}
+
 /*
 #API: |Allocate hash map (stack)|hash map type; initial reserve|hmap|O(n)|1;2|
 srt_hmap *shm_alloca(enum eSHM_Type t, size_t n);
@@ -280,6 +627,37 @@ S_INLINE srt_hmap *shm_alloc(enum eSHM_Type t, size_t init_size)
 	return shm_alloc_aux((int)t, init_size);
 }
 
+/* #API: |Set hash function set and seed (if the map is not empty, elements are rehashed)|hmap; hash function set (SHM_HASH_DEFAULT, SHM_HASH_SEEDED, SHM_HASH_RANDOM); seed (SHM_HASH_SEEDED only)|-|O(1) for empty maps, O(n) otherwise|1;2| */
+void shm_set_hash(srt_hmap *hm, enum eSHM_Hash h, uint64_t seed);
+
+/* #API: |Allocate hash map (heap), with hash function selection (see shm_set_hash())|hash map type; initial reserve; hash function set; seed|hmap|O(n)|1;2| */
+S_INLINE srt_hmap *shm_alloc_hash(enum eSHM_Type t, size_t init_size,
+				  enum eSHM_Hash h, uint64_t seed)
+{
+	srt_hmap *hm = shm_alloc_aux((int)t, init_size);
+	shm_set_hash(hm, h, seed);
+	return hm;
+}
+
+/* #API: |Allocate hash map (heap), generic mode: fixed-size keys and values, stored inline. Built-in hash and equality are byte-wise (specialized for 8, 16, 24, and 32-byte keys), and follow shm_set_hash()|key size (bytes); value size (bytes, 0 for no value); key hash function (NULL: built-in); key equality function (NULL: built-in, byte-wise); initial reserve|hmap|O(n)|1;2| */
+srt_hmap *shm_alloc_gen(size_t key_size, size_t value_size, srt_hmap_hash_f hf, srt_hmap_eq_f eqf, size_t init_size);
+
+/*
+#API: |Allocate bounded-capacity cache (stack; see shm_alloc_cache())|hash map type; capacity; eviction policy (SHM_EVICT_CLOCK, SHM_EVICT_LRU)|hmap|O(n)|1;2|
+srt_hmap *shm_alloca_cache(enum eSHM_Type t, size_t capacity, enum eSHM_Evict p);
+*/
+#define shm_alloca_cache(type, capacity, policy)			       \
+	shm_alloc_cache_raw(type, S_TRUE,				       \
+			    s_alloca(shm_cache_alloc_size(type, capacity,      \
+							  policy)),	       \
+			    capacity, policy)
+
+srt_hmap *shm_alloc_cache_raw(int t, srt_bool ext_buf, void *buffer,
+			      size_t capacity, enum eSHM_Evict p);
+
+/* #API: |Allocate bounded-capacity cache (heap): inserting a new key when full evicts one element (O(1)), and lookups (shm_at_*(), shm_count_*()) refresh the element and update the hit/miss counters|hash map type; capacity; eviction policy (SHM_EVICT_CLOCK, SHM_EVICT_LRU)|hmap|O(n)|1;2| */
+srt_hmap *shm_alloc_cache(enum eSHM_Type t, size_t capacity, enum eSHM_Evict p);
+
 SD_BUILDFUNCS_FULL_ST(shm, srt_hmap, 0)
 
 /*
@@ -308,6 +686,9 @@ size_t shm_capacity_left(const srt_hmap *hm);
 srt_bool shm_empty(const srt_hmap *hm)
 */
 
+/* #API: |Set incremental rehash mode: the hash table is kept out of the map memory block, so growing it only allocates the new table (elements are not moved), and the previous table buckets are migrated in steps on every insert/increment/delete call, bounding the per-operation rehash work (the step is raised when required for completing the migration before the next growth; element memory reallocation is not avoided, so you can combine it with shm_reserve() for bounding that, too)|hmap; buckets migrated per update (0: disabled, default; >= 2 recommended)|-|O(n) when enabling it (moving the table out of the map memory block) or when disabling it while migrating; O(1) otherwise|1;2| */
+void shm_set_rehash_step(srt_hmap *hm, size_t step);
+
 /* #API: |Duplicate hash map|input map|output map|O(n)|1;2| */
 srt_hmap *shm_dup(const srt_hmap *src);
 
@@ -325,20 +706,92 @@ void shm_free(srt_hmap **hm, ...)
 #endif
 void shm_free_aux(srt_hmap **s, ...);
 
+/*
+ * Cache mode
+ */
+
+/* #API: |Cache capacity|hmap|maximum number of elements (0: not a cache)|O(1)|1;2| */
+S_INLINE size_t shm_cache_capacity(const srt_hmap *hm)
+{
+	return hm && hm->c_off ? shm_get_cache_r(hm)->cap : 0;
+}
+
+/* #API: |Cache lookups finding the key|hmap|hit count|O(1)|1;2| */
+S_INLINE uint64_t shm_cache_hits(const srt_hmap *hm)
+{
+	return hm && hm->c_off ? shm_get_cache_r(hm)->hits : 0;
+}
+
+/* #API: |Cache lookups not finding the key|hmap|miss count|O(1)|1;2| */
+S_INLINE uint64_t shm_cache_misses(const srt_hmap *hm)
+{
+	return hm && hm->c_off ? shm_get_cache_r(hm)->misses : 0;
+}
+
+/* #API: |Cache evicted elements|hmap|eviction count|O(1)|1;2| */
+S_INLINE uint64_t shm_cache_evictions(const srt_hmap *hm)
+{
+	return hm && hm->c_off ? shm_get_cache_r(hm)->evictions : 0;
+}
+
+/* #API: |Reset cache hit/miss/eviction counters|hmap|-|O(1)|1;2| */
+S_INLINE void shm_cache_reset_stats(srt_hmap *hm)
+{
+	struct SHMCache *c;
+	if (hm && hm->c_off) {
+		c = shm_get_cache(hm);
+		c->hits = c->misses = c->evictions = 0;
+	}
+}
+
 /*
  * Copy
  */
 
-/* #API: |Overwrite map with a map copy|output hash map; input map|output map reference (optional usage)|O(n)|1;2| */
+/* #API: |Overwrite map with a map copy (a cache can be copied into a regular map, or duplicated with shm_dup(), but not used as copy target)|output hash map; input map|output map reference (optional usage)|O(n)|1;2| */
 srt_hmap *shm_cpy(srt_hmap **hm, const srt_hmap *src);
 
+/*
+ * Serialization: the file image is the hash map memory layout (header,
+ * buckets, tags, and elements), plus a section for the strings not fitting
+ * in the in-place small string storage. Loading it requires no rehash: the
+ * file is memory mapped, and only the string references are relocated (no
+ * per-element work at all for maps without such strings). That relocation
+ * is a known limitation: for maps with out-of-line strings, loading is
+ * O(n), touching every element page. The loaded map is read-only. The
+ * image is only valid for the same architecture and library build (pointer
+ * size, byte order, string optimization), which is checked when loading.
+ * Pointer values (IP and SP maps) are saved as-is. Generic mode maps using
+ * hash or equality callbacks can not be saved. The image is written to a
+ * temporary file ("<path>.tmp") and then renamed, so maps already loaded
+ * from a previous image of the same path are not affected.
+ */
+
+/* #API: |Save map image to file|hash map; file path|S_TRUE: OK, S_FALSE: I/O error or not supported (see above)|O(n)|1;2| */
+srt_bool shm_save(const srt_hmap *hm, const char *path);
+
+/* #API: |Load map image from file, using memory mapping when available (file is not modified, and the map is read-only: insert, delete, clear, and the other updates fail or do nothing; use shm_dup() for a writable copy; release it with shm_unmap(), not shm_free()). Maps with out-of-line strings have every string reference relocated when loading (one pass over the elements)|file path; verify image checksum (S_FALSE: header checks only)|hash map (NULL: file error or invalid image)|O(1) for maps without out-of-line strings, O(n) otherwise|1;2| */
+srt_hmap *shm_map_file(const char *path, srt_bool check);
+
+/* #API: |Release map loaded with shm_map_file()|hash map|-|O(1)|1;2| */
+void shm_unmap(srt_hmap **hm);
+
+/*
+ * Statistics
+ */
+
+/* #API: |Hash table statistics: load, probe distances (average, max), home bucket counter histogram, empty buckets, rehash count, and memory usage. Building the library with S_SHM_STATS defined also counts the tag groups scanned by lookups and the time spent rebuilding tables (counters updated by lookups too, so they are approximate when sharing the map between concurrent readers)|hash map; output statistics|-|O(n)|1;2| */
+void shm_stats(const srt_hmap *hm, srt_hmap_stats *st);
+
 /*
  * Random access
  */
 
-const void *shm_at(const srt_hmap *hm, uint32_t h, const void *key, uint32_t *tl);
+/* 'tl': bucket index (if found in the previous table while migrating, it
+ * refers to that one) */
+const void *shm_at(const srt_hmap *hm, shm_hash_t_ h, const void *key, size_t *tl);
 
-S_INLINE const void *shm_at_s(const srt_hmap *hm, uint32_t h, const void *key, uint32_t *tl)
+S_INLINE const void *shm_at_s(const srt_hmap *hm, shm_hash_t_ h, const void *key, size_t *tl)
 {
 	return hm ? shm_at(hm, h, key, tl) : NULL;
 }
@@ -346,40 +799,40 @@ S_INLINE const void *shm_at_s(const srt_hmap *hm, uint32_t h, const void *key, u
 /* #API: |Access to int32:int32 map|hash map; int32 key|int32|O(n), O(1) average amortized|1;2| */
 S_INLINE int32_t shm_at_ii32(const srt_hmap *hm, int32_t k)
 {
-	const struct SHMapii *e = (const struct SHMapii *)
-				shm_at_s(hm, sh_hash32((uint32_t)k), &k, NULL);
+	const struct SHMapii *e = (const struct SHMapii *)shm_at_s(
+		hm, shm_hash_u32(hm, (uint32_t)k), &k, NULL);
 	return e ? e->v : 0;
 }
 
 /* #API: |Access to uint32:uint32 map|hash map; uint32 key|uint32|O(n), O(1) average amortized|1;2| */
 S_INLINE uint32_t shm_at_uu32(const srt_hmap *hm, uint32_t k)
 {
-	const struct SHMapuu *e = (const struct SHMapuu *)
-				shm_at_s(hm, sh_hash32((uint32_t)k), &k, NULL);
+	const struct SHMapuu *e = (const struct SHMapuu *)shm_at_s(
+		hm, shm_hash_u32(hm, (uint32_t)k), &k, NULL);
 	return e ? e->v : 0;
 }
 
 /* #API: |Access to int64_t:int64_t map|hash map; integer key|integer|O(n), O(1) average amortized|1;2| */
 S_INLINE int64_t shm_at_ii(const srt_hmap *hm, int64_t k)
 {
-	const struct SHMapII *e = (const struct SHMapII *)
-				shm_at_s(hm, sh_hash64((uint64_t)k), &k, NULL);
+	const struct SHMapII *e = (const struct SHMapII *)shm_at_s(
+		hm, shm_hash_u64(hm, (uint64_t)k), &k, NULL);
 	return e ? e->v : 0;
 }
 
 /* #API: |Access to integer-string map|hash map; integer key|string|O(n), O(1) average amortized|1;2| */
 S_INLINE const srt_string *shm_at_is(const srt_hmap *hm, int64_t k)
 {
-	const struct SHMapIS *e = (const struct SHMapIS *)
-				shm_at_s(hm, sh_hash64((uint64_t)k), &k, NULL);
+	const struct SHMapIS *e = (const struct SHMapIS *)shm_at_s(
+		hm, shm_hash_u64(hm, (uint64_t)k), &k, NULL);
 	return e ? sso1_get(&e->v) : 0;
 }
 
 /* #API: |Access to integer-pointer map|hash map; integer key|pointer|O(n), O(1) average amortized|1;2| */
 S_INLINE const void *shm_at_ip(const srt_hmap *hm, int64_t k)
 {
-	const struct SHMapIP *e = (const struct SHMapIP *)
-				shm_at_s(hm, sh_hash64((uint64_t)k), &k, NULL);
+	const struct SHMapIP *e = (const struct SHMapIP *)shm_at_s(
+		hm, shm_hash_u64(hm, (uint64_t)k), &k, NULL);
 	return e ? e->v : 0;
 }
 
@@ -387,7 +840,7 @@ S_INLINE const void *shm_at_ip(const srt_hmap *hm, int64_t k)
 S_INLINE int64_t shm_at_si(const srt_hmap *hm, const srt_string *k)
 {
 	const struct SHMapSI *e = (const struct SHMapSI *)
-					shm_at_s(hm, SHM_SHASH(k), k, NULL);
+					shm_at_s(hm, shm_hash_s(hm, k), k, NULL);
 	return e ? e->v : 0;
 }
 
@@ -395,7 +848,7 @@ S_INLINE int64_t shm_at_si(const srt_hmap *hm, const srt_string *k)
 S_INLINE const srt_string *shm_at_ss(const srt_hmap *hm, const srt_string *k)
 {
 	const struct SHMapSS *e = (const struct SHMapSS *)
-					shm_at_s(hm, SHM_SHASH(k), k, NULL);
+					shm_at_s(hm, shm_hash_s(hm, k), k, NULL);
 	return e ? sso_get_s2(&e->kv) : ss_void;
 }
 
@@ -403,10 +856,62 @@ S_INLINE const srt_string *shm_at_ss(const srt_hmap *hm, const srt_string *k)
 S_INLINE const void *shm_at_sp(const srt_hmap *hm, const srt_string *k)
 {
 	const struct SHMapSP *e = (const struct SHMapSP *)
-					shm_at_s(hm, SHM_SHASH(k), k, NULL);
+					shm_at_s(hm, shm_hash_s(hm, k), k, NULL);
 	return e ? e->v : 0;
 }
 
+/* #API: |Access to generic mode map|hash map; key|value (key, if the value size is 0; NULL: not found)|O(n), O(1) average amortized|1;2| */
+S_INLINE const void *shm_at_gen(const srt_hmap *hm, const void *k)
+{
+	const uint8_t *e;
+	RETURN_IF(!hm || hm->d.sub_type != SHM0_GEN || !k, NULL);
+	e = (const uint8_t *)shm_at(hm, hm->hashf(hm, k), k, NULL);
+	return e && hm->vsize ? e + shm_gen_voff(hm->ksize) : e;
+}
+
+/*
+ * Merge and set operations (both maps must be of the same type)
+ */
+
+/* #API: |Merge map into another map (union), pre-sizing the target and reusing the source stored hashes|target hash map; source hash map; policy for keys in both maps (SHM_MERGE_OVERWRITE, SHM_MERGE_KEEP, SHM_MERGE_SUM)|S_TRUE: OK, S_FALSE: error (different map types, SHM_MERGE_SUM not supported for the map type, or not enough memory)|O(n), O(1) average amortized per element|1;2| */
+srt_bool shm_merge(srt_hmap **hm, const srt_hmap *src, enum eSHM_Merge m);
+
+/* #API: |Keep only the map elements having keys in other map (intersection), visiting the smaller one|target hash map; other hash map|S_TRUE: OK, S_FALSE: error|O(n), O(1) average amortized per element|1;2| */
+srt_bool shm_intersect(srt_hmap **hm, const srt_hmap *src);
+
+/* #API: |Delete the map elements having keys in other map (difference), visiting the smaller one|target hash map; other hash map|S_TRUE: OK, S_FALSE: error|O(n), O(1) average amortized per element|1;2| */
+srt_bool shm_diff(srt_hmap **hm, const srt_hmap *src);
+
+/*
+ * Batch access: hash all keys first, prefetch buckets and elements, and
+ * then resolve them (faster than individual calls for big tables, as
+ * cache misses overlap)
+ */
+
+/* #API: |Batch access to int32:int32 map|hash map; int32 keys; key count; output values (0 if not found; NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_at_batch_ii32(const srt_hmap *hm, const int32_t *k, size_t n, int32_t *v);
+
+/* #API: |Batch access to uint32:uint32 map|hash map; uint32 keys; key count; output values (0 if not found; NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_at_batch_uu32(const srt_hmap *hm, const uint32_t *k, size_t n, uint32_t *v);
+
+/* #API: |Batch access to int64_t:int64_t map|hash map; integer keys; key count; output values (0 if not found; NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_at_batch_ii(const srt_hmap *hm, const int64_t *k, size_t n, int64_t *v);
+
+/* #API: |Batch access to integer-string map|hash map; integer keys; key count; output values (empty string if not found; NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_at_batch_is(const srt_hmap *hm, const int64_t *k, size_t n, const srt_string **v);
+
+/* #API: |Batch access to integer-pointer map|hash map; integer keys; key count; output values (NULL if not found; NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_at_batch_ip(const srt_hmap *hm, const int64_t *k, size_t n, const void **v);
+
+/* #API: |Batch access to string-integer map|hash map; string keys; key count; output values (0 if not found; NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_at_batch_si(const srt_hmap *hm, const srt_string **k, size_t n, int64_t *v);
+
+/* #API: |Batch access to string-string map|hash map; string keys; key count; output values (empty string if not found; NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_at_batch_ss(const srt_hmap *hm, const srt_string **k, size_t n, const srt_string **v);
+
+/* #API: |Batch access to string-pointer map|hash map; string keys; key count; output values (NULL if not found; NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_at_batch_sp(const srt_hmap *hm, const srt_string **k, size_t n, const void **v);
+
 /*
  * Existence check
  */
@@ -414,23 +919,38 @@ S_INLINE const void *shm_at_sp(const srt_hmap *hm, const srt_string *k)
 /* #API: |Map element count/check|hash map; 32-bit unsigned integer key|S_TRUE: element found; S_FALSE: not in the map|O(n), O(1) average amortized|1;2| */
 S_INLINE size_t shm_count_u(const srt_hmap *hm, uint32_t k)
 {
-	return shm_at_s(hm, sh_hash32(k), &k, NULL) ? 1 : 0;
+	return shm_at_s(hm, shm_hash_u32(hm, k), &k, NULL) ? 1 : 0;
 }
 
 /* #API: |Map element count/check|hash map; integer key|S_TRUE: element found; S_FALSE: not in the map|O(n), O(1) average amortized|1;2| */
 S_INLINE size_t shm_count_i(const srt_hmap *hm, int64_t k)
 {
 	return hm->ksize == 4 ? shm_count_u(hm, (uint32_t)k) :
-	       hm->ksize == 8 && shm_at_s(hm, sh_hash64((uint64_t)k), &k, NULL)
-								 ? 1 : 0;
+	       hm->ksize == 8 && shm_at_s(hm, shm_hash_u64(hm, (uint64_t)k), &k,
+					  NULL) ? 1 : 0;
 }
 
 /* #API: |Map element count/check|hash map; string key|S_TRUE: element found; S_FALSE: not in the map|O(n), O(1) average amortized|1;2| */
 S_INLINE size_t shm_count_s(const srt_hmap *hm, const srt_string *k)
 {
-	return shm_at_s(hm, SHM_SHASH(k), k, NULL) ? 1 : 0;
+	return shm_at_s(hm, shm_hash_s(hm, k), k, NULL) ? 1 : 0;
+}
+
+/* #API: |Map element count/check (generic mode)|hash map; key|S_TRUE: element found; S_FALSE: not in the map|O(n), O(1) average amortized|1;2| */
+S_INLINE size_t shm_count_gen(const srt_hmap *hm, const void *k)
+{
+	return shm_at_gen(hm, k) ? 1 : 0;
 }
 
+/* #API: |Batch map element count/check|hash map; 32-bit unsigned integer keys; key count; output per-key result (NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_count_batch_u(const srt_hmap *hm, const uint32_t *k, size_t n, srt_bool *found);
+
+/* #API: |Batch map element count/check|hash map; integer keys; key count; output per-key result (NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_count_batch_i(const srt_hmap *hm, const int64_t *k, size_t n, srt_bool *found);
+
+/* #API: |Batch map element count/check|hash map; string keys; key count; output per-key result (NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+size_t shm_count_batch_s(const srt_hmap *hm, const srt_string **k, size_t n, srt_bool *found);
+
 /*
  * Insert
  */
@@ -459,6 +979,9 @@ srt_bool shm_insert_ss(srt_hmap **hm, const srt_string *k, const srt_string *v);
 /* #API: |Insert into string-pointer map|hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
 srt_bool shm_insert_sp(srt_hmap **hm, const srt_string *k, const void *v);
 
+/* #API: |Insert into generic mode map|hash map; key; value (NULL: zero-filled)|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
+srt_bool shm_insert_gen(srt_hmap **hm, const void *k, const void *v);
+
 /* Hash set support (proxy) */
 
 srt_bool shm_insert_i32(srt_hmap **hm, int32_t k);
@@ -482,6 +1005,34 @@ srt_bool shm_inc_ii(srt_hmap **hm, int64_t k, int64_t v);
 /* #API: |Increment into string-int map|hash map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(n), O(1) average amortized|1;2| */
 srt_bool shm_inc_si(srt_hmap **hm, const srt_string *k, int64_t v);
 
+/*
+ * Find or insert: pointer to the value of the element having the key,
+ * inserting it (with value 0 or NULL) if not in the map, for updating it
+ * in place with a single hash and lookup (the pointer is valid until the
+ * next map modification). In cache mode, found elements are refreshed.
+ */
+
+/* #API: |Find or insert element into int32-int32 map|hash map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(n), O(1) average amortized|1;2| */
+int32_t *shm_emplace_ii32(srt_hmap **hm, int32_t k, srt_bool *is_new);
+
+/* #API: |Find or insert element into uint32-uint32 map|hash map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(n), O(1) average amortized|1;2| */
+uint32_t *shm_emplace_uu32(srt_hmap **hm, uint32_t k, srt_bool *is_new);
+
+/* #API: |Find or insert element into int-int map|hash map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(n), O(1) average amortized|1;2| */
+int64_t *shm_emplace_ii(srt_hmap **hm, int64_t k, srt_bool *is_new);
+
+/* #API: |Find or insert element into int-pointer map|hash map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(n), O(1) average amortized|1;2| */
+const void **shm_emplace_ip(srt_hmap **hm, int64_t k, srt_bool *is_new);
+
+/* #API: |Find or insert element into string-int map|hash map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(n), O(1) average amortized|1;2| */
+int64_t *shm_emplace_si(srt_hmap **hm, const srt_string *k, srt_bool *is_new);
+
+/* #API: |Find or insert element into string-pointer map|hash map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(n), O(1) average amortized|1;2| */
+const void **shm_emplace_sp(srt_hmap **hm, const srt_string *k, srt_bool *is_new);
+
+/* #API: |Find or insert element into generic mode map (e.g. for updating a struct value in place)|hash map; key; output: S_TRUE if inserted (optional)|value pointer (key pointer, if the value size is 0; NULL: insertion error)|O(n), O(1) average amortized|1;2| */
+void *shm_emplace_gen(srt_hmap **hm, const void *k, srt_bool *is_new);
+
 /*
  * Delete
  */
@@ -492,6 +1043,9 @@ srt_bool shm_delete_i(srt_hmap *hm, int64_t k);
 /* #API: |Delete map element|hash map; string key|S_TRUE: found and deleted; S_FALSE: not found|O(n), O(1) average amortized|1;2| */
 srt_bool shm_delete_s(srt_hmap *hm, const srt_string *k);
 
+/* #API: |Delete map element (generic mode)|hash map; key|S_TRUE: found and deleted; S_FALSE: not found|O(n), O(1) average amortized|1;2| */
+srt_bool shm_delete_gen(srt_hmap *hm, const void *k);
+
 /*
  * Enumeration
  */
@@ -589,6 +1143,20 @@ S_INLINE const void *shm_it_sp_v(const srt_hmap *hm, size_t i)
 	S_SHM_ENUM_AUX_V(SHM_SP, struct SHMapSP, hm, i, n->v, NULL);
 }
 
+/* #API: |Enumerate generic mode map keys|hash map; element, 0 to n - 1|key (NULL: out of range)|O(1)|1;2| */
+S_INLINE const void *shm_it_gen_k(const srt_hmap *hm, size_t i)
+{
+	RETURN_IF(!hm || hm->d.sub_type != SHM0_GEN, NULL);
+	return shm_enum_r(hm, i);
+}
+
+/* #API: |Enumerate generic mode map values|hash map; element, 0 to n - 1|value (NULL: out of range)|O(1)|1;2| */
+S_INLINE const void *shm_it_gen_v(const srt_hmap *hm, size_t i)
+{
+	const uint8_t *n = (const uint8_t *)shm_it_gen_k(hm, i);
+	return n ? n + shm_gen_voff(hm->ksize) : NULL;
+}
+
 /*
  * Enumeration, with callback helper
  */
@@ -626,6 +1194,52 @@ size_t shm_itp_ss(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_ss f,
 /* #API: |Enumerate map elements in portions|map; index start; index end; callback function; callback function context|Elements processed|O(n)|1;2| */
 size_t shm_itp_sp(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_sp f, void *context);
 
+/*
+ * Parallel enumeration
+ */
+
+typedef void (*srt_hmap_job_f)(void *job_context, size_t job);
+typedef void (*srt_hmap_run_f)(void *run_context, size_t njobs,
+			       srt_hmap_job_f job, void *job_context);
+typedef void (*srt_hmap_reduce_f)(void *reduce_context, void *worker_context,
+				  size_t worker);
+
+struct SHMPar {
+	size_t nworkers; /* number of portions (0: 1) */
+	srt_hmap_run_f runf; /* job runner (NULL: sequential) */
+	void *run_context;
+	void *contexts; /* per-worker callback contexts array (or NULL) */
+	size_t context_size; /* per-worker context size, in bytes */
+	srt_hmap_reduce_f reducef; /* optional, called in worker order */
+	void *reduce_context;
+};
+
+typedef struct SHMPar srt_hmap_par;
+
+/* #API: |Enumerate map elements in parallel|map; index start; index end; callback function; parallel enumeration setup|Elements processed|O(n)|1;2| */
+size_t shm_itpp_ii32(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_ii32 f, const srt_hmap_par *p);
+
+/* #API: |Enumerate map elements in parallel|map; index start; index end; callback function; parallel enumeration setup|Elements processed|O(n)|1;2| */
+size_t shm_itpp_uu32(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_uu32 f, const srt_hmap_par *p);
+
+/* #API: |Enumerate map elements in parallel|map; index start; index end; callback function; parallel enumeration setup|Elements processed|O(n)|1;2| */
+size_t shm_itpp_ii(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_ii f, const srt_hmap_par *p);
+
+/* #API: |Enumerate map elements in parallel|map; index start; index end; callback function; parallel enumeration setup|Elements processed|O(n)|1;2| */
+size_t shm_itpp_is(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_is f, const srt_hmap_par *p);
+
+/* #API: |Enumerate map elements in parallel|map; index start; index end; callback function; parallel enumeration setup|Elements processed|O(n)|1;2| */
+size_t shm_itpp_ip(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_ip f, const srt_hmap_par *p);
+
+/* #API: |Enumerate map elements in parallel|map; index start; index end; callback function; parallel enumeration setup|Elements processed|O(n)|1;2| */
+size_t shm_itpp_si(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_si f, const srt_hmap_par *p);
+
+/* #API: |Enumerate map elements in parallel|map; index start; index end; callback function; parallel enumeration setup|Elements processed|O(n)|1;2| */
+size_t shm_itpp_ss(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_ss f, const srt_hmap_par *p);
+
+/* #API: |Enumerate map elements in parallel|map; index start; index end; callback function; parallel enumeration setup|Elements processed|O(n)|1;2| */
+size_t shm_itpp_sp(const srt_hmap *m, size_t begin, size_t end, srt_hmap_it_sp f, const srt_hmap_par *p);
+
 #ifdef __cplusplus
 } /* extern "C" { */
 #endif
@@ -72,6 +72,15 @@ S_INLINE srt_hset *shs_alloc(enum eSHS_Type t, size_t init_size)
 	return shm_alloc_aux((int)t, init_size);
 }
 
+/* #API: |Allocate hash set (heap), with hash function selection (see shm_set_hash())|set type; initial reserve; hash function set; seed|hash set|O(n)|1;2| */
+S_INLINE srt_hset *shs_alloc_hash(enum eSHS_Type t, size_t init_size,
+				  enum eSHM_Hash h, uint64_t seed)
+{
+	srt_hset *hs = shm_alloc_aux((int)t, init_size);
+	shm_set_hash(hs, h, seed);
+	return hs;
+}
+
 /* #API: |Ensure space for extra elements|hash set;number of extra elements|extra size allocated|O(1)|1;2| */
 S_INLINE size_t shs_grow(srt_hset **hs, size_t extra_elems)
 {
@@ -120,6 +129,18 @@ S_INLINE srt_bool shs_empty(const srt_hset *hs)
 	return shm_empty(hs);
 }
 
+/* #API: |Set incremental rehash mode (see shm_set_rehash_step())|hash set; buckets migrated per update (0: disabled, default; >= 2 recommended)|-|O(1); O(n) if disabling while migrating|1;2| */
+S_INLINE void shs_set_rehash_step(srt_hset *hs, size_t step)
+{
+	shm_set_rehash_step(hs, step);
+}
+
+/* #API: |Set hash function set and seed (see shm_set_hash())|hash set; hash function set (SHM_HASH_DEFAULT, SHM_HASH_SEEDED, SHM_HASH_RANDOM); seed (SHM_HASH_SEEDED only)|-|O(1) for empty sets, O(n) otherwise|1;2| */
+S_INLINE void shs_set_hash(srt_hset *hs, enum eSHM_Hash h, uint64_t seed)
+{
+	shm_set_hash(hs, h, seed);
+}
+
 /* #API: |Duplicate hash set|input hash setoutput hash set|O(n)|1;2| */
 S_INLINE srt_hset *shs_dup(const srt_hset *src)
 {
@@ -152,6 +173,28 @@ S_INLINE srt_hset *shs_cpy(srt_hset **hs, const srt_hset *src)
 	return shm_cpy(hs, src);
 }
 
+/*
+ * Serialization (see shm_save())
+ */
+
+/* #API: |Save set image to file|hash set; file path|S_TRUE: OK, S_FALSE: I/O error|O(n)|1;2| */
+S_INLINE srt_bool shs_save(const srt_hset *hs, const char *path)
+{
+	return shm_save(hs, path);
+}
+
+/* #API: |Load set image from file, using memory mapping when available (read-only set, see shm_map_file())|file path; verify image checksum (S_FALSE: header checks only)|hash set (NULL: file error or invalid image)|O(1) for sets without out-of-line strings, O(n) otherwise|1;2| */
+S_INLINE srt_hset *shs_map_file(const char *path, srt_bool check)
+{
+	return shm_map_file(path, check);
+}
+
+/* #API: |Release set loaded with shs_map_file()|hash set|-|O(1)|1;2| */
+S_INLINE void shs_unmap(srt_hset **hs)
+{
+	shm_unmap(hs);
+}
+
 /*
  * Existence check
  */
@@ -174,6 +217,24 @@ S_INLINE size_t shs_count_s(const srt_hset *hs, const srt_string *k)
 	return shm_count_s(hs, k);
 }
 
+/* #API: |Batch set element count/check|hash set; 32-bit unsigned integer keys; key count; output per-key result (NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+S_INLINE size_t shs_count_batch_u(const srt_hset *hs, const uint32_t *k, size_t n, srt_bool *found)
+{
+	return shm_count_batch_u(hs, k, n, found);
+}
+
+/* #API: |Batch set element count/check|hash set; integer keys; key count; output per-key result (NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+S_INLINE size_t shs_count_batch_i(const srt_hset *hs, const int64_t *k, size_t n, srt_bool *found)
+{
+	return shm_count_batch_i(hs, k, n, found);
+}
+
+/* #API: |Batch set element count/check|hash set; string keys; key count; output per-key result (NULL: count only)|Number of keys found|O(n), O(1) average amortized per key|1;2| */
+S_INLINE size_t shs_count_batch_s(const srt_hset *hs, const srt_string **k, size_t n, srt_bool *found)
+{
+	return shm_count_batch_s(hs, k, n, found);
+}
+
 /*
  * Insert
  */
@@ -218,6 +279,28 @@ S_INLINE srt_bool shs_delete_s(srt_hset *hs, const srt_string *k)
 	return shm_delete_s(hs, k);
 }
 
+/*
+ * Set operations (both sets must be of the same type)
+ */
+
+/* #API: |Add elements from other set (union)|target hash set; source hash set|S_TRUE: OK, S_FALSE: error|O(n), O(1) average amortized per element|1;2| */
+S_INLINE srt_bool shs_union(srt_hset **hs, const srt_hset *src)
+{
+	return shm_merge(hs, src, SHM_MERGE_KEEP);
+}
+
+/* #API: |Keep only elements in other set (intersection)|target hash set; other hash set|S_TRUE: OK, S_FALSE: error|O(n), O(1) average amortized per element|1;2| */
+S_INLINE srt_bool shs_intersect(srt_hset **hs, const srt_hset *src)
+{
+	return shm_intersect(hs, src);
+}
+
+/* #API: |Delete elements in other set (difference)|target hash set; other hash set|S_TRUE: OK, S_FALSE: error|O(n), O(1) average amortized per element|1;2| */
+S_INLINE srt_bool shs_diff(srt_hset **hs, const srt_hset *src)
+{
+	return shm_diff(hs, src);
+}
+
 /*
  * Enumeration
  */
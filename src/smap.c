@@ -31,8 +31,7 @@ static int cmp_I(const struct SMapI *a, const struct SMapI *b)
 
 static int cmp_s(const struct SMapS *a, const struct SMapS *b)
 {
-	return ss_cmp(sso_get((const srt_stringo *)&a->k),
-		      sso_get((const srt_stringo *)&b->k));
+	return sso_cmp((const srt_stringo *)&a->k, (const srt_stringo *)&b->k);
 }
 
 static void rw_inc_SM_II32(srt_tnode *node, const srt_tnode *new_data,
@@ -103,6 +102,58 @@ static void rw_inc_SM_SI(srt_tnode *node, const srt_tnode *new_data,
 			((const struct SMapSI *)new_data)->v;
 }
 
+/* Insert or overwrite the value (e.g. snapshot replay) */
+static void rw_set_SM_SP(srt_tnode *node, const srt_tnode *new_data,
+			 srt_bool existing)
+{
+	if (!existing)
+		rw_add_SM_SP(node, new_data, existing);
+	else
+		((struct SMapSP *)node)->v =
+			((const struct SMapSP *)new_data)->v;
+}
+
+static void rw_set_SM_SI(srt_tnode *node, const srt_tnode *new_data,
+			 srt_bool existing)
+{
+	if (!existing)
+		rw_add_SM_SI(node, new_data, existing);
+	else
+		((struct SMapSI *)node)->v =
+			((const struct SMapSI *)new_data)->v;
+}
+
+/*
+ * The new value is already a copy, owned by the map after the insertion
+ * (existing elements: the previous value is released)
+ */
+static void rw_add_SM_IS(srt_tnode *node, const srt_tnode *new_data,
+			 srt_bool existing)
+{
+	if (existing) {
+		sso1_free(&((struct SMapIS *)node)->v);
+		((struct SMapIS *)node)->v =
+			((const struct SMapIS *)new_data)->v;
+	}
+}
+
+/* Find or insert: existing nodes are not modified */
+static void rw_keep(srt_tnode *node, const srt_tnode *new_data,
+		    srt_bool existing)
+{
+	(void)node;
+	(void)new_data;
+	(void)existing;
+}
+
+static void rw_emplace_SM_SX(srt_tnode *node, const srt_tnode *new_data,
+			     srt_bool existing)
+{
+	if (!existing)
+		sso1_set(&((struct SMapS *)node)->k,
+			 sso1_get(&((const struct SMapS *)new_data)->k));
+}
+
 static void aux_is_delete(void *node)
 {
 	sso1_free(&((struct SMapIS *)node)->v);
@@ -118,6 +169,21 @@ static void aux_ss_delete(void *node)
 	sso_free(&((struct SMapSS *)node)->s);
 }
 
+static srt_tree_callback sm_delete_cb(int t)
+{
+	switch (t) {
+	case SM0_IS:
+		return aux_is_delete;
+	case SM0_SS:
+		return aux_ss_delete;
+	case SM0_S:
+	case SM0_SI:
+	case SM0_SP:
+		return aux_sx_delete;
+	}
+	return NULL;
+}
+
 struct SV2X {
 	srt_vector *kv, *vv;
 };
@@ -247,53 +313,255 @@ S_INLINE srt_bool sm_i32_range(int64_t k)
 	return k >= INT32_MIN && k <= INT32_MAX ? S_TRUE : S_FALSE;
 }
 
-SM_ENUM_INORDER_XX(sm_itr_ii32, srt_map_it_ii32, SM_II32, int32_t,
+/* Integer keys (B+tree index support) */
+S_INLINE srt_bool sm_bt_type(enum eSM_Type0 t)
+{
+	return t == SM0_II32 || t == SM0_UU32 || t == SM0_II || t == SM0_IS
+			       || t == SM0_IP || t == SM0_I || t == SM0_I32
+			       || t == SM0_U32
+		       ? S_TRUE
+		       : S_FALSE;
+}
+
+S_INLINE int64_t sm_bt_key(const srt_map *m, const srt_tnode *n)
+{
+	switch (m->d.sub_type) {
+	case SM0_II32:
+	case SM0_I32:
+		return ((const struct SMapi *)n)->k;
+	case SM0_UU32:
+	case SM0_U32:
+		return ((const struct SMapu *)n)->k;
+	default:
+		return ((const struct SMapI *)n)->k;
+	}
+}
+
+/*
+ * Search node for an integer key, clipped to the map key range
+ */
+
+union SMapKeyI {
+	struct SMapI i;
+	struct SMapi i32;
+	struct SMapu u32;
+};
+
+#define SM_KEY_ERR 2
+
+/* Returns 0: key in range, -1/1: below/above (clipped), SM_KEY_ERR */
+static int sm_key_i(const srt_map *m, int64_t *k, union SMapKeyI *u)
+{
+	int r = 0;
+	int64_t kmin = INT64_MIN, kmax = INT64_MAX;
+	RETURN_IF(!m, SM_KEY_ERR);
+	switch (m->d.sub_type) {
+	case SM0_II32:
+	case SM0_I32:
+		kmin = INT32_MIN;
+		kmax = INT32_MAX;
+		break;
+	case SM0_UU32:
+	case SM0_U32:
+		kmin = 0;
+		kmax = UINT32_MAX;
+		break;
+	case SM0_II:
+	case SM0_IS:
+	case SM0_IP:
+	case SM0_I:
+		break;
+	default:
+		return SM_KEY_ERR; /* BEHAVIOR: not an integer-key map */
+	}
+	if (*k < kmin) {
+		*k = kmin;
+		r = -1;
+	} else if (*k > kmax) {
+		*k = kmax;
+		r = 1;
+	}
+	if (sm_chk_Ix(m))
+		u->i.k = *k;
+	else if (kmin)
+		u->i32.k = (int32_t)*k;
+	else
+		u->u32.k = (uint32_t)*k;
+	return r;
+}
+
+/*
+ * Node operations, using the map index (B+tree, if any, or the RB tree)
+ */
+
+static const srt_tnode *sm_locate(const srt_map *m, const srt_tnode *n)
+{
+	RETURN_IF(!sm_size(m), NULL);
+	RETURN_IF(!m->bt, st_locate(m, n));
+	return get_node_r(m, sbt_at(m->bt, sm_bt_key(m, n)));
+}
+
+/*
+ * Snapshot support: keys modified since the last snapshot
+ */
+
+struct SMapLog {
+	srt_map *keys;	     /* integer or string set */
+	const srt_map *last; /* last snapshot */
+	srt_bool all;	     /* full copy required (e.g. after sm_clear()) */
+};
+
+S_INLINE const srt_string *sm_node_key_s(const srt_tnode *n)
+{
+	return sso_get((const srt_stringo *)&((const struct SMapS *)n)->k);
+}
+
+static void sm_log(srt_map *m, const srt_tnode *n)
+{
+	struct SMapI ki;
+	struct SMapS ks;
+	const srt_tnode *kn;
+	struct SMapLog *l = m->log;
+	if (l->all)
+		return;
+	if (sm_bt_type((enum eSM_Type0)m->d.sub_type)) {
+		ki.k = sm_bt_key(m, n);
+		kn = (const srt_tnode *)&ki;
+	} else {
+		sso1_setref(&ks.k, sm_node_key_s(n));
+		kn = (const srt_tnode *)&ks;
+	}
+	if (sm_locate(l->keys, kn))
+		return;
+	if (kn == (const srt_tnode *)&ks)
+		sso1_set(&ks.k, sm_node_key_s(n));
+	if (!sm_insert_node(&l->keys, kn, NULL, NULL)) {
+		if (kn == (const srt_tnode *)&ks)
+			sso1_free(&ks.k);
+		l->all = S_TRUE; /* BEHAVIOR: allocation error */
+	}
+}
+
+static void sm_log_free(srt_map *m)
+{
+	if (m->log) {
+		sm_free(&m->log->keys);
+		s_free(m->log);
+		m->log = NULL;
+	}
+}
+
+srt_tnode *sm_insert_node(srt_map **m, const srt_tnode *n,
+			  srt_tree_rewrite rw_f, srt_bool *is_new)
+{
+	size_t ts;
+	srt_tndx *x;
+	srt_tnode *node;
+	srt_bool ins = S_FALSE;
+	RETURN_IF(!m || !*m, NULL);
+	if ((*m)->log)
+		sm_log(*m, n);
+	if (!(*m)->bt)
+		return st_insert_rw_node((srt_tree **)m, n, rw_f, is_new);
+	ts = sm_size(*m);
+	/* BEHAVIOR: map reaching capability limit */
+	RETURN_IF(ts >= ST_NDX_MAX || !sm_grow(m, 1), NULL);
+	x = sbt_insert(&(*m)->bt, sm_bt_key(*m, n), (srt_tndx)ts, &ins);
+	RETURN_IF(!x, NULL);
+	node = st_enum(*m, *x);
+	if (ins) {
+		memcpy(node, n, (*m)->d.elem_size);
+		sm_set_size(*m, ts + 1);
+		if (rw_f)
+			rw_f(node, n, S_FALSE);
+	} else if (rw_f) {
+		rw_f(node, n, S_TRUE);
+	} else {
+		memcpy(node, n, (*m)->d.elem_size);
+	}
+	if (is_new)
+		*is_new = ins;
+	return node;
+}
+
+S_INLINE srt_bool sm_insert_rw(srt_map **m, const srt_tnode *n,
+			       srt_tree_rewrite rw_f)
+{
+	return sm_insert_node(m, n, rw_f, NULL) ? S_TRUE : S_FALSE;
+}
+
+static srt_bool sm_delete_node(srt_map *m, const srt_tnode *n,
+			       srt_tree_callback callback)
+{
+	size_t last;
+	srt_tndx x;
+	srt_tnode *dn;
+	const srt_tnode *ln;
+	if (m->log)
+		sm_log(m, n);
+	RETURN_IF(!m->bt, st_delete(m, n, callback));
+	RETURN_IF(!sbt_delete(m->bt, sm_bt_key(m, n), &x), S_FALSE);
+	dn = st_enum(m, x);
+	if (callback)
+		callback(dn);
+	/* Keep the element vector compact (as st_delete()) */
+	last = sm_size(m) - 1;
+	if (x != last) {
+		ln = st_enum_r(m, (srt_tndx)last);
+		sbt_set(m->bt, sm_bt_key(m, ln), x);
+		memcpy(dn, ln, m->d.elem_size);
+	}
+	sm_set_size(m, last);
+	return S_TRUE;
+}
+
+SM_ENUM_INORDER_XX(sm_itr_ii32, srt_map_it_ii32, SM_II32, int32_t, kmin, kmax,
 		   cmp_ni_i((const struct SMapi *)cn, kmin),
 		   cmp_ni_i((const struct SMapi *)cn, kmax),
 		   f(((const struct SMapi *)cn)->k,
 		     ((const struct SMapii *)cn)->v, context))
 
-SM_ENUM_INORDER_XX(sm_itr_uu32, srt_map_it_uu32, SM_UU32, uint32_t,
-		   cmp_nu_u((const struct SMapu *)cn, kmin),
+SM_ENUM_INORDER_XX(sm_itr_uu32, srt_map_it_uu32, SM_UU32, uint32_t, kmin,
+		   kmax, cmp_nu_u((const struct SMapu *)cn, kmin),
 		   cmp_nu_u((const struct SMapu *)cn, kmax),
 		   f(((const struct SMapu *)cn)->k,
 		     ((const struct SMapuu *)cn)->v, context))
 
-SM_ENUM_INORDER_XX(sm_itr_ii, srt_map_it_ii, SM_II, int64_t,
+SM_ENUM_INORDER_XX(sm_itr_ii, srt_map_it_ii, SM_II, int64_t, kmin, kmax,
 		   cmp_nI_I((const struct SMapI *)cn, kmin),
 		   cmp_nI_I((const struct SMapI *)cn, kmax),
 		   f(((const struct SMapI *)cn)->k,
 		     ((const struct SMapII *)cn)->v, context))
 
 SM_ENUM_INORDER_XX(
-	sm_itr_is, srt_map_it_is, SM_IS, int64_t,
+	sm_itr_is, srt_map_it_is, SM_IS, int64_t, kmin, kmax,
 	cmp_nI_I((const struct SMapI *)cn, kmin),
 	cmp_nI_I((const struct SMapI *)cn, kmax),
 	f(((const struct SMapI *)cn)->k,
 	  sso_get((const srt_stringo *)&((const struct SMapIS *)cn)->v),
 	  context))
 
-SM_ENUM_INORDER_XX(sm_itr_ip, srt_map_it_ip, SM_IP, int64_t,
+SM_ENUM_INORDER_XX(sm_itr_ip, srt_map_it_ip, SM_IP, int64_t, kmin, kmax,
 		   cmp_nI_I((const struct SMapI *)cn, kmin),
 		   cmp_nI_I((const struct SMapI *)cn, kmax),
 		   f(((const struct SMapI *)cn)->k,
 		     ((const struct SMapIP *)cn)->v, context))
 
 SM_ENUM_INORDER_XX(
-	sm_itr_si, srt_map_it_si, SM_SI, const srt_string *,
+	sm_itr_si, srt_map_it_si, SM_SI, const srt_string *, 0, 0,
 	cmp_ns_s((const struct SMapS *)cn, kmin),
 	cmp_ns_s((const struct SMapS *)cn, kmax),
 	f(sso_get((const srt_stringo *)&((const struct SMapS *)cn)->k),
 	  ((const struct SMapSI *)cn)->v, context))
 
-SM_ENUM_INORDER_XX(sm_itr_ss, srt_map_it_ss, SM_SS, const srt_string *,
-		   cmp_ns_s((const struct SMapS *)cn, kmin),
+SM_ENUM_INORDER_XX(sm_itr_ss, srt_map_it_ss, SM_SS, const srt_string *, 0,
+		   0, cmp_ns_s((const struct SMapS *)cn, kmin),
 		   cmp_ns_s((const struct SMapS *)cn, kmax),
 		   f(sso_get(&((const struct SMapSS *)cn)->s),
 		     sso_get_s2(&((const struct SMapSS *)cn)->s), context))
 
 SM_ENUM_INORDER_XX(
-	sm_itr_sp, srt_map_it_sp, SM_SP, const srt_string *,
+	sm_itr_sp, srt_map_it_sp, SM_SP, const srt_string *, 0, 0,
 	cmp_ns_s((const struct SMapS *)cn, kmin),
 	cmp_ns_s((const struct SMapS *)cn, kmax),
 	f(sso_get((const srt_stringo *)&((const struct SMapS *)cn)->k),
@@ -324,6 +592,26 @@ srt_map *sm_alloc0(enum eSM_Type0 t, size_t init_size)
 	return m;
 }
 
+srt_map *sm_alloc_ranked0(enum eSM_Type0 t, size_t init_size)
+{
+	srt_map *m = (srt_map *)st_alloc_ranked(
+		type2cmpf(t), sm_elem_size((int)t), init_size);
+	if (m)
+		m->d.sub_type = (uint8_t)t;
+	return m;
+}
+
+srt_map *sm_alloc_btree0(enum eSM_Type0 t, size_t init_size)
+{
+	srt_map *m = sm_alloc0(t, init_size);
+	if (m && sm_bt_type(t)) {
+		m->bt = sbt_alloc(init_size / SBT_MIN_FILL + 1);
+		if (!m->bt)
+			sm_free(&m); /* BEHAVIOR: allocation error */
+	}
+	return m;
+}
+
 void sm_free_aux(srt_map **m, ...)
 {
 	va_list ap;
@@ -333,6 +621,10 @@ void sm_free_aux(srt_map **m, ...)
 	while (!s_varg_tail_ptr_tag(next)) { /* last element tag */
 		if (next) {
 			sm_clear(*next); /* release associated dyn. memory */
+			if (*next) {
+				sbt_free(&(*next)->bt);
+				sm_log_free(*next);
+			}
 			sd_free((srt_data **)next);
 		}
 		next = (srt_map **)va_arg(ap, srt_map **);
@@ -346,24 +638,91 @@ srt_map *sm_dup(const srt_map *src)
 	return sm_cpy(&m, src);
 }
 
-void sm_clear(srt_map *m)
+srt_map *sm_from_sorted0(enum eSM_Type0 t, const srt_vector *kv,
+			 const srt_vector *vv)
 {
-	srt_tree_callback delete_callback = NULL;
-	if (!m || !m->d.size)
-		return;
-	switch (m->d.sub_type) {
-	case SM0_IS:
-		delete_callback = aux_is_delete;
+	size_t i, n;
+	srt_map *m;
+	srt_bool is_map = t == SM0_II32 || t == SM0_UU32 || t == SM0_II;
+	RETURN_IF(!kv || (is_map && !vv), NULL);
+	RETURN_IF(!is_map && t != SM0_I32 && t != SM0_U32 && t != SM0_I, NULL);
+	n = sv_size(kv);
+	if (is_map && sv_size(vv) < n)
+		n = sv_size(vv); /* BEHAVIOR: extra keys are ignored */
+	m = sm_alloc0(t, n);
+	RETURN_IF(!m, NULL);
+	if (st_max_size(m) < n) {
+		sm_free(&m); /* BEHAVIOR: allocation error */
+		return NULL;
+	}
+	/*
+	 * Nodes are written in vector order, linked later in one pass
+	 */
+	st_set_size(m, n);
+	switch (t) {
+	case SM0_II32:
+		for (i = 0; i < n; i++) {
+			struct SMapii *e =
+				(struct SMapii *)st_enum(m, (srt_tndx)i);
+			e->x.k = (int32_t)sv_at_i(kv, i);
+			e->v = (int32_t)sv_at_i(vv, i);
+		}
 		break;
-	case SM0_SS:
-		delete_callback = aux_ss_delete;
+	case SM0_UU32:
+		for (i = 0; i < n; i++) {
+			struct SMapuu *e =
+				(struct SMapuu *)st_enum(m, (srt_tndx)i);
+			e->x.k = (uint32_t)sv_at_u(kv, i);
+			e->v = (uint32_t)sv_at_u(vv, i);
+		}
 		break;
-	case SM0_S:
-	case SM0_SI:
-	case SM0_SP:
-		delete_callback = aux_sx_delete;
+	case SM0_II:
+		for (i = 0; i < n; i++) {
+			struct SMapII *e =
+				(struct SMapII *)st_enum(m, (srt_tndx)i);
+			e->x.k = sv_at_i(kv, i);
+			e->v = sv_at_i(vv, i);
+		}
+		break;
+	case SM0_I32:
+		for (i = 0; i < n; i++)
+			((struct SMapi *)st_enum(m, (srt_tndx)i))->k =
+				(int32_t)sv_at_i(kv, i);
 		break;
+	case SM0_U32:
+		for (i = 0; i < n; i++)
+			((struct SMapu *)st_enum(m, (srt_tndx)i))->k =
+				(uint32_t)sv_at_u(kv, i);
+		break;
+	default:
+		for (i = 0; i < n; i++)
+			((struct SMapI *)st_enum(m, (srt_tndx)i))->k =
+				sv_at_i(kv, i);
+	}
+	if (!st_build_sorted(m)) {
+		/*
+		 * Unsorted input or repeated keys: regular insertion (last
+		 * value wins). Nodes are re-inserted in place, as the write
+		 * position is never ahead of the node being read.
+		 */
+		struct SMapII tmp;
+		st_set_size(m, 0);
+		for (i = 0; i < n; i++) {
+			memcpy(&tmp, st_enum(m, (srt_tndx)i), m->d.elem_size);
+			st_insert(&m, (const srt_tnode *)&tmp);
+		}
 	}
+	return m;
+}
+
+void sm_clear(srt_map *m)
+{
+	srt_tree_callback delete_callback;
+	if (!m || !m->d.size)
+		return;
+	if (m->log)
+		m->log->all = S_TRUE;
+	delete_callback = sm_delete_cb(m->d.sub_type);
 	if (delete_callback) { /* deletion of dynamic memory elems */
 		srt_tndx i = 0;
 		for (; i < (srt_tndx)m->d.size; i++) {
@@ -372,6 +731,7 @@ void sm_clear(srt_map *m)
 		}
 	}
 	st_set_size((srt_tree *)m, 0);
+	sbt_clear(m->bt);
 }
 
 /*
@@ -390,10 +750,14 @@ srt_map *sm_cpy(srt_map **m, const srt_map *src)
 	RETURN_IF(ss > ST_NDX_MAX, NULL); /* BEHAVIOR */
 	if (*m) {
 		sm_clear(*m);
-		if (!sm_chk_t(*m, (int)t)) {
+		if ((*m)->log)
+			(*m)->log->all = S_TRUE;
+		if (!sm_chk_t(*m, (int)t)
+		    || (*m)->d.elem_size != src->d.elem_size) {
 			/*
-			 * Case of changing map type, reusing allocated memory,
-			 * but changing container configuration.
+			 * Case of changing map type (or node layout, e.g.
+			 * ranked map), reusing allocated memory, but changing
+			 * container configuration.
 			 */
 			size_t raw_size = (*m)->d.elem_size * (*m)->d.max_size,
 			       new_max_size = raw_size / src->d.elem_size;
@@ -402,12 +766,27 @@ srt_map *sm_cpy(srt_map **m, const srt_map *src)
 			(*m)->cmp_f = src->cmp_f;
 			(*m)->d.sub_type = src->d.sub_type;
 		}
+		(*m)->cnt_off = src->cnt_off;
 		sm_reserve(m, ss);
 	} else {
-		*m = sm_alloc0(t, ss);
+		*m = src->cnt_off ? sm_alloc_ranked0(t, ss) : sm_alloc0(t, ss);
 		RETURN_IF(!*m, NULL); /* BEHAVIOR: allocation error */
 	}
 	RETURN_IF(sm_max_size(*m) < ss, *m); /* BEHAVIOR: not enough space */
+	/*
+	 * Index copy (the target gets the source index type). The B+tree
+	 * index is allocated in the heap, so it is not available for maps
+	 * using external buffers (e.g. stack-allocated maps).
+	 */
+	if ((*m)->bt != NULL || src->bt != NULL) {
+		sbt_free(&(*m)->bt);
+		if (src->bt) {
+			/* BEHAVIOR: no B+tree index copy, output map empty */
+			RETURN_IF((*m)->d.f.ext_buffer, *m);
+			(*m)->bt = sbt_dup(src->bt);
+			RETURN_IF(!(*m)->bt, *m); /* BEHAVIOR: alloc. error */
+		}
+	}
 	/*
 	 * Bulk tree copy: tree structure can be copied as is, because of
 	 * of using indexes instead of pointers.
@@ -458,6 +837,435 @@ srt_map *sm_cpy(srt_map **m, const srt_map *src)
 	return *m;
 }
 
+/*
+ * Snapshots
+ */
+
+/* Copy an element from the newer map, or delete it if not there */
+static srt_bool sm_log_copy(srt_map **w, const srt_map *s,
+			    const srt_map *keys, srt_tndx i)
+{
+	int64_t k = 0;
+	struct SMapS ks;
+	struct SMapSI si;
+	struct SMapSP sp;
+	union SMapKeyI u;
+	const srt_tnode *n;
+	const srt_string *key = NULL;
+	if (sm_bt_type((enum eSM_Type0)s->d.sub_type)) {
+		k = sm_it_i_k(keys, i);
+		RETURN_IF(sm_key_i(s, &k, &u), S_FALSE);
+		n = sm_locate(s, (const srt_tnode *)&u);
+		if (!n) {
+			sm_delete_i(*w, k);
+			return S_TRUE;
+		}
+	} else {
+		key = sm_it_s_k(keys, i);
+		sso1_setref(&ks.k, key);
+		n = sm_locate(s, (const srt_tnode *)&ks);
+		if (!n) {
+			sm_delete_s(*w, key);
+			return S_TRUE;
+		}
+	}
+	/* Existing keys: the value is overwritten */
+	switch (s->d.sub_type) {
+	case SM0_IS:
+		return sm_insert_is(w, k,
+				    sso1_get(&((const struct SMapIS *)n)->v));
+	case SM0_SI:
+		sso1_setref(&si.x.k, key);
+		si.v = ((const struct SMapSI *)n)->v;
+		return sm_insert_rw(w, (const srt_tnode *)&si, rw_set_SM_SI);
+	case SM0_SS:
+		return sm_insert_ss(w, key,
+				    sso_get_s2(&((const struct SMapSS *)n)->s));
+	case SM0_SP:
+		sso1_setref(&sp.x.k, key);
+		sp.v = ((const struct SMapSP *)n)->v;
+		return sm_insert_rw(w, (const srt_tnode *)&sp, rw_set_SM_SP);
+	case SM0_S:
+		RETURN_IF(sm_locate(*w, (const srt_tnode *)&ks), S_TRUE);
+		sso1_set(&ks.k, key);
+		RETURN_IF(sm_insert_node(w, (const srt_tnode *)&ks, NULL, NULL),
+			  S_TRUE);
+		sso1_free(&ks.k);
+		return S_FALSE;
+	default: /* no dynamic memory: element copy */
+		return sm_insert_node(w, n, NULL, NULL) ? S_TRUE : S_FALSE;
+	}
+}
+
+srt_map *sm_snapshot(srt_map **m, srt_map *prev)
+{
+	size_t i, nk;
+	srt_bool upd = S_FALSE;
+	srt_map *s, *w;
+	struct SMapLog *l;
+	enum eSM_Type0 kt;
+	RETURN_IF(!m || !*m || (*m)->d.f.ext_buffer || *m == prev, NULL);
+	s = *m;
+	l = s->log;
+	kt = sm_bt_type((enum eSM_Type0)s->d.sub_type) ? SM0_I : SM0_S;
+	if (!l) {
+		l = (struct SMapLog *)s_malloc(sizeof(struct SMapLog));
+		RETURN_IF(!l, NULL); /* BEHAVIOR: allocation error */
+		l->keys = NULL;
+		l->last = NULL;
+		l->all = S_TRUE;
+		s->log = l;
+	}
+	if (!sm_chk_t(l->keys, (int)kt)) {
+		sm_free(&l->keys);
+		l->keys = sm_alloc0(kt, 0);
+		RETURN_IF(!l->keys, NULL); /* BEHAVIOR: allocation error */
+		l->all = S_TRUE;
+	}
+	/*
+	 * The previous snapshot is updated with the keys modified since it
+	 * was taken. Otherwise (first snapshot, map cleared or copied, or a
+	 * map that is not the last snapshot), a full copy is done.
+	 */
+	if (prev && prev == l->last && !l->all) {
+		upd = S_TRUE;
+		nk = sm_size(l->keys);
+		for (i = 0; i < nk && upd; i++)
+			upd = sm_log_copy(&prev, s, l->keys, (srt_tndx)i);
+	}
+	if (upd) {
+		w = prev;
+	} else {
+		w = prev ? sm_cpy(&prev, s) : sm_dup(s);
+		/* BEHAVIOR: allocation error (map unchanged) */
+		if (!w || sm_size(w) != sm_size(s)) {
+			if (!prev)
+				sm_free(&w);
+			return NULL;
+		}
+	}
+	sm_clear(l->keys);
+	l->all = S_FALSE;
+	l->last = s;
+	s->log = NULL;
+	w->log = l;
+	*m = w;
+	return s;
+}
+
+/*
+ * Merge and set operations: the result elements are written in key order
+ * into a new element vector, and then linked in one pass
+ */
+
+enum eSM_SetOp { SM_OP_UNION, SM_OP_INTERSECT, SM_OP_DIFF };
+
+struct SMSetOp {
+	srt_map *out;
+	size_t n;		/* output elements */
+	srt_tree_callback del;	/* target element release (dynamic memory) */
+	srt_bool move;		/* target elements moved to the output */
+};
+
+/*
+ * Output map with the target layout (ranked or not). Target elements are
+ * moved to it, unless not released afterwards one by one (copy).
+ */
+static srt_bool sm_op_init(struct SMSetOp *o, const srt_map *m, size_t n,
+			   srt_bool move)
+{
+	enum eSM_Type0 t = (enum eSM_Type0)m->d.sub_type;
+	RETURN_IF(n > ST_NDX_MAX, S_FALSE); /* BEHAVIOR */
+	o->out = m->cnt_off ? sm_alloc_ranked0(t, n) : sm_alloc0(t, n);
+	if (o->out && st_max_size(o->out) < n)
+		sm_free(&o->out);
+	RETURN_IF(!o->out, S_FALSE); /* BEHAVIOR: allocation error */
+	st_set_size(o->out, n);
+	o->n = 0;
+	o->del = sm_delete_cb((int)t);
+	o->move = move && !m->d.f.ext_buffer ? S_TRUE : S_FALSE;
+	return S_TRUE;
+}
+
+/* Append element (key and value, no tree links), copying string data */
+static srt_tnode *sm_op_put(struct SMSetOp *o, const srt_tnode *n,
+			    srt_bool dup)
+{
+	srt_tnode *e = st_enum(o->out, (srt_tndx)o->n++);
+	memcpy(e, n, sm_elem_size(o->out->d.sub_type));
+	if (!dup)
+		return e;
+	switch (o->out->d.sub_type) {
+	case SM0_IS:
+		sso1_set(&((struct SMapIS *)e)->v,
+			 sso1_get(&((const struct SMapIS *)n)->v));
+		break;
+	case SM0_S:
+	case SM0_SI:
+	case SM0_SP:
+		sso1_set(&((struct SMapS *)e)->k,
+			 sso1_get(&((const struct SMapS *)n)->k));
+		break;
+	case SM0_SS:
+		sso_set(&((struct SMapSS *)e)->s,
+			sso_get(&((const struct SMapSS *)n)->s),
+			sso_get_s2(&((const struct SMapSS *)n)->s));
+		break;
+	}
+	return e;
+}
+
+/* Target element not in the output */
+S_INLINE void sm_op_drop(struct SMSetOp *o, srt_tnode *n)
+{
+	if (o->move && o->del)
+		o->del(n);
+}
+
+static void sm_op_sum(int t, srt_tnode *e, const srt_tnode *n)
+{
+	switch (t) {
+	case SM0_II32:
+		((struct SMapii *)e)->v += ((const struct SMapii *)n)->v;
+		break;
+	case SM0_UU32:
+		((struct SMapuu *)e)->v += ((const struct SMapuu *)n)->v;
+		break;
+	case SM0_II:
+		((struct SMapII *)e)->v += ((const struct SMapII *)n)->v;
+		break;
+	case SM0_SI:
+		((struct SMapSI *)e)->v += ((const struct SMapSI *)n)->v;
+		break;
+	}
+}
+
+/* In-order enumeration of all the elements */
+static srt_tndx sm_op_first(const srt_map *m, srt_map_cursor *c)
+{
+	srt_bool r;
+	RETURN_IF(!sm_size(m), ST_NIL);
+	r = sm_bt_type((enum eSM_Type0)m->d.sub_type)
+		    ? sm_cur_seek_ge_i(m, INT64_MIN, c)
+		    : sm_cur_seek_ge_s(m, ss_void, c);
+	return r ? sm_cur_id(m, c) : ST_NIL;
+}
+
+S_INLINE srt_tndx sm_op_next(const srt_map *m, srt_map_cursor *c)
+{
+	return sm_cur_next(m, c) ? sm_cur_id(m, c) : ST_NIL;
+}
+
+/* Looking up the smaller map elements is cheaper than streaming both */
+static srt_bool sm_op_lookup(size_t small, size_t large)
+{
+	size_t lg = 1;
+	for (; large >> lg; lg++)
+		;
+	return small * lg < small + large ? S_TRUE : S_FALSE;
+}
+
+/*
+ * Link the output (already sorted), and replace the target with it. On
+ * allocation error building a B+tree index, the output keeps the Red-Black
+ * tree index (BEHAVIOR).
+ */
+static int64_t aux_op_bt_key(const void *context, srt_tndx i)
+{
+	const srt_map *m = (const srt_map *)context;
+	return sm_bt_key(m, st_enum_r(m, i));
+}
+
+static srt_bool sm_op_end(srt_map **m, struct SMSetOp *o)
+{
+	srt_map *t = *m, *r = o->out;
+	st_set_size(r, o->n);
+	st_build_sorted(r); /* always sorted: streamed in key order */
+	if (t->bt) { /* B+tree bulk load, from the elements in key order */
+		r->bt = sbt_alloc(o->n / (SBT_FANOUT - 1) + 2);
+		if (r->bt && !sbt_load_sorted(&r->bt, o->n, aux_op_bt_key, r))
+			sbt_free(&r->bt);
+	}
+	if (t->d.f.ext_buffer) {
+		/*
+		 * External buffer (e.g. stack-allocated map): target elements
+		 * were copied, so the output is copied back, if it fits
+		 */
+		if (o->n <= sm_max_size(t))
+			sm_cpy(m, r);
+		sm_free(&r);
+		return sm_size(*m) == o->n ? S_TRUE : S_FALSE;
+	}
+	r->log = t->log;
+	t->log = NULL;
+	if (r->log)
+		r->log->all = S_TRUE;
+	if (o->move)
+		st_set_size(t, 0); /* elements moved or already released */
+	sm_free(&t);
+	*m = r;
+	return S_TRUE;
+}
+
+static srt_bool sm_op_check(srt_map **m, const srt_map *src)
+{
+	return m && *m && src && (*m)->d.sub_type == src->d.sub_type
+		       ? S_TRUE
+		       : S_FALSE;
+}
+
+srt_bool sm_merge(srt_map **m, const srt_map *src, enum eSM_Merge mode)
+{
+	int c, t;
+	srt_map *a;
+	srt_tndx i, j;
+	srt_tnode *x, *e;
+	const srt_tnode *y;
+	struct SMSetOp o;
+	srt_map_cursor ca, cb;
+	RETURN_IF(!sm_op_check(m, src), S_FALSE);
+	a = *m;
+	t = a->d.sub_type;
+	RETURN_IF(mode != SM_MERGE_OVERWRITE && mode != SM_MERGE_KEEP
+			  && (mode != SM_MERGE_SUM
+			      || (t != SM0_II32 && t != SM0_UU32 && t != SM0_II
+				  && t != SM0_SI)),
+		  S_FALSE);
+	RETURN_IF(!sm_size(src) || (a == src && mode != SM_MERGE_SUM), S_TRUE);
+	RETURN_IF(!sm_op_init(&o, a, sm_size(a) + sm_size(src), S_TRUE),
+		  S_FALSE);
+	i = sm_op_first(a, &ca);
+	j = sm_op_first(src, &cb);
+	while (i != ST_NIL || j != ST_NIL) {
+		x = i != ST_NIL ? st_enum(a, i) : NULL;
+		y = j != ST_NIL ? st_enum_r(src, j) : NULL;
+		c = !x ? 1 : !y ? -1 : a->cmp_f(x, y);
+		if (c <= 0) {
+			if (c < 0 || mode != SM_MERGE_OVERWRITE) {
+				e = sm_op_put(&o, x, !o.move);
+				if (!c && mode == SM_MERGE_SUM)
+					sm_op_sum(t, e, y);
+			} else { /* source copied before releasing the target */
+				sm_op_put(&o, y, S_TRUE);
+				sm_op_drop(&o, x);
+			}
+			i = sm_op_next(a, &ca);
+		} else {
+			sm_op_put(&o, y, S_TRUE);
+		}
+		if (c >= 0)
+			j = sm_op_next(src, &cb);
+	}
+	return sm_op_end(m, &o);
+}
+
+srt_bool sm_intersect(srt_map **m, const srt_map *src)
+{
+	int c;
+	srt_map *a;
+	srt_tndx i, j;
+	srt_tnode *x;
+	const srt_tnode *y;
+	struct SMSetOp o;
+	size_t na, ns;
+	srt_map_cursor ca, cb;
+	RETURN_IF(!sm_op_check(m, src), S_FALSE);
+	a = *m;
+	RETURN_IF(a == src, S_TRUE);
+	na = sm_size(a);
+	ns = sm_size(src);
+	RETURN_IF(!na, S_TRUE);
+	if (!ns) {
+		sm_clear(a);
+		return S_TRUE;
+	}
+	if (ns < na && sm_op_lookup(ns, na)) {
+		/*
+		 * Much smaller source: look up its keys in the target, copying
+		 * the target elements found (the target is released as whole)
+		 */
+		RETURN_IF(!sm_op_init(&o, a, ns, S_FALSE), S_FALSE);
+		for (j = sm_op_first(src, &cb); j != ST_NIL;
+		     j = sm_op_next(src, &cb))
+			if ((y = sm_locate(a, st_enum_r(src, j))) != NULL)
+				sm_op_put(&o, y, S_TRUE);
+		return sm_op_end(m, &o);
+	}
+	RETURN_IF(!sm_op_init(&o, a, na < ns ? na : ns, S_TRUE), S_FALSE);
+	i = sm_op_first(a, &ca);
+	if (na < ns && sm_op_lookup(na, ns)) {
+		/* Much smaller target: look up its keys in the source */
+		for (; i != ST_NIL; i = sm_op_next(a, &ca)) {
+			x = st_enum(a, i);
+			if (sm_locate(src, x))
+				sm_op_put(&o, x, !o.move);
+			else
+				sm_op_drop(&o, x);
+		}
+		return sm_op_end(m, &o);
+	}
+	j = sm_op_first(src, &cb);
+	while (i != ST_NIL) {
+		x = st_enum(a, i);
+		y = j != ST_NIL ? st_enum_r(src, j) : NULL;
+		c = !y ? -1 : a->cmp_f(x, y);
+		if (c < 0)
+			sm_op_drop(&o, x);
+		else if (!c)
+			sm_op_put(&o, x, !o.move);
+		if (c <= 0)
+			i = sm_op_next(a, &ca);
+		if (c >= 0)
+			j = sm_op_next(src, &cb);
+	}
+	return sm_op_end(m, &o);
+}
+
+srt_bool sm_diff(srt_map **m, const srt_map *src)
+{
+	int c;
+	srt_map *a;
+	srt_tndx i, j;
+	srt_tnode *x;
+	const srt_tnode *y;
+	struct SMSetOp o;
+	size_t na, ns;
+	srt_map_cursor ca, cb;
+	RETURN_IF(!sm_op_check(m, src), S_FALSE);
+	a = *m;
+	if (a == src) {
+		sm_clear(a);
+		return S_TRUE;
+	}
+	na = sm_size(a);
+	ns = sm_size(src);
+	RETURN_IF(!na || !ns, S_TRUE);
+	if (sm_op_lookup(ns, na)) {
+		/* Much smaller source: delete its keys from the target */
+		srt_tree_callback del = sm_delete_cb(a->d.sub_type);
+		for (j = 0; j < (srt_tndx)ns; j++)
+			sm_delete_node(a, st_enum_r(src, j), del);
+		return S_TRUE;
+	}
+	RETURN_IF(!sm_op_init(&o, a, na, S_TRUE), S_FALSE);
+	i = sm_op_first(a, &ca);
+	j = sm_op_first(src, &cb);
+	while (i != ST_NIL) {
+		x = st_enum(a, i);
+		y = j != ST_NIL ? st_enum_r(src, j) : NULL;
+		c = !y ? -1 : a->cmp_f(x, y);
+		if (c < 0)
+			sm_op_put(&o, x, !o.move);
+		else if (!c)
+			sm_op_drop(&o, x);
+		if (c <= 0)
+			i = sm_op_next(a, &ca);
+		if (c >= 0)
+			j = sm_op_next(src, &cb);
+	}
+	return sm_op_end(m, &o);
+}
+
 /*
  * Random access
  */
@@ -468,7 +1276,7 @@ int32_t sm_at_ii32(const srt_map *m, int32_t k)
 	const struct SMapii *nr;
 	RETURN_IF(!sm_chk_t(m, SM_II32), 0);
 	n.x.k = k;
-	nr = (const struct SMapii *)st_locate(m, (const srt_tnode *)&n);
+	nr = (const struct SMapii *)sm_locate(m, (const srt_tnode *)&n);
 	return nr ? nr->v : 0; /* BEHAVIOR */
 }
 
@@ -478,7 +1286,7 @@ uint32_t sm_at_uu32(const srt_map *m, uint32_t k)
 	const struct SMapuu *nr;
 	RETURN_IF(!sm_chk_t(m, SM_UU32), 0);
 	n.x.k = k;
-	nr = (const struct SMapuu *)st_locate(m, (const srt_tnode *)&n);
+	nr = (const struct SMapuu *)sm_locate(m, (const srt_tnode *)&n);
 	return nr ? nr->v : 0; /* BEHAVIOR */
 }
 
@@ -488,7 +1296,7 @@ int64_t sm_at_ii(const srt_map *m, int64_t k)
 	const struct SMapII *nr;
 	RETURN_IF(!sm_chk_t(m, SM_II), 0);
 	n.x.k = k;
-	nr = (const struct SMapII *)st_locate(m, (const srt_tnode *)&n);
+	nr = (const struct SMapII *)sm_locate(m, (const srt_tnode *)&n);
 	return nr ? nr->v : 0; /* BEHAVIOR */
 }
 
@@ -498,7 +1306,7 @@ const srt_string *sm_at_is(const srt_map *m, int64_t k)
 	const struct SMapIS *nr;
 	RETURN_IF(!sm_chk_t(m, SM_IS), ss_void);
 	n.x.k = k;
-	nr = (const struct SMapIS *)st_locate(m, (const srt_tnode *)&n);
+	nr = (const struct SMapIS *)sm_locate(m, (const srt_tnode *)&n);
 	return nr ? sso_get((const srt_stringo *)&nr->v) : 0; /* BEHAVIOR */
 }
 
@@ -508,7 +1316,7 @@ const void *sm_at_ip(const srt_map *m, int64_t k)
 	const struct SMapIP *nr;
 	RETURN_IF(!sm_chk_t(m, SM_IP), NULL);
 	n.x.k = k;
-	nr = (const struct SMapIP *)st_locate(m, (const srt_tnode *)&n);
+	nr = (const struct SMapIP *)sm_locate(m, (const srt_tnode *)&n);
 	return nr ? nr->v : NULL;
 }
 
@@ -518,7 +1326,7 @@ int64_t sm_at_si(const srt_map *m, const srt_string *k)
 	const struct SMapSI *nr;
 	RETURN_IF(!sm_chk_t(m, SM_SI), 0);
 	sso1_setref(&n.x.k, k);
-	nr = (const struct SMapSI *)st_locate(m, &n.x.n);
+	nr = (const struct SMapSI *)sm_locate(m, &n.x.n);
 	return nr ? nr->v : 0; /* BEHAVIOR */
 }
 
@@ -528,7 +1336,7 @@ const srt_string *sm_at_ss(const srt_map *m, const srt_string *k)
 	const struct SMapSS *nr;
 	RETURN_IF(!sm_chk_t(m, SM_SS), ss_void);
 	sso_setref(&n.s, k, NULL);
-	nr = (const struct SMapSS *)st_locate(m, &n.n);
+	nr = (const struct SMapSS *)sm_locate(m, &n.n);
 	return nr ? sso_get_s2(&nr->s) : ss_void;
 }
 
@@ -538,7 +1346,7 @@ const void *sm_at_sp(const srt_map *m, const srt_string *k)
 	const struct SMapSP *nr;
 	RETURN_IF(!sm_chk_t(m, SM_SP), NULL);
 	sso1_setref(&n.x.k, k);
-	nr = (const struct SMapSP *)st_locate(m, &n.x.n);
+	nr = (const struct SMapSP *)sm_locate(m, &n.x.n);
 	return nr ? nr->v : NULL;
 }
 
@@ -551,7 +1359,7 @@ srt_bool sm_count_u(const srt_map *m, uint32_t k)
 	struct SMapuu n;
 	RETURN_IF(!sm_chk_t(m, SM0_UU32) && !sm_chk_t(m, SM0_U32), S_FALSE);
 	n.x.k = k;
-	return st_locate(m, (const srt_tnode *)&n) ? S_TRUE : S_FALSE;
+	return sm_locate(m, (const srt_tnode *)&n) ? S_TRUE : S_FALSE;
 }
 
 srt_bool sm_count_i(const srt_map *m, int64_t k)
@@ -570,7 +1378,7 @@ srt_bool sm_count_i(const srt_map *m, int64_t k)
 		n2.k = (int32_t)k;
 		n = (const srt_tnode *)&n2;
 	}
-	return st_locate(m, n) ? S_TRUE : S_FALSE;
+	return sm_locate(m, n) ? S_TRUE : S_FALSE;
 }
 
 srt_bool sm_count_s(const srt_map *m, const srt_string *k)
@@ -578,7 +1386,7 @@ srt_bool sm_count_s(const srt_map *m, const srt_string *k)
 	struct SMapS n;
 	RETURN_IF(!sm_chk_sx(m), S_FALSE);
 	sso1_setref(&n.k, k);
-	return st_locate(m, (const srt_tnode *)&n) ? S_TRUE : S_FALSE;
+	return sm_locate(m, (const srt_tnode *)&n) ? S_TRUE : S_FALSE;
 }
 
 /*
@@ -592,7 +1400,7 @@ S_INLINE srt_bool sm_insert_ii32_aux(srt_map **m, int32_t k, int32_t v,
 	RETURN_IF(!m || !sm_chk_t(*m, SM0_II32), S_FALSE);
 	n.x.k = k;
 	n.v = v;
-	return st_insert_rw((srt_tree **)m, (const srt_tnode *)&n, rw_f);
+	return sm_insert_rw(m, (const srt_tnode *)&n, rw_f);
 }
 
 srt_bool sm_insert_ii32(srt_map **m, int32_t k, int32_t v)
@@ -612,7 +1420,7 @@ S_INLINE srt_bool sm_insert_uu32_aux(srt_map **m, uint32_t k, uint32_t v,
 	RETURN_IF(!m || !sm_chk_t(*m, SM0_UU32), S_FALSE);
 	n.x.k = k;
 	n.v = v;
-	return st_insert_rw((srt_tree **)m, (const srt_tnode *)&n, rw_f);
+	return sm_insert_rw(m, (const srt_tnode *)&n, rw_f);
 }
 
 srt_bool sm_insert_uu32(srt_map **m, uint32_t k, uint32_t v)
@@ -632,7 +1440,7 @@ S_INLINE srt_bool sm_insert_ii_aux(srt_map **m, int64_t k, int64_t v,
 	RETURN_IF(!m || !sm_chk_t(*m, SM0_II), S_FALSE);
 	n.x.k = k;
 	n.v = v;
-	return st_insert_rw((srt_tree **)m, (const srt_tnode *)&n, rw_f);
+	return sm_insert_rw(m, (const srt_tnode *)&n, rw_f);
 }
 
 srt_bool sm_insert_ii(srt_map **m, int64_t k, int64_t v)
@@ -651,18 +1459,11 @@ srt_bool sm_insert_is(srt_map **m, int64_t k, const srt_string *v)
 	struct SMapIS n;
 	RETURN_IF(!m || !sm_chk_t(*m, SM0_IS), S_FALSE);
 	n.x.k = k;
-#if 1 /* workaround */
 	sso1_set(&n.v, v);
-	ins_ok = st_insert((srt_tree **)m, (const srt_tnode *)&n);
+	ins_ok = sm_insert_rw(m, (const srt_tnode *)&n, rw_add_SM_IS);
 	if (!ins_ok)
 		sso1_free(&n.v);
 	return ins_ok;
-#else
-	/* TODO: rw_add_SM_IS */
-	n.v = v;
-	return st_insert_rw((srt_tree **)m, (const srt_tnode *)&n,
-			    rw_add_SM_IS);
-#endif
 }
 
 srt_bool sm_insert_ip(srt_map **m, int64_t k, const void *v)
@@ -671,7 +1472,7 @@ srt_bool sm_insert_ip(srt_map **m, int64_t k, const void *v)
 	RETURN_IF(!m || !sm_chk_t(*m, SM0_IP), S_FALSE);
 	n.x.k = k;
 	n.v = v;
-	return st_insert((srt_tree **)m, (const srt_tnode *)&n);
+	return sm_insert_rw(m, (const srt_tnode *)&n, NULL);
 }
 
 S_INLINE srt_bool sm_insert_si_aux(srt_map **m, const srt_string *k, int64_t v,
@@ -682,7 +1483,7 @@ S_INLINE srt_bool sm_insert_si_aux(srt_map **m, const srt_string *k, int64_t v,
 	RETURN_IF(!m || !sm_chk_t(*m, SM0_SI), S_FALSE);
 	sso1_setref(&n.x.k, k);
 	n.v = v;
-	r = st_insert_rw((srt_tree **)m, (const srt_tnode *)&n, rw_f);
+	r = sm_insert_rw(m, (const srt_tnode *)&n, rw_f);
 	return r;
 }
 
@@ -701,8 +1502,7 @@ srt_bool sm_insert_ss(srt_map **m, const srt_string *k, const srt_string *v)
 	struct SMapSS n;
 	RETURN_IF(!m || !sm_chk_t(*m, SM0_SS), S_FALSE);
 	sso_setref(&n.s, k, v);
-	return st_insert_rw((srt_tree **)m, (const srt_tnode *)&n,
-			    rw_add_SM_SS);
+	return sm_insert_rw(m, (const srt_tnode *)&n, rw_add_SM_SS);
 }
 
 srt_bool sm_insert_sp(srt_map **m, const srt_string *k, const void *v)
@@ -711,8 +1511,78 @@ srt_bool sm_insert_sp(srt_map **m, const srt_string *k, const void *v)
 	RETURN_IF(!m || !sm_chk_t(*m, SM0_SP), S_FALSE);
 	sso1_setref(&n.x.k, k);
 	n.v = v;
-	return st_insert_rw((srt_tree **)m, (const srt_tnode *)&n,
-			    rw_add_SM_SP);
+	return sm_insert_rw(m, (const srt_tnode *)&n, rw_add_SM_SP);
+}
+
+/*
+ * Find or insert
+ */
+
+int32_t *sm_emplace_ii32(srt_map **m, int32_t k, srt_bool *is_new)
+{
+	struct SMapii n, *e;
+	RETURN_IF(!m || !sm_chk_t(*m, SM0_II32), NULL);
+	n.x.k = k;
+	n.v = 0;
+	e = (struct SMapii *)sm_insert_node(m, (const srt_tnode *)&n,
+					    rw_keep, is_new);
+	return e ? &e->v : NULL;
+}
+
+uint32_t *sm_emplace_uu32(srt_map **m, uint32_t k, srt_bool *is_new)
+{
+	struct SMapuu n, *e;
+	RETURN_IF(!m || !sm_chk_t(*m, SM0_UU32), NULL);
+	n.x.k = k;
+	n.v = 0;
+	e = (struct SMapuu *)sm_insert_node(m, (const srt_tnode *)&n,
+					    rw_keep, is_new);
+	return e ? &e->v : NULL;
+}
+
+int64_t *sm_emplace_ii(srt_map **m, int64_t k, srt_bool *is_new)
+{
+	struct SMapII n, *e;
+	RETURN_IF(!m || !sm_chk_t(*m, SM0_II), NULL);
+	n.x.k = k;
+	n.v = 0;
+	e = (struct SMapII *)sm_insert_node(m, (const srt_tnode *)&n,
+					    rw_keep, is_new);
+	return e ? &e->v : NULL;
+}
+
+const void **sm_emplace_ip(srt_map **m, int64_t k, srt_bool *is_new)
+{
+	struct SMapIP n, *e;
+	RETURN_IF(!m || !sm_chk_t(*m, SM0_IP), NULL);
+	n.x.k = k;
+	n.v = NULL;
+	e = (struct SMapIP *)sm_insert_node(m, (const srt_tnode *)&n,
+					    rw_keep, is_new);
+	return e ? &e->v : NULL;
+}
+
+int64_t *sm_emplace_si(srt_map **m, const srt_string *k, srt_bool *is_new)
+{
+	struct SMapSI n, *e;
+	RETURN_IF(!m || !sm_chk_t(*m, SM0_SI), NULL);
+	sso1_setref(&n.x.k, k);
+	n.v = 0;
+	e = (struct SMapSI *)sm_insert_node(m, (const srt_tnode *)&n,
+					    rw_emplace_SM_SX, is_new);
+	return e ? &e->v : NULL;
+}
+
+const void **sm_emplace_sp(srt_map **m, const srt_string *k,
+			   srt_bool *is_new)
+{
+	struct SMapSP n, *e;
+	RETURN_IF(!m || !sm_chk_t(*m, SM0_SP), NULL);
+	sso1_setref(&n.x.k, k);
+	n.v = NULL;
+	e = (struct SMapSP *)sm_insert_node(m, (const srt_tnode *)&n,
+					    rw_emplace_SM_SX, is_new);
+	return e ? &e->v : NULL;
 }
 
 /*
@@ -752,7 +1622,7 @@ srt_bool sm_delete_i(srt_map *m, int64_t k)
 	default:
 		return S_FALSE;
 	}
-	return st_delete(m, n, callback);
+	return sm_delete_node(m, n, callback);
 }
 
 srt_bool sm_delete_s(srt_map *m, const srt_string *k)
@@ -773,13 +1643,170 @@ srt_bool sm_delete_s(srt_map *m, const srt_string *k)
 	default:
 		return S_FALSE;
 	}
-	return st_delete(m, (const srt_tnode *)&sx, callback);
+	return sm_delete_node(m, (const srt_tnode *)&sx, callback);
 }
 
 /*
  * Enumeration / export data
  */
 
+/*
+ * Sorted enumeration with cursor
+ */
+
+S_INLINE void sm_cur_reset(srt_map_cursor *c)
+{
+	c->t.d = 0;
+	c->b.n = ST_NIL;
+	c->b.i = 0;
+}
+
+/* B+tree: from the end of a leaf to the next one (only the root is empty) */
+S_INLINE srt_bool sm_cur_bt_fix(const srt_map *m, srt_map_cursor *c)
+{
+	const struct SBTNode *n;
+	if (c->b.n != ST_NIL) {
+		n = sbt_node_r(m->bt, c->b.n);
+		if (c->b.i >= n->cnt) {
+			c->b.n = n->next;
+			c->b.i = 0;
+		}
+	}
+	return c->b.n != ST_NIL ? S_TRUE : S_FALSE;
+}
+
+static srt_bool sm_cur_seek_i(const srt_map *m, int64_t k, srt_map_cursor *c,
+			      srt_bool ge)
+{
+	int r;
+	union SMapKeyI u;
+	RETURN_IF(!c, S_FALSE);
+	sm_cur_reset(c);
+	r = sm_key_i(m, &k, &u);
+	/* BEHAVIOR: not an integer-key map, or key out of the map key range */
+	RETURN_IF(r == SM_KEY_ERR || (r < 0 && !ge) || (r > 0 && ge),
+		  S_FALSE);
+	if (m->bt) {
+		if (ge)
+			sbt_seek(m->bt, k, &c->b);
+		else
+			sbt_seek_le(m->bt, k, &c->b);
+		return sm_cur_bt_fix(m, c);
+	}
+	return ge ? st_cursor_seek_ge(m, (const srt_tnode *)&u, &c->t)
+		  : st_cursor_seek_le(m, (const srt_tnode *)&u, &c->t);
+}
+
+static srt_bool sm_cur_seek_s(const srt_map *m, const srt_string *k,
+			      srt_map_cursor *c, srt_bool ge)
+{
+	struct SMapS n;
+	RETURN_IF(!c, S_FALSE);
+	sm_cur_reset(c);
+	RETURN_IF(!sm_chk_sx(m) || !k, S_FALSE);
+	sso1_setref(&n.k, k);
+	return ge ? st_cursor_seek_ge(m, (const srt_tnode *)&n, &c->t)
+		  : st_cursor_seek_le(m, (const srt_tnode *)&n, &c->t);
+}
+
+srt_bool sm_cur_seek_ge_i(const srt_map *m, int64_t k, srt_map_cursor *c)
+{
+	return sm_cur_seek_i(m, k, c, S_TRUE);
+}
+
+srt_bool sm_cur_seek_le_i(const srt_map *m, int64_t k, srt_map_cursor *c)
+{
+	return sm_cur_seek_i(m, k, c, S_FALSE);
+}
+
+srt_bool sm_cur_seek_ge_s(const srt_map *m, const srt_string *k,
+			  srt_map_cursor *c)
+{
+	return sm_cur_seek_s(m, k, c, S_TRUE);
+}
+
+srt_bool sm_cur_seek_le_s(const srt_map *m, const srt_string *k,
+			  srt_map_cursor *c)
+{
+	return sm_cur_seek_s(m, k, c, S_FALSE);
+}
+
+srt_bool sm_cur_next(const srt_map *m, srt_map_cursor *c)
+{
+	RETURN_IF(!m || !c, S_FALSE);
+	if (!m->bt)
+		return st_cursor_next(m, &c->t);
+	RETURN_IF(c->b.n == ST_NIL, S_FALSE);
+	c->b.i++;
+	return sm_cur_bt_fix(m, c);
+}
+
+srt_bool sm_cur_prev(const srt_map *m, srt_map_cursor *c)
+{
+	int64_t k;
+	RETURN_IF(!m || !c, S_FALSE);
+	if (!m->bt)
+		return st_cursor_prev(m, &c->t);
+	RETURN_IF(c->b.n == ST_NIL, S_FALSE);
+	if (c->b.i > 0) {
+		c->b.i--;
+		return S_TRUE;
+	}
+	/* Leaves are linked forward only: search the previous key */
+	k = sbt_node_r(m->bt, c->b.n)->k[0];
+	if (k == INT64_MIN) {
+		c->b.n = ST_NIL;
+		return S_FALSE;
+	}
+	sbt_seek_le(m->bt, k - 1, &c->b);
+	return c->b.n != ST_NIL ? S_TRUE : S_FALSE;
+}
+
+/*
+ * Order statistics
+ */
+
+size_t sm_rank_i(const srt_map *m, int64_t k)
+{
+	int r;
+	union SMapKeyI u;
+	r = sm_key_i(m, &k, &u);
+	RETURN_IF(r == SM_KEY_ERR || r < 0, 0);
+	RETURN_IF(r > 0, sm_size(m));
+	if (m->bt)
+		return sbt_rank(m->bt, k);
+	return st_rank(m, (const srt_tnode *)&u);
+}
+
+size_t sm_rank_s(const srt_map *m, const srt_string *k)
+{
+	struct SMapS n;
+	RETURN_IF(!sm_chk_sx(m) || !k, 0);
+	sso1_setref(&n.k, k);
+	return st_rank(m, (const srt_tnode *)&n);
+}
+
+srt_tndx sm_select(const srt_map *m, size_t i)
+{
+	RETURN_IF(!m, ST_NIL);
+	return m->bt ? sbt_select(m->bt, i) : st_select(m, i);
+}
+
+size_t sm_count_range_i(const srt_map *m, int64_t kmin, int64_t kmax)
+{
+	RETURN_IF(!m || kmin > kmax, 0);
+	return (kmax == INT64_MAX ? sm_size(m) : sm_rank_i(m, kmax + 1))
+	       - sm_rank_i(m, kmin);
+}
+
+size_t sm_count_range_s(const srt_map *m, const srt_string *kmin,
+			const srt_string *kmax)
+{
+	RETURN_IF(!m || !kmin || !kmax || ss_cmp(kmin, kmax) > 0, 0);
+	return sm_rank_s(m, kmax) + (sm_count_s(m, kmax) ? 1 : 0)
+	       - sm_rank_s(m, kmin);
+}
+
 ssize_t sm_sort_to_vectors(const srt_map *m, srt_vector **kv, srt_vector **vv)
 {
 	ssize_t r;
@@ -849,8 +1876,506 @@ ssize_t sm_sort_to_vectors(const srt_map *m, srt_vector **kv, srt_vector **vv)
 		traverse_f = aux_sp_ss_sort;
 		break;
 	}
-	r = st_traverse_inorder((const srt_tree *)m, traverse_f, (void *)&v2x);
+	if (m->bt) {
+		struct STraverseParams tp = {NULL, NULL, ST_NIL, 0, 0};
+		struct SBTCursor c;
+		int64_t k;
+		tp.context = (void *)&v2x;
+		tp.t = m;
+		sbt_seek(m->bt, INT64_MIN, &c);
+		while (sbt_next(m->bt, &c, &k, &tp.c))
+			traverse_f(&tp);
+		r = (ssize_t)m->bt->levels + 1;
+	} else {
+		r = st_traverse_inorder((const srt_tree *)m, traverse_f,
+					(void *)&v2x);
+	}
 	*kv = v2x.kv;
 	*vv = v2x.vv;
 	return r;
 }
+
+/*
+ * Parallel enumeration: the key range is split at keys sampled from the tree
+ * levels near the root, every job enumerating one key subrange with the
+ * typed sm_itr_*() function
+ */
+
+#define SM_PAR_SAMPLE 16 /* sampled subranges per worker, for balancing */
+
+struct SMParKey {
+	int64_t k;  /* subrange lower bound */
+	uint64_t w; /* estimated number of elements */
+};
+
+struct SMParSample {
+	struct SMParKey *k; /* NULL: count only */
+	size_t n, visited;
+	int64_t kmin, kmax, last; /* sampled keys: (kmin, kmax], ascending */
+};
+
+static void sm_par_key(struct SMParSample *s, int64_t k, uint64_t w)
+{
+	s->visited++;
+	if (k <= s->kmin || k > s->kmax || (s->n && k <= s->last))
+		return;
+	if (s->k) {
+		s->k[s->n].k = k;
+		s->k[s->n].w = w;
+	}
+	s->last = k;
+	s->n++;
+}
+
+/*
+ * In-order walk of the nodes up to the given depth. Subtrees below are
+ * sampled as a whole, estimating its size from the leftmost and rightmost
+ * path lengths (Red-Black tree paths can differ up to 2x in length, so
+ * equal node count near the root does not imply equal subtree size)
+ */
+static void sm_par_sample_rb(const srt_map *m, srt_tndx x, size_t depth,
+			     struct SMParSample *s)
+{
+	int64_t k;
+	size_t l = 0, r = 0;
+	srt_tndx y;
+	const srt_tnode *n;
+	if (x == ST_NIL)
+		return;
+	n = get_node_r(m, x);
+	k = sm_bt_key(m, n);
+	if (depth == 1) {
+		for (y = n->r; y != ST_NIL; y = get_node_r(m, y)->r)
+			r++;
+		for (y = x; y != ST_NIL; y = get_node_r(m, y)->x.l, l++)
+			k = sm_bt_key(m, get_node_r(m, y));
+		l = l < r + 1 ? l : r + 1;
+		sm_par_key(s, k, (uint64_t)1 << (l < 40 ? l : 40));
+		return;
+	}
+	if (k > s->kmin)
+		sm_par_sample_rb(m, n->x.l, depth - 1, s);
+	sm_par_key(s, k, 1);
+	if (k < s->kmax)
+		sm_par_sample_rb(m, n->r, depth - 1, s);
+}
+
+/*
+ * Same, using the B+tree node keys (all leaves are at the same depth, and
+ * node fill is kept between 50% and 100%, so no size estimation is used)
+ */
+static void sm_par_sample_bt(const srt_btree *b, srt_tndx x, size_t depth,
+			     struct SMParSample *s)
+{
+	size_t i;
+	const struct SBTNode *n;
+	if (!depth)
+		return;
+	n = sbt_node_r(b, x);
+	for (i = 0; i < n->cnt; i++) {
+		if (n->leaf) {
+			sm_par_key(s, n->k[i], 1);
+			continue;
+		}
+		if ((i + 1 == n->cnt || n->k[i + 1] > s->kmin)
+		    && (!i || n->k[i] <= s->kmax))
+			sm_par_sample_bt(b, n->c[i], depth - 1, s);
+		if (i + 1 < n->cnt)
+			sm_par_key(s, n->k[i + 1], 1);
+	}
+}
+
+static size_t sm_par_sample(const srt_map *m, size_t depth,
+			    struct SMParSample *s)
+{
+	s->n = s->visited = 0;
+	if (m->bt)
+		sm_par_sample_bt(m->bt, m->bt->root, depth, s);
+	else
+		sm_par_sample_rb(m, m->root, depth, s);
+	return s->n;
+}
+
+/*
+ * Split [kmin, kmax] into one key subrange per worker (lo > hi: empty),
+ * sampling levels until having SM_PAR_SAMPLE subranges per worker, or the
+ * whole range, and then grouping the sampled subranges by estimated size
+ */
+static srt_bool sm_par_split(const srt_map *m, int64_t kmin, int64_t kmax,
+			     size_t nw, int64_t *lo, int64_t *hi)
+{
+	size_t i = 0, w, d = 0, ns = 0, np = 1, prev = 0;
+	uint64_t tot = 0, acc = 0, target;
+	struct SMParSample s;
+	s.k = NULL;
+	s.kmin = kmin;
+	s.kmax = kmax;
+	s.last = 0;
+	if (nw > 1 && sm_size(m) > 0 && kmin < kmax)
+		for (d = 1; d < ST_CURSOR_MAX_DEPTH; d++) {
+			ns = sm_par_sample(m, d, &s);
+			if (ns >= nw * SM_PAR_SAMPLE || s.visited == prev)
+				break;
+			prev = s.visited;
+		}
+	if (ns) {
+		s.k = (struct SMParKey *)s_malloc(ns * sizeof(struct SMParKey));
+		RETURN_IF(!s.k, S_FALSE);
+		ns = sm_par_sample(m, d, &s);
+		for (i = 0; i < ns; i++)
+			tot += s.k[i].w;
+	}
+	lo[0] = kmin;
+	for (w = 1, i = 0; w < nw && ns; w++) {
+		target = tot / nw * w + tot % nw * w / nw;
+		for (; i < ns && acc + s.k[i].w / 2 < target; i++)
+			acc += s.k[i].w;
+		if (i >= ns)
+			break;
+		lo[np] = s.k[i].k;
+		hi[np - 1] = lo[np] - 1;
+		np++;
+		acc += s.k[i++].w;
+	}
+	hi[np - 1] = kmax;
+	for (w = np; w < nw; w++) {
+		lo[w] = 1;
+		hi[w] = 0;
+	}
+	s_free(s.k);
+	return S_TRUE;
+}
+
+union SMItCb {
+	srt_map_it_ii32 ii32;
+	srt_map_it_uu32 uu32;
+	srt_map_it_ii ii;
+	srt_map_it_is is;
+	srt_map_it_ip ip;
+};
+
+struct SMParJob {
+	const srt_map *m;
+	union SMItCb f;
+	void *contexts;
+	size_t context_size, nw;
+	int64_t *lo, *hi; /* key subrange, per worker */
+	size_t *cnt;	  /* elements processed, per worker */
+};
+
+static void *aux_par_ctx(void *contexts, size_t context_size, size_t w)
+{
+	return contexts ? (uint8_t *)contexts + w * context_size : NULL;
+}
+
+static void aux_itrpp_job(void *job_context, size_t w)
+{
+	struct SMParJob *j = (struct SMParJob *)job_context;
+	int64_t lo, hi;
+	size_t c = 0;
+	void *ctx;
+	if (w >= j->nw)
+		return;
+	lo = j->lo[w];
+	hi = j->hi[w];
+	ctx = aux_par_ctx(j->contexts, j->context_size, w);
+	if (lo <= hi)
+		switch (j->m->d.sub_type) {
+		case SM_II32:
+			c = sm_itr_ii32(j->m, (int32_t)lo, (int32_t)hi,
+					j->f.ii32, ctx);
+			break;
+		case SM_UU32:
+			c = sm_itr_uu32(j->m, (uint32_t)lo, (uint32_t)hi,
+					j->f.uu32, ctx);
+			break;
+		case SM_II:
+			c = sm_itr_ii(j->m, lo, hi, j->f.ii, ctx);
+			break;
+		case SM_IS:
+			c = sm_itr_is(j->m, lo, hi, j->f.is, ctx);
+			break;
+		case SM_IP:
+			c = sm_itr_ip(j->m, lo, hi, j->f.ip, ctx);
+			break;
+		default:
+			break;
+		}
+	j->cnt[w] = c;
+}
+
+static srt_bool sm_par_init(struct SMParJob *j, const srt_map *m,
+			    int64_t kmin, int64_t kmax, const srt_map_par *p)
+{
+	j->m = m;
+	j->contexts = p->contexts;
+	j->context_size = p->context_size;
+	j->nw = p->nworkers ? p->nworkers : 1;
+	j->lo = (int64_t *)s_malloc(j->nw
+				    * (2 * sizeof(int64_t) + sizeof(size_t)));
+	RETURN_IF(!j->lo, S_FALSE);
+	j->hi = j->lo + j->nw;
+	j->cnt = (size_t *)(j->hi + j->nw);
+	if (!sm_par_split(m, kmin, kmax, j->nw, j->lo, j->hi)) {
+		s_free(j->lo);
+		return S_FALSE;
+	}
+	return S_TRUE;
+}
+
+static void sm_par_run(struct SMParJob *j, const srt_map_par *p)
+{
+	size_t i;
+	memset(j->cnt, 0, j->nw * sizeof(size_t));
+	if (p->runf)
+		p->runf(p->run_context, j->nw, aux_itrpp_job, j);
+	else
+		for (i = 0; i < j->nw; i++)
+			aux_itrpp_job(j, i);
+}
+
+static size_t aux_itrpp(int t, const srt_map *m, int64_t kmin, int64_t kmax,
+			union SMItCb f, const srt_map_par *p)
+{
+	size_t i, cnt = 0;
+	struct SMParJob j;
+	RETURN_IF(!m || t != m->d.sub_type || !p, 0);
+	RETURN_IF(!sm_par_init(&j, m, kmin, kmax, p), 0);
+	j.f = f;
+	sm_par_run(&j, p);
+	for (i = 0; i < j.nw; i++) {
+		cnt += j.cnt[i];
+		if (p->reducef)
+			p->reducef(p->reduce_context,
+				   aux_par_ctx(p->contexts, p->context_size, i),
+				   i);
+	}
+	s_free(j.lo);
+	return cnt;
+}
+
+#define SM_ITRPP_X(t, fld)                                                     \
+	union SMItCb cb;                                                       \
+	cb.fld = f;                                                            \
+	return aux_itrpp(t, m, kmin, kmax, cb, p)
+
+size_t sm_itrpp_ii32(const srt_map *m, int32_t kmin, int32_t kmax,
+		     srt_map_it_ii32 f, const srt_map_par *p)
+{
+	SM_ITRPP_X(SM_II32, ii32);
+}
+
+size_t sm_itrpp_uu32(const srt_map *m, uint32_t kmin, uint32_t kmax,
+		     srt_map_it_uu32 f, const srt_map_par *p)
+{
+	SM_ITRPP_X(SM_UU32, uu32);
+}
+
+size_t sm_itrpp_ii(const srt_map *m, int64_t kmin, int64_t kmax,
+		   srt_map_it_ii f, const srt_map_par *p)
+{
+	SM_ITRPP_X(SM_II, ii);
+}
+
+size_t sm_itrpp_is(const srt_map *m, int64_t kmin, int64_t kmax,
+		   srt_map_it_is f, const srt_map_par *p)
+{
+	SM_ITRPP_X(SM_IS, is);
+}
+
+size_t sm_itrpp_ip(const srt_map *m, int64_t kmin, int64_t kmax,
+		   srt_map_it_ip f, const srt_map_par *p)
+{
+	SM_ITRPP_X(SM_IP, ip);
+}
+
+/*
+ * Parallel sort to vectors, in one pass. Ranked maps: every worker writes
+ * its key subrange at its offset, computed from the subtree node counts.
+ * Otherwise: the first worker writes in place, the others into their own
+ * buffers, concatenated after the pass (also in parallel)
+ */
+
+struct SMParSort {
+	uint8_t *k, *v; /* output buffers */
+	size_t n, max;	/* elements written, buffer capacity (elements) */
+	size_t off;	/* output offset (elements) */
+	srt_bool own;	/* buffers to be concatenated and freed */
+	srt_bool err;	/* not enough memory */
+};
+
+struct SMParCat {
+	struct SMParSort *s;
+	uint8_t *k, *v; /* output start */
+	size_t es, nw;
+};
+
+static srt_bool aux_par_sort_grow(struct SMParSort *s, size_t es)
+{
+	size_t max = s->max ? s->max * 2 : 256;
+	uint8_t *k = NULL, *v = NULL;
+	if (s->own) {
+		k = (uint8_t *)s_realloc(s->k, max * es);
+		if (k)
+			s->k = k;
+		v = k ? (uint8_t *)s_realloc(s->v, max * es) : NULL;
+		if (v)
+			s->v = v;
+	}
+	if (!v) {
+		s->err = S_TRUE;
+		return S_FALSE;
+	}
+	s->max = max;
+	return S_TRUE;
+}
+
+#define SM_PAR_SORT_X(T)                                                       \
+	struct SMParSort *s = (struct SMParSort *)context;                     \
+	if (s->n == s->max && !aux_par_sort_grow(s, sizeof(T)))                \
+		return S_FALSE;                                                \
+	((T *)s->k)[s->n] = k;                                                 \
+	((T *)s->v)[s->n++] = v;                                               \
+	return S_TRUE
+
+static srt_bool aux_par_sort_ii32(int32_t k, int32_t v, void *context)
+{
+	SM_PAR_SORT_X(int32_t);
+}
+
+static srt_bool aux_par_sort_uu32(uint32_t k, uint32_t v, void *context)
+{
+	SM_PAR_SORT_X(uint32_t);
+}
+
+static srt_bool aux_par_sort_ii(int64_t k, int64_t v, void *context)
+{
+	SM_PAR_SORT_X(int64_t);
+}
+
+static void aux_par_cat_job(void *job_context, size_t w)
+{
+	struct SMParCat *c = (struct SMParCat *)job_context;
+	struct SMParSort *s;
+	if (w >= c->nw)
+		return;
+	s = c->s + w;
+	if (!s->own)
+		return;
+	if (s->n) {
+		memcpy(c->k + s->off * c->es, s->k, s->n * c->es);
+		memcpy(c->v + s->off * c->es, s->v, s->n * c->es);
+	}
+	s_free(s->k);
+	s_free(s->v);
+}
+
+static srt_bool sm_par_vector(srt_vector **v, enum eSV_Type t, size_t size)
+{
+	if (*v && (*v)->d.sub_type != (uint8_t)t)
+		sv_free(v);
+	if (!*v)
+		*v = sv_alloc_t(t, size);
+	return *v && sv_reserve(v, sv_size(*v) + size) >= sv_size(*v) + size
+		       ? S_TRUE
+		       : S_FALSE;
+}
+
+ssize_t sm_sort_to_vectors_par(const srt_map *m, srt_vector **kv,
+			       srt_vector **vv, const srt_map_par *p)
+{
+	size_t i, es, ks, vs, ms, cnt = 0;
+	srt_bool ranked, err = S_FALSE;
+	int64_t kmin, kmax;
+	enum eSV_Type t;
+	union SMItCb f;
+	struct SMParJob j;
+	struct SMParSort *ctx;
+	struct SMParCat cat;
+	RETURN_IF(!m || !kv || !vv, 0);
+	switch (m->d.sub_type) {
+	case SM_II32:
+		t = SV_I32;
+		es = sizeof(int32_t);
+		kmin = INT32_MIN;
+		kmax = INT32_MAX;
+		f.ii32 = aux_par_sort_ii32;
+		break;
+	case SM_UU32:
+		t = SV_U32;
+		es = sizeof(uint32_t);
+		kmin = 0;
+		kmax = UINT32_MAX;
+		f.uu32 = aux_par_sort_uu32;
+		break;
+	case SM_II:
+		t = SV_I64;
+		es = sizeof(int64_t);
+		kmin = INT64_MIN;
+		kmax = INT64_MAX;
+		f.ii = aux_par_sort_ii;
+		break;
+	default: /* BEHAVIOR: not integer key and value: sequential */
+		return sm_sort_to_vectors(m, kv, vv) ? (ssize_t)sm_size(m) : 0;
+	}
+	RETURN_IF(!p, 0);
+	ms = sm_size(m);
+	RETURN_IF(!sm_par_vector(kv, t, ms) || !sm_par_vector(vv, t, ms), 0);
+	RETURN_IF(!sm_par_init(&j, m, kmin, kmax, p), 0);
+	ctx = (struct SMParSort *)s_calloc(j.nw, sizeof(struct SMParSort));
+	if (!ctx) {
+		s_free(j.lo);
+		return 0;
+	}
+	ks = sv_size(*kv);
+	vs = sv_size(*vv);
+	cat.s = ctx;
+	cat.k = (uint8_t *)sv_get_buffer(*kv) + ks * es;
+	cat.v = (uint8_t *)sv_get_buffer(*vv) + vs * es;
+	cat.es = es;
+	cat.nw = j.nw;
+	ranked = sm_is_ranked(m) && !m->bt;
+	for (i = 0; i < j.nw; i++) {
+		ctx[i].off = cnt;
+		if (ranked) {
+			ctx[i].max = sm_count_range_i(m, j.lo[i], j.hi[i]);
+			cnt += ctx[i].max;
+		}
+		if (ranked || !i) {
+			ctx[i].k = cat.k + ctx[i].off * es;
+			ctx[i].v = cat.v + ctx[i].off * es;
+		} else
+			ctx[i].own = S_TRUE;
+	}
+	if (!ranked)
+		ctx[0].max = ms;
+	j.f = f;
+	j.contexts = ctx;
+	j.context_size = sizeof(struct SMParSort);
+	sm_par_run(&j, p);
+	for (cnt = i = 0; i < j.nw; i++) {
+		ctx[i].off = cnt;
+		cnt += ctx[i].n;
+		if (ctx[i].err)
+			err = S_TRUE;
+	}
+	if (!ranked && !err) {
+		if (p->runf)
+			p->runf(p->run_context, j.nw, aux_par_cat_job, &cat);
+		else
+			for (i = 0; i < j.nw; i++)
+				aux_par_cat_job(&cat, i);
+	} else
+		for (i = 0; i < j.nw; i++)
+			if (ctx[i].own) {
+				s_free(ctx[i].k);
+				s_free(ctx[i].v);
+			}
+	if (err)
+		cnt = 0;
+	sv_set_size(*kv, ks + cnt);
+	sv_set_size(*vv, vs + cnt);
+	s_free(ctx);
+	s_free(j.lo);
+	return (ssize_t)cnt;
+}
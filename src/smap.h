@@ -12,6 +12,45 @@ extern "C" {
  * #DOC Map functions handle key-value storage, which is implemented as a
  * #DOC Red-Black tree (O(log n) time complexity for insert/read/delete)
  * #DOC
+ * #DOC Integer-key maps can use a B+tree index instead (sm_alloc_btree()),
+ * #DOC keeping the same API. Each B+tree node spans a few cache lines,
+ * #DOC having the keys stored together, so a lookup touches much fewer
+ * #DOC cache lines than walking the Red-Black tree nodes, and range
+ * #DOC enumeration (sm_itr_*()) scans the linked leaves. Elements are
+ * #DOC still stored in a vector (so sm_it_*() enumeration is unchanged),
+ * #DOC the B+tree index being allocated separately in the heap (no stack
+ * #DOC allocation for this mode). Trade-off: the leaves store element
+ * #DOC positions, not the values, so a found key costs one more random
+ * #DOC access (the element), and elements keep the Red-Black node header
+ * #DOC (8 bytes). E.g. SM_II random lookups of existing keys, 1M elements:
+ * #DOC ~1200ns Red-Black tree, ~560ns B+tree, ~370ns of them in the index
+ * #DOC (10M elements: ~2100ns, ~980ns, ~720ns). Keys not found skip the
+ * #DOC element access. For read-only data, frozen maps (sfmap.h) store
+ * #DOC keys and values without per-element overhead.
+ * #DOC
+ * #DOC Snapshots (sm_snapshot()) are for many reader threads and a single
+ * #DOC writer: the map being written becomes an immutable snapshot, to be
+ * #DOC read without locks (read-only functions do not modify the map), and
+ * #DOC the writer continues on the previous snapshot, once no reader uses
+ * #DOC it anymore (e.g. after an epoch/grace period, handled by the user).
+ * #DOC That previous snapshot is brought up to date by copying only the keys
+ * #DOC modified since it was taken (tracked by the map after the first
+ * #DOC snapshot), instead of copying the whole map.
+ * #DOC
+ * #DOC Merge and set operations (sm_merge(), sm_intersect(), sm_diff())
+ * #DOC stream both maps in key order, writing the result elements into a
+ * #DOC new element vector in that same order, and linking the tree in one
+ * #DOC pass, so they are linear instead of one tree search per element.
+ * #DOC Right after the operation, elements 0 to n - 1 are in key order, so
+ * #DOC the sm_it_*() enumeration is sorted (e.g. for exporting the result
+ * #DOC as sorted vectors with a plain loop), until the next insert/delete.
+ * #DOC
+ * #DOC String keys too long for in-node storage keep a copy of their first
+ * #DOC 8 bytes in the node, so most comparisons of a tree search do not read
+ * #DOC the key string. This only helps keys whose first 8 bytes differ: keys
+ * #DOC sharing a longer common prefix (e.g. URLs starting with "https://")
+ * #DOC always tie on it, and are compared reading the key strings.
+ * #DOC
  * #DOC
  * #DOC Supported key/value modes (enum eSM_Type):
  * #DOC
@@ -51,11 +90,33 @@ extern "C" {
  * #DOC	typedef srt_bool (*srt_map_it_ss)(const srt_string *, const srt_string *, void *context);
  * #DOC
  * #DOC	typedef srt_bool (*srt_map_it_sp)(const srt_string *, const void *, void *context);
+ * #DOC
+ * #DOC
+ * #DOC Parallel range enumeration (sm_itrpp_*() functions, integer-key
+ * #DOC maps): the [key_min, key_max] range is split into one contiguous key
+ * #DOC subrange per worker, at keys sampled from the tree levels near the
+ * #DOC root (balanced partitions, without walking the whole tree), each
+ * #DOC subrange being enumerated in key order with its own callback context.
+ * #DOC Threads are provided by the user, through a job runner callback
+ * #DOC (e.g. a thread pool), that must call the job function once for every
+ * #DOC job in [0, njobs), in any order and concurrently or not, returning
+ * #DOC once all are done. Without runner, jobs are run sequentially by the
+ * #DOC calling thread. Once all jobs are done, the optional reduce callback
+ * #DOC is called for every worker, in worker order, i.e. in key order. The
+ * #DOC map must not be modified during the enumeration.
+ * #DOC
+ * #DOC
+ * #DOC	typedef void (*srt_map_job_f)(void *job_context, size_t job);
+ * #DOC
+ * #DOC	typedef void (*srt_map_run_f)(void *run_context, size_t njobs, srt_map_job_f job, void *job_context);
+ * #DOC
+ * #DOC	typedef void (*srt_map_reduce_f)(void *reduce_context, void *worker_context, size_t worker);
  *
  * Copyright (c) 2015-2019 F. Aragon. All rights reserved.
  * Released under the BSD 3-Clause License (see the doc/LICENSE)
  */
 
+#include "saux/sbtree.h"
 #include "saux/stree.h"
 #include "saux/sstringo.h"
 #include "sstring.h"
@@ -91,6 +152,12 @@ enum eSM_Type {
 	SM_SP = SM0_SP
 };
 
+enum eSM_Merge {
+	SM_MERGE_OVERWRITE, /* common keys: source value */
+	SM_MERGE_KEEP,	    /* common keys: target value */
+	SM_MERGE_SUM	    /* common keys: values added (II32, UU32, II, SI) */
+};
+
 struct SMapI {
 	srt_tnode n;
 	int64_t k;
@@ -163,6 +230,31 @@ typedef srt_bool (*srt_map_it_si)(const srt_string *, int64_t v, void *context);
 typedef srt_bool (*srt_map_it_ss)(const srt_string *, const srt_string *, void *context);
 typedef srt_bool (*srt_map_it_sp)(const srt_string *, const void *, void *context);
 
+struct SMapCursor {
+	struct STCursor t;  /* Red-Black tree path */
+	struct SBTCursor b; /* B+tree index position */
+};
+
+typedef struct SMapCursor srt_map_cursor;
+
+typedef void (*srt_map_job_f)(void *job_context, size_t job);
+typedef void (*srt_map_run_f)(void *run_context, size_t njobs,
+			      srt_map_job_f job, void *job_context);
+typedef void (*srt_map_reduce_f)(void *reduce_context, void *worker_context,
+				 size_t worker);
+
+struct SMPar {
+	size_t nworkers; /* number of key subranges (0: 1) */
+	srt_map_run_f runf; /* job runner (NULL: sequential) */
+	void *run_context;
+	void *contexts; /* per-worker callback contexts array (or NULL) */
+	size_t context_size; /* per-worker context size, in bytes */
+	srt_map_reduce_f reducef; /* optional, called in worker order */
+	void *reduce_context;
+};
+
+typedef struct SMPar srt_map_par;
+
 /*
  * Allocation
  */
@@ -198,6 +290,36 @@ S_INLINE srt_map *sm_alloc(enum eSM_Type t, size_t initial_num_elems_reserve)
 	return sm_alloc0((enum eSM_Type0)t, initial_num_elems_reserve);
 }
 
+srt_map *sm_alloc_btree0(enum eSM_Type0 t, size_t initial_num_elems_reserve);
+
+/* #API: |Allocate map (heap), using a B+tree index (integer key maps: SM_II32, SM_UU32, SM_II, SM_IS, SM_IP; other types get the Red-Black tree)|map type; initial reserve|map|O(1)|1;2| */
+S_INLINE srt_map *sm_alloc_btree(enum eSM_Type t,
+				 size_t initial_num_elems_reserve)
+{
+	return sm_alloc_btree0((enum eSM_Type0)t, initial_num_elems_reserve);
+}
+
+srt_map *sm_alloc_ranked0(enum eSM_Type0 t, size_t initial_num_elems_reserve);
+
+/* #API: |Allocate ranked map (heap): nodes also store their subtree node count (4 bytes, plus alignment), for O(log n) sm_rank_*(), sm_select() and sm_count_range_*()|map type; initial reserve|map|O(1)|1;2| */
+S_INLINE srt_map *sm_alloc_ranked(enum eSM_Type t,
+				  size_t initial_num_elems_reserve)
+{
+	return sm_alloc_ranked0((enum eSM_Type0)t, initial_num_elems_reserve);
+}
+
+/* #API: |Check if the map is ranked (see sm_alloc_ranked())|map|S_TRUE: ranked map; S_FALSE: not ranked|O(1)|1;2| */
+S_INLINE srt_bool sm_is_ranked(const srt_map *m)
+{
+	return m && m->cnt_off ? S_TRUE : S_FALSE;
+}
+
+/* #API: |Check if the map uses a B+tree index|map|S_TRUE: B+tree index; S_FALSE: Red-Black tree|O(1)|1;2| */
+S_INLINE srt_bool sm_is_btree(const srt_map *m)
+{
+	return m && m->bt ? S_TRUE : S_FALSE;
+}
+
 /* #NOTAPI: |Get map node size from map type|map type|bytes required for storing a single node|O(1)|1;2| */
 S_INLINE uint8_t sm_elem_size(int t)
 {
@@ -235,6 +357,30 @@ S_INLINE uint8_t sm_elem_size(int t)
 /* #API: |Duplicate map|input map|output map|O(n)|1;2| */
 srt_map *sm_dup(const srt_map *src);
 
+srt_map *sm_from_sorted0(enum eSM_Type0 t, const srt_vector *kv,
+			 const srt_vector *vv);
+
+/* #API: |Build map from keys in ascending order (e.g. sm_sort_to_vectors() output), without per-element rebalancing|integer vector for keys; integer vector for values|map (NULL: allocation error)|O(n); unsorted input or repeated keys: O(n log n)|1;2| */
+S_INLINE srt_map *sm_from_sorted_ii32(const srt_vector *kv,
+				      const srt_vector *vv)
+{
+	return sm_from_sorted0(SM0_II32, kv, vv);
+}
+
+/* #API: |Build map from keys in ascending order (e.g. sm_sort_to_vectors() output), without per-element rebalancing|integer vector for keys; integer vector for values|map (NULL: allocation error)|O(n); unsorted input or repeated keys: O(n log n)|1;2| */
+S_INLINE srt_map *sm_from_sorted_uu32(const srt_vector *kv,
+				      const srt_vector *vv)
+{
+	return sm_from_sorted0(SM0_UU32, kv, vv);
+}
+
+/* #API: |Build map from keys in ascending order (e.g. sm_sort_to_vectors() output), without per-element rebalancing|integer vector for keys; integer vector for values|map (NULL: allocation error)|O(n); unsorted input or repeated keys: O(n log n)|1;2| */
+S_INLINE srt_map *sm_from_sorted_ii(const srt_vector *kv,
+				    const srt_vector *vv)
+{
+	return sm_from_sorted0(SM0_II, kv, vv);
+}
+
 /* #API: |Reset/clean map (keeping map type)|map|-|O(1) for simple maps, O(n) for maps having nodes with strings|1;2| */
 void sm_clear(srt_map *m);
 
@@ -281,6 +427,22 @@ srt_bool sm_empty(const srt_map *m)
 /* #API: |Overwrite map with a map copy|output map; input map|output map reference (optional usage)|O(n)|1;2| */
 srt_map *sm_cpy(srt_map **m, const srt_map *src);
 
+/* #API: |Take snapshot: the map becomes an immutable snapshot, and the map handle is set to a writable map with the same content, reusing the previous snapshot, if given|map (heap-allocated); previous snapshot, not in use anymore (NULL: none)|snapshot (NULL: error, map unchanged)|O(k log n), k: keys modified since the previous snapshot; first snapshot, or after sm_clear()/sm_cpy(): O(n)|1;2| */
+srt_map *sm_snapshot(srt_map **m, srt_map *prev);
+
+/*
+ * Merge and set operations (both maps must be of the same type)
+ */
+
+/* #API: |Merge map into another map (union), streaming both in key order|target map; source map; policy for keys in both maps (SM_MERGE_OVERWRITE, SM_MERGE_KEEP, SM_MERGE_SUM)|S_TRUE: OK, S_FALSE: error (different map types, SM_MERGE_SUM not supported for the map type, or not enough memory)|O(n + m)|1;2| */
+srt_bool sm_merge(srt_map **m, const srt_map *src, enum eSM_Merge mode);
+
+/* #API: |Keep only the map elements having keys in other map (intersection), streaming both in key order, or looking up the smaller map elements in the other map when much smaller|target map; other map|S_TRUE: OK, S_FALSE: error|O(min(n + m, s log l)), s: smaller map size, l: larger map size|1;2| */
+srt_bool sm_intersect(srt_map **m, const srt_map *src);
+
+/* #API: |Delete the map elements having keys in other map (difference), streaming both in key order, or deleting the other map keys when much smaller|target map; other map|S_TRUE: OK, S_FALSE: error|O(min(n + m, m log n))|1;2| */
+srt_bool sm_diff(srt_map **m, const srt_map *src);
+
 /*
  * Random access
  */
@@ -362,6 +524,31 @@ srt_bool sm_inc_ii(srt_map **m, int64_t k, int64_t v);
 /* #API: |Increment into string-int map|map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(log n)|1;2| */
 srt_bool sm_inc_si(srt_map **m, const srt_string *k, int64_t v);
 
+/*
+ * Find or insert: pointer to the value of the element having the key,
+ * inserting it (with value 0 or NULL) if not in the map, for updating it
+ * in place with a single tree walk (the pointer is valid until the next
+ * map modification)
+ */
+
+/* #API: |Find or insert element into int32-int32 map|map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(log n)|1;2| */
+int32_t *sm_emplace_ii32(srt_map **m, int32_t k, srt_bool *is_new);
+
+/* #API: |Find or insert element into uint32-uint32 map|map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(log n)|1;2| */
+uint32_t *sm_emplace_uu32(srt_map **m, uint32_t k, srt_bool *is_new);
+
+/* #API: |Find or insert element into int-int map|map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(log n)|1;2| */
+int64_t *sm_emplace_ii(srt_map **m, int64_t k, srt_bool *is_new);
+
+/* #API: |Find or insert element into int-pointer map|map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(log n)|1;2| */
+const void **sm_emplace_ip(srt_map **m, int64_t k, srt_bool *is_new);
+
+/* #API: |Find or insert element into string-int map|map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(log n)|1;2| */
+int64_t *sm_emplace_si(srt_map **m, const srt_string *k, srt_bool *is_new);
+
+/* #API: |Find or insert element into string-pointer map|map; key; output: S_TRUE if inserted (optional)|value pointer (NULL: insertion error)|O(log n)|1;2| */
+const void **sm_emplace_sp(srt_map **m, const srt_string *k, srt_bool *is_new);
+
 /*
  * Delete
  */
@@ -400,9 +587,73 @@ size_t sm_itr_ss(const srt_map *m, const srt_string *key_min, const srt_string *
 /* #API: |Enumerate map elements in a given key range|map; key lower bound; key upper bound; callback function; callback function context|Elements processed|O(log n) + O(log m); additional 2 * O(log n) space required, allocated on the stack, i.e. fast|1;2| */
 size_t sm_itr_sp(const srt_map *m, const srt_string *key_min, const srt_string *key_max, srt_map_it_sp f, void *context);
 
+/* #API: |Enumerate map elements in a given key range, in parallel|map; key lower bound; key upper bound; callback function; parallel enumeration setup|Elements processed|O(n / workers) + O(workers log n)|1;2| */
+size_t sm_itrpp_ii32(const srt_map *m, int32_t key_min, int32_t key_max, srt_map_it_ii32 f, const srt_map_par *p);
+
+/* #API: |Enumerate map elements in a given key range, in parallel|map; key lower bound; key upper bound; callback function; parallel enumeration setup|Elements processed|O(n / workers) + O(workers log n)|1;2| */
+size_t sm_itrpp_uu32(const srt_map *m, uint32_t key_min, uint32_t key_max, srt_map_it_uu32 f, const srt_map_par *p);
+
+/* #API: |Enumerate map elements in a given key range, in parallel|map; key lower bound; key upper bound; callback function; parallel enumeration setup|Elements processed|O(n / workers) + O(workers log n)|1;2| */
+size_t sm_itrpp_ii(const srt_map *m, int64_t key_min, int64_t key_max, srt_map_it_ii f, const srt_map_par *p);
+
+/* #API: |Enumerate map elements in a given key range, in parallel|map; key lower bound; key upper bound; callback function; parallel enumeration setup|Elements processed|O(n / workers) + O(workers log n)|1;2| */
+size_t sm_itrpp_is(const srt_map *m, int64_t key_min, int64_t key_max, srt_map_it_is f, const srt_map_par *p);
+
+/* #API: |Enumerate map elements in a given key range, in parallel|map; key lower bound; key upper bound; callback function; parallel enumeration setup|Elements processed|O(n / workers) + O(workers log n)|1;2| */
+size_t sm_itrpp_ip(const srt_map *m, int64_t key_min, int64_t key_max, srt_map_it_ip f, const srt_map_par *p);
+
+/*
+ * Sorted enumeration with cursor (no callbacks). A cursor is valid until
+ * the next map modification.
+ */
+
+/* #API: |Position cursor at the first element with key greater or equal than the given one (integer-key maps)|map; key; cursor|S_TRUE: cursor at an element; S_FALSE: no element found|O(log n)|1;2| */
+srt_bool sm_cur_seek_ge_i(const srt_map *m, int64_t k, srt_map_cursor *c);
+
+/* #API: |Position cursor at the last element with key lower or equal than the given one (integer-key maps)|map; key; cursor|S_TRUE: cursor at an element; S_FALSE: no element found|O(log n)|1;2| */
+srt_bool sm_cur_seek_le_i(const srt_map *m, int64_t k, srt_map_cursor *c);
+
+/* #API: |Position cursor at the first element with key greater or equal than the given one (string-key maps)|map; key; cursor|S_TRUE: cursor at an element; S_FALSE: no element found|O(log n)|1;2| */
+srt_bool sm_cur_seek_ge_s(const srt_map *m, const srt_string *k, srt_map_cursor *c);
+
+/* #API: |Position cursor at the last element with key lower or equal than the given one (string-key maps)|map; key; cursor|S_TRUE: cursor at an element; S_FALSE: no element found|O(log n)|1;2| */
+srt_bool sm_cur_seek_le_s(const srt_map *m, const srt_string *k, srt_map_cursor *c);
+
+/* #API: |Move cursor to the next element, in key order|map; cursor|S_TRUE: cursor at an element; S_FALSE: no more elements (the cursor has to be positioned again)|O(1) amortized|1;2| */
+srt_bool sm_cur_next(const srt_map *m, srt_map_cursor *c);
+
+/* #API: |Move cursor to the previous element, in key order|map; cursor|S_TRUE: cursor at an element; S_FALSE: no more elements (the cursor has to be positioned again)|O(1) amortized; B+tree index: O(log n) when crossing to the previous leaf|1;2| */
+srt_bool sm_cur_prev(const srt_map *m, srt_map_cursor *c);
+
+/*
+ * Order statistics: O(log n) for ranked maps (sm_alloc_ranked()), O(n)
+ * otherwise
+ */
+
+/* #API: |Number of elements with key lower than the given one (integer-key maps)|map; key|Number of elements|O(log n) ranked map; O(n) otherwise|1;2| */
+size_t sm_rank_i(const srt_map *m, int64_t k);
+
+/* #API: |Number of elements with key lower than the given one (string-key maps)|map; key|Number of elements|O(log n) ranked map; O(n) otherwise|1;2| */
+size_t sm_rank_s(const srt_map *m, const srt_string *k);
+
+/* #API: |Locate the i-th element in key order (e.g. for percentiles)|map; position (0 to n - 1)|element, 0 to n - 1, for reading it with the sm_it_*() functions (ST_NIL: out of range)|O(log n) ranked map; O(n) otherwise|1;2| */
+srt_tndx sm_select(const srt_map *m, size_t i);
+
+/* #API: |Number of elements in a given key range (integer-key maps)|map; key lower bound; key upper bound|Number of elements|O(log n) ranked map; O(n) otherwise|1;2| */
+size_t sm_count_range_i(const srt_map *m, int64_t kmin, int64_t kmax);
+
+/* #API: |Number of elements in a given key range (string-key maps)|map; key lower bound; key upper bound|Number of elements|O(log n) ranked map; O(n) otherwise|1;2| */
+size_t sm_count_range_s(const srt_map *m, const srt_string *kmin, const srt_string *kmax);
+
+/* #NOTAPI: |Insert node, with rewrite function (in case of key already written), using the map index|map; node to insert; rewrite function (NULL: overwrite); output: S_TRUE if inserted (optional)|inserted or rewritten node (NULL: insertion error)|O(log n)|1;2| */
+srt_tnode *sm_insert_node(srt_map **m, const srt_tnode *n, srt_tree_rewrite rw_f, srt_bool *is_new);
+
 /* #NOTAPI: |Sort map to vector (used for test coverage, not as documented API)|map; output vector for keys; output vector for values|Number of map elements|O(n)|1;2| */
 ssize_t sm_sort_to_vectors(const srt_map *m, srt_vector **kv, srt_vector **vv);
 
+/* #NOTAPI: |Sort map to vector, in parallel, in one pass: every worker writes its key subrange at its offset (ranked maps) or to its own buffer, concatenated after the pass (integer key and value maps; other types: sm_sort_to_vectors())|map; output vector for keys; output vector for values; parallel setup (contexts and reduce callback not used)|Number of map elements|O(n / workers) + O(workers log n)|1;2| */
+ssize_t sm_sort_to_vectors_par(const srt_map *m, srt_vector **kv, srt_vector **vv, const srt_map_par *p);
+
 /*
  * Auxiliary inlined functions
  */
@@ -424,6 +675,16 @@ ssize_t sm_sort_to_vectors(const srt_map *m, srt_vector **kv, srt_vector **vv);
 	RETURN_IF(!n, def_v);                                                  \
 	return n_v
 
+/* #API: |Cursor element, for reading it with the sm_it_*() functions|map; cursor|element, 0 to n - 1 (ST_NIL: cursor not at an element)|O(1)|1;2| */
+S_INLINE srt_tndx sm_cur_id(const srt_map *m, const srt_map_cursor *c)
+{
+	RETURN_IF(!m || !c, ST_NIL);
+	if (m->bt)
+		return c->b.n == ST_NIL ? ST_NIL
+					: sbt_node_r(m->bt, c->b.n)->c[c->b.i];
+	return c->t.d ? c->t.p[c->t.d - 1] : ST_NIL;
+}
+
 /* #API: |Enumerate int32-* map keys|map; element, 0 to n - 1|int32_t|O(1)|1;2| */
 S_INLINE int32_t sm_it_i32_k(const srt_map *m, srt_tndx i)
 {
@@ -502,8 +763,8 @@ S_INLINE const void *sm_it_sp_v(const srt_map *m, srt_tndx i)
 	 * Templates (internal usage)
 	 */
 
-#define SM_ENUM_INORDER_XX(FN, CALLBACK_T, MAP_TYPE, KEY_T, TR_CMP_MIN,        \
-			   TR_CMP_MAX, TR_CALLBACK)                            \
+#define SM_ENUM_INORDER_XX(FN, CALLBACK_T, MAP_TYPE, KEY_T, BT_KMIN, BT_KMAX,  \
+			   TR_CMP_MIN, TR_CMP_MAX, TR_CALLBACK)                \
 	size_t FN(const srt_map *m, KEY_T kmin, KEY_T kmax, CALLBACK_T f,      \
 		  void *context)                                               \
 	{                                                                      \
@@ -512,12 +773,26 @@ S_INLINE const void *sm_it_sp_v(const srt_map *m, srt_tndx i)
 		struct STreeScan *p;                                           \
 		const srt_tnode *cn;                                           \
 		int cmpmin, cmpmax;                                            \
+		struct SBTCursor bc;                                           \
+		int64_t bk;                                                    \
+		srt_tndx bx;                                                   \
 		RETURN_IF(!m, 0);			 /* null tree */       \
 		RETURN_IF(m->d.sub_type != MAP_TYPE, 0); /* wrong type */      \
 		ts = sm_size(m);                                               \
 		RETURN_IF(!ts, S_FALSE); /* empty tree */                      \
 		level = 0;                                                     \
 		nelems = 0;                                                    \
+		if (m->bt) { /* B+tree index: linked leaves scan */            \
+			sbt_seek(m->bt, BT_KMIN, &bc);                         \
+			while (sbt_next(m->bt, &bc, &bk, &bx)                  \
+			       && bk <= BT_KMAX) {                             \
+				cn = get_node_r(m, bx);                        \
+				if (f && !TR_CALLBACK)                         \
+					return nelems;                         \
+				nelems++;                                      \
+			}                                                      \
+			return nelems;                                         \
+		}                                                              \
 		rbt_max_depth = 2 * (slog2(ts) + 1);                           \
 		p = (struct STreeScan *)s_alloca(sizeof(struct STreeScan)      \
 						 * (rbt_max_depth + 3));       \
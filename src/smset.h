@@ -11,6 +11,8 @@ extern "C" {
  *
  * #DOC Set functions handle key-only storage, which is implemented as a
  * #DOC Red-Black tree (O(n log n) maximum complexity for insert/read/delete).
+ * #DOC Integer sets can use a B+tree index instead (sms_alloc_btree(), see
+ * #DOC sm_alloc_btree()).
  * #DOC
  * #DOC
  * #DOC Supported set modes (enum eSMS_Type):
@@ -55,6 +57,7 @@ enum eSMS_Type {
 };
 
 typedef srt_map srt_set; /* Opaque structure (accessors are provided) */
+typedef srt_map_cursor srt_set_cursor;
 			 /* (set is implemented over key-only map)    */
 
 typedef srt_bool (*srt_set_it_i32)(int32_t k, void *context);
@@ -90,12 +93,44 @@ S_INLINE srt_set *sms_alloc(enum eSMS_Type t, size_t initial_num_elems_reserve)
 	return sm_alloc0((enum eSM_Type0)t, initial_num_elems_reserve);
 }
 
+/* #API: |Allocate set (heap), using a B+tree index (integer sets: SMS_I32, SMS_U32, SMS_I; SMS_S gets the Red-Black tree)|set type; initial reserve|set|O(1)|1;2| */
+S_INLINE srt_set *sms_alloc_btree(enum eSMS_Type t,
+				  size_t initial_num_elems_reserve)
+{
+	return sm_alloc_btree0((enum eSM_Type0)t, initial_num_elems_reserve);
+}
+
+/* #API: |Allocate ranked set (heap), for O(log n) sms_rank_*(), sms_select() and sms_count_range_*() (see sm_alloc_ranked())|set type; initial reserve|set|O(1)|1;2| */
+S_INLINE srt_set *sms_alloc_ranked(enum eSMS_Type t,
+				   size_t initial_num_elems_reserve)
+{
+	return sm_alloc_ranked0((enum eSM_Type0)t, initial_num_elems_reserve);
+}
+
 /* #API: |Duplicate set|input set|output set|O(n)|1;2| */
 S_INLINE srt_set *sms_dup(const srt_set *src)
 {
 	return sm_dup(src);
 }
 
+/* #API: |Build set from keys in ascending order, without per-element rebalancing|integer vector for keys|set (NULL: allocation error)|O(n); unsorted input or repeated keys: O(n log n)|1;2| */
+S_INLINE srt_set *sms_from_sorted_i32(const srt_vector *kv)
+{
+	return sm_from_sorted0(SM0_I32, kv, NULL);
+}
+
+/* #API: |Build set from keys in ascending order, without per-element rebalancing|integer vector for keys|set (NULL: allocation error)|O(n); unsorted input or repeated keys: O(n log n)|1;2| */
+S_INLINE srt_set *sms_from_sorted_u32(const srt_vector *kv)
+{
+	return sm_from_sorted0(SM0_U32, kv, NULL);
+}
+
+/* #API: |Build set from keys in ascending order, without per-element rebalancing|integer vector for keys|set (NULL: allocation error)|O(n); unsorted input or repeated keys: O(n log n)|1;2| */
+S_INLINE srt_set *sms_from_sorted_i(const srt_vector *kv)
+{
+	return sm_from_sorted0(SM0_I, kv, NULL);
+}
+
 /* #API: |Reset/clean set (keeping set type)|set|-|O(1) for simple sets, O(n) for sets having nodes with strings|1;2| */
 S_INLINE void sms_clear(srt_set *s)
 {
@@ -151,6 +186,34 @@ S_INLINE srt_set *sms_cpy(srt_set **s, const srt_set *src)
 	return sm_cpy(s, src);
 }
 
+/* #API: |Take snapshot (see sm_snapshot())|set (heap-allocated); previous snapshot, not in use anymore (NULL: none)|snapshot (NULL: error, set unchanged)|O(k log n), k: keys modified since the previous snapshot; first snapshot: O(n)|1;2| */
+S_INLINE srt_set *sms_snapshot(srt_set **s, srt_set *prev)
+{
+	return sm_snapshot(s, prev);
+}
+
+/*
+ * Set operations (both sets must be of the same type)
+ */
+
+/* #API: |Add elements from other set (union), streaming both in key order|target set; source set|S_TRUE: OK, S_FALSE: error|O(n + m)|1;2| */
+S_INLINE srt_bool sms_union(srt_set **s, const srt_set *src)
+{
+	return sm_merge(s, src, SM_MERGE_KEEP);
+}
+
+/* #API: |Keep only elements in other set (intersection)|target set; other set|S_TRUE: OK, S_FALSE: error|O(min(n + m, s log l)), s: smaller set size, l: larger set size|1;2| */
+S_INLINE srt_bool sms_intersect(srt_set **s, const srt_set *src)
+{
+	return sm_intersect(s, src);
+}
+
+/* #API: |Delete elements in other set (difference)|target set; other set|S_TRUE: OK, S_FALSE: error|O(min(n + m, m log n))|1;2| */
+S_INLINE srt_bool sms_diff(srt_set **s, const srt_set *src)
+{
+	return sm_diff(s, src);
+}
+
 /*
  * Existence check
  */
@@ -183,7 +246,8 @@ S_INLINE srt_bool sms_insert_i32(srt_set **s, int32_t k)
 	struct SMapi n;
 	RETURN_IF(!s || (*s)->d.sub_type != SMS_I32, S_FALSE);
 	n.k = k;
-	return st_insert((srt_tree **)s, (const srt_tnode *)&n);
+	return sm_insert_node(s, (const srt_tnode *)&n, NULL, NULL) ? S_TRUE
+								   : S_FALSE;
 }
 
 /* #API: |Insert into uint32-uint32 set|set; key|S_TRUE: OK, S_FALSE: insertion error|O(log n)|1;2| */
@@ -192,7 +256,8 @@ S_INLINE srt_bool sms_insert_u32(srt_set **s, uint32_t k)
 	struct SMapu n;
 	RETURN_IF(!s || (*s)->d.sub_type != SMS_U32, S_FALSE);
 	n.k = k;
-	return st_insert((srt_tree **)s, (const srt_tnode *)&n);
+	return sm_insert_node(s, (const srt_tnode *)&n, NULL, NULL) ? S_TRUE
+								   : S_FALSE;
 }
 
 /* #API: |Insert into int-int set|set; key|S_TRUE: OK, S_FALSE: insertion error|O(log n)|1;2| */
@@ -201,27 +266,28 @@ S_INLINE srt_bool sms_insert_i(srt_set **s, int64_t k)
 	struct SMapI n;
 	RETURN_IF(!s || (*s)->d.sub_type != SMS_I, S_FALSE);
 	n.k = k;
-	return st_insert((srt_tree **)s, (const srt_tnode *)&n);
+	return sm_insert_node(s, (const srt_tnode *)&n, NULL, NULL) ? S_TRUE
+								   : S_FALSE;
+}
+
+/* Insertion rewrite: the key is copied only for new elements */
+S_INLINE void rw_add_SMS_S(srt_tnode *node, const srt_tnode *new_data,
+			   srt_bool existing)
+{
+	if (!existing)
+		sso1_set(&((struct SMapS *)node)->k,
+			 sso1_get(&((const struct SMapS *)new_data)->k));
 }
 
 /* #API: |Insert into string-string set|set; key|S_TRUE: OK, S_FALSE: insertion error|O(log n)|1;2| */
 S_INLINE srt_bool sms_insert_s(srt_set **s, const srt_string *k)
 {
 	struct SMapS n;
-	srt_bool ins_ok;
 	RETURN_IF(!s || (*s)->d.sub_type != SMS_S, S_FALSE);
-#if 1 /* workaround */
-	sso1_set(&n.k, k);
-	ins_ok = st_insert((srt_tree **)s, (const srt_tnode *)&n);
-	if (!ins_ok)
-		sso1_free(&n.k);
-	return ins_ok;
-#else
-	/* TODO: rw_add_SMS_S */
-	n.k = k;
-	return st_insert_rw((srt_tree **)m, (const srt_tnode *)&n,
-			    rw_add_SMS_S);
-#endif
+	sso1_setref(&n.k, k);
+	return sm_insert_node(s, (const srt_tnode *)&n, rw_add_SMS_S, NULL)
+		       ? S_TRUE
+		       : S_FALSE;
 }
 
 /*
@@ -256,6 +322,92 @@ size_t sms_itr_i(const srt_set *s, int64_t key_min, int64_t key_max, srt_set_it_
 /* #API: |Enumerate set elements in a given key range|set; key lower bound; key upper bound; callback function; callback function context|Elements processed|O(log n) + O(log m); additional 2 * O(log n) space required, allocated on the stack, i.e. fast|1;2| */
 size_t sms_itr_s(const srt_set *s, const srt_string *key_min, const srt_string *key_max, srt_set_it_s f, void *context);
 
+/*
+ * Order statistics (see sm_rank_*())
+ */
+
+/* #API: |Number of elements lower than the given one (integer sets)|set; key|Number of elements|O(log n) ranked set; O(n) otherwise|1;2| */
+S_INLINE size_t sms_rank_i(const srt_set *s, int64_t k)
+{
+	return sm_rank_i(s, k);
+}
+
+/* #API: |Number of elements lower than the given one (string sets)|set; key|Number of elements|O(log n) ranked set; O(n) otherwise|1;2| */
+S_INLINE size_t sms_rank_s(const srt_set *s, const srt_string *k)
+{
+	return sm_rank_s(s, k);
+}
+
+/* #API: |Locate the i-th element in key order|set; position (0 to n - 1)|element, 0 to n - 1, for reading it with the sms_it_*() functions (ST_NIL: out of range)|O(log n) ranked set; O(n) otherwise|1;2| */
+S_INLINE srt_tndx sms_select(const srt_set *s, size_t i)
+{
+	return sm_select(s, i);
+}
+
+/* #API: |Number of elements in a given range (integer sets)|set; lower bound; upper bound|Number of elements|O(log n) ranked set; O(n) otherwise|1;2| */
+S_INLINE size_t sms_count_range_i(const srt_set *s, int64_t kmin,
+				  int64_t kmax)
+{
+	return sm_count_range_i(s, kmin, kmax);
+}
+
+/* #API: |Number of elements in a given range (string sets)|set; lower bound; upper bound|Number of elements|O(log n) ranked set; O(n) otherwise|1;2| */
+S_INLINE size_t sms_count_range_s(const srt_set *s, const srt_string *kmin,
+				  const srt_string *kmax)
+{
+	return sm_count_range_s(s, kmin, kmax);
+}
+
+/*
+ * Sorted enumeration with cursor (see sm_cur_*())
+ */
+
+/* #API: |Position cursor at the first element greater or equal than the given one (integer sets)|set; key; cursor|S_TRUE: cursor at an element; S_FALSE: no element found|O(log n)|1;2| */
+S_INLINE srt_bool sms_cur_seek_ge_i(const srt_set *s, int64_t k,
+				    srt_set_cursor *c)
+{
+	return sm_cur_seek_ge_i(s, k, c);
+}
+
+/* #API: |Position cursor at the last element lower or equal than the given one (integer sets)|set; key; cursor|S_TRUE: cursor at an element; S_FALSE: no element found|O(log n)|1;2| */
+S_INLINE srt_bool sms_cur_seek_le_i(const srt_set *s, int64_t k,
+				    srt_set_cursor *c)
+{
+	return sm_cur_seek_le_i(s, k, c);
+}
+
+/* #API: |Position cursor at the first element greater or equal than the given one (string sets)|set; key; cursor|S_TRUE: cursor at an element; S_FALSE: no element found|O(log n)|1;2| */
+S_INLINE srt_bool sms_cur_seek_ge_s(const srt_set *s, const srt_string *k,
+				    srt_set_cursor *c)
+{
+	return sm_cur_seek_ge_s(s, k, c);
+}
+
+/* #API: |Position cursor at the last element lower or equal than the given one (string sets)|set; key; cursor|S_TRUE: cursor at an element; S_FALSE: no element found|O(log n)|1;2| */
+S_INLINE srt_bool sms_cur_seek_le_s(const srt_set *s, const srt_string *k,
+				    srt_set_cursor *c)
+{
+	return sm_cur_seek_le_s(s, k, c);
+}
+
+/* #API: |Move cursor to the next element, in key order|set; cursor|S_TRUE: cursor at an element; S_FALSE: no more elements|O(1) amortized|1;2| */
+S_INLINE srt_bool sms_cur_next(const srt_set *s, srt_set_cursor *c)
+{
+	return sm_cur_next(s, c);
+}
+
+/* #API: |Move cursor to the previous element, in key order|set; cursor|S_TRUE: cursor at an element; S_FALSE: no more elements|O(1) amortized|1;2| */
+S_INLINE srt_bool sms_cur_prev(const srt_set *s, srt_set_cursor *c)
+{
+	return sm_cur_prev(s, c);
+}
+
+/* #API: |Cursor element, for reading it with the sms_it_*() functions|set; cursor|element, 0 to n - 1 (ST_NIL: cursor not at an element)|O(1)|1;2| */
+S_INLINE srt_tndx sms_cur_id(const srt_set *s, const srt_set_cursor *c)
+{
+	return sm_cur_id(s, c);
+}
+
 /*
  * Unordered enumeration is inlined in order to get almost as fast
  * as array access after compiler optimization.
@@ -0,0 +1,1083 @@
+/*
+ * srmap.c
+ *
+ * Radix tree map handling (adaptive radix tree).
+ *
+ * Observations:
+ * - Nodes are stored in a single memory block, in 8-byte units, and
+ *   referenced by unit offset (shifted one bit, the low bit telling if the
+ *   node is a leaf). Unit 0 is not used, so reference 0 is the null
+ *   reference. Freed nodes are kept in one free list per size class.
+ * - Space for the worst case is reserved before every modification (new
+ *   leaf plus a new or grown inner node), so node addresses don't change
+ *   during the operation.
+ * - Inner nodes store the first SRM_PREFIX bytes of their compressed path.
+ *   Longer paths are checked against a key stored below (every key below a
+ *   node shares its path), once the walk reaches a leaf.
+ * - A key ending at an inner node (i.e. being a prefix of other keys) is
+ *   stored as the node 'val' leaf, instead of using a terminator byte, so
+ *   keys can contain any byte value.
+ *
+ * Copyright (c) 2015-2019 F. Aragon. All rights reserved.
+ * Released under the BSD 3-Clause License (see the doc/LICENSE)
+ */
+
+#include "srmap.h"
+#include "saux/scommon.h"
+
+/*
+ * Constants and internal data structures
+ */
+
+#define SRM_UNIT 8
+#define SRM_PREFIX 8
+#define SRM_NIL 0
+#define SRM_REF_MAX 0x7fffffff /* unit offsets */
+#define SRM_STACK0 64	       /* enumeration stack (initial levels) */
+
+#define SRM_UNITS(bytes) (((bytes) + SRM_UNIT - 1) / SRM_UNIT)
+#define SRM_IS_LEAF(r) (((r)&1) != 0)
+
+enum eSRM_Class { SRM_N4, SRM_N16, SRM_N48, SRM_N256, SRM_LEAF };
+
+struct SRMNode {
+	uint8_t type; /* enum eSRM_Class */
+	uint8_t pad;
+	uint16_t cnt;		    /* number of children */
+	uint32_t plen;		    /* compressed path length */
+	uint8_t prefix[SRM_PREFIX]; /* compressed path (first bytes) */
+	srt_rmref val;		    /* leaf for the key ending here */
+};
+
+struct SRMNode4 {
+	struct SRMNode h;
+	uint8_t k[4]; /* sorted */
+	srt_rmref c[4];
+};
+
+struct SRMNode16 {
+	struct SRMNode h;
+	uint8_t k[16]; /* sorted */
+	srt_rmref c[16];
+};
+
+struct SRMNode48 {
+	struct SRMNode h;
+	uint8_t ix[256]; /* child slot + 1 (0: no child) */
+	srt_rmref c[48];
+};
+
+struct SRMNode256 {
+	struct SRMNode h;
+	srt_rmref c[256];
+};
+
+struct SRMLeaf { /* SRM_SI, SRM_SP */
+	srt_stringo1 k;
+	union {
+		int64_t i;
+		const void *p;
+	} v;
+};
+
+struct SRMLeafSS {
+	srt_stringo s; /* key and value */
+};
+
+struct SRMFrame {
+	srt_rmref r;
+	unsigned pos; /* next child position */
+};
+
+typedef srt_bool (*srm_leaf_f)(const srt_rmap *m, srt_rmref r, void *ctx);
+
+/* Growing nodes at full capacity, shrinking below these */
+static const uint16_t srm_capacity[SRM_LEAF] = {4, 16, 48, 256};
+static const uint16_t srm_shrink_at[SRM_LEAF] = {0, 3, 12, 40};
+
+SD_BUILDFUNCS_FULL_ST(srma, srt_rmap, 0)
+
+/*
+ * Node storage
+ */
+
+static size_t srm_units(const srt_rmap *m, int cl)
+{
+	switch (cl) {
+	case SRM_N4:
+		return SRM_UNITS(sizeof(struct SRMNode4));
+	case SRM_N16:
+		return SRM_UNITS(sizeof(struct SRMNode16));
+	case SRM_N48:
+		return SRM_UNITS(sizeof(struct SRMNode48));
+	case SRM_N256:
+		return SRM_UNITS(sizeof(struct SRMNode256));
+	}
+	return m->d.sub_type == SRM_SS ? SRM_UNITS(sizeof(struct SRMLeafSS))
+				       : SRM_UNITS(sizeof(struct SRMLeaf));
+}
+
+S_INLINE void *srm_ptr(srt_rmap *m, srt_rmref r)
+{
+	return srma_get_buffer(m) + (size_t)(r >> 1) * SRM_UNIT;
+}
+
+S_INLINE const void *srm_ptr_r(const srt_rmap *m, srt_rmref r)
+{
+	return srma_get_buffer_r(m) + (size_t)(r >> 1) * SRM_UNIT;
+}
+
+S_INLINE struct SRMNode *srm_node(srt_rmap *m, srt_rmref r)
+{
+	return (struct SRMNode *)srm_ptr(m, r);
+}
+
+S_INLINE const struct SRMNode *srm_node_r(const srt_rmap *m, srt_rmref r)
+{
+	return (const struct SRMNode *)srm_ptr_r(m, r);
+}
+
+/* Leaf key bytes and size */
+static const uint8_t *srm_key(const srt_rmap *m, srt_rmref r, size_t *ks)
+{
+	struct SDataSmall h;
+	const void *l = srm_ptr_r(m, r);
+	const srt_string *k =
+		m->d.sub_type == SRM_SS
+			? sso_get(&((const struct SRMLeafSS *)l)->s)
+			: sso1_get(&((const struct SRMLeaf *)l)->k);
+	if (!((uintptr_t)k & (sizeof(void *) - 1))) {
+		*ks = ss_size(k);
+		return (const uint8_t *)ss_get_buffer_r(k);
+	}
+	/*
+	 * In-place key (see sstringo.h): not aligned, so its header (small
+	 * mode) is copied instead of being accessed as a srt_string
+	 */
+	memcpy(&h, k, sizeof(h));
+	*ks = h.size;
+	return (const uint8_t *)k + sizeof(h);
+}
+
+/* Space for 'units' more units, not counting the free lists */
+static srt_bool srm_reserve(srt_rmap **m, size_t units)
+{
+	RETURN_IF(srma_size(*m) + units > SRM_REF_MAX, S_FALSE);
+	return srma_capacity_left(*m) >= units || srma_grow(m, units) >= units
+		       ? S_TRUE
+		       : S_FALSE;
+}
+
+/* Node allocation (space must be reserved in advance) */
+static srt_rmref srm_new(srt_rmap *m, int cl)
+{
+	size_t u;
+	srt_rmref r = m->free_list[cl];
+	if (r != SRM_NIL) {
+		m->free_list[cl] = *(srt_rmref *)srm_ptr(m, r);
+		return r;
+	}
+	u = srma_size(m);
+	srma_set_size(m, u + srm_units(m, cl));
+	return (srt_rmref)(u << 1) | (cl == SRM_LEAF ? 1 : 0);
+}
+
+static void srm_release(srt_rmap *m, srt_rmref r, int cl)
+{
+	*(srt_rmref *)srm_ptr(m, r) = m->free_list[cl];
+	m->free_list[cl] = r;
+}
+
+static srt_rmref srm_node_new(srt_rmap *m, int cl)
+{
+	srt_rmref r = srm_new(m, cl);
+	struct SRMNode *n = srm_node(m, r);
+	memset(n, 0, srm_units(m, cl) * SRM_UNIT);
+	n->type = (uint8_t)cl;
+	return r;
+}
+
+/*
+ * Inner node children
+ */
+
+/* Key byte and child arrays (nodes with 4 or 16 children) */
+S_INLINE void srm_kc(struct SRMNode *n, uint8_t **k, srt_rmref **c)
+{
+	if (n->type == SRM_N4) {
+		*k = ((struct SRMNode4 *)n)->k;
+		*c = ((struct SRMNode4 *)n)->c;
+	} else {
+		*k = ((struct SRMNode16 *)n)->k;
+		*c = ((struct SRMNode16 *)n)->c;
+	}
+}
+
+static srt_rmref *srm_child(struct SRMNode *n, uint8_t b)
+{
+	size_t i;
+	uint8_t *k;
+	srt_rmref *c;
+	struct SRMNode48 *n48;
+	switch (n->type) {
+	case SRM_N4:
+	case SRM_N16:
+		srm_kc(n, &k, &c);
+		for (i = 0; i < n->cnt; i++)
+			if (k[i] == b)
+				return c + i;
+		return NULL;
+	case SRM_N48:
+		n48 = (struct SRMNode48 *)n;
+		return n48->ix[b] ? n48->c + n48->ix[b] - 1 : NULL;
+	default:
+		return ((struct SRMNode256 *)n)->c[b] != SRM_NIL
+			       ? ((struct SRMNode256 *)n)->c + b
+			       : NULL;
+	}
+}
+
+S_INLINE srt_rmref srm_child_r(const struct SRMNode *n, uint8_t b)
+{
+	const srt_rmref *c = srm_child((struct SRMNode *)n, b); /* CONSTNESS */
+	return c ? *c : SRM_NIL;
+}
+
+/* Add child (the node must have room for it) */
+static void srm_add(struct SRMNode *n, uint8_t b, srt_rmref r)
+{
+	size_t i;
+	uint8_t *k;
+	srt_rmref *c;
+	struct SRMNode48 *n48;
+	switch (n->type) {
+	case SRM_N4:
+	case SRM_N16:
+		srm_kc(n, &k, &c);
+		for (i = 0; i < n->cnt && k[i] < b; i++)
+			;
+		memmove(k + i + 1, k + i, n->cnt - i);
+		memmove(c + i + 1, c + i, (n->cnt - i) * sizeof(c[0]));
+		k[i] = b;
+		c[i] = r;
+		break;
+	case SRM_N48:
+		n48 = (struct SRMNode48 *)n;
+		for (i = 0; n48->c[i] != SRM_NIL; i++)
+			;
+		n48->c[i] = r;
+		n48->ix[b] = (uint8_t)(i + 1);
+		break;
+	default:
+		((struct SRMNode256 *)n)->c[b] = r;
+	}
+	n->cnt++;
+}
+
+static void srm_remove(struct SRMNode *n, uint8_t b)
+{
+	size_t i;
+	uint8_t *k;
+	srt_rmref *c;
+	struct SRMNode48 *n48;
+	switch (n->type) {
+	case SRM_N4:
+	case SRM_N16:
+		srm_kc(n, &k, &c);
+		for (i = 0; k[i] != b; i++)
+			;
+		memmove(k + i, k + i + 1, n->cnt - i - 1);
+		memmove(c + i, c + i + 1, (n->cnt - i - 1) * sizeof(c[0]));
+		c[n->cnt - 1] = SRM_NIL;
+		break;
+	case SRM_N48:
+		n48 = (struct SRMNode48 *)n;
+		n48->c[n48->ix[b] - 1] = SRM_NIL;
+		n48->ix[b] = 0;
+		break;
+	default:
+		((struct SRMNode256 *)n)->c[b] = SRM_NIL;
+	}
+	n->cnt--;
+}
+
+/* Children in key byte order, from position '*pos' (0: first child) */
+static srt_rmref srm_next(const struct SRMNode *n, unsigned *pos, uint8_t *b)
+{
+	unsigned i;
+	const struct SRMNode48 *n48;
+	const struct SRMNode256 *n256;
+	switch (n->type) {
+	case SRM_N4:
+		RETURN_IF(*pos >= n->cnt, SRM_NIL);
+		*b = ((const struct SRMNode4 *)n)->k[*pos];
+		return ((const struct SRMNode4 *)n)->c[(*pos)++];
+	case SRM_N16:
+		RETURN_IF(*pos >= n->cnt, SRM_NIL);
+		*b = ((const struct SRMNode16 *)n)->k[*pos];
+		return ((const struct SRMNode16 *)n)->c[(*pos)++];
+	case SRM_N48:
+		n48 = (const struct SRMNode48 *)n;
+		for (i = *pos; i < 256; i++)
+			if (n48->ix[i]) {
+				*pos = i + 1;
+				*b = (uint8_t)i;
+				return n48->c[n48->ix[i] - 1];
+			}
+		break;
+	default:
+		n256 = (const struct SRMNode256 *)n;
+		for (i = *pos; i < 256; i++)
+			if (n256->c[i] != SRM_NIL) {
+				*pos = i + 1;
+				*b = (uint8_t)i;
+				return n256->c[i];
+			}
+	}
+	*pos = 256;
+	return SRM_NIL;
+}
+
+/* Copy node into a node of other size class (grow/shrink) */
+static srt_rmref srm_resize(srt_rmap *m, srt_rmref r, int cl)
+{
+	uint8_t b;
+	srt_rmref c;
+	unsigned pos = 0;
+	srt_rmref x = srm_node_new(m, cl);
+	struct SRMNode *n = srm_node(m, r), *o = srm_node(m, x);
+	o->plen = n->plen;
+	memcpy(o->prefix, n->prefix, SRM_PREFIX);
+	o->val = n->val;
+	while ((c = srm_next(n, &pos, &b)) != SRM_NIL)
+		srm_add(o, b, c);
+	srm_release(m, r, n->type);
+	return x;
+}
+
+/* Any leaf below (all keys below a node share its path) */
+static srt_rmref srm_any_leaf(const srt_rmap *m, srt_rmref r)
+{
+	uint8_t b;
+	unsigned pos;
+	const struct SRMNode *n;
+	while (!SRM_IS_LEAF(r)) {
+		n = srm_node_r(m, r);
+		if (n->val != SRM_NIL)
+			return n->val;
+		pos = 0;
+		r = srm_next(n, &pos, &b);
+	}
+	return r;
+}
+
+/*
+ * Compressed paths
+ */
+
+static void srm_set_prefix(struct SRMNode *n, const uint8_t *p, size_t plen)
+{
+	n->plen = (uint32_t)plen;
+	memcpy(n->prefix, p, S_MIN(plen, SRM_PREFIX));
+}
+
+/* Path bytes matching the key, starting at key byte 'd' */
+static size_t srm_prefix_match(const srt_rmap *m, srt_rmref r, const uint8_t *k,
+			       size_t ks, size_t d)
+{
+	size_t i, lks;
+	const uint8_t *lk;
+	const struct SRMNode *n = srm_node_r(m, r);
+	size_t max = S_MIN(n->plen, ks - d);
+	for (i = 0; i < max && i < SRM_PREFIX; i++)
+		if (n->prefix[i] != k[d + i])
+			return i;
+	if (i < max) {
+		lk = srm_key(m, srm_any_leaf(m, r), &lks);
+		for (; i < max; i++)
+			if (lk[d + i] != k[d + i])
+				return i;
+	}
+	return max;
+}
+
+/*
+ * Cut the node path (starting at key byte 'd') at byte 'p', returning that
+ * byte, the path continuing after it
+ */
+static uint8_t srm_prefix_cut(srt_rmap *m, srt_rmref r, size_t d, size_t p)
+{
+	uint8_t b;
+	const uint8_t *lk;
+	struct SRMNode *n = srm_node(m, r);
+	size_t lks, plen = n->plen - p - 1;
+	if (n->plen <= SRM_PREFIX) {
+		b = n->prefix[p];
+		memmove(n->prefix, n->prefix + p + 1, plen);
+	} else {
+		lk = srm_key(m, srm_any_leaf(m, r), &lks);
+		b = lk[d + p];
+		memcpy(n->prefix, lk + d + p + 1, S_MIN(plen, SRM_PREFIX));
+	}
+	n->plen = (uint32_t)plen;
+	return b;
+}
+
+/* Child 'c' replacing its parent 'n' (reached through byte 'b') */
+static void srm_prefix_join(struct SRMNode *c, const struct SRMNode *n,
+			    uint8_t b)
+{
+	uint8_t p[SRM_PREFIX];
+	size_t i = S_MIN(n->plen, SRM_PREFIX), j = 0;
+	memcpy(p, n->prefix, i);
+	if (i < SRM_PREFIX)
+		p[i++] = b;
+	for (; i < SRM_PREFIX && j < c->plen; i++, j++)
+		p[i] = c->prefix[j];
+	memcpy(c->prefix, p, i);
+	c->plen += n->plen + 1;
+}
+
+/* Leaf below a new node, whose path ends at key byte 'd' */
+static void srm_attach(struct SRMNode *n, const uint8_t *k, size_t ks,
+		       size_t d, srt_rmref leaf)
+{
+	if (ks == d)
+		n->val = leaf;
+	else
+		srm_add(n, k[d], leaf);
+}
+
+/*
+ * Search, insert, delete
+ */
+
+static srt_rmref srm_find(const srt_rmap *m, const srt_string *key)
+{
+	size_t i, d = 0, ks, lks;
+	const uint8_t *k, *lk;
+	srt_rmref r;
+	const struct SRMNode *n;
+	RETURN_IF(!m || !key, SRM_NIL);
+	k = (const uint8_t *)ss_get_buffer_r(key);
+	ks = ss_size(key);
+	r = m->root;
+	while (r != SRM_NIL && !SRM_IS_LEAF(r)) {
+		n = srm_node_r(m, r);
+		if (n->plen) {
+			RETURN_IF(ks - d < n->plen, SRM_NIL);
+			for (i = 0; i < n->plen && i < SRM_PREFIX; i++)
+				RETURN_IF(n->prefix[i] != k[d + i], SRM_NIL);
+			d += n->plen;
+		}
+		r = d == ks ? n->val : srm_child_r(n, k[d++]);
+	}
+	RETURN_IF(r == SRM_NIL, SRM_NIL);
+	/* Full key check (compressed paths are only partially checked) */
+	lk = srm_key(m, r, &lks);
+	return lks == ks && !memcmp(lk, k, ks) ? r : SRM_NIL;
+}
+
+/* Leaf for the key (new leaves are not initialized) */
+static srt_rmref srm_insert_leaf(srt_rmap **mm, const srt_string *key,
+				 srt_bool *is_new)
+{
+	uint8_t b;
+	size_t d = 0, ks, lks, p;
+	const uint8_t *k, *lk;
+	srt_rmap *m;
+	srt_rmref r, x, leaf, *slot, *c;
+	struct SRMNode *n, *n2;
+	RETURN_IF(!mm || !*mm || !key, SRM_NIL);
+	/* Worst case: new leaf, plus a new or grown inner node */
+	RETURN_IF(!srm_reserve(mm, srm_units(*mm, SRM_LEAF)
+					   + srm_units(*mm, SRM_N256)),
+		  SRM_NIL);
+	m = *mm;
+	k = (const uint8_t *)ss_get_buffer_r(key);
+	ks = ss_size(key);
+	*is_new = S_FALSE;
+	for (slot = &m->root;;) {
+		r = *slot;
+		if (r == SRM_NIL) { /* empty map */
+			leaf = *slot = srm_new(m, SRM_LEAF);
+			break;
+		}
+		if (SRM_IS_LEAF(r)) {
+			lk = srm_key(m, r, &lks);
+			if (lks == ks && !memcmp(lk, k, ks))
+				return r;
+			/* New node for the path shared by both keys */
+			for (p = 0; d + p < ks && d + p < lks
+				    && k[d + p] == lk[d + p];
+			     p++)
+				;
+			x = srm_node_new(m, SRM_N4);
+			n2 = srm_node(m, x);
+			srm_set_prefix(n2, k + d, p);
+			leaf = srm_new(m, SRM_LEAF);
+			srm_attach(n2, lk, lks, d + p, r);
+			srm_attach(n2, k, ks, d + p, leaf);
+			*slot = x;
+			break;
+		}
+		n = srm_node(m, r);
+		if (n->plen) {
+			p = srm_prefix_match(m, r, k, ks, d);
+			if (p < n->plen) {
+				/* Split the path at the first difference */
+				x = srm_node_new(m, SRM_N4);
+				n2 = srm_node(m, x);
+				srm_set_prefix(n2, k + d, p);
+				b = srm_prefix_cut(m, r, d, p);
+				srm_add(n2, b, r);
+				leaf = srm_new(m, SRM_LEAF);
+				srm_attach(n2, k, ks, d + p, leaf);
+				*slot = x;
+				break;
+			}
+			d += n->plen;
+		}
+		if (d == ks) {
+			if (n->val != SRM_NIL)
+				return n->val;
+			leaf = n->val = srm_new(m, SRM_LEAF);
+			break;
+		}
+		if ((c = srm_child(n, k[d])) != NULL) {
+			slot = c;
+			d++;
+			continue;
+		}
+		if (n->cnt == srm_capacity[n->type]) {
+			r = *slot = srm_resize(m, r, n->type + 1);
+			n = srm_node(m, r);
+		}
+		leaf = srm_new(m, SRM_LEAF);
+		srm_add(n, k[d], leaf);
+		break;
+	}
+	m->nkeys++;
+	*is_new = S_TRUE;
+	return leaf;
+}
+
+/* Release the leaf strings */
+static void srm_leaf_free(srt_rmap *m, srt_rmref r)
+{
+	void *l = srm_ptr(m, r);
+	if (m->d.sub_type == SRM_SS)
+		sso_free(&((struct SRMLeafSS *)l)->s);
+	else
+		sso1_free(&((struct SRMLeaf *)l)->k);
+}
+
+/*
+ * Node 'slot' after removing a child or its 'val' leaf: nodes with a
+ * single child are merged into it, and nodes with few children shrunk (if
+ * there is room for the smaller node, as deleting doesn't reallocate)
+ */
+static void srm_fix(srt_rmap *m, srt_rmref *slot)
+{
+	uint8_t b = 0;
+	srt_rmref c, r = *slot;
+	unsigned pos = 0;
+	struct SRMNode *n = srm_node(m, r);
+	int cl = n->type;
+	if (!n->cnt) {
+		*slot = n->val;
+		srm_release(m, r, cl);
+		return;
+	}
+	if (n->cnt == 1 && n->val == SRM_NIL) {
+		c = srm_next(n, &pos, &b);
+		if (!SRM_IS_LEAF(c))
+			srm_prefix_join(srm_node(m, c), n, b);
+		*slot = c;
+		srm_release(m, r, cl);
+		return;
+	}
+	if (n->cnt <= srm_shrink_at[cl]
+	    && (m->free_list[cl - 1] != SRM_NIL
+		|| srma_capacity_left(m) >= srm_units(m, cl - 1)))
+		*slot = srm_resize(m, r, cl - 1);
+}
+
+srt_bool srm_delete(srt_rmap *m, const srt_string *key)
+{
+	uint8_t b = 0;
+	size_t d = 0, ks;
+	const uint8_t *k;
+	srt_bool by_val = S_FALSE;
+	srt_rmref leaf, *slot, *pslot = NULL;
+	struct SRMNode *n;
+	leaf = srm_find(m, key);
+	RETURN_IF(leaf == SRM_NIL, S_FALSE);
+	k = (const uint8_t *)ss_get_buffer_r(key);
+	ks = ss_size(key);
+	/* Walk again, tracking the parent node (paths already verified) */
+	for (slot = &m->root; *slot != leaf;) {
+		pslot = slot;
+		n = srm_node(m, *slot);
+		d += n->plen;
+		if (d == ks) {
+			by_val = S_TRUE;
+			slot = &n->val;
+		} else {
+			b = k[d++];
+			slot = srm_child(n, b);
+		}
+	}
+	srm_leaf_free(m, leaf);
+	srm_release(m, leaf, SRM_LEAF);
+	m->nkeys--;
+	if (!pslot) {
+		m->root = SRM_NIL;
+		return S_TRUE;
+	}
+	n = srm_node(m, *pslot);
+	if (by_val)
+		n->val = SRM_NIL;
+	else
+		srm_remove(n, b);
+	srm_fix(m, pslot);
+	return S_TRUE;
+}
+
+/*
+ * Ordered enumeration of the subtree leaves ('val' leaf first, then the
+ * children, in key byte order), using an explicit stack, as the tree depth
+ * is bounded by the key length only
+ */
+static size_t srm_walk(const srt_rmap *m, srt_rmref r, srm_leaf_f f,
+		       void *ctx)
+{
+	uint8_t b;
+	size_t sp = 0, smax = SRM_STACK0, nelems = 0;
+	struct SRMFrame st0[SRM_STACK0], *st = st0, *st2;
+	const struct SRMNode *n;
+	RETURN_IF(r == SRM_NIL, 0);
+	if (SRM_IS_LEAF(r))
+		return f(m, r, ctx) ? 1 : 0;
+	for (;;) {
+		/* Enter node */
+		if (sp == smax) {
+			st2 = (struct SRMFrame *)s_malloc(2 * smax
+							  * sizeof(st[0]));
+			if (!st2) {
+				S_ERROR("not enough memory");
+				break; /* BEHAVIOR: partial enumeration */
+			}
+			memcpy(st2, st, smax * sizeof(st[0]));
+			if (st != st0)
+				s_free(st);
+			st = st2;
+			smax *= 2;
+		}
+		st[sp].r = r;
+		st[sp++].pos = 0;
+		n = srm_node_r(m, r);
+		if (n->val != SRM_NIL) {
+			if (!f(m, n->val, ctx))
+				break;
+			nelems++;
+		}
+		/* Next leaf or node to enter, going up when done */
+		for (r = SRM_NIL; sp > 0; sp--) {
+			r = srm_next(srm_node_r(m, st[sp - 1].r),
+				     &st[sp - 1].pos, &b);
+			while (r != SRM_NIL && SRM_IS_LEAF(r)) {
+				if (!f(m, r, ctx))
+					goto done;
+				nelems++;
+				r = srm_next(srm_node_r(m, st[sp - 1].r),
+					     &st[sp - 1].pos, &b);
+			}
+			if (r != SRM_NIL)
+				break;
+		}
+		if (r == SRM_NIL)
+			break;
+	}
+done:
+	if (st != st0)
+		s_free(st);
+	return nelems;
+}
+
+/*
+ * Allocation
+ */
+
+static void srm_reset(srt_rmap *m)
+{
+	size_t i;
+	srma_set_size(m, 1); /* unit 0: null reference */
+	m->nkeys = 0;
+	m->root = SRM_NIL;
+	for (i = 0; i < SRM_NCLASS; i++)
+		m->free_list[i] = SRM_NIL;
+}
+
+static srt_rmap *srm_alloc_units(enum eSRM_Type t, size_t units)
+{
+	srt_rmap *m;
+	size_t alloc_size;
+	RETURN_IF(t != SRM_SI && t != SRM_SS && t != SRM_SP, NULL);
+	alloc_size =
+		sd_alloc_size_raw(sizeof(srt_rmap), SRM_UNIT, units, S_FALSE);
+	m = (srt_rmap *)s_malloc(alloc_size);
+	RETURN_IF(!m, NULL);
+	sd_reset((srt_data *)m, sizeof(srt_rmap), SRM_UNIT, units, S_FALSE,
+		 S_FALSE);
+	m->d.sub_type = (uint8_t)t;
+	srm_reset(m);
+	return m;
+}
+
+srt_rmap *srm_alloc(enum eSRM_Type t, size_t init_size)
+{
+	/* Leaves plus one node with 4 children per key (upper bound) */
+	size_t u = SRM_UNITS(sizeof(struct SRMNode4))
+		   + (t == SRM_SS ? SRM_UNITS(sizeof(struct SRMLeafSS))
+				  : SRM_UNITS(sizeof(struct SRMLeaf)));
+	RETURN_IF(init_size > SRM_REF_MAX / u, NULL); /* BEHAVIOR */
+	return srm_alloc_units(t, 1 + init_size * u);
+}
+
+static srt_bool aux_dup_leaf(const srt_rmap *m, srt_rmref r, void *ctx)
+{
+	void *l = srm_ptr((srt_rmap *)m, r); /* CONSTNESS */
+	(void)ctx;
+	if (m->d.sub_type == SRM_SS)
+		sso_dupa(&((struct SRMLeafSS *)l)->s);
+	else
+		sso_dupa1(&((struct SRMLeaf *)l)->k);
+	return S_TRUE;
+}
+
+srt_rmap *srm_dup(const srt_rmap *src)
+{
+	size_t i, units;
+	srt_rmap *m;
+	RETURN_IF(!src, NULL);
+	units = srma_size(src);
+	m = srm_alloc_units((enum eSRM_Type)src->d.sub_type, units);
+	RETURN_IF(!m, NULL);
+	/* Bulk copy (references are offsets), then the string data */
+	memcpy(srma_get_buffer(m), srma_get_buffer_r(src), units * SRM_UNIT);
+	srma_set_size(m, units);
+	m->nkeys = src->nkeys;
+	m->root = src->root;
+	for (i = 0; i < SRM_NCLASS; i++)
+		m->free_list[i] = src->free_list[i];
+	srm_walk(m, m->root, aux_dup_leaf, NULL);
+	return m;
+}
+
+static srt_bool aux_free_leaf(const srt_rmap *m, srt_rmref r, void *ctx)
+{
+	(void)ctx;
+	srm_leaf_free((srt_rmap *)m, r); /* CONSTNESS */
+	return S_TRUE;
+}
+
+void srm_clear(srt_rmap *m)
+{
+	if (!m || !m->nkeys)
+		return;
+	srm_walk(m, m->root, aux_free_leaf, NULL);
+	srm_reset(m);
+}
+
+void srm_free_aux(srt_rmap **m, ...)
+{
+	va_list ap;
+	srt_rmap **next;
+	va_start(ap, m);
+	next = m;
+	while (!s_varg_tail_ptr_tag(next)) { /* last element tag */
+		if (next) {
+			srm_clear(*next); /* release associated dyn. memory */
+			sd_free((srt_data **)next);
+		}
+		next = (srt_rmap **)va_arg(ap, srt_rmap **);
+	}
+	va_end(ap);
+}
+
+/*
+ * Random access
+ */
+
+S_INLINE const struct SRMLeaf *srm_at(const srt_rmap *m, int t,
+				      const srt_string *k)
+{
+	srt_rmref r;
+	RETURN_IF(!m || m->d.sub_type != t, NULL);
+	r = srm_find(m, k);
+	return r != SRM_NIL ? (const struct SRMLeaf *)srm_ptr_r(m, r) : NULL;
+}
+
+int64_t srm_at_si(const srt_rmap *m, const srt_string *k)
+{
+	const struct SRMLeaf *l = srm_at(m, SRM_SI, k);
+	return l ? l->v.i : 0;
+}
+
+const srt_string *srm_at_ss(const srt_rmap *m, const srt_string *k)
+{
+	const struct SRMLeaf *l = srm_at(m, SRM_SS, k);
+	return l ? sso_get_s2(&((const struct SRMLeafSS *)l)->s) : ss_void;
+}
+
+const void *srm_at_sp(const srt_rmap *m, const srt_string *k)
+{
+	const struct SRMLeaf *l = srm_at(m, SRM_SP, k);
+	return l ? l->v.p : NULL;
+}
+
+/*
+ * Existence check
+ */
+
+srt_bool srm_count(const srt_rmap *m, const srt_string *k)
+{
+	return srm_find(m, k) != SRM_NIL ? S_TRUE : S_FALSE;
+}
+
+/*
+ * Insert
+ */
+
+static struct SRMLeaf *srm_insert(srt_rmap **m, int t, const srt_string *k,
+				  srt_bool *is_new)
+{
+	srt_rmref r;
+	RETURN_IF(!m || !*m || (*m)->d.sub_type != t, NULL);
+	r = srm_insert_leaf(m, k, is_new);
+	return r != SRM_NIL ? (struct SRMLeaf *)srm_ptr(*m, r) : NULL;
+}
+
+srt_bool srm_insert_si(srt_rmap **m, const srt_string *k, int64_t v)
+{
+	srt_bool is_new;
+	struct SRMLeaf *l = srm_insert(m, SRM_SI, k, &is_new);
+	RETURN_IF(!l, S_FALSE); /* BEHAVIOR: wrong type or allocation error */
+	if (is_new)
+		sso1_set(&l->k, k);
+	l->v.i = v;
+	return S_TRUE;
+}
+
+srt_bool srm_insert_ss(srt_rmap **m, const srt_string *k, const srt_string *v)
+{
+	srt_bool is_new;
+	struct SRMLeafSS *l =
+		(struct SRMLeafSS *)srm_insert(m, SRM_SS, k, &is_new);
+	RETURN_IF(!l, S_FALSE); /* BEHAVIOR: wrong type or allocation error */
+	if (is_new)
+		sso_set(&l->s, k, v);
+	else
+		sso_update(&l->s, k, v);
+	return S_TRUE;
+}
+
+srt_bool srm_insert_sp(srt_rmap **m, const srt_string *k, const void *v)
+{
+	srt_bool is_new;
+	struct SRMLeaf *l = srm_insert(m, SRM_SP, k, &is_new);
+	RETURN_IF(!l, S_FALSE); /* BEHAVIOR: wrong type or allocation error */
+	if (is_new)
+		sso1_set(&l->k, k);
+	l->v.p = v;
+	return S_TRUE;
+}
+
+/*
+ * Prefix queries
+ */
+
+/* Subtree having all the keys starting with the prefix */
+static srt_rmref srm_prefix_root(const srt_rmap *m, const srt_string *prefix)
+{
+	size_t i, d = 0, lks, ps = ss_size(prefix);
+	const uint8_t *lk, *p = (const uint8_t *)ss_get_buffer_r(prefix);
+	const struct SRMNode *n;
+	srt_rmref r = m->root;
+	while (r != SRM_NIL && !SRM_IS_LEAF(r)) {
+		n = srm_node_r(m, r);
+		for (i = 0; i < n->plen && d + i < ps && i < SRM_PREFIX; i++)
+			RETURN_IF(n->prefix[i] != p[d + i], SRM_NIL);
+		if (d + n->plen >= ps)
+			break;
+		d += n->plen;
+		r = srm_child_r(n, p[d++]);
+	}
+	RETURN_IF(r == SRM_NIL, SRM_NIL);
+	/* Check the full prefix on one key (path bytes partially checked) */
+	lk = srm_key(m, srm_any_leaf(m, r), &lks);
+	return lks >= ps && !memcmp(lk, p, ps) ? r : SRM_NIL;
+}
+
+struct SRMItp {
+	union {
+		srt_rmap_it_si si;
+		srt_rmap_it_ss ss;
+		srt_rmap_it_sp sp;
+	} f;
+	void *context;
+};
+
+static srt_bool aux_itp_si(const srt_rmap *m, srt_rmref r, void *ctx)
+{
+	const struct SRMItp *c = (const struct SRMItp *)ctx;
+	const struct SRMLeaf *l = (const struct SRMLeaf *)srm_ptr_r(m, r);
+	return c->f.si(sso1_get(&l->k), l->v.i, c->context);
+}
+
+static srt_bool aux_itp_ss(const srt_rmap *m, srt_rmref r, void *ctx)
+{
+	const struct SRMItp *c = (const struct SRMItp *)ctx;
+	const struct SRMLeafSS *l = (const struct SRMLeafSS *)srm_ptr_r(m, r);
+	return c->f.ss(sso_get(&l->s), sso_get_s2(&l->s), c->context);
+}
+
+static srt_bool aux_itp_sp(const srt_rmap *m, srt_rmref r, void *ctx)
+{
+	const struct SRMItp *c = (const struct SRMItp *)ctx;
+	const struct SRMLeaf *l = (const struct SRMLeaf *)srm_ptr_r(m, r);
+	return c->f.sp(sso1_get(&l->k), l->v.p, c->context);
+}
+
+static srt_bool aux_itp_count(const srt_rmap *m, srt_rmref r, void *ctx)
+{
+	(void)m;
+	(void)r;
+	(void)ctx;
+	return S_TRUE;
+}
+
+static size_t srm_itp(const srt_rmap *m, int t, const srt_string *prefix,
+		      srm_leaf_f f, struct SRMItp *c)
+{
+	srt_rmref r;
+	RETURN_IF(!m || m->d.sub_type != t, 0);
+	r = srm_prefix_root(m, prefix ? prefix : ss_void);
+	return srm_walk(m, r, f, c);
+}
+
+size_t srm_itp_si(const srt_rmap *m, const srt_string *prefix,
+		  srt_rmap_it_si f, void *context)
+{
+	struct SRMItp c;
+	c.f.si = f;
+	c.context = context;
+	return srm_itp(m, SRM_SI, prefix, f ? aux_itp_si : aux_itp_count, &c);
+}
+
+size_t srm_itp_ss(const srt_rmap *m, const srt_string *prefix,
+		  srt_rmap_it_ss f, void *context)
+{
+	struct SRMItp c;
+	c.f.ss = f;
+	c.context = context;
+	return srm_itp(m, SRM_SS, prefix, f ? aux_itp_ss : aux_itp_count, &c);
+}
+
+size_t srm_itp_sp(const srt_rmap *m, const srt_string *prefix,
+		  srt_rmap_it_sp f, void *context)
+{
+	struct SRMItp c;
+	c.f.sp = f;
+	c.context = context;
+	return srm_itp(m, SRM_SP, prefix, f ? aux_itp_sp : aux_itp_count, &c);
+}
+
+/*
+ * Leaf key being a prefix of the string: candidates are found in
+ * increasing key length order, so only the bytes not checked for the
+ * previous candidate ('*ck') are compared
+ */
+static srt_bool srm_lpm_chk(const srt_rmap *m, srt_rmref r, const uint8_t *s,
+			    size_t ss, size_t *ck)
+{
+	size_t ls;
+	const uint8_t *lk = srm_key(m, r, &ls);
+	RETURN_IF(ls > ss, S_FALSE);
+	RETURN_IF(memcmp(lk + *ck, s + *ck, ls - *ck), S_FALSE);
+	*ck = ls;
+	return S_TRUE;
+}
+
+static const void *srm_lpm(const srt_rmap *m, int t, const srt_string *str)
+{
+	size_t i, d = 0, ck = 0, ss;
+	const uint8_t *s;
+	const struct SRMNode *n;
+	srt_rmref r, best = SRM_NIL;
+	RETURN_IF(!m || m->d.sub_type != t || !str, NULL);
+	s = (const uint8_t *)ss_get_buffer_r(str);
+	ss = ss_size(str);
+	r = m->root;
+	/*
+	 * A candidate failing the check means a path byte not matching, so
+	 * no deeper key can match either
+	 */
+	while (r != SRM_NIL) {
+		if (SRM_IS_LEAF(r)) {
+			if (srm_lpm_chk(m, r, s, ss, &ck))
+				best = r;
+			break;
+		}
+		n = srm_node_r(m, r);
+		if (ss - d < n->plen)
+			break;
+		for (i = 0; i < n->plen && i < SRM_PREFIX; i++)
+			if (n->prefix[i] != s[d + i])
+				break;
+		if (i < n->plen && i < SRM_PREFIX)
+			break;
+		d += n->plen;
+		if (n->val != SRM_NIL) {
+			if (!srm_lpm_chk(m, n->val, s, ss, &ck))
+				break;
+			best = n->val;
+		}
+		if (d == ss)
+			break;
+		r = srm_child_r(n, s[d++]);
+	}
+	return best != SRM_NIL ? srm_ptr_r(m, best) : NULL;
+}
+
+const srt_string *srm_lpm_si(const srt_rmap *m, const srt_string *s,
+			     int64_t *v)
+{
+	const struct SRMLeaf *l = (const struct SRMLeaf *)srm_lpm(m, SRM_SI, s);
+	RETURN_IF(!l, NULL);
+	if (v)
+		*v = l->v.i;
+	return sso1_get(&l->k);
+}
+
+const srt_string *srm_lpm_ss(const srt_rmap *m, const srt_string *s,
+			     const srt_string **v)
+{
+	const struct SRMLeafSS *l =
+		(const struct SRMLeafSS *)srm_lpm(m, SRM_SS, s);
+	RETURN_IF(!l, NULL);
+	if (v)
+		*v = sso_get_s2(&l->s);
+	return sso_get(&l->s);
+}
+
+const srt_string *srm_lpm_sp(const srt_rmap *m, const srt_string *s,
+			     const void **v)
+{
+	const struct SRMLeaf *l = (const struct SRMLeaf *)srm_lpm(m, SRM_SP, s);
+	RETURN_IF(!l, NULL);
+	if (v)
+		*v = l->v.p;
+	return sso1_get(&l->k);
+}
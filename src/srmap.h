@@ -0,0 +1,185 @@
+#ifndef SRMAP_H
+#define SRMAP_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * srmap.h
+ *
+ * #SHORTDOC radix tree map handling (string keys, prefix queries)
+ *
+ * #DOC Radix tree map functions handle string-key storage, implemented as
+ * #DOC an adaptive radix tree (compressed trie): every node branches on one
+ * #DOC key byte, using one of four node sizes (4, 16, 48, or 256 children),
+ * #DOC depending on the number of children, and paths without branches are
+ * #DOC compressed into the node below. Lookups cost O(key length),
+ * #DOC independently of the number of keys (no full string comparison per
+ * #DOC tree level, as with srt_map), keys sharing prefixes also sharing the
+ * #DOC path. Keys are kept in byte order, so all keys starting with a given
+ * #DOC prefix are enumerated in order from a single subtree
+ * #DOC (srm_itp_*()), and the longest stored key being a prefix of a given
+ * #DOC string is found in one walk (srm_lpm_*(), e.g. for routing).
+ * #DOC
+ * #DOC As with the other containers, nodes are stored in a single memory
+ * #DOC block, using 32-bit references instead of pointers (freed nodes are
+ * #DOC reused). Keys are stored in the leaves, using the small string
+ * #DOC optimization (as srt_map string keys).
+ * #DOC
+ * #DOC
+ * #DOC Supported key/value modes (enum eSRM_Type):
+ * #DOC
+ * #DOC
+ * #DOC	SRM_SI: string key, 64-bit int value
+ * #DOC
+ * #DOC	SRM_SS: string key, string value
+ * #DOC
+ * #DOC	SRM_SP: string key, pointer value
+ * #DOC
+ * #DOC
+ * #DOC Callback types for the srm_itp_*() functions:
+ * #DOC
+ * #DOC
+ * #DOC	typedef srt_bool (*srt_rmap_it_si)(const srt_string *, int64_t v, void *context);
+ * #DOC
+ * #DOC	typedef srt_bool (*srt_rmap_it_ss)(const srt_string *, const srt_string *, void *context);
+ * #DOC
+ * #DOC	typedef srt_bool (*srt_rmap_it_sp)(const srt_string *, const void *, void *context);
+ *
+ * Copyright (c) 2015-2019 F. Aragon. All rights reserved.
+ * Released under the BSD 3-Clause License (see the doc/LICENSE)
+ */
+
+#include "saux/sdata.h"
+#include "saux/sstringo.h"
+#include "sstring.h"
+
+/*
+ * Structures and types
+ */
+
+enum eSRM_Type { SRM_SI, SRM_SS, SRM_SP };
+
+#define SRM_NCLASS 5 /* node size classes: 4, 16, 48, 256 children; leaf */
+
+typedef uint32_t srt_rmref; /* 8-byte unit offset, shifted, plus leaf bit */
+
+struct S_RMap {
+	struct SDataFull d; /* node storage, in 8-byte units */
+	size_t nkeys;
+	srt_rmref root;
+	srt_rmref free_list[SRM_NCLASS];
+};
+
+typedef struct S_RMap srt_rmap;
+
+typedef srt_bool (*srt_rmap_it_si)(const srt_string *k, int64_t v,
+				   void *context);
+typedef srt_bool (*srt_rmap_it_ss)(const srt_string *k, const srt_string *v,
+				   void *context);
+typedef srt_bool (*srt_rmap_it_sp)(const srt_string *k, const void *v,
+				   void *context);
+
+/*
+ * Allocation
+ */
+
+/* #API: |Allocate radix tree map (heap)|map type; initial reserve (number of keys)|map|O(1)|1;2| */
+srt_rmap *srm_alloc(enum eSRM_Type t, size_t init_size);
+
+/* #API: |Duplicate map|input map|output map|O(n)|1;2| */
+srt_rmap *srm_dup(const srt_rmap *src);
+
+/* #API: |Clear/reset map (keeping map type)|map||O(n)|1;2| */
+void srm_clear(srt_rmap *m);
+
+/*
+#API: |Free one or more maps (heap)|map; more maps (optional)|-|O(n)|1;2|
+void srm_free(srt_rmap **m, ...)
+*/
+#ifdef S_USE_VA_ARGS
+#define srm_free(...) srm_free_aux(__VA_ARGS__, S_INVALID_PTR_VARG_TAIL)
+#else
+#define srm_free(m) srm_free_aux(m, S_INVALID_PTR_VARG_TAIL)
+#endif
+void srm_free_aux(srt_rmap **m, ...);
+
+/* #API: |Get map size|map|Map number of elements|O(1)|1;2| */
+S_INLINE size_t srm_size(const srt_rmap *m)
+{
+	return m ? m->nkeys : 0;
+}
+
+/* #API: |Get map type|map|map type|O(1)|1;2| */
+S_INLINE enum eSRM_Type srm_type(const srt_rmap *m)
+{
+	return m ? (enum eSRM_Type)m->d.sub_type : SRM_SI;
+}
+
+/*
+ * Random access
+ */
+
+/* #API: |Access to string-integer map|map; string key|integer (0 if not found)|O(key length)|1;2| */
+int64_t srm_at_si(const srt_rmap *m, const srt_string *k);
+
+/* #API: |Access to string-string map|map; string key|string (empty string if not found)|O(key length)|1;2| */
+const srt_string *srm_at_ss(const srt_rmap *m, const srt_string *k);
+
+/* #API: |Access to string-pointer map|map; string key|pointer (NULL if not found)|O(key length)|1;2| */
+const void *srm_at_sp(const srt_rmap *m, const srt_string *k);
+
+/*
+ * Existence check
+ */
+
+/* #API: |Map element count/check|map; string key|S_TRUE: element found; S_FALSE: not in the map|O(key length)|1;2| */
+srt_bool srm_count(const srt_rmap *m, const srt_string *k);
+
+/*
+ * Insert
+ */
+
+/* #API: |Insert into string-int map|map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(key length)|1;2| */
+srt_bool srm_insert_si(srt_rmap **m, const srt_string *k, int64_t v);
+
+/* #API: |Insert into string-string map|map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(key length)|1;2| */
+srt_bool srm_insert_ss(srt_rmap **m, const srt_string *k, const srt_string *v);
+
+/* #API: |Insert into string-pointer map|map; key; value|S_TRUE: OK, S_FALSE: insertion error|O(key length)|1;2| */
+srt_bool srm_insert_sp(srt_rmap **m, const srt_string *k, const void *v);
+
+/*
+ * Delete
+ */
+
+/* #API: |Delete map element|map; string key|S_TRUE: found and deleted; S_FALSE: not found|O(key length)|1;2| */
+srt_bool srm_delete(srt_rmap *m, const srt_string *k);
+
+/*
+ * Prefix queries
+ */
+
+/* #API: |Enumerate, in key order, the elements having keys starting with the given prefix|map; prefix (empty string or NULL: all elements); callback function (NULL: just count); callback function context|Elements processed|O(prefix length + number of elements)|1;2| */
+size_t srm_itp_si(const srt_rmap *m, const srt_string *prefix, srt_rmap_it_si f, void *context);
+
+/* #API: |Enumerate, in key order, the elements having keys starting with the given prefix|map; prefix (empty string or NULL: all elements); callback function (NULL: just count); callback function context|Elements processed|O(prefix length + number of elements)|1;2| */
+size_t srm_itp_ss(const srt_rmap *m, const srt_string *prefix, srt_rmap_it_ss f, void *context);
+
+/* #API: |Enumerate, in key order, the elements having keys starting with the given prefix|map; prefix (empty string or NULL: all elements); callback function (NULL: just count); callback function context|Elements processed|O(prefix length + number of elements)|1;2| */
+size_t srm_itp_sp(const srt_rmap *m, const srt_string *prefix, srt_rmap_it_sp f, void *context);
+
+/* #API: |Longest prefix match: longest key being a prefix of the given string (string-int map)|map; string; output value (optional)|matching key (NULL: no key is a prefix of the string), valid until the next map modification|O(string length)|1;2| */
+const srt_string *srm_lpm_si(const srt_rmap *m, const srt_string *s, int64_t *v);
+
+/* #API: |Longest prefix match: longest key being a prefix of the given string (string-string map)|map; string; output value (optional)|matching key (NULL: no key is a prefix of the string), valid until the next map modification|O(string length)|1;2| */
+const srt_string *srm_lpm_ss(const srt_rmap *m, const srt_string *s, const srt_string **v);
+
+/* #API: |Longest prefix match: longest key being a prefix of the given string (string-pointer map)|map; string; output value (optional)|matching key (NULL: no key is a prefix of the string), valid until the next map modification|O(string length)|1;2| */
+const srt_string *srm_lpm_sp(const srt_rmap *m, const srt_string *s, const void **v);
+
+#ifdef __cplusplus
+} /* extern "C" { */
+#endif
+
+#endif /* #ifndef SRMAP_H */
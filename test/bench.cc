@@ -68,6 +68,7 @@
 #define TId_Sort10Times		(1<<4)
 #define TId_ReverseSort		(1<<5)
 #define TId_Sort10000Times	(1<<6)
+#define TId_Churn10Times	(1<<7)
 #define TId2Count(id) ((id & TId_Read10Times) != 0 ? 10 : 0)
 #define TIdTest(id, key) ((id & key) == key)
 
@@ -260,7 +261,8 @@ bool libsrt_hmap_ii32(size_t count, int tid)
 bool libsrt_hmap_ii64(size_t count, int tid)
 {
 	RETURN_IF(!TIdTest(tid, TId_Base) && !TIdTest(tid, TId_Read10Times) &&
-		  !TIdTest(tid, TId_DeleteOneByOne), false);
+		  !TIdTest(tid, TId_DeleteOneByOne) &&
+		  !TIdTest(tid, TId_Churn10Times), false);
 	srt_hmap *m = shm_alloc(SHM_II, 0);
 	for (size_t i = 0; i < count; i++)
 		shm_insert_ii(&m, (int64_t)i, (int64_t)i);
@@ -270,6 +272,17 @@ bool libsrt_hmap_ii64(size_t count, int tid)
 	if (TIdTest(tid, TId_DeleteOneByOne))
 		for (size_t i = 0; i < count; i++)
 			shm_delete_i(m, (int64_t)i);
+	if (TIdTest(tid, TId_Churn10Times))
+		for (size_t j = 0; j < 10; j++) {
+			for (size_t i = j * count; i < (j + 1) * count; i++) {
+				shm_delete_i(m, (int64_t)i);
+				shm_insert_ii(&m, (int64_t)(i + count),
+					      (int64_t)i);
+			}
+			for (size_t i = 0; i < count; i++)
+				(void)shm_at_ii(m,
+						(int64_t)((j + 1) * count + i));
+		}
 	HOLD_EXEC(tid);
 	shm_free(&m);
 	return true;
@@ -278,7 +291,8 @@ bool libsrt_hmap_ii64(size_t count, int tid)
 bool libsrt_hmap_s16(size_t count, int tid)
 {
 	RETURN_IF(!TIdTest(tid, TId_Base) && !TIdTest(tid, TId_Read10Times) &&
-		  !TIdTest(tid, TId_DeleteOneByOne), false);
+		  !TIdTest(tid, TId_DeleteOneByOne) &&
+		  !TIdTest(tid, TId_Churn10Times), false);
 	srt_string *btmp = ss_alloca(512);
 	srt_hmap *m = shm_alloc(SHM_SS, 0);
 	for (size_t i = 0; i < count; i++) {
@@ -295,6 +309,21 @@ bool libsrt_hmap_s16(size_t count, int tid)
 			ss_printf(&btmp, 512, "%016i", (int)i);
 			shm_delete_s(m, btmp);
 		}
+	if (TIdTest(tid, TId_Churn10Times))
+		for (size_t j = 0; j < 10; j++) {
+			for (size_t i = j * count; i < (j + 1) * count; i++) {
+				ss_printf(&btmp, 512, "%016i", (int)i);
+				shm_delete_s(m, btmp);
+				ss_printf(&btmp, 512, "%016i",
+					  (int)(i + count));
+				shm_insert_ss(&m, btmp, btmp);
+			}
+			for (size_t i = 0; i < count; i++) {
+				ss_printf(&btmp, 512, "%016i",
+					  (int)((j + 1) * count + i));
+				(void)shm_at_ss(m, btmp);
+			}
+		}
 	HOLD_EXEC(tid);
 	shm_free(&m);
 	return true;
@@ -347,7 +376,8 @@ bool cxx_umap_ii32(size_t count, int tid)
 bool cxx_umap_ii64(size_t count, int tid)
 {
 	RETURN_IF(!TIdTest(tid, TId_Base) && !TIdTest(tid, TId_Read10Times) &&
-		  !TIdTest(tid, TId_DeleteOneByOne), false);
+		  !TIdTest(tid, TId_DeleteOneByOne) &&
+		  !TIdTest(tid, TId_Churn10Times), false);
 	std::unordered_map <int64_t, int64_t> m;
 	for (size_t i = 0; i < count; i++)
 		m[i] = (int64_t)i;
@@ -357,6 +387,15 @@ bool cxx_umap_ii64(size_t count, int tid)
 	if (TIdTest(tid, TId_DeleteOneByOne))
 		for (size_t i = 0; i < count; i++)
 			m.erase((int64_t)i);
+	if (TIdTest(tid, TId_Churn10Times))
+		for (size_t j = 0; j < 10; j++) {
+			for (size_t i = j * count; i < (j + 1) * count; i++) {
+				m.erase((int64_t)i);
+				m[i + count] = (int64_t)i;
+			}
+			for (size_t i = 0; i < count; i++)
+				(void)m.count((j + 1) * count + i);
+		}
 	HOLD_EXEC(tid);
 	return true;
 }
@@ -364,7 +403,8 @@ bool cxx_umap_ii64(size_t count, int tid)
 bool cxx_umap_s16(size_t count, int tid)
 {
 	RETURN_IF(!TIdTest(tid, TId_Base) && !TIdTest(tid, TId_Read10Times) &&
-		  !TIdTest(tid, TId_DeleteOneByOne), false);
+		  !TIdTest(tid, TId_DeleteOneByOne) &&
+		  !TIdTest(tid, TId_Churn10Times), false);
 	char btmp[512];
 	std::unordered_map <std::string, std::string> m;
 	for (size_t i = 0; i < count; i++) {
@@ -381,6 +421,20 @@ bool cxx_umap_s16(size_t count, int tid)
 			sprintf(btmp, "%016i", (int)i);
 			m.erase(btmp);
 		}
+	if (TIdTest(tid, TId_Churn10Times))
+		for (size_t j = 0; j < 10; j++) {
+			for (size_t i = j * count; i < (j + 1) * count; i++) {
+				sprintf(btmp, "%016i", (int)i);
+				m.erase(btmp);
+				sprintf(btmp, "%016i", (int)(i + count));
+				m[btmp] = btmp;
+			}
+			for (size_t i = 0; i < count; i++) {
+				sprintf(btmp, "%016i",
+					(int)((j + 1) * count + i));
+				(void)m.count(btmp);
+			}
+		}
 	HOLD_EXEC(tid);
 	return true;
 }
@@ -1450,19 +1504,21 @@ bool cxx_bitset_popcount10000(size_t count, int tid)
 int main(int argc, char *argv[])
 {
 	BENCH_INIT;
-	const size_t ntests = 6,
+	const size_t ntests = 7,
 		     count[ntests] = { S_TEST_ELEMS,
 				       S_TEST_ELEMS,
 				       S_TEST_ELEMS,
 				       S_TEST_ELEMS,
 				       S_TEST_ELEMS,
-				       S_TEST_ELEMS_SHORT };
+				       S_TEST_ELEMS_SHORT,
+				       S_TEST_ELEMS };
 	int tid[ntests] = { TId_Base,
 			    TId_Read10Times,
 			    TId_DeleteOneByOne,
 			    TId_Sort10Times,
 			    TId_Sort10Times | TId_ReverseSort,
-			    TId_Sort10000Times };
+			    TId_Sort10000Times,
+			    TId_Churn10Times };
 	char label[ntests][512];
 	snprintf(label[0], 512,
 		 "Insert or process " FMT_ZU " elements, cleanup", count[0]);
@@ -1481,6 +1537,10 @@ int main(int argc, char *argv[])
 	snprintf(label[5], 512,
 		 "Insert or process " FMT_ZU " elements, sort 10000 "
 		 "times, cleanup", count[5]);
+	snprintf(label[6], 512,
+		 "Insert " FMT_ZU " elements, 10 times: delete and insert "
+		 FMT_ZU " elements one by one (steady size), read all "
+		 "elements, cleanup", count[6], count[6]);
 	for (size_t i = 0; i < ntests; i++) {
 		printf("\n%s\n| Test | Insert count | Memory (MiB) | Execution "
 		       "time (s) |\n|:---:|:---:|:---:|:---:|\n", label[i]);
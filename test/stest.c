@@ -3584,6 +3584,152 @@ static int test_st_traverse()
 	return res;
 }
 
+static int test_sbt_insert_del()
+{
+	int res = 0;
+	uint32_t r = 1;
+	int64_t k;
+	size_t i, j, n = 3000;
+	srt_bool is_new = S_FALSE, del;
+	srt_tndx v = 0, *x;
+	struct SBTCursor c;
+	srt_btree *b = sbt_alloc(0), *b2 = NULL;
+	srt_tndx *ref = (srt_tndx *)s_malloc(n * sizeof(srt_tndx));
+	if (!b || !ref) {
+		sbt_free(&b);
+		s_free(ref);
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+		ref[i] = ST_NIL;
+	/*
+	 * Random insert/delete, growing and then shrinking the index (node
+	 * splits, merges, entry borrowing, root changes)
+	 */
+	for (i = 0; i < 40000; i++) {
+		r = r * 1103515245 + 12345;
+		j = (r >> 8) % n;
+		k = (int64_t)j - 1000;
+		if ((r >> 4) % 8 < (i < 20000 ? 5U : 2U)) {
+			x = sbt_insert(&b, k, (srt_tndx)i, &is_new);
+			if (!x || is_new != (ref[j] == ST_NIL)
+			    || (!is_new && *x != ref[j]))
+				res |= 2;
+			else if (is_new)
+				ref[j] = (srt_tndx)i;
+		} else {
+			del = sbt_delete(b, k, &v);
+			if (del != (ref[j] != ST_NIL) || (del && v != ref[j]))
+				res |= 4;
+			ref[j] = ST_NIL;
+		}
+		if (!(i % 997) && !sbt_assert(b))
+			res |= 8;
+	}
+	res |= sbt_assert(b) ? 0 : 8;
+	for (i = 0; i < n; i++)
+		if (sbt_at(b, (int64_t)i - 1000) != ref[i])
+			res |= 16;
+	/* Ordered scan from the middle */
+	sbt_seek(b, (int64_t)(n / 2) - 1000, &c);
+	for (j = n / 2; sbt_next(b, &c, &k, &v); j++) {
+		for (; j < n && ref[j] == ST_NIL; j++)
+			;
+		if (j == n || k != (int64_t)j - 1000 || v != ref[j]) {
+			res |= 32;
+			break;
+		}
+	}
+	for (; j < n && ref[j] == ST_NIL; j++)
+		;
+	res |= j == n ? 0 : 32;
+	/* Key range limits, reference update */
+	res |= sbt_insert(&b, INT64_MAX, 1, NULL)
+			       && sbt_insert(&b, INT64_MIN, 2, NULL)
+			       && sbt_at(b, INT64_MAX) == 1
+			       && sbt_at(b, INT64_MIN) == 2
+			       && sbt_set(b, INT64_MAX, 3)
+			       && sbt_at(b, INT64_MAX) == 3
+			       && !sbt_set(b, INT64_MAX - 1, 3) && sbt_assert(b)
+		       ? 0
+		       : 64;
+	/* Delete all, in order, from a copy */
+	b2 = sbt_dup(b);
+	res |= b2 && sbt_delete(b2, INT64_MIN, NULL)
+			       && sbt_delete(b2, INT64_MAX, NULL)
+		       ? 0
+		       : 128;
+	for (i = 0; b2 && i < n; i++)
+		if (sbt_delete(b2, (int64_t)i - 1000, NULL)
+			    != (ref[i] != ST_NIL)
+		    || !sbt_assert(b2))
+			res |= 256;
+	c.n = b2 ? b2->head : ST_NIL;
+	c.i = 0;
+	res |= b2 && !b2->levels && !sbt_next(b2, &c, &k, &v)
+			       && sbt_at(b, INT64_MIN) == 2
+		       ? 0
+		       : 512;
+#ifdef S_USE_VA_ARGS
+	sbt_free(&b, &b2);
+#else
+	sbt_free(&b);
+	sbt_free(&b2);
+#endif
+	s_free(ref);
+	return res;
+}
+
+static int64_t tsbt_key(const void *context, srt_tndx v)
+{
+	return (int64_t)v * 3 - *(const int64_t *)context;
+}
+
+static int test_sbt_load_sorted()
+{
+	int res = 0;
+	int64_t k, base = 5000;
+	size_t i, j, n[] = {0, 1, 19, 20, 21, 200, 401, 8001, 12345};
+	srt_tndx v;
+	struct SBTCursor c;
+	srt_btree *b = sbt_alloc(0);
+	RETURN_IF(!b, 1);
+	/* Reusing the index: the previous contents are replaced */
+	for (j = 0; j < sizeof(n) / sizeof(n[0]); j++) {
+		if (!sbt_load_sorted(&b, n[j], tsbt_key, &base)
+		    || !sbt_assert(b)) {
+			res |= 2;
+			continue;
+		}
+		for (i = 0; i < n[j]; i++) {
+			k = tsbt_key(&base, (srt_tndx)i);
+			if (sbt_at(b, k) != (srt_tndx)i
+			    || sbt_at(b, k + 1) != ST_NIL)
+				res |= 4;
+		}
+		c.n = b->head;
+		c.i = 0;
+		for (i = 0; sbt_next(b, &c, &k, &v); i++)
+			if (v != (srt_tndx)i || k != tsbt_key(&base, v))
+				res |= 8;
+		res |= i == n[j] ? 0 : 8;
+	}
+	/* Regular insert/delete after the bulk load */
+	for (i = 0; i < 3000; i++)
+		if (!sbt_insert(&b, (int64_t)i * 3 - base + 1, 0, NULL))
+			res |= 16;
+	for (i = 0; i < 12345; i += 2)
+		if (!sbt_delete(b, tsbt_key(&base, (srt_tndx)i), NULL))
+			res |= 16;
+	res |= sbt_assert(b) && sbt_at(b, 1 - base) == 0
+			       && sbt_at(b, 3 - base) == 1
+			       && !sbt_load_sorted(&b, 1, NULL, NULL)
+		       ? 0
+		       : 32;
+	sbt_free(&b);
+	return res;
+}
+
 #define TEST_SM_ALLOC_DONOTHING(a)
 #define TEST_SM_ALLOC_X(fn, sm_alloc_X, type, insert, at, sm_free_X)           \
 	static int fn()                                                        \
@@ -3917,6 +4063,64 @@ static int test_sm_inc_si()
 	return res;
 }
 
+static int test_sm_emplace()
+{
+	int res = 0;
+	size_t i;
+	srt_bool is_new = S_FALSE;
+	int32_t *v32;
+	int64_t *v64;
+	const void **vp;
+	srt_string *s = ss_alloca(100);
+	srt_map *m = sm_alloc(SM_II32, 0), *ms = sm_alloc(SM_SI, 0),
+		*mp = sm_alloc(SM_SP, 0);
+	RETURN_IF(!m || !ms || !mp, 1);
+	for (i = 0; i < 100; i++) {
+		v32 = sm_emplace_ii32(&m, (int32_t)(i % 10), &is_new);
+		if (!v32 || is_new != (i < 10) || *v32 != (int32_t)(i / 10))
+			res |= 2;
+		else
+			(*v32)++;
+	}
+	res |= sm_size(m) == 10 && sm_at_ii32(m, 3) == 10
+			       && sm_emplace_ii32(&m, 3, NULL)
+			       && *sm_emplace_ii32(&m, 3, NULL) == 10
+		       ? 0
+		       : 4;
+	for (i = 0; i < 100; i++) {
+		ss_printf(&s, 100, "key %u", (unsigned)(i % 7));
+		v64 = sm_emplace_si(&ms, s, &is_new);
+		if (!v64)
+			res |= 8;
+		else
+			*v64 += 2;
+	}
+	res |= sm_size(ms) == 7 && sm_at_si(ms, ss_crefa("key 0")) == 30
+			       && sm_at_si(ms, ss_crefa("key 6")) == 28
+		       ? 0
+		       : 16;
+	vp = sm_emplace_sp(&mp, ss_crefa("a long key, not stored inline"),
+			   &is_new);
+	res |= vp && is_new && !*vp ? 0 : 32;
+	if (vp)
+		*vp = s;
+	vp = sm_emplace_sp(&mp, ss_crefa("a long key, not stored inline"),
+			   &is_new);
+	res |= vp && !is_new && *vp == s
+			       && sm_at_sp(mp, ss_crefa(
+					       "a long key, not stored inline"))
+					  == s
+		       ? 0
+		       : 64;
+	res |= !sm_emplace_ii(&m, 1, NULL) && !sm_emplace_ii32(NULL, 1, NULL)
+		       ? 0
+		       : 128;
+	sm_free(&m);
+	sm_free(&ms);
+	sm_free(&mp);
+	return res;
+}
+
 static int test_sm_delete_i()
 {
 	int res;
@@ -4300,6 +4504,98 @@ static int test_sm_sort_to_vectors()
 	return res;
 }
 
+static int test_sm_from_sorted()
+{
+	int res = 0;
+	size_t i, n;
+	srt_map *m = NULL, *m2 = NULL;
+	srt_set *s = NULL;
+	srt_vector *kv = sv_alloc_t(SV_I64, 0), *vv = sv_alloc_t(SV_I32, 0),
+		   *kv2 = NULL, *vv2 = NULL;
+	/*
+	 * Every size up to a few complete levels (balance and coloring)
+	 */
+	for (n = 0; n < 70 && !res; n++) {
+		sv_set_size(kv, 0);
+		sv_set_size(vv, 0);
+		for (i = 0; i < n; i++) {
+			sv_push_i(&kv, (int64_t)i * 3 - 50);
+			sv_push_i(&vv, (int64_t)i);
+		}
+		m = sm_from_sorted_ii32(kv, vv);
+		s = sms_from_sorted_i(kv);
+		res |= m && s && sm_size(m) == n && sms_size(s) == n
+				       && (!n || (st_assert((srt_tree *)m)
+						  && st_assert((srt_tree *)s)))
+			       ? 0
+			       : 1;
+		for (i = 0; i < n; i++)
+			if (sm_at_ii32(m, (int32_t)i * 3 - 50) != (int32_t)i
+			    || !sms_count_i(s, (int64_t)i * 3 - 50)
+			    || sm_count_i(m, (int64_t)i * 3 - 49))
+				res |= 2;
+		/* Insert/delete keep working on the built tree */
+		res |= sm_insert_ii32(&m, 1000, 1)
+				       && sm_delete_i(m, -50) == (n > 0)
+				       && st_assert((srt_tree *)m)
+			       ? 0
+			       : 4;
+		sm_free(&m);
+		sms_free(&s);
+	}
+	/* Round trip from sorted dump */
+	m = sm_alloc(SM_UU32, 0);
+	for (i = 0; i < 1000; i++)
+		sm_insert_uu32(&m, (uint32_t)(i * 7919 % 1000) + 0x7fffff00,
+			       (uint32_t)i);
+	sm_sort_to_vectors(m, &kv2, &vv2);
+	m2 = sm_from_sorted_uu32(kv2, vv2);
+	res |= m2 && sm_size(m2) == 1000 && st_assert((srt_tree *)m2)
+			       && sm_at_uu32(m2, 0x7fffff00) == 0
+			       && sm_at_uu32(m2, 0x7fffff00U + 999)
+					  == sm_at_uu32(m, 0x7fffff00U + 999)
+		       ? 0
+		       : 8;
+	sm_free(&m2);
+	/* Unsorted input and repeated keys: regular insertion */
+	sv_set_size(kv, 0);
+	sv_set_size(vv, 0);
+	for (i = 0; i < 100; i++) {
+		sv_push_i(&kv, (int64_t)(i % 10) * (i % 2 ? 1 : -1));
+		sv_push_i(&vv, (int64_t)i);
+	}
+	m2 = sm_from_sorted_ii(kv, vv);
+	s = sms_from_sorted_u32(kv2);
+	res |= m2 && sm_size(m2) == 10 && st_assert((srt_tree *)m2)
+			       && sm_at_ii(m2, -8) == 98
+			       && sm_at_ii(m2, 9) == 99
+			       && sm_at_ii(m2, 0) == 90 && s
+			       && sms_size(s) == 1000
+		       ? 0
+		       : 16;
+	/* Missing values, or extra keys */
+	sv_set_size(vv, 5);
+	res |= !sm_from_sorted_ii(kv, NULL) && !sms_from_sorted_i32(NULL)
+		       ? 0
+		       : 32;
+	sm_free(&m2);
+	m2 = sm_from_sorted_ii(kv, vv);
+	res |= m2 && sm_size(m2) == 5 ? 0 : 64;
+#ifdef S_USE_VA_ARGS
+	sm_free(&m, &m2);
+	sv_free(&kv, &vv, &kv2, &vv2);
+#else
+	sm_free(&m);
+	sm_free(&m2);
+	sv_free(&kv);
+	sv_free(&vv);
+	sv_free(&kv2);
+	sv_free(&vv2);
+#endif
+	sms_free(&s);
+	return res;
+}
+
 static int test_sm_double_rotation()
 {
 	size_t test_elems = 15;
@@ -4381,158 +4677,1782 @@ static int test_sm_double_rotation()
 	return res;
 }
 
-static int test_sms()
+static int test_sm_btree()
 {
-	int i, res = 0;
-	const srt_string *k[] = {ss_crefa("k000"), ss_crefa("k001"),
-				 ss_crefa("k002")};
-	size_t cnt_i32 = 0, cnt_u32 = 0, cnt_i = 0, cnt_s = 0, cnt_s2 = 0;
-	size_t processed_i32, processed_u32, processed_i, processed_s,
-		processed_s2;
-	/*
-	 * Allocation: heap, stack with 3 elements, and stack with 10 elements
-	 */
-	srt_set *s_i32 = sms_alloc(SMS_I32, 0), *s_u32 = sms_alloc(SMS_U32, 0),
-		*s_i = sms_alloc(SMS_I, 0), *s_s = sms_alloc(SMS_S, 0),
-		*s_s2 = NULL, *s_a3 = sms_alloca(SMS_I32, 3),
-		*s_a10 = sms_alloca(SMS_I32, 10);
-	res |= (sms_empty(s_i32) && sms_empty(s_u32) && sms_empty(s_i)
-				&& sms_empty(s_s) && sms_empty(s_s2)
-				&& sms_empty(s_a3) && sms_empty(s_a10)
-			? 0
-			: 1 << 0);
-	/*
-	 * Insert elements
-	 */
-	for (i = 0; i < 3; i++) {
-		sms_insert_i32(&s_i32, i + 10);
-		sms_insert_u32(&s_u32, (uint32_t)i + 20);
-		sms_insert_i(&s_i, i);
-		sms_insert_s(&s_s, k[i]);
+	int res = 0;
+	uint32_t r = 7;
+	int64_t k, *e;
+	size_t i, n = 2000;
+	srt_string *str = ss_alloca(100);
+	srt_vector *kv = NULL, *vv = NULL, *kv2 = NULL, *vv2 = NULL;
+	srt_map *m = sm_alloc_btree(SM_II, 0), *ref = sm_alloc(SM_II, 0),
+		*m32 = sm_alloc_btree(SM_UU32, 0),
+		*mis = sm_alloc_btree(SM_IS, 0), *ms = sm_alloc_btree(SM_SI, 0),
+		*m2 = NULL, *m3 = sm_alloc(SM_II32, 0);
+	srt_set *s = sms_alloc_btree(SMS_I32, 0);
+	if (!m || !ref || !m32 || !mis || !ms || !m3 || !s) {
+		res = 1;
+		goto done;
 	}
-	res |= (!sms_empty(s_i32) && !sms_empty(s_u32) && !sms_empty(s_i)
-				&& !sms_empty(s_s) && sms_empty(s_s2)
-				&& sms_empty(s_a3) && sms_empty(s_a10)
-			? 0
-			: 1 << 1);
-	res |= (sms_count_i(s_i32, 10) && sms_count_i(s_i32, 11)
-				&& sms_count_i(s_i32, 12)
-				&& sms_count_u(s_u32, 20)
-				&& sms_count_u(s_u32, 21)
-				&& sms_count_u(s_u32, 22) && sms_count_i(s_i, 0)
-				&& sms_count_i(s_i, 1) && sms_count_i(s_i, 2)
-				&& sms_count_s(s_s, k[0])
-				&& sms_count_s(s_s, k[1])
-				&& sms_count_s(s_s, k[2])
-			? 0
-			: 1 << 2);
-	/*
-	 * Enumeration
-	 */
-	s_s2 = sms_dup(s_s);
-	processed_i32 = sms_itr_i32(s_i32, -1, 100, cback_i32, &cnt_i32);
-	processed_u32 = sms_itr_u32(s_u32, 0, 100, cback_u32, &cnt_u32);
-	processed_i = sms_itr_i(s_i, -1, 100, cback_i, &cnt_i);
-	processed_s = sms_itr_s(s_s, k[0], k[2], cback_s, &cnt_s);
-	processed_s2 = sms_itr_s(s_s2, k[0], k[2], cback_s, &cnt_s2);
-	res |= (processed_i32 == cnt_i32 && cnt_i32 == 3 ? 0 : 1 << 3);
-	res |= (processed_u32 == cnt_u32 && cnt_u32 == 3 ? 0 : 1 << 4);
-	res |= (processed_i == cnt_i && cnt_i == 3 ? 0 : 1 << 5);
-	res |= (processed_s == cnt_s && cnt_s == 3 ? 0 : 1 << 6);
-	res |= (processed_s2 == cnt_s2 && cnt_s2 == 3 ? 0 : 1 << 7);
-	/*
-	 * sms_cpy() to stack with small stack allocation size
-	 */
-	sms_cpy(&s_a3, s_i32);
-	res |= (sms_size(s_a3) == 3 ? 0 : 1 << 8);
-	sms_cpy(&s_a3, s_u32);
-	res |= (sms_size(s_a3) == 3 ? 0 : 1 << 9);
-	sms_cpy(&s_a3, s_i);
-	res |= (sms_size(s_a3) == 0 ? 0 : 1 << 10);
-	sms_cpy(&s_a3, s_s);
-	res |= (sms_size(s_a3) == 0 ? 0 : 1 << 11);
-	/*
-	 * sms_cpy() to stack with enough stack allocation size
-	 */
-	sms_cpy(&s_a10, s_i32);
-	res |= (sms_size(s_a10) == 3 ? 0 : 1 << 12);
-	sms_cpy(&s_a10, s_u32);
-	res |= (sms_size(s_a10) == 3 ? 0 : 1 << 13);
-	sms_cpy(&s_a10, s_i);
-	res |= (sms_size(s_a10) == 3 ? 0 : 1 << 14);
-	sms_cpy(&s_a10, s_s);
-	res |= (sms_size(s_a10) == 3 ? 0 : 1 << 15);
-	sms_clear(s_a10);
-	res |= (sms_size(s_a10) == 0 ? 0 : 1 << 16);
-	/*
-	 * Reserve/grow
-	 */
-	sms_reserve(&s_i32, 1000);
-	sms_grow(&s_u32, 1000 - sms_max_size(s_u32));
-	res |= (sms_capacity(s_i32) >= 1000 && sms_capacity(s_u32) >= 1000
-				&& sms_capacity_left(s_i32) >= 997
-				&& sms_capacity_left(s_u32) >= 997
-			? 0
-			: 1 << 17);
-	/*
-	 * Shrink memory
-	 */
-	sms_shrink(&s_i32);
-	sms_shrink(&s_u32);
-	res |= (sms_capacity(s_i32) == 3 && sms_capacity(s_u32) == 3
-				&& sms_capacity_left(s_i32) == 0
-				&& sms_capacity_left(s_u32) == 0
-			? 0
-			: 1 << 18);
-	/*
-	 * Random access
-	 */
-	res |= (sms_it_i32(s_i32, 0) == 10 && sms_it_i32(s_i32, 1) == 11
-				&& sms_it_i32(s_i32, 2) == 12
-			? 0
-			: 1 << 19);
-	res |= (sms_it_u32(s_u32, 0) == 20 && sms_it_u32(s_u32, 1) == 21
-				&& sms_it_u32(s_u32, 2) == 22
-			? 0
-			: 1 << 20);
-	res |= (sms_it_i(s_i, 0) == 0 && sms_it_i(s_i, 1) == 1
-				&& sms_it_i(s_i, 2) == 2
-			? 0
-			: 1 << 21);
-	res |= (!ss_cmp(sms_it_s(s_s, 0), k[0])
-				&& !ss_cmp(sms_it_s(s_s, 1), k[1])
-				&& !ss_cmp(sms_it_s(s_s, 2), k[2])
-			? 0
-			: 1 << 22);
-	/*
-	 * Delete
-	 */
-	sms_delete_i(s_i32, 10);
-	sms_delete_i(s_u32, 20);
-	sms_delete_i(s_i, 0);
-	sms_delete_s(s_s, k[1]);
-	res |= (!sms_count_i(s_i32, 10) && !sms_count_i(s_u32, 20)
-				&& !sms_count_i(s_i, 0)
-				&& !sms_count_s(s_s, k[1])
-			? 0
-			: 1 << 23);
-	/*
-	 * Release memory
-	 */
+	res |= sm_is_btree(m) && sm_is_btree(m32) && sm_is_btree(mis)
+			       && sm_is_btree(s) && !sm_is_btree(ms)
+			       && !sm_is_btree(ref)
+		       ? 0
+		       : 2;
+	/* Same operations on B+tree and Red-Black tree maps */
+	for (i = 0; i < 30000; i++) {
+		r = r * 1103515245 + 12345;
+		k = (int64_t)((r >> 8) % n) - 500;
+		switch ((r >> 4) % 4) {
+		case 0:
+			sm_insert_ii(&m, k, (int64_t)i);
+			sm_insert_ii(&ref, k, (int64_t)i);
+			break;
+		case 1:
+			sm_inc_ii(&m, k, 3);
+			sm_inc_ii(&ref, k, 3);
+			break;
+		case 2:
+			if ((e = sm_emplace_ii(&m, k, NULL)) != NULL)
+				*e += 5;
+			if ((e = sm_emplace_ii(&ref, k, NULL)) != NULL)
+				*e += 5;
+			break;
+		default:
+			if (sm_delete_i(m, k) != sm_delete_i(ref, k))
+				res |= 4;
+		}
+	}
+	res |= sm_size(m) == sm_size(ref) && sbt_assert(m->bt) ? 0 : 8;
+	for (k = -600; k < (int64_t)n - 400; k++)
+		if (sm_count_i(m, k) != sm_count_i(ref, k)
+		    || sm_at_ii(m, k) != sm_at_ii(ref, k))
+			res |= 16;
+	/* Unsorted enumeration (element vector) */
+	for (i = 0; i < sm_size(m); i++)
+		if (sm_at_ii(ref, sm_it_i_k(m, (srt_tndx)i))
+		    != sm_it_ii_v(m, (srt_tndx)i))
+			res |= 32;
+	/* Sorted export and range enumeration */
+	sm_sort_to_vectors(m, &kv, &vv);
+	sm_sort_to_vectors(ref, &kv2, &vv2);
+	res |= sv_size(kv) == sm_size(ref) && sv_size(kv2) == sm_size(ref)
+		       ? 0
+		       : 64;
+	for (i = 0; i < sv_size(kv) && i < sv_size(kv2); i++)
+		if (sv_at_i(kv, i) != sv_at_i(kv2, i)
+		    || sv_at_i(vv, i) != sv_at_i(vv2, i))
+			res |= 64;
+	res |= sm_itr_ii(m, -100, 100, NULL, NULL)
+				       == sm_itr_ii(ref, -100, 100, NULL, NULL)
+			       && sm_itr_ii(m, INT64_MIN, INT64_MAX, NULL, NULL)
+					  == sm_size(m)
+			       && !sm_itr_ii(m, 100, -100, NULL, NULL)
+		       ? 0
+		       : 128;
+	/* Copy: the target gets the source index type */
+	m2 = sm_dup(m);
+	res |= sm_is_btree(m2) && sm_size(m2) == sm_size(m)
+			       && sm_at_ii(m2, 0) == sm_at_ii(ref, 0)
+			       && sbt_assert(m2->bt)
+		       ? 0
+		       : 256;
+	sm_cpy(&m3, m);
+	res |= sm_is_btree(m3) && sm_size(m3) == sm_size(m)
+			       && sm_at_ii(m3, 1) == sm_at_ii(ref, 1)
+			       && sm_delete_i(m3, 1) == sm_count_i(ref, 1)
+		       ? 0
+		       : 512;
+	sm_cpy(&m3, ref);
+	res |= !sm_is_btree(m3) && sm_size(m3) == sm_size(ref)
+			       && sm_at_ii(m3, 2) == sm_at_ii(ref, 2)
+			       && st_assert((srt_tree *)m3)
+		       ? 0
+		       : 1024;
+	sm_clear(m);
+	res |= sm_is_btree(m) && !sm_size(m) && !sm_count_i(m, 0)
+			       && sm_insert_ii(&m, 1, 2) && sm_at_ii(m, 1) == 2
+		       ? 0
+		       : 2048;
+	/* 32-bit unsigned keys (full range) */
+	sm_insert_uu32(&m32, 0xffffffff, 1);
+	sm_insert_uu32(&m32, 0, 2);
+	sm_insert_uu32(&m32, 0x80000000, 3);
+	res |= sm_at_uu32(m32, 0xffffffff) == 1
+			       && sm_itr_uu32(m32, 0x7fffffff, 0xffffffff,
+					      NULL, NULL)
+					  == 2
+			       && sm_delete_i(m32, 0x80000000)
+			       && !sm_count_u(m32, 0x80000000)
+			       && sm_at_uu32(m32, 0) == 2
+		       ? 0
+		       : 4096;
+	/* String values (element relocation on delete) */
+	for (i = 0; i < 200; i++) {
+		ss_printf(&str, 100, "a string value, not stored inline %u",
+			  (unsigned)i);
+		sm_insert_is(&mis, (int64_t)i, str);
+	}
+	for (i = 0; i < 200; i += 2)
+		sm_delete_i(mis, (int64_t)i);
+	res |= sm_size(mis) == 100 && !ss_cmp(sm_at_is(mis, 199), str)
+			       && !sm_count_i(mis, 0)
+		       ? 0
+		       : 8192;
+	/* Sets */
+	for (i = 0; i < 1000; i++)
+		sms_insert_i32(&s, (int32_t)((i * 7) % 1000) - 500);
+	res |= sms_size(s) == 1000 && sms_count_i(s, -500)
+			       && sms_itr_i32(s, -10, 9, NULL, NULL) == 20
+			       && sms_delete_i(s, 0) && !sms_count_i(s, 0)
+			       && sms_itr_i32(s, -10, 9, NULL, NULL) == 19
+		       ? 0
+		       : 16384;
+done:
 #ifdef S_USE_VA_ARGS
-	sms_free(&s_i32, &s_u32, &s_i, &s_s, &s_s2, &s_a3, &s_a10);
+	sm_free(&m, &ref, &m32, &mis, &ms, &m2, &m3);
+	sv_free(&kv, &vv, &kv2, &vv2);
 #else
-	sms_free(&s_i32);
-	sms_free(&s_u32);
-	sms_free(&s_i);
-	sms_free(&s_s);
-	sms_free(&s_s2);
-	sms_free(&s_a3);
-	sms_free(&s_a10);
-#endif
-	return res;
-}
-
+	sm_free(&m);
+	sm_free(&ref);
+	sm_free(&m32);
+	sm_free(&mis);
+	sm_free(&ms);
+	sm_free(&m2);
+	sm_free(&m3);
+	sv_free(&kv);
+	sv_free(&vv);
+	sv_free(&kv2);
+	sv_free(&vv2);
+#endif
+	sms_free(&s);
+	return res;
+}
+
+static int test_sm_cursor()
+{
+	int res = 0;
+	uint32_t r = 3;
+	int64_t k;
+	size_t i, j, n, t;
+	srt_map_cursor c;
+	srt_set_cursor sc;
+	srt_vector *kv = NULL, *vv = NULL;
+	srt_string *s1 = ss_alloca(20), *s2 = ss_alloca(20);
+	srt_map *m, *ms = sm_alloc(SM_SI, 0), *mu = sm_alloc_btree(SM_UU32, 0);
+	srt_set *s = sms_alloc(SMS_I32, 0);
+	/* Same checks for Red-Black tree and B+tree maps */
+	for (t = 0; t < 2; t++) {
+		m = t ? sm_alloc_btree(SM_II, 0) : sm_alloc(SM_II, 0);
+		res |= !sm_cur_seek_ge_i(m, 0, &c)
+				       && !sm_cur_seek_le_i(m, 0, &c)
+				       && sm_cur_id(m, &c) == ST_NIL
+			       ? 0
+			       : 1 << (t * 8);
+		for (i = 0; i < 3000; i++) {
+			r = r * 1103515245 + 12345;
+			sm_insert_ii(&m, (int64_t)((r >> 8) % 100000) * 2,
+				     (int64_t)i);
+		}
+		sv_set_size(kv, 0);
+		sv_set_size(vv, 0);
+		sm_sort_to_vectors(m, &kv, &vv);
+		n = sv_size(kv);
+		/* Full forward and backward scans */
+		i = 0;
+		if (sm_cur_seek_ge_i(m, INT64_MIN, &c))
+			do {
+				if (i >= n
+				    || sm_it_i_k(m, sm_cur_id(m, &c))
+					       != sv_at_i(kv, i)
+				    || sm_it_ii_v(m, sm_cur_id(m, &c))
+					       != sv_at_i(vv, i))
+					res |= 2 << (t * 8);
+				i++;
+			} while (sm_cur_next(m, &c));
+		res |= i == n && sm_cur_id(m, &c) == ST_NIL
+				       && !sm_cur_prev(m, &c)
+			       ? 0
+			       : 4 << (t * 8);
+		if (sm_cur_seek_le_i(m, INT64_MAX, &c))
+			do {
+				if (!i
+				    || sm_it_i_k(m, sm_cur_id(m, &c))
+					       != sv_at_i(kv, i - 1))
+					res |= 8 << (t * 8);
+				i--;
+			} while (sm_cur_prev(m, &c));
+		res |= !i ? 0 : 16 << (t * 8);
+		/* Seek to keys in and between elements, step both ways */
+		for (j = 0; j < 500; j++) {
+			r = r * 1103515245 + 12345;
+			k = (int64_t)((r >> 8) % 200003) - 1;
+			for (i = 0; i < n && sv_at_i(kv, i) < k; i++)
+				;
+			if (sm_cur_seek_ge_i(m, k, &c) != (i < n)
+			    || (i < n
+				&& (sm_it_i_k(m, sm_cur_id(m, &c))
+					    != sv_at_i(kv, i)
+				    || sm_cur_prev(m, &c) != (i > 0)
+				    || (i > 0
+					&& sm_it_i_k(m, sm_cur_id(m, &c))
+						   != sv_at_i(kv, i - 1)))))
+				res |= 32 << (t * 8);
+			if (i < n && sv_at_i(kv, i) == k)
+				i++; /* last <= k */
+			if (sm_cur_seek_le_i(m, k, &c) != (i > 0)
+			    || (i > 0
+				&& (sm_it_i_k(m, sm_cur_id(m, &c))
+					    != sv_at_i(kv, i - 1)
+				    || sm_cur_next(m, &c) != (i < n)
+				    || (i < n
+					&& sm_it_i_k(m, sm_cur_id(m, &c))
+						   != sv_at_i(kv, i)))))
+				res |= 64 << (t * 8);
+		}
+		sm_free(&m);
+	}
+	/* Key range clipping (32-bit unsigned keys) */
+	sm_insert_uu32(&mu, 0, 1);
+	sm_insert_uu32(&mu, 0xffffffff, 2);
+	res |= sm_cur_seek_ge_i(mu, -5, &c)
+			       && sm_it_uu32_v(mu, sm_cur_id(mu, &c)) == 1
+			       && !sm_cur_seek_le_i(mu, -1, &c)
+			       && !sm_cur_seek_ge_i(mu, (int64_t)1 << 33, &c)
+			       && sm_cur_seek_le_i(mu, (int64_t)1 << 33, &c)
+			       && sm_it_uu32_v(mu, sm_cur_id(mu, &c)) == 2
+			       && sm_cur_prev(mu, &c) && !sm_cur_prev(mu, &c)
+		       ? 0
+		       : 1 << 16;
+	/* String keys */
+	for (i = 0; i < 26; i += 2) {
+		ss_printf(&s1, 20, "key_%c", (char)('a' + i));
+		sm_insert_si(&ms, s1, (int64_t)i);
+	}
+	ss_cpy_c(&s1, "key_b");
+	ss_cpy_c(&s2, "key_zz");
+	res |= sm_cur_seek_ge_s(ms, s1, &c)
+			       && sm_it_si_v(ms, sm_cur_id(ms, &c)) == 2
+			       && sm_cur_next(ms, &c)
+			       && sm_it_si_v(ms, sm_cur_id(ms, &c)) == 4
+			       && sm_cur_seek_le_s(ms, s1, &c)
+			       && sm_it_si_v(ms, sm_cur_id(ms, &c)) == 0
+			       && !sm_cur_prev(ms, &c)
+			       && !sm_cur_seek_ge_s(ms, s2, &c)
+			       && sm_cur_seek_le_s(ms, s2, &c)
+			       && sm_it_si_v(ms, sm_cur_id(ms, &c)) == 24
+			       && !sm_cur_seek_ge_i(ms, 0, &c)
+			       && !sm_cur_seek_ge_s(mu, s1, &c)
+		       ? 0
+		       : 1 << 17;
+	/* Sets */
+	for (i = 0; i < 100; i++)
+		sms_insert_i32(&s, (int32_t)i * 10 - 500);
+	res |= sms_cur_seek_ge_i(s, -495, &sc)
+			       && sms_it_i32(s, sms_cur_id(s, &sc)) == -490
+			       && sms_cur_prev(s, &sc) && !sms_cur_prev(s, &sc)
+			       && sms_cur_seek_le_i(s, INT64_MAX, &sc)
+			       && sms_it_i32(s, sms_cur_id(s, &sc)) == 490
+			       && !sms_cur_next(s, &sc)
+		       ? 0
+		       : 1 << 18;
+#ifdef S_USE_VA_ARGS
+	sm_free(&ms, &mu);
+	sv_free(&kv, &vv);
+#else
+	sm_free(&ms);
+	sm_free(&mu);
+	sv_free(&kv);
+	sv_free(&vv);
+#endif
+	sms_free(&s);
+	return res;
+}
+
+static int test_sm_ranked()
+{
+	int res = 0;
+	uint32_t r = 11;
+	int64_t k, k2;
+	size_t i, n;
+	srt_vector *kv = NULL, *vv = NULL;
+	srt_string *s1 = ss_alloca(60), *s2 = ss_alloca(60);
+	srt_map *m = sm_alloc_ranked(SM_II, 0), *ref = sm_alloc(SM_II, 0),
+		*mb = sm_alloc_btree(SM_II, 0),
+		*mu = sm_alloc_ranked(SM_UU32, 0), *m2 = NULL,
+		*m3 = sm_alloc(SM_II, 0);
+	srt_set *s = sms_alloc_ranked(SMS_S, 0);
+	if (!m || !ref || !mb || !mu || !m3 || !s) {
+		res = 1;
+		goto done;
+	}
+	res |= sm_is_ranked(m) && sm_is_ranked(s) && !sm_is_ranked(ref)
+			       && !sm_is_ranked(mb)
+		       ? 0
+		       : 2;
+	/* Subtree node count kept through insert/delete rebalancing */
+	for (i = 0; i < 30000; i++) {
+		r = r * 1103515245 + 12345;
+		k = (int64_t)((r >> 8) % 3000) - 1000;
+		switch ((r >> 4) % 3) {
+		case 0:
+			sm_insert_ii(&m, k, (int64_t)i);
+			sm_insert_ii(&ref, k, (int64_t)i);
+			sm_insert_ii(&mb, k, (int64_t)i);
+			break;
+		case 1:
+			sm_inc_ii(&m, k, 1);
+			sm_inc_ii(&ref, k, 1);
+			sm_inc_ii(&mb, k, 1);
+			break;
+		default:
+			if (sm_delete_i(m, k) != sm_delete_i(ref, k))
+				res |= 4;
+			sm_delete_i(mb, k);
+		}
+		if (!(i % 1009) && !st_assert((srt_tree *)m))
+			res |= 8;
+	}
+	res |= st_assert((srt_tree *)m) && sm_size(m) == sm_size(ref) ? 0 : 8;
+	/* rank/select against the sorted dump */
+	sm_sort_to_vectors(ref, &kv, &vv);
+	n = sv_size(kv);
+	for (i = 0; i < n; i++) {
+		k = sv_at_i(kv, i);
+		if (sm_rank_i(m, k) != i || sm_rank_i(ref, k) != i
+		    || sm_rank_i(mb, k) != i
+		    || sm_it_i_k(m, sm_select(m, i)) != k
+		    || sm_it_ii_v(m, sm_select(m, i)) != sv_at_i(vv, i)
+		    || sm_it_i_k(ref, sm_select(ref, i)) != k
+		    || sm_it_i_k(mb, sm_select(mb, i)) != k)
+			res |= 16;
+	}
+	res |= sm_select(m, n) == ST_NIL && sm_select(ref, n) == ST_NIL
+			       && sm_select(mb, n) == ST_NIL
+			       && sm_rank_i(m, INT64_MIN) == 0
+			       && sm_rank_i(m, INT64_MAX) == n
+		       ? 0
+		       : 32;
+	/* Range count */
+	for (i = 0; i < 300; i++) {
+		r = r * 1103515245 + 12345;
+		k = (int64_t)((r >> 8) % 3200) - 1100;
+		k2 = k + (int64_t)((r >> 4) % 500);
+		if (sm_count_range_i(m, k, k2)
+			    != sm_itr_ii(ref, k, k2, NULL, NULL)
+		    || sm_count_range_i(mb, k, k2)
+			       != sm_count_range_i(m, k, k2))
+			res |= 64;
+	}
+	res |= sm_count_range_i(m, INT64_MIN, INT64_MAX) == n
+			       && !sm_count_range_i(m, 5, 4)
+		       ? 0
+		       : 64;
+	/* Copy keeps the node layout of the source */
+	m2 = sm_dup(m);
+	sm_cpy(&m3, m);
+	res |= sm_is_ranked(m2) && sm_is_ranked(m3)
+			       && st_assert((srt_tree *)m2)
+			       && sm_rank_i(m2, sv_at_i(kv, n / 2)) == n / 2
+			       && sm_delete_i(m3, sv_at_i(kv, 0))
+			       && st_assert((srt_tree *)m3)
+			       && sm_rank_i(m3, sv_at_i(kv, n / 2)) == n / 2 - 1
+		       ? 0
+		       : 128;
+	sm_cpy(&m3, ref);
+	res |= !sm_is_ranked(m3) && sm_size(m3) == n
+			       && sm_at_ii(m3, sv_at_i(kv, 1))
+					  == sv_at_i(vv, 1)
+		       ? 0
+		       : 256;
+	/* 32-bit keys (range clipping) */
+	for (i = 0; i < 100; i++)
+		sm_insert_uu32(&mu, (uint32_t)i * 0x2000000, (uint32_t)i);
+	res |= sm_rank_i(mu, -1) == 0 && sm_rank_i(mu, (int64_t)1 << 33) == 100
+			       && sm_rank_i(mu, 0x2000001) == 2
+			       && sm_it_uu32_v(mu, sm_select(mu, 99)) == 99
+			       && sm_count_range_i(mu, -5, 0x4000000) == 3
+			       && st_assert((srt_tree *)mu)
+		       ? 0
+		       : 512;
+	/* String set */
+	for (i = 0; i < 26; i++) {
+		ss_printf(&s1, 20, "%c", (char)('z' - i));
+		sms_insert_s(&s, s1);
+	}
+	ss_cpy_c(&s1, "c");
+	ss_cpy_c(&s2, "f");
+	res |= sms_rank_s(s, s1) == 2 && sms_count_range_s(s, s1, s2) == 4
+			       && !sms_count_range_s(s, s2, s1)
+			       && !ss_cmp(sms_it_s(s, sms_select(s, 5)), s2)
+			       && sms_delete_s(s, s1) && sms_rank_s(s, s2) == 4
+			       && st_assert((srt_tree *)s)
+		       ? 0
+		       : 1024;
+	/* Keys not stored in-place (released by the delete callback) */
+	sms_clear(s);
+	for (i = 0; i < 26; i++) {
+		ss_printf(&s1, 60, "%c, a key not stored in-place",
+			  (char)('z' - i));
+		sms_insert_s(&s, s1);
+	}
+	ss_cpy_c(&s1, "c, a key not stored in-place");
+	ss_cpy_c(&s2, "f, a key not stored in-place");
+	res |= sms_delete_s(s, s1) && sms_rank_s(s, s2) == 4
+			       && sms_count_range_s(s, s1, s2) == 3
+			       && st_assert((srt_tree *)s)
+		       ? 0
+		       : 2048;
+done:
+#ifdef S_USE_VA_ARGS
+	sm_free(&m, &ref, &mb, &mu, &m2, &m3);
+	sv_free(&kv, &vv);
+#else
+	sm_free(&m);
+	sm_free(&ref);
+	sm_free(&mb);
+	sm_free(&mu);
+	sm_free(&m2);
+	sm_free(&m3);
+	sv_free(&kv);
+	sv_free(&vv);
+#endif
+	sms_free(&s);
+	return res;
+}
+
+struct TItrppCtx {
+	int64_t sum, first, last;
+	size_t n, unsorted;
+};
+
+struct TItrppRed {
+	int64_t sum, last;
+	size_t n, order, unsorted;
+};
+
+static srt_bool cback_itrpp_ii(int64_t k, int64_t v, void *context)
+{
+	struct TItrppCtx *c = (struct TItrppCtx *)context;
+	if (!c->n)
+		c->first = k;
+	else if (k <= c->last)
+		c->unsorted++;
+	c->last = k;
+	c->sum += k + v;
+	c->n++;
+	return S_TRUE;
+}
+
+static void itrpp_run_rev(void *run_context, size_t njobs, srt_map_job_f job,
+			  void *job_context)
+{
+	size_t i;
+	(*(size_t *)run_context)++;
+	for (i = njobs; i > 0; i--)
+		job(job_context, i - 1);
+}
+
+/* Partitions have to be in key order, too */
+static void itrpp_reduce(void *reduce_context, void *worker_context,
+			 size_t worker)
+{
+	struct TItrppRed *r = (struct TItrppRed *)reduce_context;
+	struct TItrppCtx *c = (struct TItrppCtx *)worker_context;
+	if (c->n && r->n && c->first <= r->last)
+		r->unsorted++;
+	if (c->n)
+		r->last = c->last;
+	r->sum += c->sum;
+	r->n += c->n;
+	r->unsorted += c->unsorted;
+	r->order = r->order * 10 + worker;
+}
+
+static int test_sm_itrpp()
+{
+	int res = 0;
+	uint32_t r = 5;
+	size_t i, j, runs = 0, n = 3000, cnt;
+	int64_t sum;
+	struct TItrppCtx c[8];
+	struct TItrppRed red;
+	srt_map_par p;
+	srt_vector *kv = sv_alloc_t(SV_I64, 0), *vv = NULL,
+		   *kv2 = sv_alloc_t(SV_I64, 0), *vv2 = NULL;
+	srt_map *m[3], *m32 = sm_alloc(SM_UU32, 0), *ms = sm_alloc(SM_SI, 0);
+	m[0] = sm_alloc(SM_II, 0);
+	m[1] = sm_alloc_btree(SM_II, 0);
+	m[2] = sm_alloc_ranked(SM_II, 0);
+	for (i = 0; i < n; i++) {
+		r = r * 1103515245 + 12345;
+		for (j = 0; j < 2; j++)
+			sm_insert_ii(&m[j], (int64_t)(r >> 4) - 100000000,
+				     (int64_t)i);
+		/* ascending insertion (skewed Red-Black tree) */
+		sm_insert_ii(&m[2], (int64_t)i * 60000 - 90000000, (int64_t)i);
+		sm_insert_uu32(&m32, r, (uint32_t)i);
+	}
+	sm_insert_uu32(&m32, 0, 1);
+	sm_insert_uu32(&m32, 0xffffffff, 2);
+	memset(&p, 0, sizeof(p));
+	p.run_context = &runs;
+	p.contexts = c;
+	p.context_size = sizeof(c[0]);
+	p.reducef = itrpp_reduce;
+	p.reduce_context = &red;
+	for (j = 0; j < 3; j++) {
+		memset(c, 0, sizeof(c));
+		sm_itr_ii(m[j], INT64_MIN, INT64_MAX, cback_itrpp_ii, c);
+		sum = c[0].sum;
+		/* Red-Black tree, B+tree, ranked: 4 balanced partitions */
+		memset(c, 0, sizeof(c));
+		memset(&red, 0, sizeof(red));
+		p.nworkers = 4;
+		p.runf = itrpp_run_rev;
+		cnt = sm_itrpp_ii(m[j], INT64_MIN, INT64_MAX, cback_itrpp_ii,
+				  &p);
+		res |= cnt == sm_size(m[j]) && red.n == cnt && red.sum == sum
+				       && !red.unsorted && red.order == 123
+			       ? 0
+			       : 1 << (j * 4);
+		for (i = 0; i < 4; i++)
+			if (c[i].n < cnt / 8)
+				res |= 2 << (j * 4);
+		/* Sub-range, sequential */
+		memset(c, 0, sizeof(c));
+		memset(&red, 0, sizeof(red));
+		p.nworkers = 8;
+		p.runf = NULL;
+		cnt = sm_itrpp_ii(m[j], -50000000, 50000000, cback_itrpp_ii,
+				  &p);
+		res |= cnt == sm_itr_ii(m[j], -50000000, 50000000, NULL, NULL)
+				       && red.n == cnt && !red.unsorted
+				       && red.order == 1234567
+			       ? 0
+			       : 4 << (j * 4);
+		/* Sort to vectors, appending to existing vectors */
+		sv_set_size(kv, 0);
+		sv_set_size(vv, 0);
+		sv_set_size(kv2, 0);
+		sv_set_size(vv2, 0);
+		sv_push_i(&kv, 1);
+		sv_push_i(&kv2, 1);
+		p.nworkers = 3;
+		p.runf = itrpp_run_rev;
+		cnt = (size_t)sm_sort_to_vectors_par(m[j], &kv, &vv, &p);
+		sm_sort_to_vectors(m[j], &kv2, &vv2);
+		res |= cnt == sm_size(m[j]) && sv_size(kv) == cnt + 1
+				       && sv_size(vv) == cnt
+			       ? 0
+			       : 8 << (j * 4);
+		for (i = 0; i < cnt; i++)
+			if (sv_at_i(kv, i + 1) != sv_at_i(kv2, i + 1)
+			    || sv_at_i(vv, i) != sv_at_i(vv2, i))
+				res |= 8 << (j * 4);
+	}
+	/* 32-bit keys (full range), more workers than elements */
+	memset(&red, 0, sizeof(red));
+	p.nworkers = 5;
+	res |= sm_itrpp_uu32(m32, 0, 0xffffffff, NULL, &p) == sm_size(m32)
+			       && sm_itrpp_uu32(m32, 1, 0xfffffffe, NULL, &p)
+					  == sm_size(m32) - 2
+			       && sm_itrpp_ii(m[0], 5, 4, NULL, &p) == 0
+		       ? 0
+		       : 1 << 12;
+	sv_free(&kv2);
+	sv_free(&vv2);
+	res |= sm_sort_to_vectors_par(m32, &kv, &vv, &p)
+				       == (ssize_t)sm_size(m32)
+			       && sm_sort_to_vectors(m32, &kv2, &vv2)
+			       && sv_size(kv) == sm_size(m32)
+			       && sv_size(kv2) == sm_size(m32)
+		       ? 0
+		       : 2 << 12;
+	for (i = 0; i < sv_size(kv) && i < sv_size(kv2); i++)
+		if (sv_at_u(kv, i) != sv_at_u(kv2, i)
+		    || sv_at_u(vv, i) != sv_at_u(vv2, i))
+			res |= 2 << 12;
+	sm_clear(m32);
+	sm_insert_uu32(&m32, 7, 7);
+	memset(c, 0, sizeof(c));
+	memset(&red, 0, sizeof(red));
+	/* Sort runs: one pass, plus the concatenation (not ranked maps) */
+	res |= sm_itrpp_uu32(m32, 0, 0xffffffff, NULL, &p) == 1
+			       && red.order == 1234 && runs == 14
+		       ? 0
+		       : 4 << 12;
+	/* Wrong type, no setup, non-integer map sort (sequential) */
+	sm_insert_si(&ms, ss_crefa("a"), 1);
+	res |= !sm_itrpp_ii(m32, 0, 10, NULL, &p)
+			       && !sm_itrpp_ii(m[0], INT64_MIN, INT64_MAX, NULL,
+					       NULL)
+			       && !sm_sort_to_vectors_par(m[0], &kv, &vv, NULL)
+			       && sm_sort_to_vectors_par(ms, &kv, &vv, &p) == 1
+		       ? 0
+		       : 8 << 12;
+#ifdef S_USE_VA_ARGS
+	sm_free(&m[0], &m[1], &m[2], &m32, &ms);
+	sv_free(&kv, &vv, &kv2, &vv2);
+#else
+	sm_free(&m[0]);
+	sm_free(&m[1]);
+	sm_free(&m[2]);
+	sm_free(&m32);
+	sm_free(&ms);
+	sv_free(&kv);
+	sv_free(&vv);
+	sv_free(&kv2);
+	sv_free(&vv2);
+#endif
+	return res;
+}
+
+static srt_bool sm_same_ii(const srt_map *a, const srt_map *b)
+{
+	size_t i;
+	int64_t k;
+	RETURN_IF(!a || !b || sm_size(a) != sm_size(b), S_FALSE);
+	for (i = 0; i < sm_size(a); i++) {
+		k = sm_it_i_k(a, (srt_tndx)i);
+		if (!sm_count_i(b, k)
+		    || sm_at_ii(b, k) != sm_it_ii_v(a, (srt_tndx)i))
+			return S_FALSE;
+	}
+	return S_TRUE;
+}
+
+static srt_bool sm_same_ss(const srt_map *a, const srt_map *b)
+{
+	size_t i;
+	const srt_string *k;
+	RETURN_IF(!a || !b || sm_size(a) != sm_size(b), S_FALSE);
+	for (i = 0; i < sm_size(a); i++) {
+		k = sm_it_s_k(a, (srt_tndx)i);
+		if (!sm_count_s(b, k)
+		    || ss_cmp(sm_at_ss(b, k), sm_it_ss_v(a, (srt_tndx)i)))
+			return S_FALSE;
+	}
+	return S_TRUE;
+}
+
+static int64_t tsnap_buf[100];
+
+static int test_sm_snapshot()
+{
+	int res = 0;
+	uint32_t r = 3;
+	int64_t k, *e;
+	size_t i, j, round;
+	srt_string *ks = ss_alloca(40), *vs = ss_alloca(40);
+	srt_map *m, *snap, *old, *ref = NULL, *mss = sm_alloc(SM_SS, 0),
+			       *s1, *s2, *msi = sm_alloc(SM_SI, 0),
+			       *msp = sm_alloc(SM_SP, 0),
+			       *mis = sm_alloc(SM_IS, 0), *si1, *si2, *sp1,
+			       *sp2, *is1, *is2;
+	srt_set *set = sms_alloc(SMS_S, 0), *set1;
+	for (j = 0; j < 3; j++) {
+		m = j == 0 ? sm_alloc(SM_II, 0)
+			   : j == 1 ? sm_alloc_btree(SM_II, 0)
+				    : sm_alloc_ranked(SM_II, 0);
+		for (i = 0; i < 2000; i++)
+			sm_insert_ii(&m, (int64_t)i * 3, (int64_t)i);
+		snap = NULL;
+		for (round = 0; round < 6; round++) {
+			sm_cpy(&ref, m);
+			old = snap;
+			/*
+			 * Previous snapshot (only modified keys copied), no
+			 * previous snapshot, or a map that is not the last
+			 * snapshot (full copy)
+			 */
+			if (round == 4)
+				snap = sm_snapshot(&m, NULL);
+			else if (round == 5)
+				snap = sm_snapshot(&m, sm_alloc(SM_II32, 0));
+			else
+				snap = sm_snapshot(&m, old);
+			if (round >= 4)
+				sm_free(&old);
+			res |= snap && snap != m && sm_same_ii(snap, ref)
+					       && sm_same_ii(m, ref)
+				       ? 0
+				       : 1 << (j * 4);
+			for (i = 0; i < 500; i++) {
+				r = r * 1103515245 + 12345;
+				k = (int64_t)((r >> 8) % 8000);
+				switch ((r >> 4) % 4) {
+				case 0:
+					sm_insert_ii(&m, k, (int64_t)i);
+					break;
+				case 1:
+					sm_inc_ii(&m, k, 1);
+					break;
+				case 2:
+					if ((e = sm_emplace_ii(&m, k, NULL)))
+						*e += 2;
+					break;
+				default:
+					sm_delete_i(m, k);
+				}
+			}
+			if (round == 2) {
+				sm_clear(m);
+				sm_insert_ii(&m, 1, 1);
+			}
+			/* The snapshot is not affected */
+			res |= sm_same_ii(snap, ref) ? 0 : 2 << (j * 4);
+			res |= (j == 1 ? sbt_assert(m->bt)
+				       : st_assert((srt_tree *)m))
+				       ? 0
+				       : 4 << (j * 4);
+		}
+		sm_cpy(&ref, m);
+		snap = sm_snapshot(&m, snap);
+		res |= sm_same_ii(snap, ref) && sm_same_ii(m, ref)
+				       && sm_is_btree(m) == (j == 1)
+				       && sm_is_ranked(m) == (j == 2)
+			       ? 0
+			       : 8 << (j * 4);
+		sm_free(&m);
+		sm_free(&snap);
+	}
+	/* String keys and values */
+	for (i = 0; i < 300; i++) {
+		ss_printf(&ks, 40, "key%u", (unsigned)i);
+		ss_printf(&vs, 40, "a long enough string value %u",
+			  (unsigned)i);
+		sm_insert_ss(&mss, ks, vs);
+	}
+	s1 = sm_snapshot(&mss, NULL);
+	for (i = 0; i < 300; i += 3) {
+		ss_printf(&ks, 40, "key%u", (unsigned)i);
+		ss_printf(&vs, 40, "updated value %u", (unsigned)(i * 7));
+		sm_insert_ss(&mss, ks, vs);
+		ss_printf(&ks, 40, "key%u", (unsigned)i + 1);
+		sm_delete_s(mss, ks);
+		ss_printf(&ks, 40, "new key%u", (unsigned)i);
+		sm_insert_ss(&mss, ks, vs);
+	}
+	sm_free(&ref);
+	ref = sm_dup(mss);
+	s2 = sm_snapshot(&mss, s1);
+	res |= s2 && sm_size(s2) == 300 && sm_same_ss(s2, ref)
+			       && sm_same_ss(mss, ref)
+		       ? 0
+		       : 1 << 12;
+	/* Value updates: the replay overwrites the previous values */
+	for (i = 0; i < 50; i++) {
+		ss_printf(&ks, 40, "key%u", (unsigned)i);
+		ss_printf(&vs, 40, "a long enough string value %u",
+			  (unsigned)i);
+		sm_insert_si(&msi, ks, (int64_t)i);
+		sm_insert_sp(&msp, ks, tsnap_buf + i);
+		sm_insert_is(&mis, (int64_t)i, vs);
+	}
+	si1 = sm_snapshot(&msi, NULL);
+	sp1 = sm_snapshot(&msp, NULL);
+	is1 = sm_snapshot(&mis, NULL);
+	for (i = 0; i < 50; i += 2) {
+		ss_printf(&ks, 40, "key%u", (unsigned)i);
+		ss_printf(&vs, 40, "another long enough string value %u",
+			  (unsigned)i);
+		sm_inc_si(&msi, ks, 1000);
+		sm_delete_s(msp, ks);
+		sm_insert_sp(&msp, ks, tsnap_buf + 50 + i);
+		sm_insert_is(&mis, (int64_t)i, vs);
+	}
+	si2 = sm_snapshot(&msi, si1);
+	sp2 = sm_snapshot(&msp, sp1);
+	is2 = sm_snapshot(&mis, is1);
+	res |= si2 && sp2 && is2 && msi == si1 && msp == sp1 && mis == is1
+		       ? 0
+		       : 8 << 12;
+	for (i = 0; i < 50 && si2 && sp2 && is2; i++) {
+		ss_printf(&ks, 40, "key%u", (unsigned)i);
+		ss_printf(&vs, 40, "%s long enough string value %u",
+			  i % 2 ? "a" : "another", (unsigned)i);
+		k = (int64_t)i + (i % 2 ? 0 : 1000);
+		e = (int64_t *)(tsnap_buf + (i % 2 ? i : 50 + i));
+		if (sm_at_si(msi, ks) != k || sm_at_si(si2, ks) != k)
+			res |= 16 << 12;
+		if (sm_at_sp(msp, ks) != e || sm_at_sp(sp2, ks) != e)
+			res |= 32 << 12;
+		if (ss_cmp(sm_at_is(mis, (int64_t)i), vs)
+		    || ss_cmp(sm_at_is(is2, (int64_t)i), vs))
+			res |= 64 << 12;
+	}
+	/* String set */
+	for (i = 0; i < 100; i++) {
+		ss_printf(&ks, 40, "%u", (unsigned)i);
+		sms_insert_s(&set, ks);
+	}
+	set1 = sms_snapshot(&set, NULL);
+	sms_delete_s(set, ss_crefa("5"));
+	sms_insert_s(&set, ss_crefa("x"));
+	sms_insert_s(&set, ss_crefa("7"));
+	set1 = sms_snapshot(&set, set1);
+	res |= set1 && sms_size(set) == 100 && sms_count_s(set, ss_crefa("x"))
+			       && !sms_count_s(set, ss_crefa("5"))
+			       && sms_size(set1) == 100
+			       && sms_count_s(set1, ss_crefa("x"))
+		       ? 0
+		       : 2 << 12;
+	/* Errors */
+	res |= !sm_snapshot(NULL, NULL) && !sm_snapshot(&mss, mss)
+		       ? 0
+		       : 4 << 12;
+#ifdef S_USE_VA_ARGS
+	sm_free(&ref, &mss, &s2, &msi, &msp, &mis, &si2, &sp2, &is2);
+	sms_free(&set, &set1);
+#else
+	sm_free(&ref);
+	sm_free(&mss);
+	sm_free(&s2);
+	sm_free(&msi);
+	sm_free(&msp);
+	sm_free(&mis);
+	sm_free(&si2);
+	sm_free(&sp2);
+	sm_free(&is2);
+	sms_free(&set);
+	sms_free(&set1);
+#endif
+	return res;
+}
+
+static srt_bool sms_sorted_i(const srt_set *s)
+{
+	size_t i;
+	for (i = 1; i < sms_size(s); i++)
+		if (sms_it_i(s, (srt_tndx)i - 1) >= sms_it_i(s, (srt_tndx)i))
+			return S_FALSE;
+	return S_TRUE;
+}
+
+static int test_sm_setops()
+{
+	int res = 0;
+	uint32_t r = 5;
+	int64_t k;
+	size_t i, j, op, sz;
+	srt_bool in_a, in_b, ok, is_bt, is_rk;
+	srt_string *ks = ss_alloca(40), *vs = ss_alloca(40);
+	srt_set *a = NULL, *b = NULL, *x = NULL;
+	srt_map *ma = NULL, *mb = sm_alloc(SM_II, 0), *ms1 = NULL,
+		*ms2 = sm_alloc(SM_SS, 0), *ref = NULL,
+		*mstk = sm_alloca(SM_II, 10);
+	/* Large/large (streaming), large/small and small/large (lookup) */
+	static const size_t sizes[3][2] = {
+		{1500, 1500}, {2000, 10}, {10, 2000}};
+	/* Common key policy: value for key 60 (overwrite, keep, sum) */
+	static const int64_t v60[3] = {1060, 60, 1120};
+	for (j = 0; j < 9; j++) {
+		is_bt = j % 3 == 1;
+		is_rk = j % 3 == 2;
+		for (op = 0; op < 3; op++) {
+			sms_free(&a);
+			sms_free(&b);
+			sms_free(&x);
+			a = is_bt ? sms_alloc_btree(SMS_I, 0)
+				  : is_rk ? sms_alloc_ranked(SMS_I, 0)
+					  : sms_alloc(SMS_I, 0);
+			b = sms_alloc(SMS_I, 0);
+			for (i = 0; i < sizes[j / 3][0]; i++) {
+				r = r * 1103515245 + 12345;
+				sms_insert_i(&a, (int64_t)((r >> 8) % 3000));
+			}
+			for (i = 0; i < sizes[j / 3][1]; i++) {
+				r = r * 1103515245 + 12345;
+				sms_insert_i(&b, (int64_t)((r >> 8) % 3000));
+			}
+			x = sms_dup(a);
+			ok = op == 0 ? sms_union(&a, b)
+				     : op == 1 ? sms_intersect(&a, b)
+					       : sms_diff(&a, b);
+			for (k = 0, sz = 0; k < 3000; k++) {
+				in_a = sms_count_i(x, k);
+				in_b = sms_count_i(b, k);
+				if (op == 0 ? in_a || in_b
+					    : op == 1 ? in_a && in_b
+						      : in_a && !in_b) {
+					sz++;
+					if (!sms_count_i(a, k))
+						ok = S_FALSE;
+				}
+			}
+			res |= ok && sms_size(a) == sz
+					       && sm_is_btree(a) == is_bt
+					       && sm_is_ranked(a) == is_rk
+					       && (is_bt ? sbt_assert(a->bt)
+							 : st_assert(a))
+				       ? 0
+				       : 1 << op;
+			/* Element order is key order (but after deletes) */
+			res |= op == 2 || sms_sorted_i(a) ? 0 : 8;
+		}
+	}
+	res |= sms_union(&a, a) && sms_intersect(&a, a) && sms_size(a) == sz
+			       && sms_diff(&a, a) && !sms_size(a)
+		       ? 0
+		       : 16;
+	/* Common key policy */
+	for (i = 50; i < 150; i++)
+		sm_insert_ii(&mb, (int64_t)i, (int64_t)i + 1000);
+	for (op = 0; op < 3; op++) {
+		sm_free(&ma);
+		ma = sm_alloc(SM_II, 0);
+		for (i = 0; i < 100; i++)
+			sm_insert_ii(&ma, (int64_t)i, (int64_t)i);
+		ok = sm_merge(&ma, mb,
+			      op == 0 ? SM_MERGE_OVERWRITE
+				      : op == 1 ? SM_MERGE_KEEP : SM_MERGE_SUM);
+		res |= ok && sm_size(ma) == 150 && sm_at_ii(ma, 10) == 10
+				       && sm_at_ii(ma, 120) == 1120
+				       && sm_at_ii(ma, 60) == v60[op]
+			       ? 0
+			       : 32 << op;
+	}
+	/* Errors: different map types, value addition not supported */
+	ms1 = sm_alloc(SM_IS, 0);
+	res |= !sm_merge(&ma, ms1, SM_MERGE_KEEP)
+			       && !sm_merge(&ms1, ms1, SM_MERGE_SUM)
+			       && !sm_intersect(&ms1, mb) && !sm_diff(NULL, mb)
+			       && sm_size(ma) == 150
+		       ? 0
+		       : 256;
+	/* External buffer target: only if the result fits */
+	for (i = 0; i < 5; i++)
+		sm_insert_ii(&mstk, (int64_t)i * 40, 1);
+	res |= !sm_merge(&mstk, mb, SM_MERGE_KEEP) && sm_size(mstk) == 5
+			       && sm_intersect(&mstk, mb) && sm_size(mstk) == 2
+			       && sm_at_ii(mstk, 80) == 1
+			       && sm_merge(&mstk, ma, SM_MERGE_SUM) == S_FALSE
+			       && sm_diff(&mstk, ma) && !sm_size(mstk)
+		       ? 0
+		       : 512;
+	/* String keys and values (moved, copied, and released) */
+	sm_free(&ms1);
+	ms1 = sm_alloc_ranked(SM_SS, 0);
+	for (i = 0; i < 300; i++) {
+		ss_printf(&ks, 40, "key%03u", (unsigned)i);
+		ss_printf(&vs, 40, "a long enough string value %u",
+			  (unsigned)i);
+		if (i < 200)
+			sm_insert_ss(&ms1, ks, vs);
+		if (i >= 100) {
+			ss_cat_char(&vs, '!');
+			sm_insert_ss(&ms2, ks, vs);
+		}
+	}
+	ref = sm_dup(ms1);
+	for (i = 0; i < sm_size(ms2); i++)
+		sm_insert_ss(&ref, sm_it_s_k(ms2, (srt_tndx)i),
+			     sm_it_ss_v(ms2, (srt_tndx)i));
+	sms_free(&x);
+	x = sm_dup(ms1);
+	res |= sm_merge(&ms1, ms2, SM_MERGE_OVERWRITE) && sm_same_ss(ms1, ref)
+			       && sm_is_ranked(ms1) && st_assert(ms1)
+		       ? 0
+		       : 1024;
+	ss_cpy_c(&ks, "key150");
+	res |= sm_diff(&x, ms2) && sm_size(x) == 100 && sm_merge(&x, ms2,
+								 SM_MERGE_KEEP)
+			       && sm_intersect(&x, ms1) && sm_size(x) == 300
+			       && sm_diff(&ms1, x) && !sm_size(ms1)
+			       && !ss_cmp(sm_at_ss(x, ks), sm_at_ss(ref, ks))
+		       ? 0
+		       : 2048;
+#ifdef S_USE_VA_ARGS
+	sms_free(&a, &b, &x);
+	sm_free(&ma, &mb, &ms1, &ms2, &ref);
+#else
+	sms_free(&a);
+	sms_free(&b);
+	sms_free(&x);
+	sm_free(&ma);
+	sm_free(&mb);
+	sm_free(&ms1);
+	sm_free(&ms2);
+	sm_free(&ref);
+#endif
+	return res;
+}
+
+struct TSrmCtx {
+	srt_string *last;
+	size_t n, unsorted;
+	int64_t sum;
+};
+
+static srt_bool cback_srm_si(const srt_string *k, int64_t v, void *context)
+{
+	struct TSrmCtx *c = (struct TSrmCtx *)context;
+	if (c->n && ss_cmp(k, c->last) <= 0)
+		c->unsorted++;
+	ss_cpy(&c->last, k);
+	c->sum += v;
+	c->n++;
+	return S_TRUE;
+}
+
+static srt_bool srm_has_prefix(const srt_string *s, const srt_string *p)
+{
+	return ss_size(s) >= ss_size(p)
+	       && !memcmp(ss_get_buffer_r(s), ss_get_buffer_r(p), ss_size(p));
+}
+
+static int test_srm()
+{
+	int res = 0;
+	char c;
+	uint32_t r = 11;
+	int64_t v, v2;
+	size_t i, j, l, cnt;
+	const srt_string *lk, *lk2, *sv;
+	const void *pv;
+	srt_string *k = ss_alloca(64), *p = ss_alloca(64);
+	struct TSrmCtx ctx = {NULL, 0, 0, 0};
+	srt_rmap *m = srm_alloc(SRM_SI, 0), *m2 = NULL,
+		 *ms = srm_alloc(SRM_SS, 0), *mp = srm_alloc(SRM_SP, 0);
+	srt_map *ref = sm_alloc(SM_SI, 0);
+	if (!m || !ms || !mp || !ref) {
+		res = 1;
+		goto done;
+	}
+	/*
+	 * Random insert/delete against a Red-Black tree map: small alphabet
+	 * keys (many keys being prefixes of other keys), half of them below
+	 * a path longer than the node prefix buffer
+	 */
+	for (i = 0; i < 40000; i++) {
+		r = r * 1103515245 + 12345;
+		ss_cpy_c(&k, (r >> 30) & 1 ? "a long shared path/" : "");
+		l = (r >> 4) % 11;
+		for (j = 0; j < l; j++) {
+			r = r * 1103515245 + 12345;
+			c = (char)('a' + (r >> 12) % 3);
+			ss_cat_cn(&k, &c, 1);
+		}
+		if ((r >> 20) % 3) {
+			srm_insert_si(&m, k, (int64_t)i);
+			sm_delete_s(ref, k); /* sm_insert_si() keeps values */
+			sm_insert_si(&ref, k, (int64_t)i);
+		} else if (srm_delete(m, k) != sm_delete_s(ref, k)) {
+			res |= 2;
+		}
+	}
+	res |= srm_size(m) == sm_size(ref) && srm_type(m) == SRM_SI ? 0 : 4;
+	for (i = 0; i < sm_size(ref); i++)
+		if (!srm_count(m, sm_it_s_k(ref, (srt_tndx)i))
+		    || srm_at_si(m, sm_it_s_k(ref, (srt_tndx)i))
+			       != sm_it_si_v(ref, (srt_tndx)i))
+			res |= 8;
+	/* Prefix enumeration: key order, same elements as the reference */
+	for (i = 0; i < 8; i++) {
+		ss_cpy_c(&p, i < 4 ? "a long shared path/" : "");
+		ss_cat_cn(&p, "abcabcab", i % 4 * 2);
+		ctx.n = ctx.unsorted = 0;
+		ctx.sum = 0;
+		for (cnt = 0, v = 0, j = 0; j < sm_size(ref); j++)
+			if (srm_has_prefix(sm_it_s_k(ref, (srt_tndx)j), p)) {
+				cnt++;
+				v += sm_it_si_v(ref, (srt_tndx)j);
+			}
+		if (srm_itp_si(m, p, cback_srm_si, &ctx) != cnt || ctx.n != cnt
+		    || ctx.sum != v || ctx.unsorted
+		    || srm_itp_si(m, p, NULL, NULL) != cnt)
+			res |= 16;
+	}
+	res |= srm_itp_si(m, NULL, NULL, NULL) == sm_size(ref)
+			       && !srm_itp_si(m, ss_crefa("zz"), NULL, NULL)
+		       ? 0
+		       : 32;
+	/* Longest prefix match */
+	for (i = 0; i < 200; i++) {
+		r = r * 1103515245 + 12345;
+		ss_cpy_c(&k, (r >> 30) & 1 ? "a long shared path/" : "");
+		for (j = 0; j < 12; j++) {
+			c = (char)('a' + (r >> j) % 3);
+			ss_cat_cn(&k, &c, 1);
+		}
+		for (lk = NULL, v = 0, j = 0; j < sm_size(ref); j++)
+			if (srm_has_prefix(k, sm_it_s_k(ref, (srt_tndx)j))
+			    && (!lk || ss_size(sm_it_s_k(ref, (srt_tndx)j))
+					       > ss_size(lk))) {
+				lk = sm_it_s_k(ref, (srt_tndx)j);
+				v = sm_it_si_v(ref, (srt_tndx)j);
+			}
+		v2 = -1;
+		lk2 = srm_lpm_si(m, k, &v2);
+		if ((lk != NULL) != (lk2 != NULL)
+		    || (lk && (ss_cmp(lk, lk2) || v != v2)))
+			res |= 64;
+	}
+	/* Copy, clear */
+	m2 = srm_dup(m);
+	cnt = srm_itp_si(m2, NULL, NULL, NULL);
+	res |= srm_size(m2) == srm_size(m) && cnt == srm_size(m)
+			       && srm_at_si(m2, sm_it_s_k(ref, 0))
+					  == sm_it_si_v(ref, 0)
+		       ? 0
+		       : 128;
+	srm_clear(m);
+	res |= !srm_size(m) && !srm_count(m, sm_it_s_k(ref, 0))
+			       && srm_size(m2) == sm_size(ref)
+		       ? 0
+		       : 256;
+	/* Node growth up to 256 children (all byte values), then shrink */
+	for (i = 0; i < 256; i++) {
+		c = (char)i;
+		ss_cpy_c(&k, "x");
+		ss_cat_cn(&k, &c, 1);
+		srm_insert_si(&m, k, (int64_t)i);
+	}
+	srm_insert_si(&m, ss_crefa(""), -1);
+	srm_insert_si(&m, ss_crefa("x"), -2);
+	ctx.n = ctx.unsorted = 0;
+	cnt = srm_itp_si(m, ss_crefa("x"), cback_srm_si, &ctx);
+	res |= srm_size(m) == 258 && cnt == 257 && !ctx.unsorted
+			       && srm_at_si(m, ss_crefa("")) == -1
+			       && srm_at_si(m, ss_crefa("x")) == -2
+		       ? 0
+		       : 512;
+	for (i = 0; i < 256; i++) {
+		if (!(i % 3))
+			continue;
+		c = (char)i;
+		ss_cpy_c(&k, "x");
+		ss_cat_cn(&k, &c, 1);
+		if (!srm_delete(m, k))
+			res |= 1024;
+	}
+	c = (char)255;
+	ss_cpy_c(&k, "x");
+	ss_cat_cn(&k, &c, 1);
+	res |= srm_size(m) == 88 && srm_at_si(m, k) == 255
+			       && srm_delete(m, ss_crefa(""))
+			       && srm_delete(m, ss_crefa("x"))
+			       && !srm_delete(m, ss_crefa("x"))
+			       && srm_itp_si(m, NULL, NULL, NULL) == 86
+			       && srm_lpm_si(m, ss_crefa("x"), NULL) == NULL
+		       ? 0
+		       : 2048;
+	/* String values (out of the leaf) */
+	for (i = 0; i < 300; i++) {
+		ss_printf(&k, 64, "string key, not stored inline, #%u",
+			  (unsigned)i);
+		ss_printf(&p, 64, "string value, not stored inline, #%u",
+			  (unsigned)(i * 2));
+		srm_insert_ss(&ms, k, p);
+	}
+	srm_insert_ss(&ms, k, ss_crefa("updated"));
+	sv = NULL;
+	cnt = srm_itp_ss(ms, ss_crefa("string key, not stored inline, #1"),
+			 cback_ss, NULL);
+	ss_cpy_c(&p, "string key, not stored inline, #12345");
+	res |= srm_size(ms) == 300
+			       && !ss_cmp(srm_at_ss(ms, k), ss_crefa("updated"))
+			       && cnt == 111 && srm_lpm_ss(ms, p, &sv)
+			       && !ss_cmp(sv, ss_crefa("string value, not "
+						      "stored inline, #246"))
+			       && srm_delete(ms, k) && !srm_count(ms, k)
+			       && ss_size(srm_at_ss(ms, k)) == 0
+		       ? 0
+		       : 4096;
+	/* Pointer values, wrong map type */
+	srm_insert_sp(&mp, ss_crefa("abc"), &res);
+	pv = NULL;
+	res |= srm_at_sp(mp, ss_crefa("abc")) == &res
+			       && srm_at_sp(mp, ss_crefa("ab")) == NULL
+			       && srm_lpm_sp(mp, ss_crefa("abcd"), &pv)
+			       && pv == &res
+			       && !srm_insert_si(&mp, ss_crefa("x"), 1)
+			       && !srm_insert_ss(&m, ss_crefa("x"),
+						 ss_crefa("y"))
+			       && srm_size(mp) == 1
+		       ? 0
+		       : 8192;
+done:
+#ifdef S_USE_VA_ARGS
+	srm_free(&m, &m2, &ms, &mp);
+#else
+	srm_free(&m);
+	srm_free(&m2);
+	srm_free(&ms);
+	srm_free(&mp);
+#endif
+	sm_free(&ref);
+	ss_free(&ctx.last);
+	return res;
+}
+
+static int test_sm_freeze()
+{
+	int res = 0;
+	uint32_t r = 3;
+	int64_t k;
+	size_t i, n;
+	void *buf = NULL;
+	const srt_fmap *fr;
+	srt_fmap *f = NULL, *f32 = NULL, *fu = NULL, *fs = NULL, *fs2 = NULL;
+	srt_map *m = NULL, *m32 = NULL, *mu = NULL, *ms = sm_alloc(SM_SI, 0);
+	srt_set *s = NULL;
+	/* Every tree shape, up to a few levels (Eytzinger in-order fill) */
+	for (n = 0; n < 70 && !res; n++) {
+		sm_free(&m);
+		sfm_free(&f);
+		m = sm_alloc(SM_II, 0);
+		for (i = 0; i < n; i++)
+			sm_insert_ii(&m, (int64_t)i * 2, (int64_t)i + 100);
+		f = sm_freeze(m);
+		if (!f || sfm_size(f) != n) {
+			res |= 1;
+			continue;
+		}
+		for (k = -1; k <= (int64_t)n * 2; k++)
+			if (sfm_count_i(f, k) != sm_count_i(m, k)
+			    || sfm_at_ii(f, k) != sm_at_ii(m, k))
+				res |= 2;
+	}
+	/* Random keys, including the key type limits */
+	m32 = sm_alloc(SM_II32, 0);
+	mu = sm_alloc(SM_UU32, 0);
+	s = sms_alloc(SMS_I, 0);
+	sm_insert_ii(&m, INT64_MIN, 1);
+	sm_insert_ii(&m, INT64_MAX, 2);
+	sm_insert_ii32(&m32, INT32_MIN, 3);
+	sm_insert_ii32(&m32, INT32_MAX, 4);
+	sm_insert_uu32(&mu, 0, 5);
+	sm_insert_uu32(&mu, 0xffffffff, 6);
+	for (i = 0; i < 5000; i++) {
+		r = r * 1103515245 + 12345;
+		sm_insert_ii(&m, (int64_t)r * 12345, (int64_t)i);
+		sm_insert_ii32(&m32, (int32_t)(r >> 16) - 20000, (int32_t)i);
+		sm_insert_uu32(&mu, r, (uint32_t)i);
+		sms_insert_i(&s, (int64_t)(r % 20000));
+	}
+	sfm_free(&f);
+	f = sm_freeze(m);
+	f32 = sm_freeze(m32);
+	fu = sm_freeze(mu);
+	fs = sms_freeze(s);
+	if (!f || !f32 || !fu || !fs) {
+		res |= 4;
+		goto done;
+	}
+	res |= sfm_size(f) == sm_size(m) && sfm_size(f32) == sm_size(m32)
+			       && sfm_size(fu) == sm_size(mu)
+			       && sfm_size(fs) == sms_size(s)
+			       && sfm_at_ii(f, INT64_MIN) == 1
+			       && sfm_at_ii(f, INT64_MAX) == 2
+			       && sfm_at_ii32(f32, INT32_MIN) == 3
+			       && sfm_at_ii32(f32, INT32_MAX) == 4
+			       && sfm_at_uu32(fu, 0) == 5
+			       && sfm_at_uu32(fu, 0xffffffff) == 6
+		       ? 0
+		       : 8;
+	for (i = 0; i < sm_size(m); i++)
+		if (sfm_at_ii(f, sm_it_i_k(m, (srt_tndx)i))
+		    != sm_it_ii_v(m, (srt_tndx)i))
+			res |= 16;
+	for (i = 0; i < sm_size(m32); i++)
+		if (sfm_at_ii32(f32, sm_it_i32_k(m32, (srt_tndx)i))
+		    != sm_it_ii32_v(m32, (srt_tndx)i))
+			res |= 32;
+	for (i = 0; i < sm_size(mu); i++)
+		if (sfm_at_uu32(fu, sm_it_u32_k(mu, (srt_tndx)i))
+			    != sm_it_uu32_v(mu, (srt_tndx)i)
+		    || !sfm_count_u(fu, sm_it_u32_k(mu, (srt_tndx)i)))
+			res |= 64;
+	for (k = -30000; k < 30000; k++)
+		if (sfm_count_i(f32, k) != sm_count_i(m32, k)
+		    || sfm_count_i(fs, k) != sms_count_i(s, k))
+			res |= 128;
+	/* Wrong type, not supported types */
+	res |= !sfm_at_ii(f32, 0) && !sfm_at_ii32(f, 0) && !sfm_count_u(f, 0)
+			       && !sfm_count_i(fu, 0)
+			       && !sfm_count_i(f32, (int64_t)INT32_MAX + 1)
+			       && !sm_freeze(ms) && !sm_freeze(NULL)
+			       && !sfm_size(NULL) && !sfm_at_ii(NULL, 0)
+		       ? 0
+		       : 256;
+	/* Serialization: the memory block used in place, e.g. from a file */
+	n = sfm_get_buffer_size(f32);
+	buf = s_malloc(n);
+	if (!buf) {
+		res |= 512;
+		goto done;
+	}
+	memcpy(buf, sfm_get_buffer_r(f32), n);
+	fr = sfm_ref(buf, n);
+	res |= fr && sfm_size(fr) == sm_size(m32)
+			       && sfm_at_ii32(fr, INT32_MIN) == 3
+			       && sfm_count_i(fr, sm_it_i32_k(m32, 7))
+			       && !sfm_ref(buf, n - 1) && !sfm_ref(NULL, n)
+			       && !sfm_ref((char *)buf + 1, n - 1)
+		       ? 0
+		       : 1024;
+	((uint8_t *)buf)[0] ^= 1;
+	res |= !sfm_ref(buf, n) ? 0 : 2048;
+	/* Empty map */
+	sm_clear(m);
+	fs2 = sm_freeze(m);
+	res |= fs2 && !sfm_size(fs2) && !sfm_count_i(fs2, 0)
+			       && !sfm_at_ii(fs2, 0)
+			       && sfm_ref(sfm_get_buffer_r(fs2),
+					  sfm_get_buffer_size(fs2))
+					  == fs2
+		       ? 0
+		       : 4096;
+done:
+#ifdef S_USE_VA_ARGS
+	sfm_free(&f, &f32, &fu, &fs, &fs2);
+	sm_free(&m, &m32, &mu, &ms);
+#else
+	sfm_free(&f);
+	sfm_free(&f32);
+	sfm_free(&fu);
+	sfm_free(&fs);
+	sfm_free(&fs2);
+	sm_free(&m);
+	sm_free(&m32);
+	sm_free(&mu);
+	sm_free(&ms);
+#endif
+	sms_free(&s);
+	s_free(buf);
+	return res;
+}
+
+static int test_sm_key_prefix()
+{
+	int res = 0;
+	uint32_t r = 9;
+	size_t i, j, nk;
+	srt_map_cursor c;
+	const srt_string *prev, *kk;
+	srt_string *k = ss_alloca(120), *v = ss_alloca(160);
+	srt_map *msi = sm_alloc(SM_SI, 0), *mss = sm_alloc(SM_SS, 0);
+	srt_hmap *hss = shm_alloc(SHM_SS, 0);
+	/*
+	 * Keys tying on the cached prefix (shared first 8 bytes, zero
+	 * padding vs actual zero bytes), and keys differing in it (including
+	 * bytes >= 0x80, compared as unsigned)
+	 */
+	static const char *pfx[] = {"",
+				    "a",
+				    "ab",
+				    "ab\0",
+				    "ab\0\0\0\0\0\0\0\0",
+				    "abcdefg",
+				    "abcdefgh",
+				    "abcdefgh, then a long key suffix",
+				    "abcdefgh, then a long key suffiy",
+				    "abcdefgi",
+				    "\x7f",
+				    "\x80",
+				    "\xff\xff\xff\xff\xff\xff\xff\xff"};
+	static const size_t pfx_size[] = {0, 1, 2, 3, 10, 7, 8,
+					  32, 32, 8, 1, 1, 8};
+	nk = sizeof(pfx_size) / sizeof(pfx_size[0]);
+	if (!msi || !mss || !hss) {
+		res = 1;
+		goto done;
+	}
+	for (i = 0; i < 3 * nk * 4; i++) {
+		r = r * 1103515245 + 12345;
+		j = (r >> 8) % nk;
+		ss_cpy_cn(&k, pfx[j], pfx_size[j]);
+		/* In-place and out-of-line keys, for the same prefix */
+		if ((r >> 4) % 4)
+			ss_cat_c(&k, (r >> 4) % 4 == 1 ? "+"
+				      : (r >> 4) % 4 == 2
+					      ? "+a key not stored in-place"
+					      : "+a key not stored in-place, "
+						"neither as SM_SS key");
+		/* Short and long values (SM_SS key stored alone or not) */
+		ss_cpy(&v, k);
+		if (ss_size(k) % 2)
+			ss_cat_c(&v, ", a value not stored in-place");
+		sm_insert_si(&msi, k, (int64_t)ss_size(k));
+		sm_insert_ss(&mss, k, v);
+		shm_insert_ss(&hss, k, v);
+	}
+	res |= sm_size(msi) == sm_size(mss) && sm_size(msi) == shm_size(hss)
+			       && sm_size(msi) > nk * 2
+			       && st_assert((const srt_tree *)msi)
+			       && st_assert((const srt_tree *)mss)
+		       ? 0
+		       : 2;
+	/* Key order */
+	prev = NULL;
+	if (sm_cur_seek_ge_s(msi, ss_void, &c)) {
+		do {
+			kk = sm_it_s_k(msi, sm_cur_id(msi, &c));
+			if (prev && ss_cmp(prev, kk) >= 0)
+				res |= 4;
+			prev = kk;
+		} while (sm_cur_next(msi, &c));
+	}
+	prev = NULL;
+	if (sm_cur_seek_ge_s(mss, ss_void, &c)) {
+		do {
+			kk = sm_it_s_k(mss, sm_cur_id(mss, &c));
+			if (prev && ss_cmp(prev, kk) >= 0)
+				res |= 8;
+			prev = kk;
+		} while (sm_cur_next(mss, &c));
+	}
+	/* Lookups: every key, and keys only tying on the prefix */
+	for (i = 0; i < sm_size(msi); i++) {
+		kk = sm_it_s_k(msi, (srt_tndx)i);
+		if (sm_at_si(msi, kk) != (int64_t)ss_size(kk)
+		    || ss_cmp(sm_at_ss(mss, kk), shm_at_ss(hss, kk))
+		    || !sm_count_s(mss, kk) || !shm_count_s(hss, kk))
+			res |= 16;
+		ss_cpy(&k, kk);
+		ss_cat_c(&k, "?");
+		if (sm_count_s(msi, k) || sm_count_s(mss, k)
+		    || shm_count_s(hss, k))
+			res |= 32;
+	}
+done:
+	sm_free(&msi);
+	sm_free(&mss);
+	shm_free(&hss);
+	return res;
+}
+
+/*
+ * Hash map string element overwrite: the previous strings are released
+ * (leaks are reported by memory checkers), including when the new key or
+ * value is the one already stored
+ */
+static int test_shm_overwrite_str()
+{
+	int res = 0;
+	size_t i, j, n = 100;
+	int64_t pv[2];
+	srt_string *k = ss_alloca(80), *v = ss_alloca(80);
+	srt_hmap *hss = shm_alloc(SHM_SS, 0), *hsi = shm_alloc(SHM_SI, 0),
+		 *hsp = shm_alloc(SHM_SP, 0), *his = shm_alloc(SHM_IS, 0);
+	srt_hset *hs = shs_alloc(SHS_S, 0);
+	if (!hss || !hsi || !hsp || !his || !hs) {
+		res = 1;
+		goto done;
+	}
+	for (j = 0; j < 2; j++)
+		for (i = 0; i < n; i++) {
+			ss_printf(&k, 80, "an out-of-line key, not in-place %u",
+				  (unsigned)i);
+			ss_printf(&v, 80, "%s value, not stored in-place %u",
+				  j ? "second" : "first", (unsigned)i);
+			shm_insert_ss(&hss, k, v);
+			shm_insert_si(&hsi, k, (int64_t)(i + j));
+			shm_insert_sp(&hsp, k, &pv[j]);
+			shm_insert_is(&his, (int64_t)i, v);
+			shs_insert_s(&hs, k);
+		}
+	/* Key and value from the element being overwritten */
+	for (i = 0; i < n; i++) {
+		shm_insert_ss(&hss, shm_it_s_k(hss, i), shm_it_ss_v(hss, i));
+		shm_insert_si(&hsi, shm_it_s_k(hsi, i), 5);
+		shm_insert_is(&his, shm_it_i_k(his, i), shm_it_is_v(his, i));
+		shs_insert_s(&hs, shs_it_s(hs, i));
+	}
+	res |= shm_size(hss) == n && shm_size(hsi) == n && shm_size(hsp) == n
+			       && shm_size(his) == n && shs_size(hs) == n
+		       ? 0
+		       : 2;
+	for (i = 0; i < n; i++) {
+		ss_printf(&k, 80, "an out-of-line key, not in-place %u",
+			  (unsigned)i);
+		ss_printf(&v, 80, "second value, not stored in-place %u",
+			  (unsigned)i);
+		if (ss_cmp(shm_at_ss(hss, k), v) || shm_at_si(hsi, k) != 5
+		    || shm_at_sp(hsp, k) != (const void *)&pv[1]
+		    || ss_cmp(shm_at_is(his, (int64_t)i), v)
+		    || !shs_count_s(hs, k))
+			res |= 4;
+	}
+done:
+#ifdef S_USE_VA_ARGS
+	shm_free(&hss, &hsi, &hsp, &his);
+#else
+	shm_free(&hss);
+	shm_free(&hsi);
+	shm_free(&hsp);
+	shm_free(&his);
+#endif
+	shs_free(&hs);
+	return res;
+}
+
+static int test_sms()
+{
+	int i, res = 0;
+	const srt_string *k[] = {ss_crefa("k000"), ss_crefa("k001"),
+				 ss_crefa("k002")};
+	size_t cnt_i32 = 0, cnt_u32 = 0, cnt_i = 0, cnt_s = 0, cnt_s2 = 0;
+	size_t processed_i32, processed_u32, processed_i, processed_s,
+		processed_s2;
+	/*
+	 * Allocation: heap, stack with 3 elements, and stack with 10 elements
+	 */
+	srt_set *s_i32 = sms_alloc(SMS_I32, 0), *s_u32 = sms_alloc(SMS_U32, 0),
+		*s_i = sms_alloc(SMS_I, 0), *s_s = sms_alloc(SMS_S, 0),
+		*s_s2 = NULL, *s_a3 = sms_alloca(SMS_I32, 3),
+		*s_a10 = sms_alloca(SMS_I32, 10);
+	res |= (sms_empty(s_i32) && sms_empty(s_u32) && sms_empty(s_i)
+				&& sms_empty(s_s) && sms_empty(s_s2)
+				&& sms_empty(s_a3) && sms_empty(s_a10)
+			? 0
+			: 1 << 0);
+	/*
+	 * Insert elements
+	 */
+	for (i = 0; i < 3; i++) {
+		sms_insert_i32(&s_i32, i + 10);
+		sms_insert_u32(&s_u32, (uint32_t)i + 20);
+		sms_insert_i(&s_i, i);
+		sms_insert_s(&s_s, k[i]);
+	}
+	res |= (!sms_empty(s_i32) && !sms_empty(s_u32) && !sms_empty(s_i)
+				&& !sms_empty(s_s) && sms_empty(s_s2)
+				&& sms_empty(s_a3) && sms_empty(s_a10)
+			? 0
+			: 1 << 1);
+	res |= (sms_count_i(s_i32, 10) && sms_count_i(s_i32, 11)
+				&& sms_count_i(s_i32, 12)
+				&& sms_count_u(s_u32, 20)
+				&& sms_count_u(s_u32, 21)
+				&& sms_count_u(s_u32, 22) && sms_count_i(s_i, 0)
+				&& sms_count_i(s_i, 1) && sms_count_i(s_i, 2)
+				&& sms_count_s(s_s, k[0])
+				&& sms_count_s(s_s, k[1])
+				&& sms_count_s(s_s, k[2])
+			? 0
+			: 1 << 2);
+	/*
+	 * Enumeration
+	 */
+	s_s2 = sms_dup(s_s);
+	processed_i32 = sms_itr_i32(s_i32, -1, 100, cback_i32, &cnt_i32);
+	processed_u32 = sms_itr_u32(s_u32, 0, 100, cback_u32, &cnt_u32);
+	processed_i = sms_itr_i(s_i, -1, 100, cback_i, &cnt_i);
+	processed_s = sms_itr_s(s_s, k[0], k[2], cback_s, &cnt_s);
+	processed_s2 = sms_itr_s(s_s2, k[0], k[2], cback_s, &cnt_s2);
+	res |= (processed_i32 == cnt_i32 && cnt_i32 == 3 ? 0 : 1 << 3);
+	res |= (processed_u32 == cnt_u32 && cnt_u32 == 3 ? 0 : 1 << 4);
+	res |= (processed_i == cnt_i && cnt_i == 3 ? 0 : 1 << 5);
+	res |= (processed_s == cnt_s && cnt_s == 3 ? 0 : 1 << 6);
+	res |= (processed_s2 == cnt_s2 && cnt_s2 == 3 ? 0 : 1 << 7);
+	/*
+	 * sms_cpy() to stack with small stack allocation size
+	 */
+	sms_cpy(&s_a3, s_i32);
+	res |= (sms_size(s_a3) == 3 ? 0 : 1 << 8);
+	sms_cpy(&s_a3, s_u32);
+	res |= (sms_size(s_a3) == 3 ? 0 : 1 << 9);
+	sms_cpy(&s_a3, s_i);
+	res |= (sms_size(s_a3) == 0 ? 0 : 1 << 10);
+	sms_cpy(&s_a3, s_s);
+	res |= (sms_size(s_a3) == 0 ? 0 : 1 << 11);
+	/*
+	 * sms_cpy() to stack with enough stack allocation size
+	 */
+	sms_cpy(&s_a10, s_i32);
+	res |= (sms_size(s_a10) == 3 ? 0 : 1 << 12);
+	sms_cpy(&s_a10, s_u32);
+	res |= (sms_size(s_a10) == 3 ? 0 : 1 << 13);
+	sms_cpy(&s_a10, s_i);
+	res |= (sms_size(s_a10) == 3 ? 0 : 1 << 14);
+	sms_cpy(&s_a10, s_s);
+	res |= (sms_size(s_a10) == 3 ? 0 : 1 << 15);
+	sms_clear(s_a10);
+	res |= (sms_size(s_a10) == 0 ? 0 : 1 << 16);
+	/*
+	 * Reserve/grow
+	 */
+	sms_reserve(&s_i32, 1000);
+	sms_grow(&s_u32, 1000 - sms_max_size(s_u32));
+	res |= (sms_capacity(s_i32) >= 1000 && sms_capacity(s_u32) >= 1000
+				&& sms_capacity_left(s_i32) >= 997
+				&& sms_capacity_left(s_u32) >= 997
+			? 0
+			: 1 << 17);
+	/*
+	 * Shrink memory
+	 */
+	sms_shrink(&s_i32);
+	sms_shrink(&s_u32);
+	res |= (sms_capacity(s_i32) == 3 && sms_capacity(s_u32) == 3
+				&& sms_capacity_left(s_i32) == 0
+				&& sms_capacity_left(s_u32) == 0
+			? 0
+			: 1 << 18);
+	/*
+	 * Random access
+	 */
+	res |= (sms_it_i32(s_i32, 0) == 10 && sms_it_i32(s_i32, 1) == 11
+				&& sms_it_i32(s_i32, 2) == 12
+			? 0
+			: 1 << 19);
+	res |= (sms_it_u32(s_u32, 0) == 20 && sms_it_u32(s_u32, 1) == 21
+				&& sms_it_u32(s_u32, 2) == 22
+			? 0
+			: 1 << 20);
+	res |= (sms_it_i(s_i, 0) == 0 && sms_it_i(s_i, 1) == 1
+				&& sms_it_i(s_i, 2) == 2
+			? 0
+			: 1 << 21);
+	res |= (!ss_cmp(sms_it_s(s_s, 0), k[0])
+				&& !ss_cmp(sms_it_s(s_s, 1), k[1])
+				&& !ss_cmp(sms_it_s(s_s, 2), k[2])
+			? 0
+			: 1 << 22);
+	/*
+	 * Delete
+	 */
+	sms_delete_i(s_i32, 10);
+	sms_delete_i(s_u32, 20);
+	sms_delete_i(s_i, 0);
+	sms_delete_s(s_s, k[1]);
+	res |= (!sms_count_i(s_i32, 10) && !sms_count_i(s_u32, 20)
+				&& !sms_count_i(s_i, 0)
+				&& !sms_count_s(s_s, k[1])
+			? 0
+			: 1 << 23);
+	/*
+	 * Release memory
+	 */
+#ifdef S_USE_VA_ARGS
+	sms_free(&s_i32, &s_u32, &s_i, &s_s, &s_s2, &s_a3, &s_a10);
+#else
+	sms_free(&s_i32);
+	sms_free(&s_u32);
+	sms_free(&s_i);
+	sms_free(&s_s);
+	sms_free(&s_s2);
+	sms_free(&s_a3);
+	sms_free(&s_a10);
+#endif
+	return res;
+}
+
+/*
+ * Lock callbacks for the sharded hash map test: no threads, just check
+ * that every access is bracketed by a lock/unlock pair of the same kind
+ */
+struct TestCHMLocks {
+	size_t nlock, nunlock, nexcl, held, bad;
+};
+
+static void test_schm_lock(void *context, size_t shard, srt_bool exclusive)
+{
+	struct TestCHMLocks *l = (struct TestCHMLocks *)context;
+	if (l->held || shard >= 8)
+		l->bad++;
+	l->held = exclusive ? 2 : 1;
+	l->nlock++;
+	if (exclusive)
+		l->nexcl++;
+}
+
+static void test_schm_unlock(void *context, size_t shard, srt_bool exclusive)
+{
+	struct TestCHMLocks *l = (struct TestCHMLocks *)context;
+	if (l->held != (exclusive ? 2u : 1u) || shard >= 8)
+		l->bad++;
+	l->held = 0;
+	l->nunlock++;
+}
+
+static srt_bool test_schm_itp_ii(int64_t k, int64_t v, void *context)
+{
+	*(int64_t *)context += k + v;
+	return S_TRUE;
+}
+
+static int test_schm()
+{
+	int res = 0;
+	int64_t i, n = 1000, sum = 0;
+	struct TestCHMLocks l = {0, 0, 0, 0, 0};
+	srt_string *k = NULL, *v = NULL;
+	srt_chmap *m_ii = schm_alloc(SHM_II, 5, 100),
+		  *m_ss = schm_alloc_hash(SHM_SS, 1, 0, SHM_HASH_RANDOM, 0),
+		  *m_i32 = schm_alloc(SHM_II32, 4, 0),
+		  *m_is = schm_alloc(SHM_IS, 2, 0);
+	if (!m_ii || !m_ss || !m_i32 || !m_is) {
+		res = 1;
+		goto done;
+	}
+	res |= schm_nshards(m_ii) == 8 && schm_nshards(m_ss) == 1 ? 0 : 2;
+	schm_set_locking(m_ii, test_schm_lock, test_schm_unlock, &l);
+	for (i = 0; i < n; i++)
+		if (!schm_insert_ii(m_ii, i, i) || !schm_inc_ii(m_ii, i, 1))
+			res |= 4;
+	res |= schm_size(m_ii) == (size_t)n ? 0 : 8;
+	for (i = 0; i < n; i++)
+		if (schm_at_ii(m_ii, i) != i + 1 || !schm_count_i(m_ii, i))
+			res |= 16;
+	res |= schm_count_i(m_ii, n) == 0 && schm_delete_i(m_ii, 0)
+			       && !schm_delete_i(m_ii, 0)
+		       ? 0
+		       : 32;
+	res |= schm_itp_ii(m_ii, 0, S_NPOS, test_schm_itp_ii, &sum)
+				       == (size_t)(n - 1)
+			       && sum == n * n - 1
+		       ? 0
+		       : 64;
+	res |= schm_itp_ii(m_ii, 10, 20, NULL, NULL) == 10
+			       && !schm_itp_ii(m_ii, (size_t)n, S_NPOS, NULL,
+					       NULL)
+		       ? 0
+		       : 128;
+	res |= !l.bad && !l.held && l.nlock == l.nunlock
+			       && l.nexcl == (size_t)(2 * n + 2)
+		       ? 0
+		       : 256;
+	ss_cpy_c(&k, "a");
+	ss_cpy_c(&v, "b");
+	schm_insert_ss(m_ss, k, v);
+	res |= !ss_cmp(schm_at_ss(m_ss, k, &v), k) ? 512 : 0;
+	res |= !ss_cmp(v, ss_crefa("b")) ? 0 : 1024;
+	schm_delete_s(m_ss, k);
+	res |= ss_size(schm_at_ss(m_ss, k, &v)) == 0 ? 0 : 2048;
+	schm_clear(m_ii);
+	res |= schm_size(m_ii) == 0 && schm_size(NULL) == 0 ? 0 : 4096;
+	/* 32-bit keys, and string values */
+	for (i = 0; i < 100; i++)
+		schm_insert_ii32(m_i32, (int32_t)i, (int32_t)-i);
+	res |= schm_at_ii32(m_i32, 42) == -42 && schm_count_i(m_i32, 99)
+			       && !schm_count_i(m_i32, 100)
+		       ? 0
+		       : 8192;
+	ss_cpy_c(&v, "b");
+	schm_insert_is(m_is, 7, v);
+	res |= !ss_cmp(schm_at_is(m_is, 7, &k), ss_crefa("b"))
+			       && ss_size(schm_at_is(m_is, 8, &k)) == 0
+		       ? 0
+		       : 16384;
+done:
+#ifdef S_USE_VA_ARGS
+	ss_free(&k, &v);
+	schm_free(&m_ii, &m_ss, &m_i32, &m_is);
+#else
+	ss_free(&k);
+	ss_free(&v);
+	schm_free(&m_ii);
+	schm_free(&m_ss);
+	schm_free(&m_i32);
+	schm_free(&m_is);
+#endif
+	return res;
+}
+
 static int test_shs()
 {
 	int res = 0;
@@ -4883,247 +6803,994 @@ static int test_shm_dup()
 	return res;
 }
 
-static int test_shm_cpy()
+static int test_shm_cpy()
+{
+	int res = 0;
+	srt_hmap *m1 = shm_alloc(SHM_II32, 0), *m2 = shm_alloc(SHM_SS, 0),
+		 *m1a3 = shm_alloca(SHM_II32, 3),
+		 *m1a10 = shm_alloca(SHM_II32, 10);
+	const srt_string *k1 = ss_crefa("key1"), *k2 = ss_crefa("key2"),
+			 *k3 = ss_crefa("key3"), *v1 = ss_crefa("val1"),
+			 *v2 = ss_crefa("val2"), *v3 = ss_crefa("val3");
+	shm_insert_ii32(&m1, 1, 1);
+	shm_insert_ii32(&m1, 2, 2);
+	shm_insert_ii32(&m1, 3, 3);
+	shm_insert_ss(&m2, k1, v1);
+	shm_insert_ss(&m2, k2, v2);
+	shm_insert_ss(&m2, k3, v3);
+	shm_cpy(&m1, m2);
+	shm_cpy(&m1a3, m2);
+	shm_cpy(&m1a10, m2);
+	res |= (shm_size(m1) == 3 ? 0 : 1);
+#ifdef S_ENABLE_SM_STRING_OPTIMIZATION
+	/*
+	 * TODO: adjust test to the node size of the string optimized map mode
+	 */
+#else
+	if (sizeof(uint32_t) == sizeof(void *))
+		res |= (shm_size(m1a3) == 3 ? 0 : 2);
+	else
+		res |= (shm_size(m1a3) < 3 ? 0 : 4);
+	res |= (shm_size(m1a10) == 3 ? 0 : 8);
+	res |= (!ss_cmp(shm_it_s_k(m1, 0), shm_it_s_k(m2, 0)) ? 0 : 16);
+	res |= (!ss_cmp(shm_it_s_k(m1, 1), shm_it_s_k(m2, 1)) ? 0 : 32);
+	res |= (!ss_cmp(shm_it_s_k(m1, 2), shm_it_s_k(m2, 2)) ? 0 : 64);
+	res |= (!ss_cmp(shm_it_s_k(m1, 0), shm_it_s_k(m1a10, 0)) ? 0 : 128);
+	res |= (!ss_cmp(shm_it_s_k(m1, 1), shm_it_s_k(m1a10, 1)) ? 0 : 256);
+	res |= (!ss_cmp(shm_it_s_k(m1, 2), shm_it_s_k(m1a10, 2)) ? 0 : 512);
+#endif
+#ifdef S_USE_VA_ARGS
+	shm_free(&m1, &m2, &m1a3, &m1a10);
+#else
+	shm_free(&m1);
+	shm_free(&m2);
+	shm_free(&m1a3);
+	shm_free(&m1a10);
+#endif
+	return res;
+}
+
+#define TEST_SHM_X_COUNT(T, insf, cntf, v)                                     \
+	int res = 0;                                                           \
+	uint32_t i, tcount = 100;                                              \
+	srt_hmap *m = shm_alloc(T, tcount);                                    \
+	for (i = 0; i < tcount; i++)                                           \
+		insf(&m, (unsigned)i, v);                                      \
+	for (i = 0; i < tcount; i++)                                           \
+		if (!cntf(m, i)) {                                             \
+			res = 1 + (int)i;                                      \
+			break;                                                 \
+		}                                                              \
+	shm_free(&m);                                                          \
+	return res;
+
+static int test_shm_count_u()
+{
+	TEST_SHM_X_COUNT(SHM_UU32, shm_insert_uu32, shm_count_u, 1);
+}
+
+static int test_shm_count_i()
+{
+	TEST_SHM_X_COUNT(SHM_II32, shm_insert_ii32, shm_count_i, 1);
+}
+
+static int test_shm_count_s()
+{
+	int res;
+	srt_string *s = ss_dup_c("a_1"), *t = ss_dup_c("a_2"),
+		   *u = ss_dup_c("a_3");
+	srt_hmap *m = shm_alloc(SHM_SI, 3);
+	shm_insert_si(&m, s, 1);
+	shm_insert_si(&m, t, 2);
+	shm_insert_si(&m, u, 3);
+	res = shm_count_s(m, s) && shm_count_s(m, t) && shm_count_s(m, u) ? 0
+									  : 1;
+#ifdef S_USE_VA_ARGS
+	ss_free(&s, &t, &u);
+#else
+	ss_free(&s);
+	ss_free(&t);
+	ss_free(&u);
+#endif
+	shm_free(&m);
+	return res;
+}
+
+static int test_shm_inc_ii32()
+{
+	int res;
+	srt_hmap *m = shm_alloc(SHM_II32, 0);
+	shm_inc_ii32(&m, 123, -10);
+	shm_inc_ii32(&m, 123, -20);
+	shm_inc_ii32(&m, 123, -30);
+	res = !m ? 1 : (shm_at_ii32(m, 123) == -60 ? 0 : 2);
+	shm_free(&m);
+	return res;
+}
+
+static int test_shm_inc_uu32()
+{
+	int res;
+	srt_hmap *m = shm_alloc(SHM_UU32, 0);
+	shm_inc_uu32(&m, 123, 10);
+	shm_inc_uu32(&m, 123, 20);
+	shm_inc_uu32(&m, 123, 30);
+	res = !m ? 1 : (shm_at_uu32(m, 123) == 60 ? 0 : 2);
+	shm_free(&m);
+	return res;
+}
+
+static int test_shm_inc_ii()
+{
+	int res;
+	srt_hmap *m = shm_alloc(SHM_II, 0);
+	shm_inc_ii(&m, 123, -7);
+	shm_inc_ii(&m, 123, S_MAX_I64);
+	shm_inc_ii(&m, 123, 3);
+	res = !m ? 1 : (shm_at_ii(m, 123) == S_MAX_I64 - 4 ? 0 : 2);
+	shm_free(&m);
+	return res;
+}
+
+static int test_shm_inc_si()
+{
+	int res;
+	srt_hmap *m = shm_alloc(SHM_SI, 0);
+	const srt_string *k = ss_crefa("hello");
+	shm_inc_si(&m, k, -7);
+	shm_inc_si(&m, k, S_MAX_I64);
+	shm_inc_si(&m, k, 3);
+	res = !m ? 1 : (shm_at_si(m, k) == S_MAX_I64 - 4 ? 0 : 2);
+	shm_free(&m);
+	return res;
+}
+
+struct TEmplaceAcc {
+	int64_t sum;
+	uint32_t cnt;
+};
+
+static int test_shm_emplace()
+{
+	int res = 0;
+	size_t i;
+	uint32_t k;
+	srt_bool is_new = S_FALSE;
+	int64_t *v64;
+	uint32_t *vu;
+	const void **vp;
+	struct TEmplaceAcc *acc;
+	srt_string *s = ss_alloca(100);
+	srt_hmap *hm = shm_alloc(SHM_UU32, 0), *hs = shm_alloc(SHM_SI, 0),
+		 *hp = shm_alloc(SHM_IP, 0),
+		 *hg = shm_alloc_gen(sizeof(k), sizeof(struct TEmplaceAcc),
+				     NULL, NULL, 0),
+		 *hc = shm_alloc_cache(SHM_II, 4, SHM_EVICT_LRU);
+	RETURN_IF(!hm || !hs || !hp || !hg || !hc, 1);
+	/* Aggregation through the returned slot, across rehashes */
+	for (i = 0; i < 3000; i++) {
+		vu = shm_emplace_uu32(&hm, (uint32_t)(i % 1000), &is_new);
+		if (!vu || is_new != (i < 1000) || *vu != i / 1000)
+			res |= 2;
+		else
+			(*vu)++;
+	}
+	res |= shm_size(hm) == 1000 && shm_at_uu32(hm, 999) == 3 ? 0 : 4;
+	for (i = 0; i < 100; i++) {
+		ss_printf(&s, 100, "a somewhat long string key %u",
+			  (unsigned)(i % 7));
+		v64 = shm_emplace_si(&hs, s, NULL);
+		if (!v64)
+			res |= 8;
+		else
+			*v64 -= 1;
+	}
+	ss_printf(&s, 100, "a somewhat long string key %u", 6);
+	res |= shm_size(hs) == 7 && shm_at_si(hs, s) == -14 ? 0 : 16;
+	vp = shm_emplace_ip(&hp, -5, &is_new);
+	res |= vp && is_new && !*vp ? 0 : 32;
+	if (vp)
+		*vp = s;
+	vp = shm_emplace_ip(&hp, -5, &is_new);
+	res |= vp && !is_new && *vp == s && shm_at_ip(hp, -5) == s ? 0 : 64;
+	/* Generic mode: struct value updated in place */
+	for (i = 0; i < 50; i++) {
+		k = (uint32_t)(i % 5);
+		acc = (struct TEmplaceAcc *)shm_emplace_gen(&hg, &k, &is_new);
+		if (!acc || is_new != (i < 5))
+			res |= 128;
+		else {
+			acc->sum += (int64_t)i;
+			acc->cnt++;
+		}
+	}
+	k = 4;
+	acc = (struct TEmplaceAcc *)shm_at_gen(hg, &k);
+	res |= acc && acc->cnt == 10 && acc->sum == 4 * 10 + 5 * 45 ? 0 : 256;
+	/* Cache mode: found elements are refreshed, new ones may evict */
+	for (i = 0; i < 4; i++)
+		shm_insert_ii(&hc, (int64_t)i, (int64_t)i);
+	v64 = shm_emplace_ii(&hc, 0, &is_new);
+	res |= v64 && !is_new && !*v64 ? 0 : 512;
+	v64 = shm_emplace_ii(&hc, 10, &is_new);
+	res |= v64 && is_new && !*v64 && shm_size(hc) == 4
+			       && shm_count_i(hc, 0) && !shm_count_i(hc, 1)
+		       ? 0
+		       : 1024;
+	res |= !shm_emplace_ii32(&hm, 1, NULL)
+			       && !shm_emplace_gen(&hm, &k, NULL)
+			       && !shm_emplace_si(NULL, s, NULL)
+		       ? 0
+		       : 2048;
+#ifdef S_USE_VA_ARGS
+	shm_free(&hm, &hs, &hp, &hg, &hc);
+#else
+	shm_free(&hm);
+	shm_free(&hs);
+	shm_free(&hp);
+	shm_free(&hg);
+	shm_free(&hc);
+#endif
+	return res;
+}
+
+static int test_shm_delete_i()
+{
+	int res;
+	srt_hmap *m_ii32 = shm_alloc(SHM_II32, 0),
+		 *m_uu32 = shm_alloc(SHM_UU32, 0), *m_ii = shm_alloc(SHM_II, 0);
+	/*
+	 * Insert elements
+	 */
+	shm_insert_ii32(&m_ii32, -1, -1);
+	shm_insert_ii32(&m_ii32, -2, -2);
+	shm_insert_ii32(&m_ii32, -3, -3);
+	shm_insert_uu32(&m_uu32, 1, 1);
+	shm_insert_uu32(&m_uu32, 2, 2);
+	shm_insert_uu32(&m_uu32, 3, 3);
+	shm_insert_ii(&m_ii, S_MAX_I64, S_MAX_I64);
+	shm_insert_ii(&m_ii, S_MAX_I64 - 1, S_MAX_I64 - 1);
+	shm_insert_ii(&m_ii, S_MAX_I64 - 2, S_MAX_I64 - 2);
+	/*
+	 * Check elements were properly inserted
+	 */
+	res = m_ii32 && m_uu32 && m_ii ? 0 : 1;
+	res |= (shm_at_ii32(m_ii32, -2) == -2 ? 0 : 2);
+	res |= (shm_at_uu32(m_uu32, 2) == 2 ? 0 : 4);
+	res |= (shm_at_ii(m_ii, S_MAX_I64 - 1) == S_MAX_I64 - 1 ? 0 : 8);
+	/*
+	 * Delete elements, checking that second deletion of same
+	 * element gives error
+	 */
+	res |= shm_delete_i(m_ii32, -2) ? 0 : 16;
+	res |= !shm_delete_i(m_ii32, -2) ? 0 : 32;
+	res |= shm_delete_i(m_uu32, 2) ? 0 : 64;
+	res |= !shm_delete_i(m_uu32, 2) ? 0 : 128;
+	res |= shm_delete_i(m_ii, S_MAX_I64 - 1) ? 0 : 256;
+	res |= !shm_delete_i(m_ii, S_MAX_I64 - 1) ? 0 : 512;
+	/*
+	 * Check that querying for deleted elements gives default value
+	 */
+	res |= (shm_at_ii32(m_ii32, -2) == 0 ? 0 : 1024);
+	res |= (shm_at_uu32(m_uu32, 2) == 0 ? 0 : 2048);
+	res |= (shm_at_ii(m_ii, S_MAX_I64 - 1) == 0 ? 0 : 4096);
+#ifdef S_USE_VA_ARGS
+	shm_free(&m_ii32, &m_uu32, &m_ii);
+#else
+	shm_free(&m_ii32);
+	shm_free(&m_uu32);
+	shm_free(&m_ii);
+#endif
+	return res;
+}
+
+static int test_shm_delete_s()
 {
-	int res = 0;
-	srt_hmap *m1 = shm_alloc(SHM_II32, 0), *m2 = shm_alloc(SHM_SS, 0),
-		 *m1a3 = shm_alloca(SHM_II32, 3),
-		 *m1a10 = shm_alloca(SHM_II32, 10);
+	int res;
+	srt_hmap *m_si = shm_alloc(SHM_SI, 0), *m_sp = shm_alloc(SHM_SP, 0),
+		 *m_ss = shm_alloc(SHM_SS, 0);
+	/*
+	 * Insert elements
+	 */
 	const srt_string *k1 = ss_crefa("key1"), *k2 = ss_crefa("key2"),
 			 *k3 = ss_crefa("key3"), *v1 = ss_crefa("val1"),
 			 *v2 = ss_crefa("val2"), *v3 = ss_crefa("val3");
-	shm_insert_ii32(&m1, 1, 1);
-	shm_insert_ii32(&m1, 2, 2);
-	shm_insert_ii32(&m1, 3, 3);
-	shm_insert_ss(&m2, k1, v1);
-	shm_insert_ss(&m2, k2, v2);
-	shm_insert_ss(&m2, k3, v3);
-	shm_cpy(&m1, m2);
-	shm_cpy(&m1a3, m2);
-	shm_cpy(&m1a10, m2);
-	res |= (shm_size(m1) == 3 ? 0 : 1);
-#ifdef S_ENABLE_SM_STRING_OPTIMIZATION
+	shm_insert_si(&m_si, k1, -1);
+	shm_insert_si(&m_si, k2, S_MAX_I64);
+	shm_insert_si(&m_si, k3, -3);
+	shm_insert_sp(&m_sp, k1, (void *)-1);
+	shm_insert_sp(&m_sp, k2, (void *)-2);
+	shm_insert_sp(&m_sp, k3, (void *)-3);
+	shm_insert_ss(&m_ss, k1, v1);
+	shm_insert_ss(&m_ss, k2, v2);
+	shm_insert_ss(&m_ss, k3, v3);
 	/*
-	 * TODO: adjust test to the node size of the string optimized map mode
+	 * Check elements were properly inserted
+	 */
+	res = m_si && m_sp && m_ss ? 0 : 1;
+	res |= (shm_at_si(m_si, k2) == S_MAX_I64 ? 0 : 2);
+	res |= (shm_at_sp(m_sp, k2) == (void *)-2 ? 0 : 4);
+	res |= (!ss_cmp(shm_at_ss(m_ss, k2), v2) ? 0 : 8);
+	/*
+	 * Delete elements, checking that second deletion of same
+	 * element gives error
+	 */
+	res |= shm_delete_s(m_si, k2) ? 0 : 16;
+	res |= !shm_delete_s(m_si, k2) ? 0 : 32;
+	res |= shm_delete_s(m_sp, k2) ? 0 : 64;
+	res |= !shm_delete_s(m_sp, k2) ? 0 : 128;
+	res |= shm_delete_s(m_ss, k2) ? 0 : 256;
+	res |= !shm_delete_s(m_ss, k2) ? 0 : 512;
+	/*
+	 * Check that querying for deleted elements gives default value
 	 */
+	res |= (shm_at_si(m_si, k2) == 0 ? 0 : 1024);
+	res |= (shm_at_sp(m_sp, k2) == 0 ? 0 : 2048);
+	res |= (!ss_cmp(shm_at_ss(m_ss, k2), ss_void) ? 0 : 4096);
+#ifdef S_USE_VA_ARGS
+	shm_free(&m_si, &m_sp, &m_ss);
 #else
-	if (sizeof(uint32_t) == sizeof(void *))
-		res |= (shm_size(m1a3) == 3 ? 0 : 2);
-	else
-		res |= (shm_size(m1a3) < 3 ? 0 : 4);
-	res |= (shm_size(m1a10) == 3 ? 0 : 8);
-	res |= (!ss_cmp(shm_it_s_k(m1, 0), shm_it_s_k(m2, 0)) ? 0 : 16);
-	res |= (!ss_cmp(shm_it_s_k(m1, 1), shm_it_s_k(m2, 1)) ? 0 : 32);
-	res |= (!ss_cmp(shm_it_s_k(m1, 2), shm_it_s_k(m2, 2)) ? 0 : 64);
-	res |= (!ss_cmp(shm_it_s_k(m1, 0), shm_it_s_k(m1a10, 0)) ? 0 : 128);
-	res |= (!ss_cmp(shm_it_s_k(m1, 1), shm_it_s_k(m1a10, 1)) ? 0 : 256);
-	res |= (!ss_cmp(shm_it_s_k(m1, 2), shm_it_s_k(m1a10, 2)) ? 0 : 512);
+	shm_free(&m_si);
+	shm_free(&m_sp);
+	shm_free(&m_ss);
 #endif
+	return res;
+}
+
+static int test_shm_churn()
+{
+	int res = 0;
+	int64_t i, j, n = 100, rounds = 20;
+	srt_hmap *m = shm_alloc(SHM_II, 0), *ma = shm_alloca(SHM_II, 128);
+	/*
+	 * Insert/delete at steady size (deleted buckets must not exhaust
+	 * the table, nor hide elements from lookups)
+	 */
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < n; i++) {
+			shm_insert_ii(&m, (j * n + i) << 10, i);
+			shm_insert_ii(&ma, (j * n + i) << 10, i);
+		}
+		for (i = 0; i < n; i++) {
+			if (shm_at_ii(m, (j * n + i) << 10) != i
+			    || shm_at_ii(ma, (j * n + i) << 10) != i)
+				res |= 1;
+			if (i % 2)
+				continue;
+			if (!shm_delete_i(m, (j * n + i) << 10)
+			    || !shm_delete_i(ma, (j * n + i) << 10))
+				res |= 2;
+		}
+		for (i = 1; i < n; i += 2)
+			if (!shm_delete_i(m, (j * n + i) << 10)
+			    || !shm_delete_i(ma, (j * n + i) << 10))
+				res |= 4;
+		if (shm_size(m) || shm_size(ma))
+			res |= 8;
+	}
+	res |= shm_max_size(ma) == 128 ? 0 : 16;
+	/*
+	 * Clear must also reset the hash table
+	 */
+	shm_insert_ii(&m, 1, 1);
+	shm_clear(m);
+	shm_insert_ii(&m, 1, 2);
+	res |= shm_size(m) == 1 && shm_at_ii(m, 1) == 2 ? 0 : 32;
+	shm_clear(m);
+	res |= !shm_size(m) && !shm_count_i(m, 1) ? 0 : 64;
 #ifdef S_USE_VA_ARGS
-	shm_free(&m1, &m2, &m1a3, &m1a10);
+	shm_free(&m, &ma);
 #else
-	shm_free(&m1);
-	shm_free(&m2);
-	shm_free(&m1a3);
-	shm_free(&m1a10);
+	shm_free(&m);
+	shm_free(&ma);
 #endif
 	return res;
 }
 
-#define TEST_SHM_X_COUNT(T, insf, cntf, v)                                     \
-	int res = 0;                                                           \
-	uint32_t i, tcount = 100;                                              \
-	srt_hmap *m = shm_alloc(T, tcount);                                    \
-	for (i = 0; i < tcount; i++)                                           \
-		insf(&m, (unsigned)i, v);                                      \
-	for (i = 0; i < tcount; i++)                                           \
-		if (!cntf(m, i)) {                                             \
-			res = 1 + (int)i;                                      \
-			break;                                                 \
-		}                                                              \
-	shm_free(&m);                                                          \
+static int test_shm_delete_shift()
+{
+	int res = 0;
+	uint32_t r = 1;
+	int64_t i, j, k, n = 1000, rounds = 50;
+	char in[1000];
+	srt_string *ks = ss_alloca(100);
+	srt_hmap *m = shm_alloc(SHM_II, 0), *ms = shm_alloc(SHM_SI, 0);
+	/*
+	 * Random deletes and re-inserts on a dense table: elements shifted
+	 * back (including around the table end) must stay reachable
+	 */
+	memset(in, 0, sizeof(in));
+	for (j = 0; j < rounds && !res; j++) {
+		for (i = 0; i < n / 2; i++) {
+			r = r * 1103515245 + 12345;
+			k = (int64_t)((r >> 8) % (uint32_t)n);
+			ss_printf(&ks, 50, "%i", (int)k);
+			if (in[k]) {
+				if (!shm_delete_i(m, k)
+				    || !shm_delete_s(ms, ks))
+					res |= 1;
+			} else {
+				shm_insert_ii(&m, k, k);
+				shm_insert_si(&ms, ks, k);
+			}
+			in[k] = !in[k];
+		}
+		for (k = 0; k < n; k++) {
+			ss_printf(&ks, 50, "%i", (int)k);
+			if (in[k] ? shm_at_ii(m, k) != k
+					    || shm_at_si(ms, ks) != k
+				  : shm_count_i(m, k) || shm_count_s(ms, ks))
+				res |= 2;
+		}
+	}
+#ifdef S_USE_VA_ARGS
+	shm_free(&m, &ms);
+#else
+	shm_free(&m);
+	shm_free(&ms);
+#endif
 	return res;
+}
 
-static int test_shm_count_u()
+static int test_shm_rehash_step()
 {
-	TEST_SHM_X_COUNT(SHM_UU32, shm_insert_uu32, shm_count_u, 1);
+	int res = 0;
+	int64_t i, n = 5000;
+	srt_string *k = ss_alloca(100);
+	srt_hmap *m = shm_alloc(SHM_II, 0), *ms = shm_alloc(SHM_SI, 0), *m2,
+		 *m3 = NULL;
+	shm_set_rehash_step(m, 2);
+	shm_set_rehash_step(ms, 2);
+	for (i = 0; i < n; i++) {
+		shm_insert_ii(&m, i, -i);
+		ss_printf(&k, 100, "key%i_0123456789_0123456789", (int)i);
+		shm_insert_si(&ms, k, i);
+		/* Delete some elements while migrating */
+		if (i % 7 == 0 && i > 0) {
+			shm_delete_i(m, i - 1);
+			ss_printf(&k, 100, "key%i_0123456789_0123456789",
+				  (int)i - 1);
+			shm_delete_s(ms, k);
+		}
+		if (i == n / 2 + 100) {
+			/* Copy while migrating */
+			m2 = shm_dup(ms);
+			shm_cpy(&m3, m);
+			res |= shm_size(m2) == shm_size(ms) ? 0 : 1;
+			res |= shm_size(m3) == shm_size(m) ? 0 : 2;
+			res |= shm_at_si(m2, k) == i ? 0 : 4;
+			res |= shm_at_ii(m3, i) == -i ? 0 : 8;
+			shm_free(&m2);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		ss_printf(&k, 100, "key%i_0123456789_0123456789", (int)i);
+		if (i % 7 == 6 && i < n - 1) {
+			if (shm_count_i(m, i) || shm_count_s(ms, k))
+				res |= 16;
+		} else if (shm_at_ii(m, i) != -i || shm_at_si(ms, k) != i) {
+			res |= 32;
+		}
+	}
+	res |= shm_at_ii(m3, n / 2) == -n / 2 ? 0 : 64;
+	shm_set_rehash_step(m, 0);
+	shm_clear(ms);
+	res |= !shm_size(ms) && shm_at_ii(m, n - 1) == -(n - 1) ? 0 : 128;
+#ifdef S_USE_VA_ARGS
+	shm_free(&m, &ms, &m3);
+#else
+	shm_free(&m);
+	shm_free(&ms);
+	shm_free(&m3);
+#endif
+	return res;
 }
 
-static int test_shm_count_i()
+static int test_shm_rehash_bounded()
 {
-	TEST_SHM_X_COUNT(SHM_II32, shm_insert_ii32, shm_count_i, 1);
+	int res = 0;
+	int64_t i, n = 100000;
+	srt_bool grew;
+	size_t nb, next, moved, max_moved = 0, growths = 0;
+	const void *old;
+	const uint8_t *data;
+	srt_hmap *m = shm_alloc(SHM_II, 0);
+	shm_set_rehash_step(m, 2);
+	if (shm_reserve(&m, (size_t)n) < (size_t)n) {
+		shm_free(&m);
+		return 1;
+	}
+	data = shm_get_buffer_r(m);
+	for (i = 0; i < n; i++) {
+		nb = (size_t)m->hmask + 1;
+		old = m->rh_old;
+		next = m->rh_next;
+		shm_insert_ii(&m, i, -i);
+		/*
+		 * Growth only allocates the new table (nothing migrated yet),
+		 * and the previous table buckets moved by a single insert are
+		 * bounded (growing never completes a pending migration)
+		 */
+		grew = (size_t)m->hmask + 1 != nb;
+		if (grew) {
+			growths++;
+			if (!m->rh_old || m->rh_next)
+				res |= 2;
+		}
+		moved = !old ? 0
+			     : grew || !m->rh_old ? nb / 2 - next
+						  : m->rh_next - next;
+		if (moved > max_moved)
+			max_moved = moved;
+	}
+	res |= growths >= 10 ? 0 : 4;
+	res |= max_moved <= 4 ? 0 : 8;
+	/* Elements not moved when growing the table */
+	res |= shm_get_buffer_r(m) == data ? 0 : 16;
+	for (i = 0; i < n; i++)
+		if (shm_at_ii(m, i) != -i) {
+			res |= 32;
+			break;
+		}
+	shm_free(&m);
+	return res;
 }
 
-static int test_shm_count_s()
+static int test_shm_rehash_hashes()
 {
-	int res;
-	srt_string *s = ss_dup_c("a_1"), *t = ss_dup_c("a_2"),
-		   *u = ss_dup_c("a_3");
-	srt_hmap *m = shm_alloc(SHM_SI, 3);
-	shm_insert_si(&m, s, 1);
-	shm_insert_si(&m, t, 2);
-	shm_insert_si(&m, u, 3);
-	res = shm_count_s(m, s) && shm_count_s(m, t) && shm_count_s(m, u) ? 0
-									  : 1;
+	int res = 0;
+	int64_t i, j, n = 3000;
+	srt_string *k = ss_alloca(100);
+	srt_hmap *m = shm_alloc(SHM_SI, 0), *ms = shm_alloc(SHM_SI, 0),
+		 *m2 = NULL, *m3 = shm_alloc(SHM_SI, 0);
+	shm_set_rehash_step(ms, 2);
+	/*
+	 * String keys not fitting in the node: growth, deleted bucket cleanup,
+	 * and copies, with the table rebuilt from the bucket hashes
+	 */
+	for (i = 0; i < n; i++) {
+		ss_printf(&k, 100, "key%i_0123456789_0123456789", (int)i);
+		shm_insert_si(&m, k, i);
+		shm_insert_si(&ms, k, i);
+		if (i % 3 == 0) {
+			shm_delete_s(m, k);
+			shm_delete_s(ms, k);
+		}
+		if (i == n / 2 + 100) {
+			/* Copy while migrating, and copy to a smaller map */
+			shm_cpy(&m2, ms);
+			shm_cpy(&m3, m);
+			for (j = 0; j <= i; j++) {
+				ss_printf(&k, 100,
+					  "key%i_0123456789_0123456789",
+					  (int)j);
+				if (shm_count_s(m2, k) != (j % 3 ? 1 : 0)
+				    || shm_count_s(m3, k) != (j % 3 ? 1 : 0)
+				    || (j % 3 && shm_at_si(m2, k) != j))
+					res |= 1;
+			}
+		}
+	}
+	shm_free(&m2);
+	m2 = shm_dup(m);
+	for (i = 0; i < n; i++) {
+		ss_printf(&k, 100, "key%i_0123456789_0123456789", (int)i);
+		if (shm_at_si(m, k) != (i % 3 ? i : 0)
+		    || shm_at_si(ms, k) != (i % 3 ? i : 0)
+		    || shm_at_si(m2, k) != (i % 3 ? i : 0))
+			res |= 2;
+	}
+	res |= shm_size(m) == shm_size(m2) && shm_size(m) == (size_t)(n * 2 / 3)
+		       ? 0
+		       : 4;
+	/* Churn at low load factor (deleted bucket cleanup without growing) */
+	for (i = 1; i < n; i += 3) {
+		ss_printf(&k, 100, "key%i_0123456789_0123456789", (int)i);
+		shm_delete_s(m, k);
+	}
+	for (i = 0; i < 4 * n; i++) {
+		ss_printf(&k, 100, "key%i_0123456789_0123456789", (int)(n + i));
+		shm_insert_si(&m, k, i);
+		shm_delete_s(m, k);
+	}
+	for (i = 0; i < n; i++) {
+		ss_printf(&k, 100, "key%i_0123456789_0123456789", (int)i);
+		if (shm_at_si(m, k) != (i % 3 == 2 ? i : 0))
+			res |= 8;
+	}
 #ifdef S_USE_VA_ARGS
-	ss_free(&s, &t, &u);
+	shm_free(&m, &ms, &m2, &m3);
 #else
-	ss_free(&s);
-	ss_free(&t);
-	ss_free(&u);
-#endif
 	shm_free(&m);
+	shm_free(&ms);
+	shm_free(&m2);
+	shm_free(&m3);
+#endif
 	return res;
 }
 
-static int test_shm_inc_ii32()
+static int test_shm_hash()
 {
-	int res;
-	srt_hmap *m = shm_alloc(SHM_II32, 0);
-	shm_inc_ii32(&m, 123, -10);
-	shm_inc_ii32(&m, 123, -20);
-	shm_inc_ii32(&m, 123, -30);
-	res = !m ? 1 : (shm_at_ii32(m, 123) == -60 ? 0 : 2);
-	shm_free(&m);
+	int res = 0;
+	size_t i, j, n = 1000;
+	uint32_t h0, h1;
+	shm_hash_t_ h;
+	uint8_t seen[3][1024];
+	const size_t hs = SHM_HASH_BITS - 10;
+	srt_string *k[1000];
+	srt_hmap *m_ii, *m_si, *m_ii2 = NULL;
+	enum eSHM_Hash ht[3] = {SHM_HASH_DEFAULT, SHM_HASH_SEEDED,
+				SHM_HASH_RANDOM};
+	for (i = 0; i < n; i++)
+		k[i] = ss_dup_printf(128, "%u_%0100u", (unsigned)i, 0);
+	for (j = 0; j < 3; j++) {
+		m_ii = shm_alloc_hash(SHM_II, 0, ht[j], 12345);
+		m_si = shm_alloc(SHM_SI, 0);
+		/* keys differing only in the upper 32 bits */
+		for (i = 0; i < n; i++) {
+			shm_insert_ii(&m_ii, (int64_t)i << 32, (int64_t)i);
+			shm_insert_si(&m_si, k[i], (int64_t)i);
+		}
+		/* hash change on non-empty map (rehash) */
+		shm_set_hash(m_si, ht[j], 12345);
+		shm_cpy(&m_ii2, m_ii);
+		res |= shm_size(m_ii) == n && shm_size(m_si) == n ? 0 : 1 << j;
+		for (i = 0; i < n; i++) {
+			if (shm_at_ii(m_ii, (int64_t)i << 32) != (int64_t)i
+			    || shm_at_ii(m_ii2, (int64_t)i << 32) != (int64_t)i
+			    || shm_at_si(m_si, k[i]) != (int64_t)i)
+				res |= 8 << j;
+		}
+		res |= shm_delete_s(m_si, k[0]) && !shm_count_s(m_si, k[0])
+			       ? 0
+			       : 64 << j;
+#ifdef S_USE_VA_ARGS
+		shm_free(&m_ii, &m_si);
+#else
+		shm_free(&m_ii);
+		shm_free(&m_si);
+#endif
+	}
+	/* the seed must change the hash, and all key bits must be used */
+	h0 = (uint32_t)sh_wyh64(1, ss_get_buffer_r(k[1]), ss_size(k[1]));
+	h1 = (uint32_t)sh_wyh64(2, ss_get_buffer_r(k[1]), ss_size(k[1]));
+	res |= h0 != h1 ? 0 : 512;
+	res |= sh_hash64s((uint64_t)1 << 40, 0) != sh_hash64s(0, 0) ? 0 : 1024;
+	/* bucket ids (hash upper bits, 32 or 64-bit hash) must be spread */
+	for (j = 0; j < 2; j++) {
+		m_ii = shm_alloc_hash(SHM_II, 0, ht[j], 12345);
+		memset(seen, 0, sizeof(seen));
+		for (i = 0; i < n; i++) {
+			seen[0][shm_hash_u32(m_ii, (uint32_t)i) >> hs] = 1;
+			h = shm_hash_u64(m_ii, (uint64_t)i << 32);
+			seen[1][h >> hs] = 1;
+			seen[2][shm_hash_s(m_ii, k[i]) >> hs] = 1;
+		}
+		for (i = 0, h0 = 0; i < 1024; i++)
+			h0 += seen[0][i] + seen[1][i] + seen[2][i];
+		res |= h0 > 3 * 500 ? 0 : 2048 << j;
+		shm_free(&m_ii);
+	}
+	for (i = 0; i < n; i++)
+		ss_free(&k[i]);
+	shm_free(&m_ii2);
 	return res;
 }
 
-static int test_shm_inc_uu32()
+static int test_shm_save()
 {
-	int res;
-	srt_hmap *m = shm_alloc(SHM_UU32, 0);
-	shm_inc_uu32(&m, 123, 10);
-	shm_inc_uu32(&m, 123, 20);
-	shm_inc_uu32(&m, 123, 30);
-	res = !m ? 1 : (shm_at_uu32(m, 123) == 60 ? 0 : 2);
-	shm_free(&m);
+	int res = 0;
+	size_t i, n = 300;
+	FILE *f;
+	srt_string *k[300], *v[300];
+	srt_hmap *m_ii = shm_alloc(SHM_II, 0), *m_ss = shm_alloc(SHM_SS, 0),
+		 *m_is = shm_alloc(SHM_IS, 0), *m_si = shm_alloc(SHM_SI, 0),
+		 *l_ii, *l_ss, *l_is, *l_si, h;
+	srt_hset *s_s = shs_alloc(SHS_S, 0), *ls_s;
+	/* short and long strings (in-place and out-of-line storage) */
+	for (i = 0; i < n; i++) {
+		k[i] = ss_dup_printf(128, "k%u", (unsigned)i);
+		v[i] = ss_dup_printf(128, "%u_%040u", (unsigned)i, 0);
+		if (i % 2)
+			ss_cat_c(&k[i], "_long_key_not_fitting_in_place");
+	}
+	/* saving while migrating (incremental rehash) */
+	shm_set_rehash_step(m_ii, 2);
+	for (i = 0; i < n; i++) {
+		shm_insert_ii(&m_ii, (int64_t)i, (int64_t)i * 3);
+		shm_insert_ss(&m_ss, k[i], i % 3 ? v[i] : k[i]);
+		shm_insert_is(&m_is, (int64_t)i, v[i]);
+		shm_insert_si(&m_si, k[i], (int64_t)i);
+		shs_insert_s(&s_s, k[i]);
+	}
+	res |= shm_save(m_ii, STEST_FILE) ? 0 : 1;
+	l_ii = shm_map_file(STEST_FILE, S_TRUE);
+	res |= shm_save(m_ss, STEST_FILE) ? 0 : 2;
+	l_ss = shm_map_file(STEST_FILE, S_TRUE);
+	res |= shm_save(m_is, STEST_FILE) ? 0 : 4;
+	l_is = shm_map_file(STEST_FILE, S_FALSE);
+	res |= shm_save(m_si, STEST_FILE) ? 0 : 8;
+	l_si = shm_map_file(STEST_FILE, S_TRUE);
+	res |= shs_save(s_s, STEST_FILE) ? 0 : 16;
+	ls_s = shs_map_file(STEST_FILE, S_TRUE);
+	res |= l_ii && l_ss && l_is && l_si && ls_s ? 0 : 32;
+	if (!res) {
+		res |= shm_size(l_ii) == n && shm_size(l_ss) == n
+				       && shm_size(l_is) == n
+				       && shm_size(l_si) == n
+				       && shs_size(ls_s) == n
+			       ? 0
+			       : 64;
+		for (i = 0; i < n; i++)
+			if (shm_at_ii(l_ii, (int64_t)i) != (int64_t)i * 3
+			    || ss_cmp(shm_at_ss(l_ss, k[i]),
+				      i % 3 ? v[i] : k[i])
+			    || ss_cmp(shm_at_is(l_is, (int64_t)i), v[i])
+			    || shm_at_si(l_si, k[i]) != (int64_t)i
+			    || !shs_count_s(ls_s, k[i])) {
+				res |= 128;
+				break;
+			}
+		res |= !shm_count_i(l_ii, (int64_t)n)
+				       && !shm_count_s(l_si, v[0])
+			       ? 0
+			       : 256;
+		/* loaded maps are read-only */
+		res |= !shm_insert_ii(&l_ii, (int64_t)n, 0)
+				       && !shm_insert_ii(&l_ii, 1, 0)
+				       && !shm_inc_ii(&l_ii, 1, 1)
+				       && !shm_delete_i(l_ii, 1)
+				       && !shm_insert_ss(&l_ss, k[1], v[0])
+				       && !shm_insert_is(&l_is, 1, v[0])
+				       && !shm_delete_s(l_si, k[1])
+				       && !shs_insert_s(&ls_s, v[0])
+			       ? 0
+			       : 512;
+		shm_clear(l_ii);
+		shm_set_hash(l_ss, SHM_HASH_RANDOM, 0);
+		res |= shm_size(l_ii) == n && shm_at_ii(l_ii, 1) == 3
+				       && shm_size(l_ss) == n
+				       && !ss_cmp(shm_at_is(l_is, 1), v[1])
+				       && !ss_cmp(shm_at_ss(l_ss, k[1]), v[1])
+				       && shm_at_si(l_si, k[1]) == 1
+			       ? 0
+			       : 8192;
+	}
+	/*
+	 * Writer incremental rehash state in the image header (file header
+	 * size: 64 bytes) is not used
+	 */
+	shm_unmap(&l_ii);
+	shm_save(m_ii, STEST_FILE);
+	f = fopen(STEST_FILE, "r+b");
+	if (f) {
+		if (!fseek(f, 64, SEEK_SET)
+		    && fread(&h, sizeof(h), 1, f) == 1) {
+			h.rh_step = 2;
+			h.rh_next = 1;
+			h.rh_old = h.rh_tbl = &h;
+			if (!fseek(f, 64, SEEK_SET))
+				fwrite(&h, sizeof(h), 1, f);
+		}
+		fclose(f);
+	}
+	l_ii = shm_map_file(STEST_FILE, S_FALSE);
+	res |= l_ii && !l_ii->rh_old && !l_ii->rh_tbl && !l_ii->rh_step
+			       && shm_at_ii(l_ii, 5) == 15
+		       ? 0
+		       : 4096;
+	shm_unmap(&l_ii);
+	/* corrupted image: detected by the checksum */
+	f = fopen(STEST_FILE, "r+b");
+	if (f) {
+		fseek(f, -1, SEEK_END);
+		fputc(0x55 ^ fgetc(f), f);
+		fclose(f);
+	}
+	res |= !shm_map_file(STEST_FILE, S_TRUE) ? 0 : 1024;
+	res |= !shm_map_file("non_existing_file", S_FALSE) ? 0 : 2048;
+	remove(STEST_FILE);
+	shm_unmap(&l_ss);
+	shm_unmap(&l_is);
+	shm_unmap(&l_si);
+	shs_unmap(&ls_s);
+	for (i = 0; i < n; i++)
+		ss_free(&k[i]);
+	for (i = 0; i < n; i++)
+		ss_free(&v[i]);
+#ifdef S_USE_VA_ARGS
+	shm_free(&m_ii, &m_ss, &m_is, &m_si);
+#else
+	shm_free(&m_ii);
+	shm_free(&m_ss);
+	shm_free(&m_is);
+	shm_free(&m_si);
+#endif
+	shs_free(&s_s);
 	return res;
 }
 
-static int test_shm_inc_ii()
+struct TGenKey {
+	uint32_t a, b;
+	uint64_t c[3];
+};
+
+static shm_hash_t_ tgen_hash_a(const void *key, size_t key_size)
 {
-	int res;
-	srt_hmap *m = shm_alloc(SHM_II, 0);
-	shm_inc_ii(&m, 123, -7);
-	shm_inc_ii(&m, 123, S_MAX_I64);
-	shm_inc_ii(&m, 123, 3);
-	res = !m ? 1 : (shm_at_ii(m, 123) == S_MAX_I64 - 4 ? 0 : 2);
-	shm_free(&m);
-	return res;
+	(void)key_size;
+	return ((const struct TGenKey *)key)->a * 2654435761u;
 }
 
-static int test_shm_inc_si()
+static srt_bool tgen_eq_a(const void *a, const void *b, size_t key_size)
 {
-	int res;
-	srt_hmap *m = shm_alloc(SHM_SI, 0);
-	const srt_string *k = ss_crefa("hello");
-	shm_inc_si(&m, k, -7);
-	shm_inc_si(&m, k, S_MAX_I64);
-	shm_inc_si(&m, k, 3);
-	res = !m ? 1 : (shm_at_si(m, k) == S_MAX_I64 - 4 ? 0 : 2);
+	(void)key_size;
+	return ((const struct TGenKey *)a)->a == ((const struct TGenKey *)b)->a;
+}
+
+static int test_shm_gen_n(size_t ks, size_t vs, srt_hmap_hash_f hf,
+			  srt_hmap_eq_f eqf)
+{
+	int res = 0;
+	size_t i, n = 1000;
+	uint8_t k[64], v[64], k2[64];
+	const uint8_t *r;
+	srt_hmap *m = shm_alloc_gen(ks, vs, hf, eqf, 0), *m2 = NULL;
+	RETURN_IF(!m, 1);
+	shm_set_rehash_step(m, 4);
+	for (i = 0; i < n; i++) {
+		memset(k, 0, sizeof(k));
+		memset(v, 0, sizeof(v));
+		memcpy(k, &i, sizeof(i) < ks ? sizeof(i) : ks);
+		k[ks - 1] ^= 0x5a; /* last byte is part of the key */
+		v[0] = (uint8_t)i;
+		v[vs ? vs - 1 : 0] ^= (uint8_t)(i >> 3);
+		res |= shm_insert_gen(&m, k, i % 7 ? v : NULL) ? 0 : 2;
+	}
+	res |= shm_size(m) == n ? 0 : 4;
+	m2 = shm_dup(m);
+	for (i = 0; i < n && !res; i++) {
+		memset(k, 0, sizeof(k));
+		memcpy(k, &i, sizeof(i) < ks ? sizeof(i) : ks);
+		k[ks - 1] ^= 0x5a;
+		r = (const uint8_t *)shm_at_gen(i % 2 ? m : m2, k);
+		if (!r) {
+			res |= 8;
+			break;
+		}
+		if (vs && i % 7
+		    && (r[0] != (uint8_t)i
+			|| (vs > 1 && r[vs - 1] != (uint8_t)(i >> 3))))
+			res |= 16;
+		if (vs && !(i % 7) && r[0])
+			res |= 32;
+		memcpy(k2, k, ks);
+		k2[ks - 1] ^= 0xa5;
+		if (!hf && shm_count_gen(m, k2))
+			res |= 64;
+		if (i % 2)
+			res |= shm_delete_gen(m, k) ? 0 : 128;
+	}
+	res |= shm_size(m) == n / 2 && shm_size(m2) == n ? 0 : 256;
+	for (i = 0; i < shm_size(m) && !res; i++) {
+		r = (const uint8_t *)shm_it_gen_k(m, i);
+		if (!r || !shm_at_gen(m2, r)
+		    || (vs && shm_it_gen_v(m, i) != r + shm_gen_voff(ks)))
+			res |= 512;
+	}
+	res |= !shm_at_gen(m, NULL) && !shm_at_ii(m, 1) ? 0 : 1024;
 	shm_free(&m);
+	shm_free(&m2);
 	return res;
 }
 
-static int test_shm_delete_i()
+static int test_shm_gen()
 {
-	int res;
-	srt_hmap *m_ii32 = shm_alloc(SHM_II32, 0),
-		 *m_uu32 = shm_alloc(SHM_UU32, 0), *m_ii = shm_alloc(SHM_II, 0);
-	/*
-	 * Insert elements
-	 */
-	shm_insert_ii32(&m_ii32, -1, -1);
-	shm_insert_ii32(&m_ii32, -2, -2);
-	shm_insert_ii32(&m_ii32, -3, -3);
-	shm_insert_uu32(&m_uu32, 1, 1);
-	shm_insert_uu32(&m_uu32, 2, 2);
-	shm_insert_uu32(&m_uu32, 3, 3);
-	shm_insert_ii(&m_ii, S_MAX_I64, S_MAX_I64);
-	shm_insert_ii(&m_ii, S_MAX_I64 - 1, S_MAX_I64 - 1);
-	shm_insert_ii(&m_ii, S_MAX_I64 - 2, S_MAX_I64 - 2);
-	/*
-	 * Check elements were properly inserted
-	 */
-	res = m_ii32 && m_uu32 && m_ii ? 0 : 1;
-	res |= (shm_at_ii32(m_ii32, -2) == -2 ? 0 : 2);
-	res |= (shm_at_uu32(m_uu32, 2) == 2 ? 0 : 4);
-	res |= (shm_at_ii(m_ii, S_MAX_I64 - 1) == S_MAX_I64 - 1 ? 0 : 8);
-	/*
-	 * Delete elements, checking that second deletion of same
-	 * element gives error
-	 */
-	res |= shm_delete_i(m_ii32, -2) ? 0 : 16;
-	res |= !shm_delete_i(m_ii32, -2) ? 0 : 32;
-	res |= shm_delete_i(m_uu32, 2) ? 0 : 64;
-	res |= !shm_delete_i(m_uu32, 2) ? 0 : 128;
-	res |= shm_delete_i(m_ii, S_MAX_I64 - 1) ? 0 : 256;
-	res |= !shm_delete_i(m_ii, S_MAX_I64 - 1) ? 0 : 512;
-	/*
-	 * Check that querying for deleted elements gives default value
-	 */
-	res |= (shm_at_ii32(m_ii32, -2) == 0 ? 0 : 1024);
-	res |= (shm_at_uu32(m_uu32, 2) == 0 ? 0 : 2048);
-	res |= (shm_at_ii(m_ii, S_MAX_I64 - 1) == 0 ? 0 : 4096);
-#ifdef S_USE_VA_ARGS
-	shm_free(&m_ii32, &m_uu32, &m_ii);
-#else
-	shm_free(&m_ii32);
-	shm_free(&m_uu32);
-	shm_free(&m_ii);
-#endif
+	int res = 0;
+	size_t i;
+	struct TGenKey k;
+	srt_hmap *m, *l;
+	res |= test_shm_gen_n(8, 8, NULL, NULL);
+	res |= test_shm_gen_n(16, 4, NULL, NULL) << 1;
+	res |= test_shm_gen_n(24, 16, NULL, NULL) << 2;
+	res |= test_shm_gen_n(32, 0, NULL, NULL) << 3;
+	res |= test_shm_gen_n(6, 3, NULL, NULL) << 4;
+	res |= test_shm_gen_n(40, 40, NULL, NULL) << 5;
+	res |= test_shm_gen_n(sizeof(k), 8, tgen_hash_a, tgen_eq_a) << 6;
+	m = shm_alloc_gen(0, 8, NULL, NULL, 0);
+	res |= !shm_insert_gen(&m, &k, NULL) ? 0 : 1 << 7;
+	shm_free(&m);
+	if (res)
+		return res;
+	/* user callbacks: only the "a" field is the key */
+	m = shm_alloc_gen(sizeof(k), sizeof(i), tgen_hash_a, tgen_eq_a, 0);
+	memset(&k, 0, sizeof(k));
+	k.a = 1;
+	i = 10;
+	shm_insert_gen(&m, &k, &i);
+	k.b = 2;
+	i = 20;
+	shm_insert_gen(&m, &k, &i);
+	res |= shm_size(m) == 1 && *(const size_t *)shm_at_gen(m, &k) == 20
+		       ? 0
+		       : 1 << 8;
+	res |= !shm_save(m, STEST_FILE) ? 0 : 1 << 9;
+	shm_free(&m);
+	/* built-in key kernels: save and map */
+	m = shm_alloc_gen(sizeof(k), sizeof(i), NULL, NULL, 0);
+	memset(&k, 0, sizeof(k));
+	for (i = 0; i < 100; i++) {
+		k.c[2] = i;
+		shm_insert_gen(&m, &k, &i);
+	}
+	res |= shm_save(m, STEST_FILE) ? 0 : 1 << 10;
+	l = shm_map_file(STEST_FILE, S_TRUE);
+	res |= l && shm_size(l) == 100 ? 0 : 1 << 11;
+	for (i = 0; i < 100 && l && !res; i++) {
+		k.c[2] = i;
+		if (!shm_at_gen(l, &k)
+		    || *(const size_t *)shm_at_gen(l, &k) != i)
+			res |= 1 << 12;
+	}
+	remove(STEST_FILE);
+	shm_unmap(&l);
+	shm_free(&m);
 	return res;
 }
 
-static int test_shm_delete_s()
+static int test_shm_at_batch()
 {
-	int res;
-	srt_hmap *m_si = shm_alloc(SHM_SI, 0), *m_sp = shm_alloc(SHM_SP, 0),
+	int res = 0;
+	size_t i, n = 200, nq = 300;
+	srt_bool f[300];
+	int32_t ki32[300], vi32[300];
+	int64_t ki[300], vi[300];
+	const srt_string *ks[300], *vs[300];
+	srt_string *sbuf[300];
+	srt_hmap *m_ii32 = shm_alloc(SHM_II32, 0), *m_ii = shm_alloc(SHM_II, 0),
 		 *m_ss = shm_alloc(SHM_SS, 0);
-	/*
-	 * Insert elements
-	 */
-	const srt_string *k1 = ss_crefa("key1"), *k2 = ss_crefa("key2"),
-			 *k3 = ss_crefa("key3"), *v1 = ss_crefa("val1"),
-			 *v2 = ss_crefa("val2"), *v3 = ss_crefa("val3");
-	shm_insert_si(&m_si, k1, -1);
-	shm_insert_si(&m_si, k2, S_MAX_I64);
-	shm_insert_si(&m_si, k3, -3);
-	shm_insert_sp(&m_sp, k1, (void *)-1);
-	shm_insert_sp(&m_sp, k2, (void *)-2);
-	shm_insert_sp(&m_sp, k3, (void *)-3);
-	shm_insert_ss(&m_ss, k1, v1);
-	shm_insert_ss(&m_ss, k2, v2);
-	shm_insert_ss(&m_ss, k3, v3);
-	/*
-	 * Check elements were properly inserted
-	 */
-	res = m_si && m_sp && m_ss ? 0 : 1;
-	res |= (shm_at_si(m_si, k2) == S_MAX_I64 ? 0 : 2);
-	res |= (shm_at_sp(m_sp, k2) == (void *)-2 ? 0 : 4);
-	res |= (!ss_cmp(shm_at_ss(m_ss, k2), v2) ? 0 : 8);
-	/*
-	 * Delete elements, checking that second deletion of same
-	 * element gives error
-	 */
-	res |= shm_delete_s(m_si, k2) ? 0 : 16;
-	res |= !shm_delete_s(m_si, k2) ? 0 : 32;
-	res |= shm_delete_s(m_sp, k2) ? 0 : 64;
-	res |= !shm_delete_s(m_sp, k2) ? 0 : 128;
-	res |= shm_delete_s(m_ss, k2) ? 0 : 256;
-	res |= !shm_delete_s(m_ss, k2) ? 0 : 512;
-	/*
-	 * Check that querying for deleted elements gives default value
-	 */
-	res |= (shm_at_si(m_si, k2) == 0 ? 0 : 1024);
-	res |= (shm_at_sp(m_sp, k2) == 0 ? 0 : 2048);
-	res |= (!ss_cmp(shm_at_ss(m_ss, k2), ss_void) ? 0 : 4096);
+	srt_hset *s_i32 = shs_alloc(SHS_I32, 0), *s_s = shs_alloc(SHS_S, 0);
+	for (i = 0; i < nq; i++) {
+		ki32[i] = (int32_t)i * 3;
+		ki[i] = (int64_t)i * 3;
+		sbuf[i] = ss_dup_printf(64, "key_%u_0123456789ABCDEF",
+					(unsigned)i * 3);
+		ks[i] = sbuf[i];
+		if (i >= n)
+			continue;
+		shm_insert_ii32(&m_ii32, ki32[i], -ki32[i]);
+		shm_insert_ii(&m_ii, ki[i], -ki[i]);
+		shm_insert_ss(&m_ss, ks[i], ks[i]);
+		shs_insert_i32(&s_i32, ki32[i]);
+		shs_insert_s(&s_s, ks[i]);
+	}
+	res |= shm_at_batch_ii32(m_ii32, ki32, nq, vi32) == n ? 0 : 1;
+	res |= shm_at_batch_ii(m_ii, ki, nq, vi) == n ? 0 : 2;
+	res |= shm_at_batch_ss(m_ss, ks, nq, vs) == n ? 0 : 4;
+	for (i = 0; i < nq; i++) {
+		if (vi32[i] != shm_at_ii32(m_ii32, ki32[i])
+		    || vi[i] != shm_at_ii(m_ii, ki[i])
+		    || ss_cmp(vs[i], shm_at_ss(m_ss, ks[i])))
+			res |= 8;
+	}
+	res |= shm_at_batch_ii(m_ii, ki, nq, NULL) == n ? 0 : 16;
+	res |= shs_count_batch_i(s_i32, ki, nq, f) == n ? 0 : 32;
+	for (i = 0; i < nq; i++)
+		if (f[i] != (i < n ? S_TRUE : S_FALSE))
+			res |= 64;
+	res |= shs_count_batch_s(s_s, ks + n, nq - n, f) == 0 ? 0 : 128;
+	res |= shs_count_batch_s(s_s, ks, nq, NULL) == n ? 0 : 256;
+	res |= shm_at_batch_ii(NULL, ki, nq, vi) == 0 ? 0 : 512;
+	for (i = 0; i < nq; i++)
+		ss_free(&sbuf[i]);
 #ifdef S_USE_VA_ARGS
-	shm_free(&m_si, &m_sp, &m_ss);
+	shm_free(&m_ii32, &m_ii, &m_ss);
+	shs_free(&s_i32, &s_s);
 #else
-	shm_free(&m_si);
-	shm_free(&m_sp);
+	shm_free(&m_ii32);
+	shm_free(&m_ii);
 	shm_free(&m_ss);
+	shs_free(&s_i32);
+	shs_free(&s_s);
 #endif
 	return res;
 }
@@ -5283,6 +7950,507 @@ static int test_shm_itp()
 	return res;
 }
 
+struct TItppCtx {
+	int64_t sum;
+	size_t n;
+};
+
+struct TItppRed {
+	int64_t sum;
+	size_t n, order;
+};
+
+static srt_bool cback_itpp_ii(int64_t k, int64_t v, void *context)
+{
+	struct TItppCtx *c = (struct TItppCtx *)context;
+	c->sum += k + v;
+	c->n++;
+	return c->n < 1000 ? S_TRUE : S_FALSE; /* early stop, per worker */
+}
+
+static srt_bool cback_itpp_ss(const srt_string *k, const srt_string *v,
+			      void *context)
+{
+	struct TItppCtx *c = (struct TItppCtx *)context;
+	c->sum += (int64_t)(ss_size(k) + ss_size(v));
+	c->n++;
+	return S_TRUE;
+}
+
+/* Job runner: reverse order (the reduce order must not depend on it) */
+static void itpp_run_rev(void *run_context, size_t njobs, srt_hmap_job_f job,
+			 void *job_context)
+{
+	size_t i;
+	(*(size_t *)run_context)++;
+	for (i = njobs; i > 0; i--)
+		job(job_context, i - 1);
+}
+
+static void itpp_reduce(void *reduce_context, void *worker_context,
+			size_t worker)
+{
+	struct TItppRed *r = (struct TItppRed *)reduce_context;
+	struct TItppCtx *c = (struct TItppCtx *)worker_context;
+	r->sum += c->sum;
+	r->n += c->n;
+	r->order = r->order * 10 + worker;
+}
+
+static int test_shm_itpp()
+{
+	int res = 0;
+	size_t i, runs = 0, n = 3000, cnt;
+	int64_t sum = 0;
+	struct TItppCtx c[4];
+	struct TItppRed r;
+	srt_hmap_par p;
+	srt_string *kv = ss_alloca(100);
+	srt_hmap *hm_ii = shm_alloc(SHM_II, n), *hm_ss = shm_alloc(SHM_SS, 0);
+	for (i = 0; i < n; i++) {
+		shm_insert_ii(&hm_ii, (int64_t)i, (int64_t)i * 2);
+		sum += (int64_t)i * 3;
+		ss_printf(&kv, 100, "%u", (unsigned)i);
+		shm_insert_ss(&hm_ss, kv, kv);
+	}
+	memset(&p, 0, sizeof(p));
+	memset(c, 0, sizeof(c));
+	memset(&r, 0, sizeof(r));
+	p.nworkers = 4;
+	p.runf = itpp_run_rev;
+	p.run_context = &runs;
+	p.contexts = c;
+	p.context_size = sizeof(c[0]);
+	p.reducef = itpp_reduce;
+	p.reduce_context = &r;
+	/* 4 portions of 750 elements */
+	cnt = shm_itpp_ii(hm_ii, 0, S_NPOS, cback_itpp_ii, &p);
+	res |= cnt == n && r.n == n && r.sum == sum ? 0 : 1;
+	res |= r.order == 123 && runs == 1 ? 0 : 2;
+	/* 2 portions of 1500 elements: callbacks stop at 1000 */
+	memset(c, 0, sizeof(c));
+	memset(&r, 0, sizeof(r));
+	p.nworkers = 2;
+	cnt = shm_itpp_ii(hm_ii, 0, n, cback_itpp_ii, &p);
+	res |= cnt == 2000 - 2 && r.n == 2000 && r.order == 1 ? 0 : 4;
+	/* sequential (no runner), sub-range, more workers than elements */
+	memset(c, 0, sizeof(c));
+	memset(&r, 0, sizeof(r));
+	p.runf = NULL;
+	p.nworkers = 4;
+	cnt = shm_itpp_ss(hm_ss, 10, 13, cback_itpp_ss, &p);
+	for (sum = 0, i = 10; i < 13; i++)
+		sum += (int64_t)(ss_size(shm_it_s_k(hm_ss, i))
+				 + ss_size(shm_it_ss_v(hm_ss, i)));
+	res |= cnt == 3 && r.n == 3 && r.sum == sum && runs == 2 ? 0 : 8;
+	res |= c[0].n == 1 && c[2].n == 1 && c[3].n == 0 ? 0 : 16;
+	/* no contexts, no reduce, wrong type */
+	p.contexts = NULL;
+	p.reducef = NULL;
+	res |= shm_itpp_ss(hm_ss, 0, S_NPOS, NULL, &p) == n ? 0 : 32;
+	res |= !shm_itpp_si(hm_ss, 0, S_NPOS, NULL, &p)
+			       && !shm_itpp_ss(hm_ss, 0, S_NPOS, NULL, NULL)
+		       ? 0
+		       : 64;
+	shm_free(&hm_ii);
+	shm_free(&hm_ss);
+	return res;
+}
+
+static int test_shm_merge()
+{
+	int res = 0;
+	size_t i, n = 1000;
+	int64_t v;
+	srt_string *k = ss_alloca(200), *val = ss_alloca(200);
+	srt_hmap *a = shm_alloc(SHM_II, 0), *b = shm_alloc(SHM_II, 0),
+		 *c = shm_alloc_hash(SHM_II, 0, SHM_HASH_SEEDED, 7), *t = NULL,
+		 *sa = shm_alloc(SHM_SS, 0), *sb = shm_alloc(SHM_SS, 0),
+		 *si = shm_alloc(SHM_SI, 0);
+	/* a: [0, n), value i; b: [n / 2, 3 * n), value 1 */
+	shm_set_rehash_step(b, 4);
+	for (i = 0; i < 3 * n; i++) {
+		if (i < n)
+			shm_insert_ii(&a, (int64_t)i, (int64_t)i);
+		if (i >= n / 2) {
+			shm_insert_ii(&b, (int64_t)i, 1);
+			shm_insert_ii(&c, (int64_t)i, 1);
+		}
+	}
+	/* smaller target (source copy path), and bigger target */
+	t = shm_dup(a);
+	res |= shm_merge(&t, b, SHM_MERGE_SUM) && shm_size(t) == 3 * n ? 0 : 1;
+	for (i = 0; i < 3 * n && !res; i++) {
+		v = (int64_t)(i < n / 2 ? i : i < n ? i + 1 : 1);
+		if (shm_at_ii(t, (int64_t)i) != v)
+			res |= 2;
+	}
+	res |= shm_merge(&t, a, SHM_MERGE_OVERWRITE)
+			       && shm_at_ii(t, (int64_t)n - 1) == (int64_t)n - 1
+			       && shm_at_ii(t, (int64_t)n) == 1
+		       ? 0
+		       : 4;
+	shm_free(&t);
+	t = shm_dup(a);
+	res |= shm_merge(&t, b, SHM_MERGE_KEEP) && shm_size(t) == 3 * n
+			       && shm_at_ii(t, (int64_t)n - 1) == (int64_t)n - 1
+		       ? 0
+		       : 8;
+	shm_free(&t);
+	t = shm_dup(b);
+	res |= shm_merge(&t, a, SHM_MERGE_OVERWRITE) && shm_size(t) == 3 * n
+			       && shm_at_ii(t, (int64_t)n - 1) == (int64_t)n - 1
+			       && shm_at_ii(t, (int64_t)n) == 1
+		       ? 0
+		       : 16;
+	shm_free(&t);
+	/* different hash function set (keys hashed again), self merge */
+	t = shm_dup(a);
+	res |= shm_merge(&t, c, SHM_MERGE_SUM) && shm_size(t) == 3 * n
+			       && shm_at_ii(t, (int64_t)n / 2)
+					  == (int64_t)n / 2 + 1
+		       ? 0
+		       : 32;
+	res |= shm_merge(&t, t, SHM_MERGE_SUM) && shm_size(t) == 3 * n
+			       && shm_at_ii(t, (int64_t)n * 2) == 2
+		       ? 0
+		       : 64;
+	shm_free(&t);
+	/* small target, growing many times at once (not a source copy) */
+	t = shm_alloc_hash(SHM_II, 0, SHM_HASH_SEEDED, 1);
+	shm_set_rehash_step(t, 2);
+	for (i = 0; i < 10; i++)
+		shm_insert_ii(&t, -(int64_t)i - 1, (int64_t)i);
+	res |= shm_merge(&t, b, SHM_MERGE_KEEP)
+			       && shm_size(t) == 10 + shm_size(b)
+			       && shm_at_ii(t, -10) == 9
+			       && shm_at_ii(t, -1) == 0
+			       && shm_at_ii(t, (int64_t)n) == 1
+		       ? 0
+		       : 64;
+	/* string keys and values, strings out-of-line */
+	for (i = 0; i < n; i++) {
+		ss_printf(&k, 200, "key%u_%040u", (unsigned)i, 0);
+		ss_printf(&val, 200, "a%u", (unsigned)i);
+		shm_insert_ss(&sa, k, val);
+		if (i % 2) {
+			ss_printf(&val, 200, "b%u_%040u", (unsigned)i, 0);
+			shm_insert_ss(&sb, k, val);
+			shm_insert_si(&si, k, (int64_t)i);
+		}
+	}
+	res |= shm_merge(&sa, sb, SHM_MERGE_OVERWRITE) && shm_size(sa) == n
+		       ? 0
+		       : 128;
+	for (i = 0; i < n && !(res & 256); i++) {
+		ss_printf(&k, 200, "key%u_%040u", (unsigned)i, 0);
+		if (i % 2)
+			ss_printf(&val, 200, "b%u_%040u", (unsigned)i, 0);
+		else
+			ss_printf(&val, 200, "a%u", (unsigned)i);
+		if (ss_cmp(shm_at_ss(sa, k), val))
+			res |= 256;
+	}
+	/* wrong types, and SHM_MERGE_SUM on non-integer values */
+	res |= !shm_merge(&sa, si, SHM_MERGE_KEEP)
+			       && !shm_merge(&sa, sb, SHM_MERGE_SUM)
+			       && shm_merge(&si, si, SHM_MERGE_SUM)
+			       && shm_at_si(si, k) == 2 * (int64_t)(n - 1)
+		       ? 0
+		       : 512;
+#ifdef S_USE_VA_ARGS
+	shm_free(&a, &b, &c, &t, &sa, &sb, &si);
+#else
+	shm_free(&a);
+	shm_free(&b);
+	shm_free(&c);
+	shm_free(&t);
+	shm_free(&sa);
+	shm_free(&sb);
+	shm_free(&si);
+#endif
+	return res;
+}
+
+static int test_shs_setops()
+{
+	int res = 0;
+	size_t i, n = 1000;
+	srt_string *k = ss_alloca(200);
+	srt_hset *a = shs_alloc(SHS_I, 0), *b = shs_alloc(SHS_I, 0), *t = NULL,
+		 *u, *sa = shs_alloc(SHS_S, 0), *sb = shs_alloc(SHS_S, 0),
+		 *st = NULL, *ea = shs_alloca(SHS_I, 2000);
+	/* a: [0, n); b: multiples of 3 in [0, 3 * n) */
+	for (i = 0; i < 3 * n; i++) {
+		if (i < n) {
+			shs_insert_i(&a, (int64_t)i);
+			shs_insert_i(&ea, (int64_t)i);
+			ss_printf(&k, 200, "%u_%040u", (unsigned)i, 0);
+			shs_insert_s(&sa, k);
+		}
+		if (!(i % 3)) {
+			shs_insert_i(&b, (int64_t)i);
+			ss_printf(&k, 200, "%u_%040u", (unsigned)i, 0);
+			shs_insert_s(&sb, k);
+		}
+	}
+	u = shs_dup(a);
+	res |= shs_union(&u, b) && shs_size(u) == 2 * n - (n + 2) / 3 ? 0 : 1;
+	/* both visiting orders (smaller target, and smaller source) */
+	t = shs_dup(a);
+	res |= shs_intersect(&t, b) && shs_size(t) == (n + 2) / 3 ? 0 : 2;
+	shs_free(&t);
+	t = shs_dup(b);
+	res |= shs_intersect(&t, a) && shs_size(t) == (n + 2) / 3 ? 0 : 4;
+	res |= shs_count_i(t, 999) && !shs_count_i(t, 998) ? 0 : 8;
+	shs_free(&t);
+	t = shs_dup(a);
+	res |= shs_diff(&t, b) && shs_size(t) == n - (n + 2) / 3
+			       && !shs_count_i(t, 3) && shs_count_i(t, 4)
+		       ? 0
+		       : 16;
+	shs_free(&t);
+	t = shs_dup(u);
+	res |= shs_diff(&t, a) && shs_size(t) == shs_size(u) - n
+			       && shs_count_i(t, 1002) && !shs_count_i(t, 999)
+		       ? 0
+		       : 32;
+	res |= shs_diff(&t, t) && shs_size(t) == 0 ? 0 : 64;
+	/* strings, and fixed-size (stack) target */
+	st = shs_dup(sa);
+	res |= shs_intersect(&st, sb) && shs_size(st) == (n + 2) / 3 ? 0 : 128;
+	ss_printf(&k, 200, "%u_%040u", 999u, 0);
+	res |= shs_count_s(st, k) ? 0 : 256;
+	res |= shs_diff(&sa, sb) && shs_size(sa) == n - (n + 2) / 3
+			       && !shs_count_s(sa, k)
+		       ? 0
+		       : 512;
+	res |= shs_intersect(&ea, b) && shs_size(ea) == (n + 2) / 3
+			       && shs_count_i(ea, 999)
+		       ? 0
+		       : 1024;
+	res |= !shs_union(&sa, a) ? 0 : 2048;
+#ifdef S_USE_VA_ARGS
+	shs_free(&a, &b, &t, &u, &sa, &sb, &st, &ea);
+#else
+	shs_free(&a);
+	shs_free(&b);
+	shs_free(&t);
+	shs_free(&u);
+	shs_free(&sa);
+	shs_free(&sb);
+	shs_free(&st);
+	shs_free(&ea);
+#endif
+	return res;
+}
+
+/* LRU reference model: keys from the oldest to the newest */
+static size_t tcache_find(const int64_t *o, size_t n, int64_t k)
+{
+	size_t i;
+	for (i = 0; i < n && o[i] != k; i++)
+		;
+	return i;
+}
+
+static void tcache_use(int64_t *o, size_t *n, size_t i, int64_t k)
+{
+	if (i < *n) {
+		memmove(o + i, o + i + 1, (*n - i - 1) * sizeof(*o));
+		(*n)--;
+	}
+	if (k >= 0)
+		o[(*n)++] = k;
+}
+
+static int test_shm_cache()
+{
+	int res = 0;
+	int64_t o[64];
+	uint32_t rnd = 1;
+	size_t i, j, n = 0, cap = 64;
+	srt_string *k = ss_alloca(200);
+	srt_hmap *l = shm_alloc_cache(SHM_II, 4, SHM_EVICT_LRU),
+		 *c = shm_alloc_cache(SHM_II, 4, SHM_EVICT_CLOCK), *d = NULL,
+		 *r = shm_alloc_cache(SHM_II, cap, SHM_EVICT_LRU),
+		 *s = shm_alloca_cache(SHM_SI, 3, SHM_EVICT_LRU);
+	RETURN_IF(!l || !c || !r || !s || shm_cache_capacity(l) != 4, 1);
+	/* LRU: the least recently used is evicted */
+	for (i = 1; i <= 4; i++)
+		shm_insert_ii(&l, (int64_t)i, (int64_t)i * 10);
+	res |= shm_at_ii(l, 1) == 10 && shm_insert_ii(&l, 5, 50)
+			       && shm_size(l) == 4 && !shm_count_i(l, 2)
+			       && shm_count_i(l, 1) && shm_insert_ii(&l, 3, 31)
+			       && shm_insert_ii(&l, 6, 60) && !shm_count_i(l, 4)
+			       && shm_at_ii(l, 3) == 31
+		       ? 0
+		       : 2;
+	res |= shm_cache_hits(l) == 3 && shm_cache_misses(l) == 2
+			       && shm_cache_evictions(l) == 2
+		       ? 0
+		       : 4;
+	shm_cache_reset_stats(l);
+	res |= !shm_cache_hits(l) && !shm_cache_evictions(l) ? 0 : 4;
+	/* CLOCK: referenced elements get a second chance */
+	for (i = 1; i <= 4; i++)
+		shm_insert_ii(&c, (int64_t)i, (int64_t)i);
+	res |= shm_at_ii(c, 1) == 1 && shm_at_ii(c, 3) == 3
+			       && shm_insert_ii(&c, 5, 5) && !shm_count_i(c, 2)
+			       && shm_insert_ii(&c, 6, 6) && !shm_count_i(c, 4)
+			       && shm_count_i(c, 1) && shm_count_i(c, 3)
+			       && shm_count_i(c, 5) && shm_size(c) == 4
+		       ? 0
+		       : 8;
+	/* Copy: duplicates are caches, caches can not be copy targets */
+	d = shm_dup(c);
+	res |= d && shm_cache_capacity(d) == 4 && shm_size(d) == 4
+			       && shm_at_ii(d, 6) == 6 && !shm_cpy(&c, l)
+			       && !shm_merge(&c, l, SHM_MERGE_KEEP)
+		       ? 0
+		       : 16;
+	/* Stack-allocated, string keys (not fitting in the small storage) */
+	for (i = 0; i < 100; i++) {
+		ss_printf(&k, 200, "key%u_%040u", (unsigned)i, 0);
+		if (!shm_insert_si(&s, k, (int64_t)i))
+			res |= 32;
+	}
+	res |= shm_size(s) == 3 && shm_at_si(s, k) == 99
+			       && shm_cache_evictions(s) == 97
+		       ? 0
+		       : 32;
+	shm_clear(s);
+	res |= !shm_size(s) && shm_insert_si(&s, k, 1) ? 0 : 32;
+	/* LRU vs reference model, with deletions */
+	for (j = 0; j < 20000 && !(res & 64); j++) {
+		rnd = rnd * 1103515245 + 12345;
+		i = (size_t)(rnd >> 16) % (cap * 2);
+		switch ((rnd >> 8) % 4) {
+		case 0:
+		case 1:
+			if (!shm_insert_ii(&r, (int64_t)i, (int64_t)j))
+				res |= 64;
+			if (n == cap && tcache_find(o, n, (int64_t)i) == n)
+				tcache_use(o, &n, 0, -1);
+			tcache_use(o, &n, tcache_find(o, n, (int64_t)i),
+				   (int64_t)i);
+			break;
+		case 2:
+			if (shm_count_i(r, (int64_t)i)
+			    != (tcache_find(o, n, (int64_t)i) < n ? 1 : 0))
+				res |= 64;
+			if (tcache_find(o, n, (int64_t)i) < n)
+				tcache_use(o, &n, tcache_find(o, n, (int64_t)i),
+					   (int64_t)i);
+			break;
+		default:
+			shm_delete_i(r, (int64_t)i);
+			tcache_use(o, &n, tcache_find(o, n, (int64_t)i), -1);
+			break;
+		}
+		if (shm_size(r) != n)
+			res |= 64;
+	}
+	for (i = 0; i < n && !(res & 128); i++)
+		if (!shm_delete_i(r, o[i]))
+			res |= 128;
+#ifdef S_USE_VA_ARGS
+	shm_free(&l, &c, &d, &r, &s);
+#else
+	shm_free(&l);
+	shm_free(&c);
+	shm_free(&d);
+	shm_free(&r);
+	shm_free(&s);
+#endif
+	return res;
+}
+
+static shm_hash_t_ tstats_hash_const(const void *key, size_t key_size)
+{
+	(void)key;
+	(void)key_size;
+	return 0x12345678;
+}
+
+static int test_shm_stats()
+{
+	int res = 0;
+	uint64_t k;
+	size_t i, b, w, n = 1000;
+	srt_hmap_stats st;
+	srt_string *s = ss_alloca(200);
+	srt_hmap *hm = shm_alloc(SHM_II, 0), *hs = shm_alloc(SHM_SI, 0),
+		 *hi = shm_alloc(SHM_IS, 0),
+		 *hc = shm_alloc_gen(sizeof(k), 0, tstats_hash_const, NULL, 0);
+	RETURN_IF(!hm || !hs || !hi || !hc, 1);
+	shm_stats(hm, &st);
+	res |= !st.size && st.empty_ratio == 1 && !st.avg_probe
+			       && !st.max_probe && !st.rehashes
+			       && st.cnt_hist[0] == st.buckets
+		       ? 0
+		       : 2;
+	for (i = 0; i < n; i++)
+		shm_insert_ii(&hm, (int64_t)i, (int64_t)i);
+	shm_stats(hm, &st);
+	for (b = w = i = 0; i < SHM_STATS_CNT_BINS; i++) {
+		b += st.cnt_hist[i];
+		w += st.cnt_hist[i] * i;
+	}
+	res |= st.size == n && st.rehashes > 0 && b == st.buckets
+			       && (w == n || st.cnt_hist[i - 1] > 0)
+			       && st.load_factor == (double)n / st.buckets
+			       && st.empty_ratio > 0 && st.empty_ratio < 1
+			       && st.max_probe < st.buckets
+			       && st.elem_bytes >= n * sizeof(struct SHMapII)
+			       && st.bucket_bytes
+					  >= st.buckets
+						     * sizeof(struct SHMBucket)
+			       && !st.str_bytes
+		       ? 0
+		       : 4;
+	b = st.rehashes;
+	shm_set_hash(hm, SHM_HASH_SEEDED, 1);
+	shm_stats(hm, &st);
+	res |= st.rehashes == b + 1 ? 0 : 8;
+	/* Out-of-line strings */
+	for (i = 0; i < 10; i++) {
+		ss_printf(&s, 200, "%u_%0100u", (unsigned)i, 0);
+		shm_insert_si(&hs, s, (int64_t)i);
+	}
+	shm_stats(hs, &st);
+	res |= st.str_bytes >= 10 * ss_size(s) ? 0 : 16;
+	/* NULL and void string references take no memory */
+	shm_insert_is(&hi, 1, NULL);
+	shm_insert_is(&hi, 2, ss_void);
+	shm_stats(hi, &st);
+	res |= !st.str_bytes ? 0 : 128;
+	shm_stats(NULL, &st);
+	res |= !st.size && !st.buckets && !st.elem_bytes && !st.str_bytes
+		       ? 0
+		       : 256;
+	/* Pathological: all keys with the same hash */
+	for (k = 0; k < 100; k++)
+		shm_insert_gen(&hc, &k, NULL);
+	shm_stats(hc, &st);
+	res |= st.max_probe == 99 && st.avg_probe == 49.5
+			       && st.cnt_hist[SHM_STATS_CNT_BINS - 1] == 1
+		       ? 0
+		       : 32;
+#ifdef S_SHM_STATS
+	res |= st.probe_steps > 0 ? 0 : 64;
+#endif
+#ifdef S_USE_VA_ARGS
+	shm_free(&hm, &hs, &hi, &hc);
+#else
+	shm_free(&hm);
+	shm_free(&hs);
+	shm_free(&hi);
+	shm_free(&hc);
+#endif
+	return res;
+}
+
 static int test_tree_vs_hash()
 {
 	int i, count_stack = 150, count = 5000, res = 0;
@@ -6189,6 +9357,8 @@ int main()
 	STEST_ASSERT(test_st_alloc());
 	STEST_ASSERT(test_st_insert_del());
 	STEST_ASSERT(test_st_traverse());
+	STEST_ASSERT(test_sbt_insert_del());
+	STEST_ASSERT(test_sbt_load_sorted());
 	/*
 	 * Map
 	 */
@@ -6208,12 +9378,24 @@ int main()
 	STEST_ASSERT(test_sm_inc_uu32());
 	STEST_ASSERT(test_sm_inc_ii());
 	STEST_ASSERT(test_sm_inc_si());
+	STEST_ASSERT(test_sm_emplace());
 	STEST_ASSERT(test_sm_delete_i());
 	STEST_ASSERT(test_sm_delete_s());
 	STEST_ASSERT(test_sm_it());
 	STEST_ASSERT(test_sm_itr());
 	STEST_ASSERT(test_sm_sort_to_vectors());
+	STEST_ASSERT(test_sm_from_sorted());
 	STEST_ASSERT(test_sm_double_rotation());
+	STEST_ASSERT(test_sm_btree());
+	STEST_ASSERT(test_sm_cursor());
+	STEST_ASSERT(test_sm_ranked());
+	STEST_ASSERT(test_sm_itrpp());
+	STEST_ASSERT(test_sm_snapshot());
+	STEST_ASSERT(test_sm_setops());
+	STEST_ASSERT(test_srm());
+	STEST_ASSERT(test_sm_freeze());
+	STEST_ASSERT(test_sm_key_prefix());
+	STEST_ASSERT(test_shm_overwrite_str());
 	/*
 	 * Set
 	 */
@@ -6233,14 +9415,33 @@ int main()
 	STEST_ASSERT(test_shm_count_u());
 	STEST_ASSERT(test_shm_count_i());
 	STEST_ASSERT(test_shm_count_s());
+	STEST_ASSERT(test_shm_at_batch());
 	STEST_ASSERT(test_shm_inc_ii32());
 	STEST_ASSERT(test_shm_inc_uu32());
 	STEST_ASSERT(test_shm_inc_ii());
 	STEST_ASSERT(test_shm_inc_si());
+	STEST_ASSERT(test_shm_emplace());
 	STEST_ASSERT(test_shm_delete_i());
 	STEST_ASSERT(test_shm_delete_s());
+	STEST_ASSERT(test_shm_churn());
+	STEST_ASSERT(test_shm_delete_shift());
+	STEST_ASSERT(test_shm_rehash_step());
+	STEST_ASSERT(test_shm_rehash_bounded());
+	STEST_ASSERT(test_shm_rehash_hashes());
+	STEST_ASSERT(test_shm_hash());
+	STEST_ASSERT(test_shm_save());
+	STEST_ASSERT(test_shm_gen());
 	STEST_ASSERT(test_shm_it());
 	STEST_ASSERT(test_shm_itp());
+	STEST_ASSERT(test_shm_itpp());
+	STEST_ASSERT(test_shm_merge());
+	STEST_ASSERT(test_shs_setops());
+	STEST_ASSERT(test_shm_cache());
+	STEST_ASSERT(test_shm_stats());
+	/*
+	 * Sharded hash map
+	 */
+	STEST_ASSERT(test_schm());
 	/*
 	 * Hash set
 	 */
@@ -6273,8 +9474,10 @@ int main()
 		(unsigned)OptStrMaxSize);
 	fprintf(stderr, "\tsrt_stringo max in-place length DD: %u\n",
 		(unsigned)OptStr_MaxSize_DD);
-	fprintf(stderr, "\tsrt_stringo max in-place length DI/ID: %u\n",
+	fprintf(stderr, "\tsrt_stringo max in-place length DI: %u\n",
 		(unsigned)OptStr_MaxSize_DI);
+	fprintf(stderr, "\tsrt_stringo max in-place length ID: %u\n",
+		(unsigned)OptStr_MaxSize_ID);
 #endif
 	S_LOGSZ(struct SMapi);
 	S_LOGSZ(struct SMapu);